@@ -0,0 +1,310 @@
+/**
+ * @file bench_main.cpp
+ * @brief Times the gateway's hot paths on the host and prints the results as JSON
+ *
+ * @details The per-packet path is the real one - a data report is put in the radio's receive queue and
+ * listenForLoRAMessageGateway() deciphers it, checks and updates the node table, builds the acknowledgement and
+ * sends it with RHMesh::sendtoAsync() and takes in the hop ack, then publishWebhook() formats the webhook and queues it.  The channel runs
+ * with no airtime and a responder hop-acks every frame a couple of milliseconds later, so what is measured is
+ * the firmware's own work plus a few passes through the stand-in radio.
+ *
+ * The JSON cases use the node table format the gateway kept before the binary table (see printNodeData()) and
+ * the edits the old nodeUpdate() made, so the two can be compared.  murmur3_32 is the hash StorageHelperRK
+ * computes over the node table when it is saved and checks when it is loaded.
+ *
+ * Each case is run --repeats times for --iterations operations after a warm up - fewer for the whole document JSON
+ * cases.  The minimum is the number to compare between builds - the median shows how noisy the machine was.  Host
+ * numbers are not device numbers: the Boron's nRF52840 runs at 64 MHz, but a change that makes the host slower per
+ * packet will make the device slower.
+ *
+ *   gateway_bench [--iterations N] [--repeats R] [--filter NAME]
+ */
+
+#include "Particle.h"
+#include <RHMeshETX.h>
+#include <RH_RF95.h>
+#include "MyPersistentData.h"
+#include "LoRA_Functions.h"
+#include "LoRA_Codec.h"
+#include "JsonParserGeneratorRK.h"
+#include "StorageHelperRK.h"
+#include "SimClock.h"
+#include "SimChannel.h"
+#include "SimCloud.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+void setup();
+void publishWebhook(uint8_t nodeNumber);		// From LoRA_Particle_Gateway.cpp
+
+extern RH_RF95 driver;                                              // From LoRA_Functions.cpp
+extern RHMeshETX manager;
+
+const uint8_t DATA_RPT = 3;                                         // LoRA_State in LoRA_Functions.cpp
+const uint8_t FLAGS_ACK = 0x80;
+const uint8_t HEADER_LEN = 4 + 5 + 1;                               // RH header, router header, mesh message type
+const uint8_t TURNAROUND_MS = 2;                                    // Time the gateway needs to get back to receive after a send
+const int NODE_COUNTS[] = {10, 50, 200};
+
+struct Options {
+    uint32_t iterations = 2000;
+    uint32_t repeats = 7;
+    const char *filter = nullptr;
+};
+
+struct Result {
+    std::string name;
+    int nodes;
+    size_t bytes;                                                   // Size of the data the case works on - 0 if not meaningful
+    uint32_t iterations;
+    double minNs;
+    double medianNs;
+};
+
+static Options options;
+static std::vector<Result> results;
+
+// Answers every unicast frame with a hop ack from the node it was sent to - as the node would
+class Responder : public sim::Radio {
+public:
+    bool listening() const override { return true; }
+    const sim::RadioParams &radioParams() const override { return driver.radioParams(); }	// Follows the gateway
+
+    void receive(const uint8_t *frame, uint8_t len, int16_t rssi, int8_t snr) override {
+        if (len < 4 || frame[0] == 0 || frame[0] == RH_BROADCAST_ADDRESS || (frame[3] & FLAGS_ACK)) return;
+        std::vector<uint8_t> ack = {frame[1], frame[0], frame[2], FLAGS_ACK, '!'};
+        sim::after(TURNAROUND_MS, [this, ack]() { sim::Channel::instance().transmit(this, ack.data(), (uint8_t)ack.size(), driver.radioParams()); });
+    }
+};
+
+struct Node {
+    std::string deviceID;
+    uint16_t radioID;
+    std::vector<uint8_t> frame;                                     // A data report as it comes off the air
+};
+
+static void usage() {
+    fprintf(stderr, "usage: gateway_bench [--iterations N] [--repeats R] [--filter NAME]\n");
+    exit(2);
+}
+
+static void parseArgs(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(arg, "--iterations") && hasValue) options.iterations = strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(arg, "--repeats") && hasValue) options.repeats = strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(arg, "--filter") && hasValue) options.filter = argv[++i];
+        else usage();
+    }
+    if (options.iterations == 0 || options.repeats == 0) usage();
+}
+
+/**
+ * @brief Runs op(i) iterations times for each repeat and records nanoseconds per operation
+ *
+ * @param before - called ahead of each repeat, outside the timing
+ */
+template<class Op, class Before>
+static void measure(const char *name, int nodes, size_t bytes, uint32_t iterations, Op op, Before before) {
+    if (options.filter && !strstr(name, options.filter)) return;
+
+    before();
+    for (uint32_t i = 0; i < iterations / 10 + 1; i++) op(i);     // Warm the caches and the branch predictors
+
+    std::vector<double> perOp;
+    for (uint32_t r = 0; r < options.repeats; r++) {
+        before();
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++) op(i);
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        perOp.push_back(elapsed / iterations);
+    }
+    std::sort(perOp.begin(), perOp.end());
+    results.push_back({name, nodes, bytes, iterations, perOp.front(), perOp[perOp.size() / 2]});
+}
+
+template<class Op>
+static void measure(const char *name, int nodes, size_t bytes, uint32_t iterations, Op op) {
+    measure(name, nodes, bytes, iterations, op, []() {});
+}
+
+static std::string makeDeviceID() {
+    static const char hex[] = "0123456789abcdef";
+    std::string id = "e00fce68";                                    // Particle deviceIDs share a prefix
+    while (id.size() < 24) id += hex[sim::randomU32() & 0x0F];
+    return id;
+}
+
+// Fills the node table and the routing table with count nodes and builds a data report for each
+static std::vector<Node> loadNodes(int count) {
+    std::vector<Node> nodes;
+    nodeDatabase.resetNodeIDs();
+    manager.clearRoutingTable();
+    sim::seed(count);
+    for (int i = 0; i < count; i++) {
+        Node node;
+        node.deviceID = makeDeviceID();
+        node.radioID = LoRA_Functions::instance().stringCheckSum(node.deviceID.c_str());
+        uint8_t nodeNumber = nodeDatabase.addNode(node.deviceID.c_str(), node.radioID);
+        nodeDatabase.set_sensorType(nodeNumber, 1);
+        manager.addRouteTo(nodeNumber, nodeNumber);
+
+        uint32_t field[RPT_FIELD_COUNT];
+        field[RPT_MAGIC] = sysStatus.get_magicNumber();
+        field[RPT_NODE_ID] = node.radioID;
+        field[RPT_HOURLY] = 12;
+        field[RPT_DAILY] = 140;
+        field[RPT_SENSOR_TYPE] = 1;
+        field[RPT_TEMP] = 25;
+        field[RPT_BATT_CHG] = 85;
+        field[RPT_BATT_STATE] = 2;
+        field[RPT_RESETS] = 0;
+        field[RPT_MESSAGE_COUNT] = 40;
+        field[RPT_SUCCESS_COUNT] = 38;
+        field[RPT_RSSI] = (uint16_t)-85;
+        field[RPT_SNR] = 7;
+        uint8_t payload[64];
+        uint8_t len = DATA_REPORT_SCHEMA.encode(field, payload, sizeof(payload));
+        node.frame = {0, nodeNumber, 0, 0,                          // RH header - the id is set per packet
+                      0, nodeNumber, 0, 0, DATA_RPT,                // RHRouter header - dest, source, hops, id, flags
+                      0};                                           // RHMesh application message
+        node.frame.insert(node.frame.end(), payload, payload + len);
+        nodes.push_back(node);
+    }
+    nodeDatabase.flush(true);
+    return nodes;
+}
+
+// Puts the report from a node in the radio's receive queue - as the radio interrupt would
+static void receiveReport(Node &node, uint32_t sequence) {
+    node.frame[2] = (uint8_t)sequence;
+    node.frame[7] = (uint8_t)sequence;
+    driver.receive(node.frame.data(), (uint8_t)node.frame.size(), -85, 7);
+}
+
+// The node table as JSON - the format the gateway stored in FRAM before the binary table, with succ written the
+// way JsonModifier writes a float so the edits below leave the document the same length
+static std::string nodeTableJson(const std::vector<Node> &nodes) {
+    std::string json = "{\"nodes\":[";
+    char entry[160];
+    for (size_t i = 0; i < nodes.size(); i++) {
+        snprintf(entry, sizeof(entry), "%s{\"node\":%u,\"dID\":\"%s\",\"rID\":%u,\"last\":%lu,\"type\":%d,\"succ\":%f,\"pend\":%d}",
+                 (i) ? "," : "", (unsigned)i + 1, nodes[i].deviceID.c_str(), nodes[i].radioID, (unsigned long)Time.now(), 1, 95.0, 0);
+        json += entry;
+    }
+    return json + "]}";
+}
+
+static void benchPacketPath(int count) {
+    std::vector<Node> nodes = loadNodes(count);
+    auto clearCloud = []() {                                        // The stand-in keeps every publish - keep that out of the numbers
+        sim::cloud().publishes.clear();
+        sim::cloud().countByName.clear();
+    };
+    uint32_t sequence = 0;
+
+    measure("packet.total", count, 0, options.iterations, [&](uint32_t i) {
+        Node &node = nodes[i % nodes.size()];
+        receiveReport(node, ++sequence);
+        LoRA_Functions::instance().listenForLoRAMessageGateway();
+        while (LoRA_Functions::instance().acknowledgementsInFlight()) LoRA_Functions::instance().listenForLoRAMessageGateway();	// Until the hop ack is in
+        publishWebhook(current.get_nodeNumber());
+    }, clearCloud);
+
+    measure("packet.listenAndAcknowledge", count, 0, options.iterations, [&](uint32_t i) {
+        Node &node = nodes[i % nodes.size()];
+        receiveReport(node, ++sequence);
+        LoRA_Functions::instance().listenForLoRAMessageGateway();
+        while (LoRA_Functions::instance().acknowledgementsInFlight()) LoRA_Functions::instance().listenForLoRAMessageGateway();	// Until the hop ack is in
+    });
+
+    measure("packet.nodeTable", count, sizeof(nodeIDData::NodeRecord), options.iterations, [&](uint32_t i) {
+        uint8_t nodeNumber = i % nodes.size() + 1;
+        LoRA_Functions::instance().nodeConfigured(nodeNumber, nodes[nodeNumber - 1].radioID);
+        LoRA_Functions::instance().getAlert(nodeNumber);
+        LoRA_Functions::instance().nodeUpdate(nodeNumber, 95.0);
+    });
+
+    measure("packet.publishWebhook", count, 0, options.iterations, [&](uint32_t i) {
+        publishWebhook(current.get_nodeNumber());                // Node and nodeID are the last packet's - as in loop()
+    }, clearCloud);
+}
+
+static void benchNodeTable(int count) {
+    std::vector<Node> nodes = loadNodes(count);
+    std::string json = nodeTableJson(nodes);
+
+    uint32_t jsonIterations = std::max<uint32_t>(options.iterations * 10 / count, 10);	// Whole document work - keep the run short at 200 nodes
+    JsonParser jp;
+    jp.allocate(json.size() + 256);
+    jp.allocateTokens(count * 15 + 16);
+
+    measure("json.parse", count, json.size(), jsonIterations, [&](uint32_t i) {
+        jp.clear();
+        jp.addString(json.c_str());
+        jp.parse();
+    });
+
+    jp.clear();
+    jp.addString(json.c_str());
+    jp.parse();
+    measure("json.modify", count, json.size(), jsonIterations, [&](uint32_t i) {  // What nodeUpdate() did to the JSON node table
+        const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;
+        const JsonParserGeneratorRK::jsmntok_t *value;
+        jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
+        const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, i % count);
+
+        JsonModifier mod(jp);
+        jp.getValueTokenByKey(nodeObjectContainer, "last", value);
+        mod.startModify(value);
+        mod.insertValue((int)Time.now());
+        mod.finish();
+        jp.getValueTokenByKey(nodeObjectContainer, "succ", value);
+        mod.startModify(value);
+        mod.insertValue((float)95.0);
+        mod.finish();
+    });
+
+    size_t tableBytes = offsetof(nodeIDData::NodeData, nodes) + count * sizeof(nodeIDData::NodeRecord);
+    volatile uint32_t hash;
+    measure("murmur3_32.nodeTable", count, tableBytes, options.iterations, [&](uint32_t i) {
+        hash = StorageHelperRK::murmur3_32((const uint8_t *)&nodeDatabase.nodeData, tableBytes, i);
+    });
+}
+
+int main(int argc, char **argv) {
+    parseArgs(argc, argv);
+    sim::seed(1);
+    sim::setStartEpoch(1686837000);                                 // 2023-06-15 13:50:00 UTC - same as the simulation
+
+    Responder responder;
+    sim::Channel::instance().attach(&responder);
+    sim::Channel::instance().setAirtimeScale(0);
+
+    try {
+        setup();
+        for (int count : NODE_COUNTS) {
+            benchPacketPath(count);
+            benchNodeTable(count);
+        }
+    }
+    catch (const sim::Halt &halt) {
+        fprintf(stderr, "gateway_bench: firmware halted - %s\n", halt.reason);
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"config\": {\"iterations\": %u, \"repeats\": %u, \"compiler\": \"%s\"},\n", options.iterations, options.repeats, __VERSION__);
+    printf("  \"units\": \"nanoseconds per operation\",\n");
+    printf("  \"results\": [");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        printf("%s\n    {\"name\": \"%s\", \"nodes\": %d, \"bytes\": %zu, \"iterations\": %u, \"min\": %.1f, \"median\": %.1f}", (i) ? "," : "",
+               result.name.c_str(), result.nodes, result.bytes, result.iterations, result.minNs, result.medianNs);
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -10,6 +10,10 @@ PublishQueuePosix *PublishQueuePosix::_instance;
 
 static Logger _log("app.pubq");
 
+// Ring log file name and share of ringLogSize in quarters, by PublishQueuePriority
+static const char * const ringLogNames[] = { "ring_background.log", "ring.log", "ring_urgent.log" };
+static const uint8_t ringLogQuarters[] = { 1, 2, 1 };
+
 
 PublishQueuePosix &PublishQueuePosix::instance() {
     if (!_instance) {
@@ -22,6 +26,11 @@ PublishQueuePosix &PublishQueuePosix::withRamQueueSize(size_t size) {
     ramQueueSize = size;
 
     if (stateHandler) {
+        if (ramQueueSize + 2 > eventPool.getCapacity()) {
+            // The event pool was sized by setup()
+            ramQueueSize = eventPool.getCapacity() - 2;
+            _log.info("withRamQueueSize(%u) larger than the event pool", size);
+        }
         _log.trace("withRamQueueSize(%u)", ramQueueSize);
         checkQueueLimits();
     }
@@ -47,6 +56,13 @@ void PublishQueuePosix::setup() {
 
     os_mutex_recursive_create(&mutex);
 
+    // One for each event in the RAM queue, one being published, and one more as a failed publish
+    // goes back on the front of a full RAM queue before it's written to the ring log
+    if (!eventPool.setup(ramQueueSize + 2) || !ramQueue.setup(ramQueueSize + 2)) {
+        _log.error("could not allocate event pool");
+        return;
+    }
+
     // Register a system reset handler
     System.on(reset | cloud_status, systemEventHandler);
 
@@ -55,6 +71,12 @@ void PublishQueuePosix::setup() {
 
     fileQueue.scanDir();
 
+    for(size_t ii = 0; ii < NUM_PRIORITIES; ii++) {
+        ringLog[ii].open(String(fileQueue.getDirPath()) + "/" + ringLogNames[ii], ringLogSize / 4 * ringLogQuarters[ii]);
+    }
+
+    moveQueueFilesToRingLog();
+
     checkQueueLimits();
 
     stateHandler = &PublishQueuePosix::stateConnectWait;
@@ -66,20 +88,49 @@ void PublishQueuePosix::loop() {
     }
 }
 
-bool PublishQueuePosix::publishCommon(const char *eventName, const char *eventData, int ttl, PublishFlags flags1, PublishFlags flags2) {
+bool PublishQueuePosix::publishCommon(const char *eventName, const char *eventData, int ttl, PublishFlags flags1, PublishFlags flags2, PublishQueuePriority priority, uint8_t coalesceKey) {
 
-    PublishQueueEvent *event = newRamEvent(eventName, eventData, flags1 | flags2);
-    if (!event) {
+    if (coalesceKey > PublishQueueRingLog::MAX_COALESCE_KEY || (size_t)priority >= NUM_PRIORITIES) {
         return false;
     }
-    _log.trace("publishCommon eventName=%s eventData=%s", eventName, eventData ? eventData : "");
 
     WITH_LOCK(*this) {
-        ramQueue.push_back(event);
+        if (coalesceKey) {
+            // Replace any event with this key that's still waiting to go
+            for(size_t ii = 0; ii < ramQueue.size(); ii++) {
+                if (ramQueue.at(ii).coalesceKey == coalesceKey) {
+                    _log.trace("replacing queued %s", ramQueue.at(ii).event->eventName);
+                    eventPool.free(ramQueue.at(ii).event);
+                    ramQueue.erase(ii);
+                    break;
+                }
+            }
+            for(size_t ii = 0; ii < NUM_PRIORITIES; ii++) {
+                ringLog[ii].supersede(coalesceKey);
+            }
+            if (curEvent && curCoalesceKey == coalesceKey) {
+                // Don't put it back in the queue if this publish fails
+                curCoalesceKey = 0;
+                curSuperseded = true;
+            }
+        }
 
-        _log.trace("fileQueueLen=%u ramQueueLen=%u connected=%d", fileQueue.getQueueLen(), ramQueue.size(), Particle.connected());
+        PublishQueueEvent *event = newRamEvent(eventName, eventData, flags1 | flags2);
+        if (!event && eventPool.getNumFree() == 0) {
+            // Event pool is in use by the RAM queue, move it to the ring log to free it
+            writeQueueToFiles();
+            event = newRamEvent(eventName, eventData, flags1 | flags2);
+        }
+        if (!event) {
+            return false;
+        }
+        _log.trace("publishCommon eventName=%s eventData=%s priority=%u", eventName, eventData ? eventData : "", (unsigned)priority);
 
-        if (fileQueue.getQueueLen() == 0 && (ramQueue.size() <= ramQueueSize) && Particle.connected()) {
+        ramQueue.push_back({event, priority, coalesceKey});
+
+        _log.trace("fileQueueLen=%u ramQueueLen=%u connected=%d", getNumRingLogEvents(), ramQueue.size(), Particle.connected());
+
+        if (getNumRingLogEvents() == 0 && (ramQueue.size() <= ramQueueSize) && Particle.connected()) {
             // No files in the disk-based queue, RAM-based queue is not full, and we are cloud connected
             // Leave the event in the RAM queue and return true
             _log.trace("queued to ramQueue");
@@ -109,7 +160,7 @@ PublishQueueEvent *PublishQueuePosix::newRamEvent(const char *eventName, const c
 
     PublishQueueEvent *event;
 
-    event = (PublishQueueEvent *) new char[sizeof(PublishQueueEvent) + strlen(eventData)];
+    event = eventPool.alloc();
     if (event) {
         event->flags = flags;
         strcpy(event->eventName, eventName);
@@ -122,36 +173,26 @@ void PublishQueuePosix::writeQueueToFiles() {
 
     WITH_LOCK(*this) {
         while(!ramQueue.empty()) {
-            PublishQueueEvent *event = ramQueue.front();
+            PublishQueueRamEntry entry = ramQueue.front();
             ramQueue.pop_front();
 
-            int fileNum = fileQueue.reserveFile();
-
-            int fd = open(fileQueue.getPathForFileNum(fileNum), O_RDWR | O_CREAT);
-            if (fd) {
-                PublishQueueFileHeader hdr;
-                hdr.magic = FILE_MAGIC;
-                hdr.version = FILE_VERSION;
-                hdr.headerSize = sizeof(PublishQueueFileHeader);
-                hdr.nameLen = sizeof(PublishQueueEvent::eventName);
-                write(fd, &hdr, sizeof(hdr));
-
-                write(fd, event, sizeof(PublishQueueEvent) + strlen(event->eventData));
-                close(fd);
-
+            PublishQueueRingLog &log = ringLog[(size_t)entry.priority];
+            if (log.append(entry.event, sizeof(PublishQueueEvent) + strlen(entry.event->eventData), entry.coalesceKey)) {
                 // This message is monitored by the automated test tool. If you edit this, change that too.
-                _log.trace("writeQueueToFiles fileNum=%d", fileNum);
+                _log.trace("writeQueueToFiles numEvents=%u", getNumRingLogEvents());
+            }
+            else {
+                _log.error("could not write event %s to the ring log", entry.event->eventName);
             }
-            fileQueue.addFileToQueue(fileNum);
 
-            delete event;
+            eventPool.free(entry.event);
         }
     }
 }
 
 
-PublishQueueEvent *PublishQueuePosix::readQueueFile(int fileNum) {
-    PublishQueueEvent *result = NULL;
+bool PublishQueuePosix::readQueueFile(int fileNum, PublishQueueEvent *event) {
+    bool result = false;
 
     int fd = open(fileQueue.getPathForFileNum(fileNum), O_RDONLY);
     if (fd) {
@@ -165,6 +206,7 @@ PublishQueueEvent *PublishQueuePosix::readQueueFile(int fileNum) {
         lseek(fd, 0, SEEK_SET);
         read(fd, &hdr, sizeof(PublishQueueFileHeader));
         if (sb.st_size >= (off_t)(sizeof(PublishQueueFileHeader) + sizeof(PublishQueueEvent)) &&
+            sb.st_size <= (off_t)(sizeof(PublishQueueFileHeader) + PublishQueueEventPool::EVENT_SIZE) &&
             hdr.magic == FILE_MAGIC && 
             hdr.version == FILE_VERSION &&
             hdr.headerSize == sizeof(PublishQueueFileHeader) &&
@@ -172,19 +214,14 @@ PublishQueueEvent *PublishQueuePosix::readQueueFile(int fileNum) {
 
             size_t eventSize = sb.st_size - sizeof(PublishQueueFileHeader);
 
-            result = (PublishQueueEvent *)new char[eventSize];
-            if (result) {
-                read(fd, result, eventSize);
-
-                if (((char *)result)[eventSize - 1] == 0 && strlen(result->eventName) < (sizeof(PublishQueueEvent::eventName) - 1)) {
-                    _log.trace("readQueueFile %d event=%s data=%s", fileNum, result->eventName, result->eventData);
-                }
-                else {
-                    _log.trace("readQueueFile %d corrupted event name or data", fileNum);
-                    delete result;
-                    result = NULL;
-                }
+            read(fd, event, eventSize);
 
+            if (((char *)event)[eventSize - 1] == 0 && strlen(event->eventName) < (sizeof(PublishQueueEvent::eventName) - 1)) {
+                _log.trace("readQueueFile %d event=%s data=%s", fileNum, event->eventName, event->eventData);
+                result = true;
+            }
+            else {
+                _log.trace("readQueueFile %d corrupted event name or data", fileNum);
             }
         } else {
             _log.trace("readQueueFile %d bad magic=%08lx version=%u headerSize=%u nameLen=%u", fileNum, hdr.magic, hdr.version, hdr.headerSize, hdr.nameLen);
@@ -195,16 +232,35 @@ PublishQueueEvent *PublishQueuePosix::readQueueFile(int fileNum) {
     return result;
 }
 
+void PublishQueuePosix::moveQueueFilesToRingLog() {
+    int fileNum;
+
+    PublishQueueEvent *event = eventPool.alloc();
+    if (!event) {
+        return;
+    }
+    while((fileNum = fileQueue.getFileFromQueue(true)) != 0) {
+        if (readQueueFile(fileNum, event)) {
+            ringLog[(size_t)PublishQueuePriority::NORMAL].append(event, sizeof(PublishQueueEvent) + strlen(event->eventData));
+        }
+        fileQueue.removeFileNum(fileNum, false);
+        _log.info("moved event file %d to the ring log", fileNum);
+    }
+    eventPool.free(event);
+}
+
 void PublishQueuePosix::clearQueues() {
     WITH_LOCK(*this) {
         while(!ramQueue.empty()) {
-            PublishQueueEvent *event = ramQueue.front();
+            PublishQueueEvent *event = ramQueue.front().event;
             ramQueue.pop_front();
 
-            delete event;
+            eventPool.free(event);
         }
 
-        fileQueue.removeAll(true);
+        for(size_t ii = 0; ii < NUM_PRIORITIES; ii++) {
+            ringLog[ii].clear();
+        }
     }
 
     _log.trace("clearQueues");
@@ -230,29 +286,41 @@ void PublishQueuePosix::checkQueueLimits() {
             writeQueueToFiles();
         }
 
-        while(fileQueue.getQueueLen() > (int)fileQueueSize) {
-            int fileNum = fileQueue.getFileFromQueue(true);
-            if (fileNum) {
-                fileQueue.removeFileNum(fileNum, false);
-                _log.info("discarded event %d", fileNum);
+        while(getNumRingLogEvents() > fileQueueSize) {
+            // Lowest priority first
+            for(size_t ii = 0; ii < NUM_PRIORITIES; ii++) {
+                if (ringLog[ii].getNumRecords()) {
+                    _log.info("discarded event %lu priority %u", (unsigned long)ringLog[ii].getFrontSequence(), ii);
+                    ringLog[ii].removeFront();
+                    break;
+                }
             }
         }
     }
 }
 
+size_t PublishQueuePosix::getNumRingLogEvents() const {
+    size_t result = 0;
+
+    for(size_t ii = 0; ii < NUM_PRIORITIES; ii++) {
+        result += ringLog[ii].getNumRecords();
+    }
+    return result;
+}
+
 size_t PublishQueuePosix::getNumEvents() {
     size_t result = 0;
 
     WITH_LOCK(*this) {
         result = ramQueue.size();
         if (result == 0) {
-            result = fileQueue.getQueueLen();
+            result = getNumRingLogEvents();
 
-            if (curEvent && curFileNum == 0) {
+            if (curEvent && curSequence == 0) {
                 // This happens when we are sending an event from the RAM queue
                 // It's not in the RAM queue, but we want to count it, because
                 // otherwise getNumEvents would return 1 for the event sent from
-                // a file (because the file is not deleted until sent) and
+                // the ring log (because the record is not removed until sent) and
                 // this makes the behavior consistent.
                 result++;
             }
@@ -296,23 +364,55 @@ void PublishQueuePosix::stateWait() {
         return;
     }
     
-    curFileNum = fileQueue.getFileFromQueue(false);
-    if (curFileNum) {
-        curEvent = readQueueFile(curFileNum);
-        if (!curEvent) {
-            // Probably a corrupted file, discard
-            _log.info("discarding corrupted file %d", curFileNum);
-            fileQueue.getFileFromQueue(true);
-            fileQueue.removeFileNum(curFileNum, false);
+    WITH_LOCK(*this) {
+        // Highest priority first. At the same priority, events in the ring log are older than those in the RAM queue.
+        size_t ramIndex = ramQueue.size();
+        for(size_t ii = 0; ii < ramQueue.size(); ii++) {
+            if (ramIndex == ramQueue.size() || ramQueue.at(ii).priority > ramQueue.at(ramIndex).priority) {
+                ramIndex = ii;
+            }
         }
-    }
-    else {
-        if (!ramQueue.empty()) {
-            curEvent = ramQueue.front();
-            ramQueue.pop_front();
+        size_t ringIndex = NUM_PRIORITIES;
+        while(ringIndex > 0 && ringLog[ringIndex - 1].getNumRecords() == 0) {
+            ringIndex--;
+        }
+        curSequence = 0;
+        curSuperseded = false;
+        if (ringIndex > 0 && (ramIndex == ramQueue.size() || (size_t)ramQueue.at(ramIndex).priority < ringIndex)) {
+            curPriority = (PublishQueuePriority)(ringIndex - 1);
+            curCoalesceKey = 0;         // The ring log handles replacing its own events
+            curSequence = ringLog[ringIndex - 1].getFrontSequence();
+        }
+        if (curSequence) {
+            PublishQueueRingLog &log = ringLog[(size_t)curPriority];
+            size_t len;
+            curEvent = eventPool.alloc();
+            if (!curEvent) {
+                // Pool is held by the RAM queue, move it to the ring log behind this event
+                writeQueueToFiles();
+                curEvent = eventPool.alloc();
+            }
+            if (curEvent && (!log.readFront(curSequence, curEvent, PublishQueueEventPool::EVENT_SIZE, len) || 
+                len < sizeof(PublishQueueEvent) || ((char *)curEvent)[len - 1] != 0 || 
+                strlen(curEvent->eventName) >= sizeof(PublishQueueEvent::eventName))) {
+                // Probably a corrupted record, discard
+                _log.info("discarding corrupted event %lu", (unsigned long)curSequence);
+                log.removeFront();
+                eventPool.free(curEvent);
+                curEvent = NULL;
+                curSequence = 0;
+            }
         }
         else {
-            curEvent = NULL;
+            if (ramIndex < ramQueue.size()) {
+                curEvent = ramQueue.at(ramIndex).event;
+                curPriority = ramQueue.at(ramIndex).priority;
+                curCoalesceKey = ramQueue.at(ramIndex).coalesceKey;
+                ramQueue.erase(ramIndex);
+            }
+            else {
+                curEvent = NULL;
+            }
         }
     }
 
@@ -324,7 +424,7 @@ void PublishQueuePosix::stateWait() {
         canSleep = false;
 
         // This message is monitored by the automated test tool. If you edit this, change that too.
-        _log.trace("publishing %s event=%s data=%s", (curFileNum ? "file" : "ram"), curEvent->eventName, curEvent->eventData);
+        _log.trace("publishing %s event=%s data=%s", (curSequence ? "file" : "ram"), curEvent->eventName, curEvent->eventData);
 
         if (BackgroundPublishRK::instance().publish(curEvent->eventName, curEvent->eventData, curEvent->flags, 
             [this](bool succeeded, const char *eventName, const char *eventData, const void *context) {
@@ -345,38 +445,49 @@ void PublishQueuePosix::statePublishWait() {
 
     if (publishSuccess) {
         // Remove from the queue
-        _log.trace("publish success %d", curFileNum);
+        _log.trace("publish success %lu", (unsigned long)curSequence);
 
-        if (curFileNum) {
+        if (curSequence) {
             // Was from the file-based queue
-            int fileNum = fileQueue.getFileFromQueue(false);
-            if (fileNum == curFileNum) {
-                fileQueue.getFileFromQueue(true);
-                fileQueue.removeFileNum(fileNum, false);
-                _log.trace("removed file %d", fileNum);
+            WITH_LOCK(*this) {
+                PublishQueueRingLog &log = ringLog[(size_t)curPriority];
+                if (log.getFrontSequence() == curSequence) {
+                    log.removeFront();
+                    _log.trace("removed event %lu", (unsigned long)curSequence);
+                }
             }
-            curFileNum = 0;
+            curSequence = 0;
+        }
+        WITH_LOCK(*this) {
+            eventPool.free(curEvent);
         }
-
-        delete curEvent;
         curEvent = NULL;
         durationMs = waitBetweenPublish;
     }
     else {
         // Wait and retry
         // This message is monitored by the automated test tool. If you edit this, change that too.
-        _log.trace("publish failed %d", curFileNum);
+        _log.trace("publish failed %lu", (unsigned long)curSequence);
         durationMs = waitAfterFailure;
 
-        if (curFileNum) {
+        if (curSequence) {
             // Was from the file-based queue
-            delete curEvent;
+            WITH_LOCK(*this) {
+                eventPool.free(curEvent);
+            }
             curEvent = NULL;
+            curSequence = 0;
         }
         else {
-            // Was in the RAM-based queue, put back
+            // Was in the RAM-based queue, put back unless a newer event with the same coalesce key was queued
             WITH_LOCK(*this) {
-                ramQueue.push_front(curEvent);
+                if (curSuperseded) {
+                    eventPool.free(curEvent);
+                }
+                else {
+                    ramQueue.push_front({curEvent, curPriority, curCoalesceKey});
+                }
+                curEvent = NULL;
             }
             // Then write the entire queue to files
             _log.trace("writing to files after publish failure");
@@ -404,3 +515,80 @@ void PublishQueuePosix::systemEventHandler(system_event_t event, int param) {
     }
 }
 
+
+bool PublishQueueEventPool::setup(size_t numEvents) {
+    storage = new uint8_t[numEvents * EVENT_SIZE];
+    if (!storage) {
+        return false;
+    }
+    this->numEvents = numEvents;
+
+    freeList = 0;
+    numFree = 0;
+    for(size_t ii = numEvents; ii-- > 0; ) {
+        free((PublishQueueEvent *)&storage[ii * EVENT_SIZE]);
+    }
+    return true;
+}
+
+PublishQueueEvent *PublishQueueEventPool::alloc() {
+    void *event = freeList;
+    if (event) {
+        freeList = *(void **)event;
+        numFree--;
+    }
+    return (PublishQueueEvent *)event;
+}
+
+void PublishQueueEventPool::free(PublishQueueEvent *event) {
+    if (event) {
+        *(void **)event = freeList;
+        freeList = event;
+        numFree++;
+    }
+}
+
+bool PublishQueueEventRing::setup(size_t capacity) {
+    entries = new PublishQueueRamEntry[capacity];
+    if (!entries) {
+        return false;
+    }
+    this->capacity = capacity;
+    first = count = 0;
+    return true;
+}
+
+bool PublishQueueEventRing::push_back(const PublishQueueRamEntry &entry) {
+    if (count >= capacity) {
+        return false;
+    }
+    entries[(first + count++) % capacity] = entry;
+    return true;
+}
+
+bool PublishQueueEventRing::push_front(const PublishQueueRamEntry &entry) {
+    if (count >= capacity) {
+        return false;
+    }
+    first = (first + capacity - 1) % capacity;
+    entries[first] = entry;
+    count++;
+    return true;
+}
+
+void PublishQueueEventRing::pop_front() {
+    if (count) {
+        first = (first + 1) % capacity;
+        count--;
+    }
+}
+
+void PublishQueueEventRing::erase(size_t index) {
+    if (index >= count) {
+        return;
+    }
+    for(; index > 0; index--) {
+        entries[(first + index) % capacity] = entries[(first + index - 1) % capacity];
+    }
+    pop_front();
+}
@@ -6,15 +6,15 @@
 
 #include "Particle.h"
 #include "SequentialFileRK.h"
-
-#include <deque>
+#include "PublishQueueRingLogRK.h"
 
 /**
  * @brief Structure stored before the event data in files on the flash file system
  * 
- * Each file is sequentially numbered and has one event. The contents of the file
- * are this header (8 bytes) followed by the PublishQueueEvent structure, which
- * is variably sized based on the size of the event.    
+ * Versions before the ring log stored each event in its own sequentially numbered file.
+ * The contents of the file are this header (8 bytes) followed by the PublishQueueEvent
+ * structure, which is variably sized based on the size of the event. Files like this
+ * found in the queue directory are moved into the ring log by setup().
  */
 struct PublishQueueFileHeader {
     uint32_t magic;         //!< PublishQueuePosix::FILE_MAGIC = 0x31b67663
@@ -26,10 +26,9 @@ struct PublishQueueFileHeader {
 /**
  * @brief Structure to hold an event in RAM or in files
  * 
- * In RAM, this structure is stored in the ramQueue. 
+ * In RAM, this structure is in a PublishQueueEventPool buffer, which fits the longest event. 
  * 
- * On the flash file system, each file contains one event and consists of the
- * PublishQueueFileHeader above (8 bytes) plus this structure.
+ * On the flash file system, each ring log record is this structure.
  * 
  * Note that the eventData is specified as 1 byte here, but it's actually
  * sized to fit the event data with a null terminator.
@@ -40,6 +39,144 @@ struct PublishQueueEvent {
     char eventData[1]; //!< Variable size event data
 };
 
+/**
+ * @brief Order queued events are sent in
+ * 
+ * Each priority has its own ring log. When there's a connection, URGENT events are sent first and BACKGROUND
+ * events last; within a priority, oldest first. When the file queue is over its limit, events are discarded
+ * from BACKGROUND first.
+ */
+enum class PublishQueuePriority : uint8_t {
+    BACKGROUND = 0, //!< Diagnostics and the like, sent when nothing else is waiting
+    NORMAL = 1,     //!< Default
+    URGENT = 2      //!< Sent before everything else
+};
+
+/**
+ * @brief An event in the RAM queue and how it was queued
+ */
+struct PublishQueueRamEntry {
+    PublishQueueEvent *event; //!< Buffer from the PublishQueueEventPool
+    PublishQueuePriority priority; //!< Ring log it's written to and the order it's sent in
+    uint8_t coalesceKey; //!< Non-zero to replace a queued event with the same key
+};
+
+/**
+ * @brief Fixed pool of event buffers, each big enough for the largest event
+ * 
+ * The buffers are allocated once, from PublishQueuePosix::setup(). Free buffers are kept
+ * on a list threaded through the buffers themselves, so allocating and freeing an event
+ * never touches the heap. Not thread safe; PublishQueuePosix holds its mutex while using it.
+ */
+class PublishQueueEventPool {
+public:
+    /**
+     * @brief Allocate the buffers
+     * 
+     * @param numEvents Number of events the pool holds
+     * 
+     * @return false if out of memory
+     */
+    bool setup(size_t numEvents);
+
+    /**
+     * @brief Take a buffer from the pool
+     * 
+     * @return The buffer, EVENT_SIZE bytes, or NULL if all are in use
+     */
+    PublishQueueEvent *alloc();
+
+    /**
+     * @brief Return a buffer from alloc() to the pool
+     */
+    void free(PublishQueueEvent *event);
+
+    /**
+     * @brief Number of events the pool holds
+     */
+    size_t getCapacity() const { return numEvents; };
+
+    /**
+     * @brief Number of buffers not in use
+     */
+    size_t getNumFree() const { return numFree; };
+
+    /**
+     * @brief Size of each buffer: the event header and the longest event data with its null terminator, rounded up to a pointer
+     */
+    static const size_t EVENT_SIZE = (sizeof(PublishQueueEvent) + particle::protocol::MAX_EVENT_DATA_LENGTH + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+protected:
+    uint8_t *storage = 0; //!< numEvents buffers of EVENT_SIZE bytes
+    size_t numEvents = 0; //!< Number of buffers in storage
+    size_t numFree = 0; //!< Number of buffers on freeList
+    void *freeList = 0; //!< First free buffer - its first bytes point to the next
+};
+
+/**
+ * @brief Fixed capacity first in, first out queue of events, used for the RAM queue
+ * 
+ * Holds entries for events from a PublishQueueEventPool. The array is allocated once,
+ * from PublishQueuePosix::setup(). The methods are named like the std::deque ones it replaces.
+ */
+class PublishQueueEventRing {
+public:
+    /**
+     * @brief Allocate the array
+     * 
+     * @param capacity Most events the queue can hold
+     * 
+     * @return false if out of memory
+     */
+    bool setup(size_t capacity);
+
+    /**
+     * @brief Add an event at the back. Returns false if the queue is full.
+     */
+    bool push_back(const PublishQueueRamEntry &entry);
+
+    /**
+     * @brief Add an event at the front. Returns false if the queue is full.
+     */
+    bool push_front(const PublishQueueRamEntry &entry);
+
+    /**
+     * @brief Remove the event at the front
+     */
+    void pop_front();
+
+    /**
+     * @brief Remove the event at index, moving the ones before it back
+     */
+    void erase(size_t index);
+
+    /**
+     * @brief The event at the front. The queue must not be empty.
+     */
+    const PublishQueueRamEntry &front() const { return entries[first]; };
+
+    /**
+     * @brief The event at index, 0 being the front. index must be less than size().
+     */
+    const PublishQueueRamEntry &at(size_t index) const { return entries[(first + index) % capacity]; };
+
+    /**
+     * @brief Returns true if there are no events in the queue
+     */
+    bool empty() const { return count == 0; };
+
+    /**
+     * @brief Number of events in the queue
+     */
+    size_t size() const { return count; };
+
+protected:
+    PublishQueueRamEntry *entries = 0; //!< capacity entries, used as a ring
+    size_t capacity = 0; //!< Size of entries
+    size_t first = 0; //!< Index in events of the front
+    size_t count = 0; //!< Number of events in the queue
+};
+
 /**
  * @brief Class for asynchronous publishing of events
  * 
@@ -59,6 +196,9 @@ public:
      * 
      * @param size The size to set (can be 0, default is 2)
      * 
+     * The event buffers for the RAM queue are allocated by setup(), so after setup() the
+     * size can only be lowered.
+     * 
      * You can set this to 0 and the events will be stored on the flash
      * file system immediately. This is the best option if the events must
      * not be lost in the event of a sudden reboot. 
@@ -78,9 +218,10 @@ public:
     /**
      * @brief Sets the file-based queue size (default is 100)
      * 
-     * @param size The maximum number of files to store (one event per file)
+     * @param size The maximum number of events to store on the flash file system
      * 
-     * If you exceed this number of events, the oldest event is discarded.
+     * If you exceed this number of events, the oldest event of the lowest priority is discarded.
+     * Events are also discarded, oldest first, when a ring log is full; see withRingLogSize().
      */
     PublishQueuePosix &withFileQueueSize(size_t size);
 
@@ -89,6 +230,22 @@ public:
      */
     size_t getFileQueueSize() const { return fileQueueSize; };
 
+    /**
+     * @brief Sets the size of the ring log files that hold the file-based queue (default is 64K)
+     * 
+     * @param size Size in bytes of all three files together, not counting their 32 byte headers. Must be called before setup().
+     * 
+     * NORMAL events get half of the size, URGENT and BACKGROUND events a quarter each. Events are stored in
+     * 128 byte slots: a typical event takes 2 or 3, a full 1024 byte event 9. Changing the size discards any
+     * events in the ring logs.
+     */
+    PublishQueuePosix &withRingLogSize(size_t size) { ringLogSize = size; return *this; };
+
+    /**
+     * @brief Gets the ring log size
+     */
+    size_t getRingLogSize() const { return ringLogSize; };
+
     /**
      * @brief Sets the directory to use as the queue directory. This is required!
      * 
@@ -184,6 +341,26 @@ public:
 		return publishCommon(eventName, data, ttl, flags1, flags2);
 	}
 
+	/**
+	 * @brief Overload for publishing an event with a priority
+	 *
+	 * @param eventName The name of the event (63 character maximum).
+	 *
+	 * @param data The event data (255 bytes maximum, 622 bytes in system firmware 0.8.0-rc.4 and later).
+	 *
+	 * @param flags PRIVATE, optionally with WITH_ACK or NO_ACK
+	 *
+	 * @param priority Order the event is sent in relative to other queued events
+	 *
+	 * @param coalesceKey 1 to PublishQueueRingLog::MAX_COALESCE_KEY to replace the queued event with the same
+	 * key instead of adding another, or 0 to always add. The keys are chosen by the application.
+	 *
+	 * @return true if the event was queued or false if it was not.
+	 */
+	inline bool publish(const char *eventName, const char *data, PublishFlags flags, PublishQueuePriority priority, uint8_t coalesceKey = 0) {
+		return publishCommon(eventName, data, 60, flags, PublishFlags(), priority, coalesceKey);
+	}
+
 	/**
 	 * @brief Common publish function. All other overloads lead here. This is a pure virtual function, implemented in subclasses.
 	 *
@@ -199,15 +376,19 @@ public:
 	 *
 	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
 	 *
+	 * @param priority (optional) Order the event is sent in, default NORMAL
+	 *
+	 * @param coalesceKey (optional) Non-zero to replace the queued event with the same key
+	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
 	 * This function almost always returns true. If you queue more events than fit in the buffer the
 	 * oldest (sometimes second oldest) is discarded.
 	 */
-	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags());
+	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags(), PublishQueuePriority priority = PublishQueuePriority::NORMAL, uint8_t coalesceKey = 0);
 
     /**
-     * @brief If there are events in the RAM queue, write them to files in the flash file system
+     * @brief If there are events in the RAM queue, write them to the ring log in the flash file system
      */
     void writeQueueToFiles();
 
@@ -255,10 +436,16 @@ public:
      */
     size_t getNumEvents();
 
+    /**
+     * @brief Gets the number of events in the ring log for one priority
+     */
+    size_t getNumEvents(PublishQueuePriority priority) const { return ringLog[(size_t)priority].getNumRecords(); };
+
     /**
      * @brief Check the queue limit, discarding events as necessary
      * 
-     * When the RAM queue exceeds the limit, all events are moved into files. 
+     * When the RAM queue exceeds the limit, all events are moved into files. When the ring
+     * logs together exceed the file queue size, events are discarded, lowest priority first.
      */
     void checkQueueLimits();
     
@@ -318,26 +505,34 @@ protected:
     PublishQueuePosix& operator=(const PublishQueuePosix&) = delete;
 
     /**
-     * @brief Allocate a new event structure in RAM
-     * 
-     * The PublishEventQueue structure contains a header and is variably sized for the eventData.
+     * @brief Take an event structure from the event pool and fill it in
      * 
-     * May return NULL if eventName or eventData are invalid (too long) or out of memory.
+     * May return NULL if eventName or eventData are invalid (too long) or all of the pool is in use.
      * 
-     * You must delete the result from this method when you are done using it. 
+     * You must return the result to eventPool when you are done using it. 
      */
     PublishQueueEvent *newRamEvent(const char *eventName, const char *eventData, PublishFlags flags);
 
     /**
-     * @brief Read an event from a sequentially numbered file 
+     * @brief Read an event from a sequentially numbered file left by an earlier version
      * 
      * @param fileNum The file number to read 
      * 
-     * May return NULL if file does not exist, or out of memory.
+     * @param event Buffer of PublishQueueEventPool::EVENT_SIZE bytes to read it into
      * 
-     * You must delete the result from this method when you are done using it. 
+     * Returns false if file does not exist or is corrupted.
+     */
+    bool readQueueFile(int fileNum, PublishQueueEvent *event);
+
+    /**
+     * @brief Move events stored one per file by earlier versions into the NORMAL ring log, oldest first
+     */
+    void moveQueueFilesToRingLog();
+
+    /**
+     * @brief Number of events in all of the ring logs
      */
-    PublishQueueEvent *readQueueFile(int fileNum);
+    size_t getNumRingLogEvents() const;
 
     /**
      * @brief Callback for BackgroundPublishRK library
@@ -369,19 +564,34 @@ protected:
     void statePublishWait();
 
     /**
-     * @brief SequentialFileRK library object for maintaining the queue of files on the POSIX file system
+     * @brief SequentialFileRK library object for the queue directory and the files left by earlier versions
      */
     SequentialFile fileQueue;
 
+    /**
+     * @brief Number of priorities, and of ring logs
+     */
+    static const size_t NUM_PRIORITIES = 3;
+
+    /**
+     * @brief The queue on the flash file system - one file in the queue directory for each priority
+     */
+    PublishQueueRingLog ringLog[NUM_PRIORITIES];
+
 
     size_t ramQueueSize = 2; //!< size of the queue in RAM
     size_t fileQueueSize = 100; //!< size of the queue on the flash file system
+    size_t ringLogSize = 64 * 1024; //!< bytes of slots in the ring log files together
 
     os_mutex_recursive_t mutex; //!< mutex for protecting the queue
-    std::deque<PublishQueueEvent*> ramQueue; //!< Queue in RAM
+    PublishQueueEventPool eventPool; //!< Buffers for the events in ramQueue and curEvent
+    PublishQueueEventRing ramQueue; //!< Queue in RAM
 
     PublishQueueEvent *curEvent = 0; //!< Current event being published
-    int curFileNum = 0; //!< Current file number being published (0 if from RAM queue)
+    uint32_t curSequence = 0; //!< Ring log sequence number of the event being published (0 if from RAM queue)
+    PublishQueuePriority curPriority = PublishQueuePriority::NORMAL; //!< Priority of the event being published, and its ring log
+    uint8_t curCoalesceKey = 0; //!< Coalesce key of the event being published, 0 once a newer event with the key is queued
+    bool curSuperseded = false; //!< true if a newer event with the coalesce key of the event being published was queued
     unsigned long stateTime = 0; //!< millis() value when entering the state, used for stateWait
     unsigned long durationMs = 0; //!< how long to wait before publishing in milliseconds, used in stateWait
     bool publishComplete = false; //!< true if the publish has completed (successfully or not)
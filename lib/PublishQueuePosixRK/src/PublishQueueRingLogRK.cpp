@@ -0,0 +1,302 @@
+#include "PublishQueueRingLogRK.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static Logger _log("app.pubq");
+
+
+PublishQueueRingLog::PublishQueueRingLog() {
+}
+
+PublishQueueRingLog::~PublishQueueRingLog() {
+    close();
+}
+
+bool PublishQueueRingLog::open(const char *path, size_t fileSize, uint16_t slotSize) {
+    close();
+
+    uint32_t numSlots = fileSize / slotSize;
+    if (slotSize < sizeof(PublishQueueRingLogRecord) || numSlots < 2) {
+        _log.error("ring log too small fileSize=%u slotSize=%u", (unsigned)fileSize, (unsigned)slotSize);
+        return false;
+    }
+
+    fd = ::open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        _log.error("could not open ring log %s", path);
+        return false;
+    }
+
+    PublishQueueRingLogHeader hdr;
+    if (lseek(fd, 0, SEEK_SET) != 0 ||
+        read(fd, &hdr, sizeof(hdr)) != (int)sizeof(hdr) ||
+        hdr.magic != RING_MAGIC ||
+        hdr.version != RING_VERSION ||
+        hdr.headerSize != sizeof(PublishQueueRingLogHeader) ||
+        hdr.crc != crc32(&hdr, offsetof(PublishQueueRingLogHeader, crc))) {
+        _log.info("new ring log %s numSlots=%lu", path, (unsigned long)numSlots);
+        return reset(slotSize, numSlots);
+    }
+    if (hdr.slotSize != slotSize || hdr.numSlots != numSlots) {
+        _log.info("ring log %s size changed, discarding %lu events", path, (unsigned long)hdr.numRecords);
+        return reset(slotSize, numSlots);
+    }
+    header = hdr;
+
+    // Count the records again - a corrupted one counts as one and is discarded when it reaches the front
+    uint32_t numRecords = scanRecords();
+    bool changed = (numRecords != header.numRecords);
+    if (changed) {
+        _log.info("ring log has %lu events, header said %lu", (unsigned long)numRecords, (unsigned long)header.numRecords);
+        header.numRecords = numRecords;
+    }
+    if (dropSupersededFront() || changed) {
+        writeHeader();
+    }
+    _log.trace("opened ring log %s numRecords=%lu", path, (unsigned long)header.numRecords);
+    return true;
+}
+
+void PublishQueueRingLog::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool PublishQueueRingLog::append(const void *data, size_t len, uint8_t coalesceKey) {
+    if (fd < 0 || len > getMaxRecordSize() || len > 0xffff || coalesceKey > MAX_COALESCE_KEY) {
+        return false;
+    }
+
+    uint32_t slots = slotsFor(len);
+    while(header.tail - header.head + slots > header.numSlots) {
+        _log.info("ring log full, discarded event %lu", (unsigned long)header.head);
+        removeFront();
+    }
+
+    PublishQueueRingLogRecord record;
+    record.sequence = header.tail;
+    record.length = (uint16_t)len;
+    record.coalesceKey = coalesceKey;
+    record.reserved = 0;
+    record.crc = crc32(data, len, crc32(&record, offsetof(PublishQueueRingLogRecord, crc)));
+
+    if (!transfer(true, header.tail, 0, &record, sizeof(record)) ||
+        !transfer(true, header.tail, sizeof(record), const_cast<void *>(data), len)) {
+        return false;
+    }
+    if (coalesceKey) {
+        if (keySequence[coalesceKey]) {
+            numSuperseded++;
+        }
+        keySequence[coalesceKey] = header.tail;
+    }
+    header.tail += slots;
+    header.numRecords++;
+    dropSupersededFront();
+    return writeHeader();
+}
+
+void PublishQueueRingLog::supersede(uint8_t coalesceKey) {
+    if (fd < 0 || coalesceKey == 0 || coalesceKey > MAX_COALESCE_KEY || keySequence[coalesceKey] == 0) {
+        return;
+    }
+    numSuperseded++;
+    keySequence[coalesceKey] = 0;
+    if (dropSupersededFront()) {
+        writeHeader();
+    }
+}
+
+bool PublishQueueRingLog::readFront(uint32_t &sequence, void *buf, size_t bufSize, size_t &len) {
+    sequence = getFrontSequence();
+    len = 0;
+    if (fd < 0 || sequence == 0) {
+        return false;
+    }
+
+    PublishQueueRingLogRecord record;
+    if (!readRecordHeader(sequence, record) || record.length > bufSize) {
+        return false;
+    }
+
+    if (!transfer(false, sequence, sizeof(record), buf, record.length) ||
+        record.crc != crc32(buf, record.length, crc32(&record, offsetof(PublishQueueRingLogRecord, crc)))) {
+        _log.trace("ring log record %lu corrupted", (unsigned long)sequence);
+        return false;
+    }
+    len = record.length;
+    return true;
+}
+
+void PublishQueueRingLog::removeFront() {
+    if (fd < 0 || header.numRecords == 0) {
+        return;
+    }
+
+    dropFront();
+    dropSupersededFront();
+    writeHeader();
+}
+
+void PublishQueueRingLog::clear() {
+    if (fd < 0) {
+        return;
+    }
+    header.head = header.tail;
+    header.numRecords = 0;
+    numSuperseded = 0;
+    memset(keySequence, 0, sizeof(keySequence));
+    writeHeader();
+}
+
+bool PublishQueueRingLog::transfer(bool write, uint32_t sequence, size_t offset, void *buf, size_t len) {
+    size_t ringSize = (size_t)header.numSlots * header.slotSize;
+    size_t pos = ((size_t)(sequence % header.numSlots) * header.slotSize + offset) % ringSize;
+    uint8_t *p = (uint8_t *)buf;
+
+    while(len > 0) {
+        size_t count = (len < ringSize - pos) ? len : ringSize - pos;
+        if (lseek(fd, header.headerSize + pos, SEEK_SET) != (off_t)(header.headerSize + pos)) {
+            return false;
+        }
+        int result = write ? ::write(fd, p, count) : ::read(fd, p, count);
+        if (result != (int)count) {
+            return false;
+        }
+        p += count;
+        len -= count;
+        pos = 0;
+    }
+    return true;
+}
+
+uint32_t PublishQueueRingLog::nextRecord(uint32_t sequence) {
+    PublishQueueRingLogRecord record;
+    if (readRecordHeader(sequence, record)) {
+        return sequence + slotsFor(record.length);
+    }
+
+    // Don't know how long it is - the next record starts at the first slot that holds a valid one
+    for(sequence++; sequence != header.tail; sequence++) {
+        if (readRecordHeader(sequence, record) && checkRecord(sequence, record)) {
+            break;
+        }
+    }
+    return sequence;
+}
+
+void PublishQueueRingLog::dropFront() {
+    PublishQueueRingLogRecord record;
+    if (readRecordHeader(header.head, record) && record.coalesceKey && record.coalesceKey <= MAX_COALESCE_KEY) {
+        if (keySequence[record.coalesceKey] == header.head) {
+            keySequence[record.coalesceKey] = 0;
+        }
+        else if (numSuperseded) {
+            numSuperseded--;
+        }
+    }
+
+    header.head = nextRecord(header.head);
+    if (--header.numRecords == 0 || header.head == header.tail) {
+        header.head = header.tail;
+        header.numRecords = 0;
+        numSuperseded = 0;
+        memset(keySequence, 0, sizeof(keySequence));
+    }
+}
+
+bool PublishQueueRingLog::dropSupersededFront() {
+    bool dropped = false;
+    PublishQueueRingLogRecord record;
+
+    while(header.numRecords &&
+        readRecordHeader(header.head, record) &&
+        record.coalesceKey && record.coalesceKey <= MAX_COALESCE_KEY &&
+        keySequence[record.coalesceKey] != header.head) {
+        _log.trace("ring log record %lu replaced", (unsigned long)header.head);
+        dropFront();
+        dropped = true;
+    }
+    return dropped;
+}
+
+uint32_t PublishQueueRingLog::scanRecords() {
+    uint32_t numRecords = 0;
+
+    numSuperseded = 0;
+    memset(keySequence, 0, sizeof(keySequence));
+    for(uint32_t sequence = header.head; sequence != header.tail; sequence = nextRecord(sequence)) {
+        PublishQueueRingLogRecord record;
+        if (readRecordHeader(sequence, record) && record.coalesceKey && record.coalesceKey <= MAX_COALESCE_KEY) {
+            if (keySequence[record.coalesceKey]) {
+                numSuperseded++;
+            }
+            keySequence[record.coalesceKey] = sequence;
+        }
+        numRecords++;
+    }
+    return numRecords;
+}
+
+bool PublishQueueRingLog::readRecordHeader(uint32_t sequence, PublishQueueRingLogRecord &record) {
+    return transfer(false, sequence, 0, &record, sizeof(record)) &&
+        record.sequence == sequence &&
+        record.length <= getMaxRecordSize() &&
+        sequence - header.head + slotsFor(record.length) <= header.tail - header.head;
+}
+
+bool PublishQueueRingLog::checkRecord(uint32_t sequence, const PublishQueueRingLogRecord &record) {
+    uint32_t crc = crc32(&record, offsetof(PublishQueueRingLogRecord, crc));
+    uint8_t buf[64];
+
+    for(size_t offset = 0; offset < record.length; offset += sizeof(buf)) {
+        size_t count = (record.length - offset < sizeof(buf)) ? record.length - offset : sizeof(buf);
+        if (!transfer(false, sequence, sizeof(record) + offset, buf, count)) {
+            return false;
+        }
+        crc = crc32(buf, count, crc);
+    }
+    return crc == record.crc;
+}
+
+bool PublishQueueRingLog::writeHeader() {
+    header.crc = crc32(&header, offsetof(PublishQueueRingLogHeader, crc));
+    if (lseek(fd, 0, SEEK_SET) != 0 || ::write(fd, &header, sizeof(header)) != (int)sizeof(header)) {
+        return false;
+    }
+    fsync(fd);
+    return true;
+}
+
+bool PublishQueueRingLog::reset(uint16_t slotSize, uint32_t numSlots) {
+    header = {};
+    header.magic = RING_MAGIC;
+    header.version = RING_VERSION;
+    header.headerSize = sizeof(PublishQueueRingLogHeader);
+    header.slotSize = slotSize;
+    header.numSlots = numSlots;
+    header.head = header.tail = 1;  // Sequence 0 means no record
+    header.numRecords = 0;
+    numSuperseded = 0;
+    memset(keySequence, 0, sizeof(keySequence));
+    ftruncate(fd, header.headerSize);
+    return writeHeader();
+}
+
+// [static]
+uint32_t PublishQueueRingLog::crc32(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    while(len--) {
+        crc ^= *p++;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
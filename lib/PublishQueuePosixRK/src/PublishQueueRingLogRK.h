@@ -0,0 +1,251 @@
+#ifndef __PUBLISHQUEUERINGLOGRK_H
+#define __PUBLISHQUEUERINGLOGRK_H
+
+// Github: https://github.com/rickkas7/PublishQueuePosixRK
+// License: MIT
+
+#include "Particle.h"
+
+/**
+ * @brief Structure at the start of the ring log file
+ *
+ * The rest of the file is numSlots fixed size slots. Positions in the ring are slot sequence
+ * numbers that only ever increase; the slot a sequence number lives in is sequence % numSlots.
+ * The header is rewritten after each append and each removal, so after a reset the queue
+ * picks up where it was.
+ */
+struct PublishQueueRingLogHeader {
+    uint32_t magic;         //!< PublishQueueRingLog::RING_MAGIC = 0x31b67664
+    uint8_t version;        //!< PublishQueueRingLog::RING_VERSION = 1
+    uint8_t headerSize;     //!< sizeof(PublishQueueRingLogHeader) = 32
+    uint16_t slotSize;      //!< Bytes in each slot
+    uint32_t numSlots;      //!< Slots in the file after this header
+    uint32_t head;          //!< Sequence number of the first slot of the oldest record
+    uint32_t tail;          //!< Sequence number of the slot the next record will start in
+    uint32_t numRecords;    //!< Records between head and tail
+    uint32_t reserved;      //!< Always 0
+    uint32_t crc;           //!< CRC-32 of the fields above
+};
+
+/**
+ * @brief Structure at the start of each record
+ *
+ * A record takes as many consecutive slots as it needs for this header and its data, wrapping
+ * from the last slot to the first.
+ */
+struct PublishQueueRingLogRecord {
+    uint32_t sequence;      //!< Sequence number of the record's first slot - a stale record from a previous lap never matches
+    uint16_t length;        //!< Bytes of data after this header
+    uint8_t coalesceKey;    //!< Non-zero if a later record with the same key replaces this one
+    uint8_t reserved;       //!< Always 0
+    uint32_t crc;           //!< CRC-32 of sequence, length, coalesceKey and the data
+};
+
+/**
+ * @brief Queue of variable length records in one file on the flash file system
+ *
+ * One file holds the whole queue as a ring of fixed size slots. Appending a record writes
+ * its slots and then the header; removing the oldest record only rewrites the header. When
+ * the ring is full the oldest records are discarded to make room.
+ *
+ * A record is written before the header that adds it to the queue, so a reset part way
+ * through an append loses only that event. A record that fails its CRC is discarded
+ * when it reaches the front of the queue.
+ *
+ * A record can have a coalesce key. Appending a record with the same key, or calling
+ * supersede(), replaces it: it's no longer counted and it's discarded instead of read
+ * when it reaches the front of the queue.
+ */
+class PublishQueueRingLog {
+public:
+    /**
+     * @brief Constructor
+     */
+    PublishQueueRingLog();
+
+    /**
+     * @brief Destructor - closes the file
+     */
+    virtual ~PublishQueueRingLog();
+
+    /**
+     * @brief Open the ring log, creating it if necessary
+     *
+     * @param path Pathname of the file
+     *
+     * @param fileSize Size of the ring in bytes, not counting the header. Rounded down to whole slots.
+     *
+     * @param slotSize Size of each slot in bytes
+     *
+     * If the file exists but was made with a different size, it's started again empty.
+     */
+    bool open(const char *path, size_t fileSize, uint16_t slotSize = DEFAULT_SLOT_SIZE);
+
+    /**
+     * @brief Close the file
+     */
+    void close();
+
+    /**
+     * @brief Add a record at the tail
+     *
+     * @param data The bytes to store
+     *
+     * @param len Number of bytes. Must fit in the ring with its record header.
+     *
+     * @param coalesceKey 1 to MAX_COALESCE_KEY to replace the record already queued with that key, or 0
+     *
+     * @return true if added. Oldest records are discarded if needed to make room.
+     */
+    bool append(const void *data, size_t len, uint8_t coalesceKey = 0);
+
+    /**
+     * @brief Replace the record queued with a coalesce key, because a newer event with that key is queued elsewhere
+     *
+     * @param coalesceKey 1 to MAX_COALESCE_KEY
+     *
+     * Only a record at the front is removed from the file. One further back is counted again after a reset,
+     * unless a newer record with its key is in this ring by then - the newer event may have been lost with RAM.
+     */
+    void supersede(uint8_t coalesceKey);
+
+    /**
+     * @brief Read the oldest record
+     *
+     * @param sequence Filled in with the sequence number of the record, which identifies it until it's removed
+     *
+     * @param buf Buffer to read the record data into
+     *
+     * @param bufSize Size of buf in bytes
+     *
+     * @param len Filled in with the number of bytes
+     *
+     * @return false if the queue is empty, the record is corrupted or longer than bufSize
+     */
+    bool readFront(uint32_t &sequence, void *buf, size_t bufSize, size_t &len);
+
+    /**
+     * @brief Remove the oldest record
+     *
+     * If its header is corrupted the slots after it are searched for the next valid record.
+     * Replaced records that are then at the front are removed too.
+     */
+    void removeFront();
+
+    /**
+     * @brief Discard all records
+     */
+    void clear();
+
+    /**
+     * @brief Number of records in the queue, not counting replaced ones
+     */
+    size_t getNumRecords() const { return (header.numRecords > numSuperseded) ? header.numRecords - numSuperseded : 0; };
+
+    /**
+     * @brief Sequence number of the oldest record, 0 if the queue is empty
+     */
+    uint32_t getFrontSequence() const { return header.numRecords ? header.head : 0; };
+
+    /**
+     * @brief Largest record that fits in the ring
+     */
+    size_t getMaxRecordSize() const { return (size_t)header.numSlots * header.slotSize - sizeof(PublishQueueRingLogRecord); };
+
+    /**
+     * @brief Magic bytes at the beginning of the ring log file for validity checking
+     */
+    static const uint32_t RING_MAGIC = 0x31b67664;
+
+    /**
+     * @brief Version of the ring log file
+     */
+    static const uint8_t RING_VERSION = 1;
+
+    /**
+     * @brief Default slot size. A typical event takes 2 or 3 slots, a full 1024 byte event 9.
+     */
+    static const uint16_t DEFAULT_SLOT_SIZE = 128;
+
+    /**
+     * @brief Largest coalesce key
+     */
+    static const uint8_t MAX_COALESCE_KEY = 15;
+
+protected:
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueRingLog(const PublishQueueRingLog&) = delete;
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueRingLog& operator=(const PublishQueueRingLog&) = delete;
+
+    /**
+     * @brief Number of slots a record with len bytes of data takes
+     */
+    uint32_t slotsFor(size_t len) const { return (sizeof(PublishQueueRingLogRecord) + len + header.slotSize - 1) / header.slotSize; };
+
+    /**
+     * @brief Read or write len bytes starting offset bytes into the slot with sequence number sequence, wrapping at the end of the ring
+     */
+    bool transfer(bool write, uint32_t sequence, size_t offset, void *buf, size_t len);
+
+    /**
+     * @brief Sequence number of the record after the one at sequence
+     */
+    uint32_t nextRecord(uint32_t sequence);
+
+    /**
+     * @brief Read the record header at sequence and check it belongs there
+     */
+    bool readRecordHeader(uint32_t sequence, PublishQueueRingLogRecord &record);
+
+    /**
+     * @brief Advance head past the oldest record without writing the header
+     */
+    void dropFront();
+
+    /**
+     * @brief Drop replaced records from the front without writing the header
+     *
+     * @return true if any were dropped
+     */
+    bool dropSupersededFront();
+
+    /**
+     * @brief Find the newest record for each coalesce key and count the replaced ones
+     *
+     * @return Number of records in the ring
+     */
+    uint32_t scanRecords();
+
+    /**
+     * @brief Check the CRC of the record at sequence whose header is record
+     */
+    bool checkRecord(uint32_t sequence, const PublishQueueRingLogRecord &record);
+
+    /**
+     * @brief Write the header with a new CRC and sync the file
+     */
+    bool writeHeader();
+
+    /**
+     * @brief Start an empty ring in the open file
+     */
+    bool reset(uint16_t slotSize, uint32_t numSlots);
+
+    /**
+     * @brief CRC-32 (IEEE 802.3), continuing from crc
+     */
+    static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+    int fd = -1; //!< File descriptor of the open ring log, -1 if not open
+    PublishQueueRingLogHeader header = {}; //!< Copy of the header in the file
+    uint32_t keySequence[MAX_COALESCE_KEY + 1] = {}; //!< Sequence number of the record that is current for each coalesce key, 0 if none
+    uint32_t numSuperseded = 0; //!< Records in the ring that have been replaced
+};
+
+#endif /* __PUBLISHQUEUERINGLOGRK_H */
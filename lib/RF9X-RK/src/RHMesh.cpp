@@ -47,6 +47,26 @@ uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t f
     return RHRouter::sendtoWait(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
 }
 
+////////////////////////////////////////////////////////////////////
+// Discovers a route to the destination (if necessary) and sends without waiting for delivery to the next hop
+uint8_t RHMesh::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags, uint8_t* handle)
+{
+    if (len > RH_MESH_MAX_MESSAGE_LEN)
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+
+    if (address != RH_BROADCAST_ADDRESS)
+    {
+	RoutingTableEntry* route = getRouteTo(address);
+	if (!route && !doArp(address))
+	    return RH_ROUTER_ERROR_NO_ROUTE;
+    }
+
+    MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
+    a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+    memcpy(a->data, buf, len);
+    return RHRouter::sendtoAsync(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags, handle);
+}
+
 ////////////////////////////////////////////////////////////////////
 bool RHMesh::doArp(uint8_t address)
 {
@@ -77,7 +97,7 @@ bool RHMesh::doArp(uint8_t address)
 		{
 		    // Got a reply, now add the next hop to the dest to the routing table
 		    // The first hop taken is the first octet
-		    addRouteTo(address, headerFrom());
+		    offerRoute(address, headerFrom(), messageLen - sizeof(RHMesh::MeshMessageHeader) - 2);
 		    return true;
 		}
 	    }
@@ -99,16 +119,21 @@ void RHMesh::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 	// being routed back to the originator here. Want to scrape some routing data out of the response
 	// We can find the routes to all the nodes between here and the responding node
 	MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)message->data;
-	addRouteTo(d->dest, headerFrom());
 	uint8_t numRoutes = messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - 2;
 	uint8_t i;
 	// Find us in the list of nodes that were traversed to get to the responding node
 	for (i = 0; i < numRoutes; i++)
 	    if (d->route[i] == _thisAddress)
 		break;
+	// The next hop is the first node after us in the list, or the first in the list if we sent the request
+	uint8_t first = (i < numRoutes) ? i + 1 : 0;
+	offerRoute(d->dest, headerFrom(), numRoutes - first);
 	i++;
 	while (i < numRoutes)
-	    addRouteTo(d->route[i++], headerFrom());
+	{
+	    offerRoute(d->route[i], headerFrom(), i - first);
+	    i++;
+	}
     }
     else if (   messageLen > 1 
 	     && m->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE)
@@ -143,6 +168,27 @@ uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
     return ret;
 }
 
+////////////////////////////////////////////////////////////////////
+// Called when a message sent with sendtoAsync() completes
+void RHMesh::sendComplete(uint8_t handle, uint8_t* buf, uint8_t len, uint8_t address, uint8_t attempts, bool acked)
+{
+    RoutedMessage* message = (RoutedMessage*)buf;
+    if (!acked && address != RH_BROADCAST_ADDRESS && len >= sizeof(RoutedMessageHeader))
+    {
+	// Cant deliver to the next hop. Delete the route, as route() does for sendtoWait()
+	deleteRouteTo(message->header.dest);
+    }
+    RHRouter::sendComplete(handle, buf, len, address, attempts, acked);
+}
+
+////////////////////////////////////////////////////////////////////
+// Subclasses may want to override to choose between routes
+void RHMesh::offerRoute(uint8_t dest, uint8_t next_hop, uint8_t hops)
+{
+    (void)hops; // Not used
+    addRouteTo(dest, next_hop);
+}
+
 ////////////////////////////////////////////////////////////////////
 // Subclasses may want to override
 bool RHMesh::isPhysicalAddress(uint8_t* address, uint8_t addresslen)
@@ -200,14 +246,14 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 		    return false; // Already been through us. Discard
 	    
 	        
-            addRouteTo(_source, headerFrom()); // The originator needs to be added regardless of node type
+            offerRoute(_source, headerFrom(), numRoutes); // The originator needs to be added regardless of node type
 
 	    // Hasnt been past us yet, record routes back to the earlier nodes
             // No need to waste memory if we are not participating in routing
             if (_isa_router)
             {
 	        for (i = 0; i < numRoutes; i++)
-		    addRouteTo(d->route[i], headerFrom());
+		    offerRoute(d->route[i], headerFrom(), numRoutes - i - 1);
             }
 
 	    if (isPhysicalAddress(&d->dest, d->destlen))
@@ -67,7 +67,8 @@
 ///
 /// Note that there is a race condition here that can effect routing on multipath routes. For example, 
 /// if the route to the destination can traverse several paths, last reply from the destination 
-/// will be the one used.
+/// will be the one used. Every route learned this way is passed to offerRoute(), which subclasses
+/// can override to choose between paths instead (see RHMeshETX).
 ///
 /// \par Route Failure
 ///
@@ -174,6 +175,20 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
 
+    /// Similar to sendtoWait() above, but returns once the message has been transmitted to the next hop
+    /// instead of waiting for its acknowledgement. See RHReliableDatagram::sendtoAsync().
+    /// Route discovery, if it is needed, still blocks. If the next hop never acknowledges
+    /// the message, the route is deleted the same as for sendtoWait()
+    /// \param [in] buf The application message data
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address. If the address is RH_BROADCAST_ADDRESS (255)
+    /// the message will be broadcast to all the nearby nodes, but not routed or relayed.
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end to the dest address. The receiver can recover the flags with recvFromAck().
+    /// \param [out] handle If present and not NULL, set to the handle the send callback will be called with
+    /// \return The result code, as for RHRouter::sendtoAsync()
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0, uint8_t* handle = NULL);
+
     /// Starts the receiver if it is not running already, processes and possibly routes any received messages
     /// addressed to other nodes
     /// and delivers any messages addressed to this node.
@@ -215,6 +230,15 @@ public:
     /// \return true if a valid message was copied to buf
     bool recvfromAckTimeout(uint8_t* buf, uint8_t* len,  uint16_t timeout, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL, uint8_t* hops = NULL);
 
+    /// Offers a route learned from a message that went past: route discovery requests and responses, 
+    /// or an application message whose last hop is known.
+    /// RHMesh always takes the route, so the last one heard wins. 
+    /// Virtual so subclasses can choose between routes, see RHMeshETX
+    /// \param [in] dest The destination node the route leads to
+    /// \param [in] next_hop The neighbour to send messages for dest to
+    /// \param [in] hops The number of nodes between next_hop and dest. 0 if next_hop is dest
+    virtual void offerRoute(uint8_t dest, uint8_t next_hop, uint8_t hops);
+
 protected:
 
     /// Internal function that inspects messages being received and adjusts the routing table if necessary.
@@ -230,6 +254,10 @@ protected:
     /// \param [in] messageLen Length of message in octets
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
+    /// Deletes the route to the destination of a message sent with sendtoAsync() that the next hop
+    /// did not acknowledge, then lets RHRouter report the outcome
+    virtual void sendComplete(uint8_t handle, uint8_t* buf, uint8_t len, uint8_t address, uint8_t attempts, bool acked);
+
     /// Try to resolve a route for the given address. Blocks while discovering the route
     /// which may take up to 4000 msec.
     /// Virtual so subclasses can override.
@@ -0,0 +1,262 @@
+// RHMeshETX.cpp
+//
+// RHMesh that chooses routes by expected transmission count instead of taking the last one heard
+
+#include <RHMeshETX.h>
+
+uint8_t RHMeshETX::_tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
+
+// Delivery ratios are out of 255. The lowest keeps the ETX of a link finite
+#define RH_MESH_ETX_MIN_DELIVERY 10
+#define RH_MESH_ETX_SNR_FLOOR_DELIVERY 26
+
+////////////////////////////////////////////////////////////////////
+// Constructors
+RHMeshETX::RHMeshETX(RH_RF95& driver, uint8_t thisAddress)
+    : RHMesh(driver, thisAddress),
+      _rf95(driver)
+{
+    for (uint8_t i = 0; i < RH_MESH_ETX_NEIGHBOURS; i++)
+	_neighbours[i].address = RH_BROADCAST_ADDRESS;
+    memset(_routeHops, 0, sizeof(_routeHops));
+    _snrFloor = -7;
+    _snrSpan = 10;
+    _hopEtx = 150;
+    _maxLinkEtx = 400;
+    _linkTimeout = 3UL * 60 * 60 * 1000;
+    _arpSettle = 1500;
+}
+
+////////////////////////////////////////////////////////////////////
+// Public methods
+void RHMeshETX::offerRoute(uint8_t dest, uint8_t next_hop, uint8_t hops)
+{
+    RoutingTableEntry* route = getRouteTo(dest);
+    if (route && route->next_hop != next_hop && !degraded(route->next_hop))
+    {
+	// Keep the current route unless this one is clearly better
+	uint32_t current = routeEtx(dest);
+	uint32_t offered = (uint32_t)linkEtx(next_hop) + (uint32_t)hops * _hopEtx;
+	if (offered + RH_MESH_ETX_HYSTERESIS > current)
+	    return;
+    }
+    addRouteTo(dest, next_hop);
+    _routeHops[dest] = hops;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMeshETX::ageRoutes()
+{
+    uint8_t deleted = 0;
+    for (uint16_t dest = 0; dest < RH_BROADCAST_ADDRESS; dest++)
+    {
+	RoutingTableEntry* route = getRouteTo(dest);
+	if (route && degraded(route->next_hop))
+	{
+	    deleteRouteTo(dest);
+	    deleted++;
+	}
+    }
+    return deleted;
+}
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHMeshETX::linkEtx(uint8_t neighbour)
+{
+    Neighbour* n = findNeighbour(neighbour, false);
+    if (!n)
+	return _hopEtx;
+    return (uint16_t)(25500 / n->delivery);
+}
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHMeshETX::routeEtx(uint8_t dest)
+{
+    RoutingTableEntry* route = getRouteTo(dest);
+    if (!route)
+	return 0;
+    uint32_t etx = (uint32_t)linkEtx(route->next_hop) + (uint32_t)_routeHops[dest] * _hopEtx;
+    return (etx > 0xffff) ? 0xffff : (uint16_t)etx;
+}
+
+////////////////////////////////////////////////////////////////////
+int8_t RHMeshETX::linkSnr(uint8_t neighbour)
+{
+    Neighbour* n = findNeighbour(neighbour, false);
+    return n ? n->snr : 0;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMeshETX::setSnrRange(int8_t floor, uint8_t span)
+{
+    _snrFloor = floor;
+    _snrSpan = span ? span : 1;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMeshETX::setHopEtx(uint16_t etx)
+{
+    _hopEtx = etx;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMeshETX::setMaxLinkEtx(uint16_t etx)
+{
+    _maxLinkEtx = etx;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMeshETX::setLinkTimeout(uint32_t timeout)
+{
+    _linkTimeout = timeout;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMeshETX::setArpSettle(uint16_t settle)
+{
+    _arpSettle = settle;
+}
+
+////////////////////////////////////////////////////////////////////
+// Protected methods
+void RHMeshETX::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
+{
+    // headerFrom() is the neighbour that sent us this copy of the message
+    int8_t snr = (int8_t)_rf95.lastSNR();
+    Neighbour* n = findNeighbour(headerFrom(), false);
+    if (n)
+    {
+	n->snr = (int8_t)((3 * n->snr + snr) / 4);
+	n->delivery += ((int16_t)snrDelivery(snr) - n->delivery) / 16;
+	if (n->delivery < RH_MESH_ETX_MIN_DELIVERY)
+	    n->delivery = RH_MESH_ETX_MIN_DELIVERY;
+    }
+    else
+    {
+	// A new neighbour starts with what its signal suggests
+	n = findNeighbour(headerFrom(), true);
+	if (n)
+	{
+	    n->snr = snr;
+	    n->delivery = snrDelivery(snr);
+	}
+    }
+    if (n)
+	n->lastHeard = millis();
+
+    RHMesh::peekAtMessage(message, messageLen);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMeshETX::sendResult(uint8_t address, uint8_t attempts, bool acked)
+{
+    Neighbour* n = findNeighbour(address, false);
+    if (!n)
+    {
+	n = findNeighbour(address, true);
+	if (!n)
+	    return;
+	n->snr = 0;
+	n->delivery = (_hopEtx > 100) ? (uint8_t)(25500 / _hopEtx) : 255;
+	n->lastHeard = millis();
+    }
+
+    // Each transmission counts, so a message that took four tries says more than the SNR of one that got through
+    uint8_t lost = acked ? attempts - 1 : attempts;
+    while (lost--)
+	n->delivery -= n->delivery / 8;
+    if (acked)
+    {
+	n->delivery += (255 - n->delivery + 7) / 8;
+	n->lastHeard = millis();
+    }
+    if (n->delivery < RH_MESH_ETX_MIN_DELIVERY)
+	n->delivery = RH_MESH_ETX_MIN_DELIVERY;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMeshETX::doArp(uint8_t address)
+{
+    // Broadcast a route discovery message with nothing in it, the same as RHMesh
+    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)&_tmpMessage;
+    p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST;
+    p->destlen = 1;
+    p->dest = address; // Who we are looking for
+    uint8_t error = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 2, RH_BROADCAST_ADDRESS);
+    if (error != RH_ROUTER_ERROR_NONE)
+	return false;
+
+    // Responses come back over every path the request took. peekAtMessage() offers each one
+    // and offerRoute() keeps the best, so keep listening a while after the first
+    unsigned long starttime = millis();
+    unsigned long timeout = RH_MESH_ARP_TIMEOUT;
+    int32_t timeLeft;
+    while ((timeLeft = timeout - (millis() - starttime)) > 0)
+    {
+	if (waitAvailableTimeout(timeLeft))
+	{
+	    uint8_t messageLen = sizeof(_tmpMessage);
+	    if (RHRouter::recvfromAck(_tmpMessage, &messageLen))
+	    {
+		if (   messageLen > 1
+		    && p->header.msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE
+		    && p->dest == address
+		    && timeout == RH_MESH_ARP_TIMEOUT)
+		{
+		    // First response. Settle for what has arrived by the settle time
+		    unsigned long settle = (millis() - starttime) + _arpSettle;
+		    if (settle < timeout)
+			timeout = settle;
+		}
+	    }
+	}
+	YIELD;
+    }
+    return getRouteTo(address) != NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+RHMeshETX::Neighbour* RHMeshETX::findNeighbour(uint8_t address, bool create)
+{
+    uint8_t i;
+    for (i = 0; i < RH_MESH_ETX_NEIGHBOURS; i++)
+	if (_neighbours[i].address == address)
+	    return &_neighbours[i];
+    if (!create || address == RH_BROADCAST_ADDRESS)
+	return NULL;
+
+    // Use a free entry, or the one we heard from longest ago
+    uint8_t oldest = 0;
+    for (i = 0; i < RH_MESH_ETX_NEIGHBOURS; i++)
+    {
+	if (_neighbours[i].address == RH_BROADCAST_ADDRESS)
+	{
+	    oldest = i;
+	    break;
+	}
+	if (millis() - _neighbours[i].lastHeard > millis() - _neighbours[oldest].lastHeard)
+	    oldest = i;
+    }
+    _neighbours[oldest].address = address;
+    return &_neighbours[oldest];
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMeshETX::degraded(uint8_t address)
+{
+    Neighbour* n = findNeighbour(address, false);
+    if (!n)
+	return false; // No evidence either way, for example a route restored at startup
+    return linkEtx(address) > _maxLinkEtx || millis() - n->lastHeard > _linkTimeout;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMeshETX::snrDelivery(int8_t snr)
+{
+    int16_t margin = (int16_t)snr - _snrFloor;
+    if (margin <= 0)
+	return RH_MESH_ETX_SNR_FLOOR_DELIVERY;
+    if (margin >= _snrSpan)
+	return 255;
+    return (uint8_t)(RH_MESH_ETX_SNR_FLOOR_DELIVERY + (255 - RH_MESH_ETX_SNR_FLOOR_DELIVERY) * margin / _snrSpan);
+}
@@ -0,0 +1,184 @@
+// RHMeshETX.h
+//
+// RHMesh that chooses routes by expected transmission count instead of taking the last one heard
+
+#ifndef RHMeshETX_h
+#define RHMeshETX_h
+
+#include <RHMesh.h>
+#include <RH_RF95.h>
+
+// The number of neighbours we keep link estimates for. The least recently heard is replaced when full
+#ifndef RH_MESH_ETX_NEIGHBOURS
+#define RH_MESH_ETX_NEIGHBOURS 32
+#endif
+
+// How much lower in hundredths the ETX of a new route must be to replace the current one. Stops routes flapping
+#define RH_MESH_ETX_HYSTERESIS 25
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHMeshETX RHMeshETX.h <RHMeshETX.h>
+/// \brief RHMesh subclass that picks routes by expected transmission count (ETX)
+///
+/// RHMesh installs whichever route it heard last, so a weak direct link wins over a strong two hop path
+/// and every retransmission on it costs airtime. RHMeshETX keeps an estimate of the delivery ratio
+/// of the link to each neighbour and only replaces a route with one that is expected to take fewer transmissions.
+///
+/// \par Link estimates
+///
+/// The delivery ratio of a link is an exponentially weighted moving average fed by two kinds of evidence:
+/// - the SNR of every message received from the neighbour, mapped to a delivery ratio from 10% at the
+///   demodulation floor (see setSnrRange()) to 100% once the margin above it reaches the span
+/// - every transmission to the neighbour, as reported by RHReliableDatagram::sendResult().
+///   Acknowledged transmissions pull the ratio up, unacknowledged ones pull it down, and these count more
+///
+/// The ETX of a link is 1 / delivery ratio. The ETX of a route is the ETX of the link to its next hop plus
+/// an assumed ETX (see setHopEtx()) for each hop beyond it we can't measure. ETX values are kept in hundredths.
+///
+/// \par Choosing routes
+///
+/// Routes from route discovery, and routes the application learns from received messages through offerRoute(),
+/// replace the current route only if their ETX is lower by the hysteresis margin, or if the current route's
+/// next hop is degraded. doArp() keeps listening for a while after the first route discovery response
+/// so responses over better paths can win.
+///
+/// A next hop is degraded when the ETX of the link to it is above the limit set by setMaxLinkEtx(), or it has
+/// not been heard from for the link timeout. ageRoutes() deletes every route through a degraded next hop.
+/// Call it periodically, for example when the radio is put to sleep, so the next message finds a new route.
+///
+/// Only this node's choice of next hop is affected. The messages on air are the same as RHMesh's, so RHMeshETX
+/// and RHMesh nodes can be mixed in a network.
+class RHMeshETX : public RHMesh
+{
+public:
+    /// Constructor.
+    /// \param[in] driver The RH_RF95 driver to use to transport messages. Its lastSNR() feeds the link estimates
+    /// \param[in] thisAddress The address to assign to this node. Defaults to 0
+    RHMeshETX(RH_RF95& driver, uint8_t thisAddress = 0);
+
+    /// Takes the route if there is no route to dest yet, if it goes via the current next hop,
+    /// if the current next hop is degraded, or if its ETX is lower than the current route's by the hysteresis margin
+    /// \param [in] dest The destination node the route leads to
+    /// \param [in] next_hop The neighbour to send messages for dest to
+    /// \param [in] hops The number of nodes between next_hop and dest. 0 if next_hop is dest
+    virtual void offerRoute(uint8_t dest, uint8_t next_hop, uint8_t hops);
+
+    /// Deletes every route whose next hop is degraded
+    /// \return The number of routes deleted
+    uint8_t ageRoutes();
+
+    /// Returns the ETX of the link to a neighbour
+    /// \param [in] neighbour The address of the neighbour
+    /// \return ETX in hundredths. The assumed hop ETX if we have no estimate for the neighbour
+    uint16_t linkEtx(uint8_t neighbour);
+
+    /// Returns the ETX of the current route to a node
+    /// \param [in] dest The address of the node
+    /// \return ETX in hundredths, 0 if there is no route
+    uint16_t routeEtx(uint8_t dest);
+
+    /// Returns the smoothed SNR of messages received from a neighbour
+    /// \param [in] neighbour The address of the neighbour
+    /// \return SNR in dB, 0 if we have not heard from the neighbour
+    int8_t linkSnr(uint8_t neighbour);
+
+    /// Sets how SNR maps to an expected delivery ratio. Set the floor to the demodulation limit of the
+    /// spreading factor in use: about -7.5dB for SF7, -10dB for SF8, -12.5dB for SF9, -15dB for SF10,
+    /// -17.5dB for SF11 and -20dB for SF12.
+    /// \param [in] floor SNR in dB at which we expect 10% of messages to get through. Defaults to -7
+    /// \param [in] span Margin above floor in dB at which we expect all messages to get through. Defaults to 10
+    void setSnrRange(int8_t floor, uint8_t span);
+
+    /// Sets the ETX assumed for a link we can't measure: hops beyond the next hop, and neighbours we have no estimate for
+    /// \param [in] etx ETX in hundredths. Defaults to 150
+    void setHopEtx(uint16_t etx);
+
+    /// Sets the link ETX above which a next hop is degraded
+    /// \param [in] etx ETX in hundredths. Defaults to 400, a delivery ratio of 25%
+    void setMaxLinkEtx(uint16_t etx);
+
+    /// Sets how long a neighbour can go unheard before routes through it are degraded
+    /// \param [in] timeout Time in milliseconds. Defaults to 3 hours
+    void setLinkTimeout(uint32_t timeout);
+
+    /// Sets how long doArp() keeps listening for better routes after the first route discovery response
+    /// \param [in] settle Time in milliseconds. Defaults to 1500. Limited by RH_MESH_ARP_TIMEOUT
+    void setArpSettle(uint16_t settle);
+
+protected:
+
+    /// Defines the link estimate kept for a neighbour
+    typedef struct
+    {
+	uint8_t      address;    ///< Neighbour node address, RH_BROADCAST_ADDRESS if the entry is unused
+	int8_t       snr;        ///< Smoothed SNR of messages from the neighbour in dB
+	uint8_t      delivery;   ///< Smoothed delivery ratio of the link, 255 is 100%
+	unsigned long lastHeard; ///< millis() when we last received a message from the neighbour or it acknowledged one
+    } Neighbour;
+
+    /// Updates the link estimate of the last hop with the SNR of the message, then lets RHMesh look at it
+    /// \param [in] message Pointer to the RHRouter message that was received.
+    /// \param [in] messageLen Length of message in octets
+    virtual void peekAtMessage(RoutedMessage* message, uint8_t messageLen);
+
+    /// Updates the link estimate of the neighbour with the outcome of each transmission
+    /// \param[in] address The node the message was sent to
+    /// \param[in] attempts The number of times the message was transmitted
+    /// \param[in] acked true if the node acknowledged the message
+    virtual void sendResult(uint8_t address, uint8_t attempts, bool acked);
+
+    /// Broadcasts a route discovery request and offers every response heard until the settle time
+    /// after the first one has passed
+    /// \param [in] address The physical address to resolve
+    /// \return true if there is a route to the address
+    virtual bool doArp(uint8_t address);
+
+    /// Finds the link estimate for a neighbour
+    /// \param [in] address The address of the neighbour
+    /// \param [in] create If true and there is no estimate, one is started in place of the least recently heard
+    /// \return Pointer to the estimate, NULL if there is none and create is false
+    Neighbour* findNeighbour(uint8_t address, bool create);
+
+    /// Tests whether routes through a neighbour should be dropped
+    /// \param [in] address The address of the neighbour
+    /// \return true if the link ETX is above the limit or the neighbour has not been heard for the link timeout
+    bool degraded(uint8_t address);
+
+    /// Returns the delivery ratio we expect from the SNR of a received message
+    /// \param [in] snr SNR in dB
+    /// \return Delivery ratio, 255 is 100%
+    uint8_t snrDelivery(int8_t snr);
+
+private:
+    /// The driver, for the SNR of received messages
+    RH_RF95&             _rf95;
+
+    /// Link estimates
+    Neighbour            _neighbours[RH_MESH_ETX_NEIGHBOURS];
+
+    /// The number of nodes between the next hop and the destination of the current route to each node
+    uint8_t              _routeHops[256];
+
+    /// SNR in dB at which we expect a 10% delivery ratio
+    int8_t               _snrFloor;
+
+    /// Margin above _snrFloor in dB at which we expect a 100% delivery ratio
+    uint8_t              _snrSpan;
+
+    /// ETX in hundredths assumed for a link we can't measure
+    uint16_t             _hopEtx;
+
+    /// Link ETX in hundredths above which a next hop is degraded
+    uint16_t             _maxLinkEtx;
+
+    /// Time in milliseconds after which a neighbour we have not heard from is degraded
+    uint32_t             _linkTimeout;
+
+    /// Time in milliseconds doArp() listens on after the first response
+    uint16_t             _arpSettle;
+
+    /// Temporary message buffer
+    static uint8_t       _tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
+};
+
+#endif
@@ -23,6 +23,9 @@ RHReliableDatagram::RHReliableDatagram(RHGenericDriver& driver, uint8_t thisAddr
     _timeout = RH_DEFAULT_TIMEOUT;
     _retries = RH_DEFAULT_RETRIES;
     memset(_seenIds, 0, sizeof(_seenIds));
+    memset(_pending, 0, sizeof(_pending));
+    _lastHandle = 0;
+    _sendCallback = NULL;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -103,6 +106,7 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 			   && (id == thisSequenceNumber))
 		    {
 			// Its the ACK we are waiting for
+			sendResult(address, retries, true);
 			return true;
 		    }
 		    else if (   !(flags & RH_FLAGS_ACK)
@@ -111,6 +115,11 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 			// This is a request we have already received. ACK it again
 			acknowledge(id, from);
 		    }
+		    else if ((flags & RH_FLAGS_ACK) && to == _thisAddress)
+		    {
+			// Maybe the ACK for a message sent with sendtoAsync()
+			receivedAck(from, id);
+		    }
 		    // Else discard it
 		}
 	    }
@@ -121,9 +130,169 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 	YIELD;
     }
     // Retries exhausted
+    sendResult(address, _retries + 1, false);
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address)
+{
+    if (len > RH_MAX_MESSAGE_LEN)
+	return 0;
+    PendingSend* send = NULL;
+    for (uint8_t i = 0; i < RH_RELIABLE_DATAGRAM_MAX_PENDING; i++)
+    {
+	if (!_pending[i].handle)
+	{
+	    send = &_pending[i];
+	    break;
+	}
+    }
+    if (!send)
+	return 0; // Too many in flight
+
+    if (++_lastHandle == 0)
+	_lastHandle = 1;
+    send->handle = _lastHandle;
+    send->address = address;
+    send->id = ++_lastSequenceNumber;
+    send->attempts = 0;
+    send->len = len;
+    memcpy(send->buf, buf, len);
+    transmitPending(*send);
+    return send->handle;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHReliableDatagram::pollSends()
+{
+    uint32_t next = 0xffffffff;
+    for (uint8_t i = 0; i < RH_RELIABLE_DATAGRAM_MAX_PENDING; i++)
+    {
+	PendingSend& send = _pending[i];
+	if (!send.handle)
+	    continue;
+	if (send.address == RH_BROADCAST_ADDRESS)
+	{
+	    // Never wait for ACKS to broadcasts
+	    completePending(send, true);
+	    continue;
+	}
+	uint32_t elapsed = millis() - send.sentAt;
+	if (elapsed >= send.timeout)
+	{
+	    if (send.attempts > _retries)
+	    {
+		completePending(send, false);
+		continue;
+	    }
+	    transmitPending(send);
+	    elapsed = 0;
+	}
+	if (send.timeout - elapsed < next)
+	    next = send.timeout - elapsed;
+    }
+    return next;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::sendsInFlight()
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < RH_RELIABLE_DATAGRAM_MAX_PENDING; i++)
+	if (_pending[i].handle)
+	    count++;
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::cancelSend(uint8_t handle)
+{
+    for (uint8_t i = 0; i < RH_RELIABLE_DATAGRAM_MAX_PENDING; i++)
+    {
+	PendingSend& send = _pending[i];
+	if (handle && send.handle == handle)
+	{
+	    completePending(send, send.address == RH_BROADCAST_ADDRESS);
+	    return true;
+	}
+    }
     return false;
 }
 
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::setSendCallback(SendCallback callback)
+{
+    _sendCallback = callback;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::transmitPending(PendingSend& send)
+{
+    setHeaderId(send.id);
+    // The RETRY flag on every transmission after the first, the same as sendtoWait()
+    if (send.attempts == 0)
+	setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACK | RH_FLAGS_RETRY);
+    else
+	setHeaderFlags(RH_FLAGS_RETRY, RH_FLAGS_ACK);
+    sendto(send.buf, send.len, send.address);
+    waitPacketSent();
+
+    if (send.attempts++ > 0)
+	_retransmissions++;
+    send.sentAt = millis(); // Timeout does not include original transmit time
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
+    send.timeout = _timeout + (_timeout * (random() & 0xFF) / 256);
+#else
+    send.timeout = _timeout + (_timeout * random(0, 256) / 256);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::completePending(PendingSend& send, bool acked)
+{
+    if (send.address != RH_BROADCAST_ADDRESS)
+	sendResult(send.address, send.attempts, acked);
+    sendComplete(send.handle, send.buf, send.len, send.address, send.attempts, acked);
+    send.handle = 0; // Free only now - buf is still needed above
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::receivedAck(uint8_t from, uint8_t id)
+{
+    for (uint8_t i = 0; i < RH_RELIABLE_DATAGRAM_MAX_PENDING; i++)
+    {
+	PendingSend& send = _pending[i];
+	if (send.handle && send.address == from && send.id == id)
+	{
+	    completePending(send, true);
+	    return;
+	}
+    }
+    // Else a late ACK for a message that already completed
+}
+
+////////////////////////////////////////////////////////////////////
+// Subclasses may want to override this to act on the message
+void RHReliableDatagram::sendComplete(uint8_t handle, uint8_t* buf, uint8_t len, uint8_t address, uint8_t attempts, bool acked)
+{
+    (void)buf; // Not used
+    (void)len; // Not used
+    (void)address; // Not used
+    if (_sendCallback)
+	_sendCallback(handle, attempts, acked);
+}
+
+////////////////////////////////////////////////////////////////////
+// Subclasses may want to override this to keep link statistics
+void RHReliableDatagram::sendResult(uint8_t address, uint8_t attempts, bool acked)
+{
+    // Default does nothing
+    (void)address; // Not used
+    (void)attempts; // Not used
+    (void)acked; // Not used
+}
+
 ////////////////////////////////////////////////////////////////////
 bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {  
@@ -134,7 +303,9 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
     // Get the message before its clobbered by the ACK (shared rx and tx buffer in some drivers
     if (available() && recvfrom(buf, len, &_from, &_to, &_id, &_flags))
     {
-	// Never ACK an ACK
+	// Never ACK an ACK, but it may be for a message sent with sendtoAsync()
+	if ((_flags & RH_FLAGS_ACK) && _to == _thisAddress)
+	    receivedAck(_from, _id);
 	if (!(_flags & RH_FLAGS_ACK))
 	{
 	    // Its a normal message not an ACK
@@ -35,6 +35,11 @@
 /// The default number of retries
 #define RH_DEFAULT_RETRIES 3
 
+/// The number of messages sendtoAsync() can have waiting for an acknowledgement at once
+#ifndef RH_RELIABLE_DATAGRAM_MAX_PENDING
+#define RH_RELIABLE_DATAGRAM_MAX_PENDING 4
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHReliableDatagram RHReliableDatagram.h <RHReliableDatagram.h>
 /// \brief RHDatagram subclass for sending addressed, acknowledged, retransmitted datagrams.
@@ -74,7 +79,7 @@
 /// This will be recognised as "pure ALOHA". 
 /// The addition of Clear Channel Assessment (CCA) is desirable and planned.
 ///
-/// There is no message queuing or threading in RHReliableDatagram. 
+/// There is no threading in RHReliableDatagram. 
 /// sendtoWait() waits until an acknowledgement is received, retransmitting
 /// up to (by default) 3 retries time with a default 200ms timeout. 
 /// During this transmit-acknowledge phase, any received message (other than the expected
@@ -84,6 +89,17 @@
 /// retransmit strategy and configuration lest they hang for a long time
 /// trying to reply to clients that are unreachable.
 ///
+/// \par Asynchronous sends
+///
+/// sendtoAsync() transmits the message once and returns a handle without waiting. Up to
+/// RH_RELIABLE_DATAGRAM_MAX_PENDING messages can be waiting for their acknowledgements at once.
+/// The acknowledgements are picked up by recvfromAck(), so the sketch keeps receiving
+/// while they are in flight, and pollSends() retransmits messages whose timeout has passed and
+/// gives up on those whose retries are exhausted. Call both often, for example from loop().
+/// cancelSend() gives up on a message early, for example once the node can no longer be listening.
+/// The callback set by setSendCallback() is told the outcome of each message. The timeout,
+/// retries and sendResult() statistics are the same as for sendtoWait().
+///
 /// Caution: if you have a radio network with a mixture of slow and fast
 /// processors and ReliableDatagrams, you may be affected by race conditions
 /// where the fast processor acknowledges a message before the sender is ready
@@ -134,6 +150,43 @@ public:
     /// \return true if the message was transmitted and an acknowledgement was received.
     bool sendtoWait(uint8_t* buf, uint8_t len, uint8_t address);
 
+    /// Called when a message sent with sendtoAsync() has been acknowledged or its retries are exhausted
+    /// \param[in] handle The handle sendtoAsync() returned
+    /// \param[in] attempts The number of times the message was transmitted
+    /// \param[in] acked true if the node acknowledged the message. Broadcasts are always true
+    typedef void (*SendCallback)(uint8_t handle, uint8_t attempts, bool acked);
+
+    /// Sends the message once and returns without waiting for the acknowledgement. 
+    /// recvfromAck() picks up the acknowledgement and pollSends() does the retransmissions, 
+    /// with the same timeout and retries as sendtoWait(). The outcome goes to the callback set with setSendCallback().
+    /// Broadcasts are sent once and complete at the next pollSends().
+    /// Blocks only while the message is transmitted.
+    /// \param[in] buf Pointer to the binary message to send. It is copied
+    /// \param[in] len Number of octets to send. At most RH_MAX_MESSAGE_LEN
+    /// \param[in] address The address to send the message to.
+    /// \return A handle for the message, never 0. 0 if RH_RELIABLE_DATAGRAM_MAX_PENDING messages are 
+    /// already in flight or the message is too long
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address);
+
+    /// Retransmits the messages sent with sendtoAsync() whose timeout has passed, 
+    /// and completes those whose retries are exhausted. Call it often, for example from loop()
+    /// \return Milliseconds until the next timeout of a message in flight, 0xffffffff if there are none
+    uint32_t pollSends();
+
+    /// Returns the number of messages sent with sendtoAsync() that have not completed yet
+    /// \return The number of messages in flight
+    uint8_t sendsInFlight();
+
+    /// Gives up on a message sent with sendtoAsync() without any more retransmissions. It completes 
+    /// at once, as if its retries were exhausted, so the callback is told it was not acknowledged
+    /// \param[in] handle The handle sendtoAsync() returned
+    /// \return true if the message was still in flight
+    bool cancelSend(uint8_t handle);
+
+    /// Sets the function told the outcome of each message sent with sendtoAsync()
+    /// \param[in] callback The function, NULL for none
+    void setSendCallback(SendCallback callback);
+
     /// If there is a valid message available for this node, send an acknowledgement to the SRC
     /// address (blocking until this is complete), then copy the message to buf and return true
     /// else return false. 
@@ -191,6 +244,51 @@ protected:
     /// \return true if there is a message received and it is a new message
     bool haveNewMessage();
 
+    /// Called by sendtoWait() when a message to a single node has been acknowledged or its retries are exhausted.
+    /// Lets subclasses keep statistics on the link to each neighbour. The default does nothing
+    /// \param[in] address The node the message was sent to
+    /// \param[in] attempts The number of times the message was transmitted
+    /// \param[in] acked true if the node acknowledged the message
+    virtual void sendResult(uint8_t address, uint8_t attempts, bool acked);
+
+    /// Called when a message sent with sendtoAsync() has been acknowledged or its retries are exhausted, 
+    /// after sendResult(). The default calls the callback set by setSendCallback().
+    /// Subclasses can override it to act on the message, for example to drop a route that failed
+    /// \param[in] handle The handle sendtoAsync() returned
+    /// \param[in] buf The message as it was sent
+    /// \param[in] len Number of octets in the message
+    /// \param[in] address The node the message was sent to
+    /// \param[in] attempts The number of times the message was transmitted
+    /// \param[in] acked true if the node acknowledged the message
+    virtual void sendComplete(uint8_t handle, uint8_t* buf, uint8_t len, uint8_t address, uint8_t attempts, bool acked);
+
+    /// Defines a message sent with sendtoAsync() that has not completed yet
+    typedef struct
+    {
+	uint8_t       handle;    ///< Returned by sendtoAsync(), 0 if the entry is free
+	uint8_t       address;   ///< The node the message is for
+	uint8_t       id;        ///< The sequence number the acknowledgement will carry
+	uint8_t       attempts;  ///< The number of times the message has been transmitted
+	unsigned long sentAt;    ///< millis() when the last transmission finished
+	uint16_t      timeout;   ///< Milliseconds after sentAt to retransmit or give up, random between _timeout and _timeout*2
+	uint8_t       len;       ///< Number of octets in buf
+	uint8_t       buf[RH_MAX_MESSAGE_LEN]; ///< The message
+    } PendingSend;
+
+    /// Transmits a message in flight again, or for the first time, and starts its timeout
+    /// \param[in] send The message
+    void transmitPending(PendingSend& send);
+
+    /// Completes a message in flight and frees its entry
+    /// \param[in] send The message
+    /// \param[in] acked true if the node acknowledged the message
+    void completePending(PendingSend& send, bool acked);
+
+    /// Completes the message in flight an acknowledgement is for, if there is one
+    /// \param[in] from The node that sent the acknowledgement
+    /// \param[in] id The ID of the acknowledgement
+    void receivedAck(uint8_t from, uint8_t id);
+
 private:
     /// Count of retransmissions we have had to send
     uint32_t _retransmissions;
@@ -212,6 +310,15 @@ private:
     /// (this is generally due to lost ACKs, causing the sender to retransmit, even though we have already
     /// received that message)
     uint8_t _seenIds[256];
+
+    /// Messages sent with sendtoAsync() that have not completed
+    PendingSend _pending[RH_RELIABLE_DATAGRAM_MAX_PENDING];
+
+    /// The last handle returned by sendtoAsync()
+    uint8_t _lastHandle;
+
+    /// Told the outcome of each message sent with sendtoAsync()
+    SendCallback _sendCallback;
 };
 
 /// @example rf22_reliable_datagram_client.pde
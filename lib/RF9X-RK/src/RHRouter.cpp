@@ -103,7 +103,7 @@ RHRouter::RoutingTableEntry* RHRouter::getRouteTo(uint8_t dest)
 void RHRouter::deleteRoute(uint8_t index)
 {
     // Delete a route by copying following routes on top of it
-    memcpy(&_routes[index], &_routes[index+1], 
+    memmove(&_routes[index], &_routes[index+1], 
 	   sizeof(RoutingTableEntry) * (RH_ROUTING_TABLE_SIZE - index - 1));
     _routes[RH_ROUTING_TABLE_SIZE - 1].state = Invalid;
 }
@@ -180,6 +180,38 @@ uint8_t RHRouter::sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest,
     return route(&_tmpMessage, sizeof(RoutedMessageHeader)+len);
 }
 
+////////////////////////////////////////////////////////////////////
+// Returns once the message is on its way to the next hop
+uint8_t RHRouter::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags, uint8_t* handle)
+{
+    if (((uint16_t)len + sizeof(RoutedMessageHeader)) > _driver.maxMessageLength())
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+
+    uint8_t next_hop = RH_BROADCAST_ADDRESS;
+    if (dest != RH_BROADCAST_ADDRESS)
+    {
+	RoutingTableEntry* route = getRouteTo(dest);
+	if (!route)
+	    return RH_ROUTER_ERROR_NO_ROUTE;
+	next_hop = route->next_hop;
+    }
+
+    // Construct a RH RouterMessage message. RHReliableDatagram keeps a copy
+    _tmpMessage.header.source = _thisAddress;
+    _tmpMessage.header.dest = dest;
+    _tmpMessage.header.hops = 0;
+    _tmpMessage.header.id = _lastE2ESequenceNumber++;
+    _tmpMessage.header.flags = flags;
+    memcpy(_tmpMessage.data, buf, len);
+
+    uint8_t sent = RHReliableDatagram::sendtoAsync((uint8_t*)&_tmpMessage, sizeof(RoutedMessageHeader)+len, next_hop);
+    if (!sent)
+	return RH_ROUTER_ERROR_BUSY;
+    if (handle)
+	*handle = sent;
+    return RH_ROUTER_ERROR_NONE;
+}
+
 ////////////////////////////////////////////////////////////////////
 uint8_t RHRouter::route(RoutedMessage* message, uint8_t messageLen)
 {
@@ -13,7 +13,12 @@
 #define RH_DEFAULT_MAX_HOPS 30
 
 // The default size of the routing table we keep
-#define RH_ROUTING_TABLE_SIZE 50
+// Sized so a gateway can hold a route to every node it can assign (nodeIDData::MAX_NODES) with room
+// left for routes to other addresses, such as the one unconfigured nodes share, so those never push out a node's route
+// Must be less than 256 as the table is indexed with uint8_t
+#ifndef RH_ROUTING_TABLE_SIZE
+#define RH_ROUTING_TABLE_SIZE 216
+#endif
 
 // Error codes
 #define RH_ROUTER_ERROR_NONE              0
@@ -22,6 +27,7 @@
 #define RH_ROUTER_ERROR_TIMEOUT           3
 #define RH_ROUTER_ERROR_NO_REPLY          4
 #define RH_ROUTER_ERROR_UNABLE_TO_DELIVER 5
+#define RH_ROUTER_ERROR_BUSY              6
 
 // This size of RH_ROUTER_MAX_MESSAGE_LEN is OK for Arduino Mega, but too big for
 // Duemilanove. Size of 50 works with the sample router programs on Duemilanove.
@@ -91,7 +97,7 @@
 /// You can also use addRouteTo() to change a route and 
 /// deleteRouteTo() to delete a route at run time. Youcan also clear the entire routing table
 ///
-/// The Routing Table has limited capacity for entries (defined by RH_ROUTING_TABLE_SIZE, which is 10)
+/// The Routing Table has limited capacity for entries (defined by RH_ROUTING_TABLE_SIZE, which is 216)
 /// if more than RH_ROUTING_TABLE_SIZE are added, the oldest (first) one will be removed by calling 
 /// retireOldestRoute()
 ///
@@ -256,6 +262,22 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags = 0);
 
+    /// Similar to sendtoWait() above, but returns once the message has been transmitted to the next hop
+    /// instead of waiting for its acknowledgement. See RHReliableDatagram::sendtoAsync().
+    /// The outcome goes to the callback set with setSendCallback()
+    /// \param [in] buf The application message data
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end to the dest address. The receiver can recover the flags with recvFromAck().
+    /// \param [out] handle If present and not NULL, set to the handle the callback will be called with
+    /// \return The result code:
+    ///         - RH_ROUTER_ERROR_NONE Message was transmitted to the next hop and is waiting for its acknowledgement
+    ///         - RH_ROUTER_ERROR_INVALID_LENGTH The message is too long
+    ///         - RH_ROUTER_ERROR_NO_ROUTE There was no route for dest in the local routing table
+    ///         - RH_ROUTER_ERROR_BUSY RH_RELIABLE_DATAGRAM_MAX_PENDING messages are already waiting for acknowledgements
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0, uint8_t* handle = NULL);
+
     /// Starts the receiver if it is not running already.
     /// If there is a valid message available for this node (or RH_BROADCAST_ADDRESS), 
     /// send an acknowledgement to the last hop
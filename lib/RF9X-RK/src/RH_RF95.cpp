@@ -32,8 +32,13 @@ PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
 RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, RHGenericSPI& spi)
     :
     RHSPIDriver(slaveSelectPin, spi),
-    _rxBufValid(0)
+    _rxHead(0),
+    _rxTail(0),
+    _rxOverflow(0)
 {
+#if defined(PARTICLE)
+    _rxSignal = NULL;
+#endif
     _interruptPin = interruptPin;
     _myInterruptIndex = 0xff; // Not allocated yet
     _enableCRC = true;
@@ -45,6 +50,11 @@ bool RH_RF95::init()
     if (!RHSPIDriver::init())
 	return false;
 
+#if defined(PARTICLE)
+    if (!_rxSignal && os_semaphore_create(&_rxSignal, 1, 0) != 0)
+	_rxSignal = NULL; // waitAvailableTimeout() polls instead
+#endif
+
 #ifdef RH_USE_MUTEX
     if (RH_MUTEX_INIT(lock) != 0)
     { 
@@ -184,8 +194,7 @@ void RH_RF95::handleInterrupt()
 //    if (_mode == RHModeRx && irq_flags & (RH_RF95_RX_TIMEOUT | RH_RF95_PAYLOAD_CRC_ERROR))
     {
 //	Serial.println("E");
-	_rxBad++;
-        clearRxBuf();
+	_rxBad++;	// Frames already queued are good - leave them for recv()
     }
     // It is possible to get RX_DONE and CRC_ERROR and VALID_HEADER all at once
     // so this must be an else
@@ -196,39 +205,64 @@ void RH_RF95::handleInterrupt()
 	// Have received a packet
 	uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
 
-	// Reset the fifo read ptr to the beginning of the packet
-	spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-	spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
-	_bufLen = len;
-
-	// Remember the last signal to noise ratio, LORA mode
-	// Per page 111, SX1276/77/78/79 datasheet
-	_lastSNR = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
-
-	// Remember the RSSI of this packet, LORA mode
-	// this is according to the doc, but is it really correct?
-	// weakest receiveable signals are reported RSSI at about -66
-	_lastRssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
-	// Adjust the RSSI, datasheet page 87
-	if (_lastSNR < 0)
-	    _lastRssi = _lastRssi + _lastSNR;
-	else
-	    _lastRssi = (int)_lastRssi * 16 / 15;
-	if (_usingHFport)
-	    _lastRssi -= 157;
+	if ((uint8_t)(_rxHead - _rxTail) >= RH_RF95_RX_QUEUE_LEN)
+	{
+	    // Application has not kept up - no room for this one.
+	    // Read just the headers so only frames we would have kept count as lost
+	    uint8_t headers[RH_RF95_HEADER_LEN];
+	    if (len >= RH_RF95_HEADER_LEN)
+	    {
+		spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
+		spiBurstRead(RH_RF95_REG_00_FIFO, headers, RH_RF95_HEADER_LEN);
+	    }
+	    if (validateRxBuf(headers, len))
+		_rxOverflow++;
+	}
 	else
-	    _lastRssi -= 164;
-	    
-	// We have received a message.
-	validateRxBuf(); 
-	if (_rxBufValid)
-	    setModeIdle(); // Got one 
+	{
+	    RxFrame& frame = _rxQueue[_rxHead % RH_RF95_RX_QUEUE_LEN];
+
+	    // Reset the fifo read ptr to the beginning of the packet
+	    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
+	    spiBurstRead(RH_RF95_REG_00_FIFO, frame.buf, len);
+	    frame.len = len;
+
+	    // Remember the signal to noise ratio of this frame, LORA mode
+	    // Per page 111, SX1276/77/78/79 datasheet
+	    // These registers only hold the latest packet, so they are read now and kept with the frame
+	    frame.snr = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
+
+	    // Remember the RSSI of this packet, LORA mode
+	    // this is according to the doc, but is it really correct?
+	    // weakest receiveable signals are reported RSSI at about -66
+	    int16_t rssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
+	    // Adjust the RSSI, datasheet page 87
+	    if (frame.snr < 0)
+		rssi = rssi + frame.snr;
+	    else
+		rssi = (int)rssi * 16 / 15;
+	    if (_usingHFport)
+		rssi -= 157;
+	    else
+		rssi -= 164;
+	    frame.rssi = rssi;
+
+	    // We have received a message. Publish it to the reader only once the frame is complete.
+	    // The radio stays in continuous receive so a frame right behind this one is not lost.
+	    if (validateRxBuf(frame.buf, frame.len))
+	    {
+		_rxGood++;
+		_rxHead++;
+		signalWaiter();
+	    }
+	}
     }
     else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
     {
 //	Serial.println("T");
 	_txGood++;
 	setModeIdle();
+	signalWaiter(); // A wait that started during the transmission can turn the receiver on now
     }
     else if (_mode == RHModeCad && irq_flags & RH_RF95_CAD_DONE)
     {
@@ -267,23 +301,16 @@ void RH_INTERRUPT_ATTR RH_RF95::isr2()
 	_deviceForInterrupt[2]->handleInterrupt();
 }
 
-// Check whether the latest received message is complete and uncorrupted
-void RH_RF95::validateRxBuf()
+// Check whether a received frame is complete and addressed to us
+bool RH_RF95::validateRxBuf(const uint8_t* buf, uint8_t len)
 {
-    if (_bufLen < 4)
-	return; // Too short to be a real message
-    // Extract the 4 headers
-    _rxHeaderTo    = _buf[0];
-    _rxHeaderFrom  = _buf[1];
-    _rxHeaderId    = _buf[2];
-    _rxHeaderFlags = _buf[3];
+    if (len < RH_RF95_HEADER_LEN)
+	return false; // Too short to be a real message
     if (_promiscuous ||
-	_rxHeaderTo == _thisAddress ||
-	_rxHeaderTo == RH_BROADCAST_ADDRESS)
-    {
-	_rxGood++;
-	_rxBufValid = true;
-    }
+	buf[0] == _thisAddress ||
+	buf[0] == RH_BROADCAST_ADDRESS)
+	return true;
+    return false;
 }
 
 bool RH_RF95::available()
@@ -295,16 +322,47 @@ bool RH_RF95::available()
 	return false;
     }
     setModeRx();
+    bool ready = (_rxHead != _rxTail); // Set by the interrupt handler when a good message is received
+    if (ready)
+    {
+	// Extract the 4 headers of the oldest frame - this is the one recv() will return
+	const RxFrame& frame = _rxQueue[_rxTail % RH_RF95_RX_QUEUE_LEN];
+	_rxHeaderTo    = frame.buf[0];
+	_rxHeaderFrom  = frame.buf[1];
+	_rxHeaderId    = frame.buf[2];
+	_rxHeaderFlags = frame.buf[3];
+    }
     RH_MUTEX_UNLOCK(lock);
-    return _rxBufValid; // Will be set by the interrupt handler when a good message is received
+    return ready;
 }
 
-void RH_RF95::clearRxBuf()
+bool RH_RF95::waitAvailableTimeout(uint16_t timeout, uint16_t polldelay)
 {
-    ATOMIC_BLOCK_START;
-    _rxBufValid = false;
-    _bufLen = 0;
-    ATOMIC_BLOCK_END;
+#if defined(PARTICLE)
+    if (_rxSignal)
+    {
+	unsigned long starttime = millis();
+	while (!available()) // Also turns the receiver on
+	{
+	    unsigned long elapsed = millis() - starttime;
+	    if (elapsed >= timeout)
+		return false;
+	    // Sleep until the interrupt handler signals. A frame queued since available() looked has already
+	    // given the semaphore, so this returns at once rather than missing it
+	    os_semaphore_take(_rxSignal, timeout - elapsed, false);
+	}
+	return true;
+    }
+#endif
+    return RHGenericDriver::waitAvailableTimeout(timeout, polldelay);
+}
+
+void RH_RF95::signalWaiter()
+{
+#if defined(PARTICLE)
+    if (_rxSignal)
+	os_semaphore_give(_rxSignal, false); // Safe from an ISR. Fails harmlessly if already given
+#endif
 }
 
 bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
@@ -312,16 +370,17 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
     if (!available())
 	return false;
     RH_MUTEX_LOCK(lock); // Multithread support
+    const RxFrame& frame = _rxQueue[_rxTail % RH_RF95_RX_QUEUE_LEN];
     if (buf && len)
     {
-	ATOMIC_BLOCK_START;
-	// Skip the 4 headers that are at the beginning of the rxBuf
-	if (*len > _bufLen-RH_RF95_HEADER_LEN)
-	    *len = _bufLen-RH_RF95_HEADER_LEN;
-	memcpy(buf, _buf+RH_RF95_HEADER_LEN, *len);
-	ATOMIC_BLOCK_END;
+	// Skip the 4 headers that are at the beginning of the frame
+	if (*len > frame.len-RH_RF95_HEADER_LEN)
+	    *len = frame.len-RH_RF95_HEADER_LEN;
+	memcpy(buf, frame.buf+RH_RF95_HEADER_LEN, *len);
     }
-    clearRxBuf(); // This message accepted and cleared
+    _lastRssi = frame.rssi; // Signal quality of the message being returned, not of whatever arrived since
+    _lastSNR = frame.snr;
+    _rxTail++; // This message accepted - hand the slot back to the interrupt handler
     RH_MUTEX_UNLOCK(lock);
     return true;
 }
@@ -575,6 +634,11 @@ int RH_RF95::lastSNR()
     return _lastSNR;
 }
 
+uint16_t RH_RF95::rxOverflow()
+{
+    return _rxOverflow;
+}
+
  ///////////////////////////////////////////////////
  //
  // additions below by Brian Norman 9th Nov 2018
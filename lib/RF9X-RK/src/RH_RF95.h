@@ -29,6 +29,16 @@
 // The headers are inside the LORA's payload
 #define RH_RF95_HEADER_LEN 4
 
+// Number of received frames the interrupt handler can hold until the application reads them.
+// Each costs RH_RF95_MAX_PAYLOAD_LEN + 4 octets of SRAM. Can be pre-defined prior to including this header,
+// must be a power of 2 no larger than 128 so the free running uint8_t queue indexes wrap cleanly
+#ifndef RH_RF95_RX_QUEUE_LEN
+ #define RH_RF95_RX_QUEUE_LEN 4
+#endif
+#if (RH_RF95_RX_QUEUE_LEN < 1) || (RH_RF95_RX_QUEUE_LEN > 128) || (RH_RF95_RX_QUEUE_LEN & (RH_RF95_RX_QUEUE_LEN - 1))
+ #error RH_RF95_RX_QUEUE_LEN must be a power of 2 from 1 to 128
+#endif
+
 // This is the maximum message length that can be supported by this driver. 
 // Can be pre-defined to a smaller size (to save SRAM) prior to including this header
 // Here we allow for 1 byte message length, 4 bytes headers, user data and 2 bytes of FCS
@@ -658,12 +668,21 @@ public:
     bool        setModemConfig(ModemConfigChoice index);
 
     /// Tests whether a new message is available from the Driver. 
-    /// On most drivers, this will also put the Driver into RHModeRx mode until
-    /// a message is actually received by the transport, when it will be returned to RHModeIdle.
+    /// This will also put the Driver into RHModeRx mode. The radio stays in receive after a frame
+    /// arrives, the interrupt handler queues up to RH_RF95_RX_QUEUE_LEN frames for recv() to drain.
     /// This can be called multiple times in a timeout loop
     /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
     virtual bool    available();
 
+    /// Starts the receiver and blocks until a message is available or the timeout expires.
+    /// On Particle the calling thread sleeps on a semaphore that the interrupt handler gives when it queues
+    /// a frame or a transmission finishes, so it wakes as soon as a frame arrives and uses no CPU meanwhile.
+    /// Other platforms poll as RHGenericDriver does.
+    /// \param[in] timeout Maximum time to wait in milliseconds
+    /// \param[in] polldelay Time between polls in milliseconds on platforms that poll. Not used on Particle
+    /// \return true if a message is available
+    virtual bool    waitAvailableTimeout(uint16_t timeout, uint16_t polldelay = 0);
+
     /// Turns the receiver on if it not already on.
     /// If there is a valid message available, copy it to buf and return true
     /// else return false.
@@ -782,10 +801,18 @@ public:
     int frequencyError();
 
     /// Returns the Signal-to-noise ratio (SNR) of the last received message, as measured
-    /// by the receiver.
+    /// by the receiver. The SNR is captured by the interrupt handler with each frame, so this is the SNR
+    /// of the message most recently returned by recv(), even if more frames have been queued since.
+    /// lastRssi() works the same way.
     /// \return SNR of the last received message in dB
     int lastSNR();
 
+    /// Returns the number of frames addressed to this node that were dropped because the receive queue was full.
+    /// Frames for other nodes and runt frames are not counted, they would have been discarded anyway.
+    /// If this grows, read the radio more often or define a larger RH_RF95_RX_QUEUE_LEN
+    /// \return Count of frames lost to receive queue overflow
+    uint16_t rxOverflow();
+
     /// brian.n.norman@gmail.com 9th Nov 2018
     /// Sets the radio spreading factor.
     /// valid values are 6 through 12.
@@ -855,11 +882,14 @@ protected:
     /// Should not need to be called by user code.
     void           handleInterrupt();
 
-    /// Examine the revceive buffer to determine whether the message is for this node
-    void validateRxBuf();
+    /// Examine a received frame to determine whether the message is for this node
+    /// \param[in] buf The frame as read from the FIFO, including the 4 headers
+    /// \param[in] len Number of octets in the frame
+    /// \return true if the frame is long enough and addressed to us (or we are promiscuous)
+    bool validateRxBuf(const uint8_t* buf, uint8_t len);
 
-    /// Clear our local receive buffer
-    void clearRxBuf();
+    /// Wakes a thread blocked in waitAvailableTimeout(). Called by the interrupt handler
+    void signalWaiter();
 
     /// Called by RH_RF95 when the radio mode is about to change to a new setting.
     /// Can be used by subclasses to implement antenna switching etc.
@@ -894,19 +924,39 @@ private:
     /// else 0xff
     uint8_t             _myInterruptIndex;
 
-    /// Number of octets in the buffer
-    volatile uint8_t    _bufLen;
-    
-    /// The receiver/transmitter buffer
-    uint8_t             _buf[RH_RF95_MAX_PAYLOAD_LEN];
-
-    /// True when there is a valid message in the buffer
-    volatile bool       _rxBufValid;
+    /// One received frame as read from the FIFO, headers included
+    typedef struct
+    {
+	int16_t         rssi;                           ///< Packet RSSI in dBm, read when the frame arrived
+	int8_t          snr;                            ///< Packet SNR in dB, read when the frame arrived
+	uint8_t         len;                            ///< Number of octets in buf
+	uint8_t         buf[RH_RF95_MAX_PAYLOAD_LEN];   ///< Headers followed by the payload
+    } RxFrame;
+
+    /// Single producer / single consumer ring of received frames.
+    /// handleInterrupt() is the only writer of _rxHead and available()/recv() the only writer of _rxTail,
+    /// so no locking is needed. The indexes run freely and wrap, _rxHead - _rxTail is the number queued.
+    RxFrame             _rxQueue[RH_RF95_RX_QUEUE_LEN];
+
+    /// Count of frames pushed by the interrupt handler
+    volatile uint8_t    _rxHead;
+
+    /// Count of frames consumed by the application
+    volatile uint8_t    _rxTail;
+
+    /// Count of frames addressed to us dropped because the queue was full
+    volatile uint16_t   _rxOverflow;
+
+#if defined(PARTICLE)
+    /// Given by the interrupt handler when a frame is queued or a transmission ends. Binary - a give that
+    /// nobody waited for only makes the next wait look at the queue once more
+    os_semaphore_t      _rxSignal;
+#endif
 
     /// True if we are using the HF port (779.0 MHz and above)
     bool                _usingHFport;
 
-    /// Last measured SNR, dB
+    /// SNR of the message last returned by recv(), dB
     int8_t              _lastSNR;
 
     /// If true, sends CRCs in every packet and requires a valid CRC in every received packet
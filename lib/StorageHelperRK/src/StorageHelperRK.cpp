@@ -65,8 +65,10 @@ bool StorageHelperRK::PersistentDataBase::setValueString(size_t offset, size_t s
             p += offset;
 
             if (strcmp(value, p) != 0) {
+                recordUndo(offset, size);
                 memset(p, 0, size);
                 strcpy(p, value);
+                markDirty(offset, size);
                 updateHash();
             }
             result = true;
@@ -97,10 +99,187 @@ uint32_t StorageHelperRK::PersistentDataBase::getHash() const {
 }
 
 void StorageHelperRK::PersistentDataBase::updateHash() {
-    savedDataHeader->hash = getHash();
+    WITH_LOCK(*this) {
+        if (batchDepth) {
+            batchChanged = true;
+            return;
+        }
+        if (deferHash) {
+            hashStale = true;
+        }
+        else {
+            savedDataHeader->hash = getHash();
+        }
+    }
     saveOrDefer();
 }
 
+void StorageHelperRK::PersistentDataBase::refreshHash() {
+    WITH_LOCK(*this) {
+        if (hashStale) {
+            savedDataHeader->hash = getHash();
+            hashStale = false;
+        }
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::beginBatch() {
+    lock();
+    batchDepth++;
+}
+
+void StorageHelperRK::PersistentDataBase::endBatch() {
+    if (--batchDepth == 0 && batchChanged) {
+        batchChanged = false;
+        updateHash();
+    }
+    unlock();
+}
+
+void StorageHelperRK::PersistentDataBase::recordUndo(size_t offset, size_t size) {
+    for(Transaction *t = transaction; t; t = t->outer) {
+        t->saveUndo(offset, size);
+    }
+}
+
+StorageHelperRK::PersistentDataBase::Transaction::Transaction(PersistentDataBase &data) : data(data) {
+    data.beginBatch();
+    outer = data.transaction;
+    data.transaction = this;
+}
+
+StorageHelperRK::PersistentDataBase::Transaction::~Transaction() {
+    if (open) {
+        commit();
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::Transaction::commit() {
+    if (open) {
+        close();
+    }
+}
+
+bool StorageHelperRK::PersistentDataBase::Transaction::rollback() {
+    if (!open) {
+        return false;
+    }
+    bool result = !undoOverflow;
+    if (result) {
+        // Newest first so a field set twice ends up with the value from before the transaction
+        uint8_t *p = (uint8_t *)data.savedDataHeader;
+        size_t pos = undoUsed;
+        while(pos > 0) {
+            uint16_t entry[2];
+            memcpy(entry, &undo[pos - sizeof(entry)], sizeof(entry));
+            pos -= sizeof(entry) + entry[1];
+            memcpy(p + entry[0], &undo[pos], entry[1]);
+        }
+    }
+    close();
+    return result;
+}
+
+void StorageHelperRK::PersistentDataBase::Transaction::saveUndo(size_t offset, size_t size) {
+    uint16_t entry[2] = {(uint16_t)offset, (uint16_t)size};
+    if (undoOverflow || undoUsed + size + sizeof(entry) > UNDO_BYTES) {
+        undoOverflow = true;
+        return;
+    }
+    memcpy(&undo[undoUsed], (const uint8_t *)data.savedDataHeader + offset, size);
+    memcpy(&undo[undoUsed + size], entry, sizeof(entry));
+    undoUsed += size + sizeof(entry);
+}
+
+void StorageHelperRK::PersistentDataBase::Transaction::close() {
+    open = false;
+    data.transaction = outer;
+    data.endBatch();
+}
+
+void StorageHelperRK::PersistentDataBase::markDirty(size_t offset, size_t size) {
+    WITH_LOCK(*this) {
+        if (allDirty || size == 0 || offset >= savedDataSize) {
+            return;
+        }
+        size_t end = offset + size;
+        if (end > savedDataSize) {
+            end = savedDataSize;
+        }
+
+        // Find the first range that ends at or after this one starts (allowing for the merge gap)
+        size_t ii = 0;
+        while(ii < dirtyCount && (size_t)dirtyRanges[ii].end + DIRTY_RANGE_MERGE_GAP < offset) {
+            ii++;
+        }
+
+        if (ii < dirtyCount && (size_t)dirtyRanges[ii].start <= end + DIRTY_RANGE_MERGE_GAP) {
+            // Overlaps or is close to range ii - grow it, then absorb any following ranges it now reaches
+            if (offset < dirtyRanges[ii].start) {
+                dirtyRanges[ii].start = (uint16_t) offset;
+            }
+            if (end > dirtyRanges[ii].end) {
+                dirtyRanges[ii].end = (uint16_t) end;
+            }
+            size_t next = ii + 1;
+            while(next < dirtyCount && (size_t)dirtyRanges[next].start <= (size_t)dirtyRanges[ii].end + DIRTY_RANGE_MERGE_GAP) {
+                if (dirtyRanges[next].end > dirtyRanges[ii].end) {
+                    dirtyRanges[ii].end = dirtyRanges[next].end;
+                }
+                next++;
+            }
+            memmove(&dirtyRanges[ii + 1], &dirtyRanges[next], (dirtyCount - next) * sizeof(DirtyRange));
+            dirtyCount -= next - (ii + 1);
+            return;
+        }
+
+        if (dirtyCount == MAX_DIRTY_RANGES) {
+            // Full - merge the two neighbouring ranges with the smallest gap to make room
+            size_t closest = 0;
+            for(size_t jj = 1; jj + 1 < dirtyCount; jj++) {
+                if (dirtyRanges[jj + 1].start - dirtyRanges[jj].end < dirtyRanges[closest + 1].start - dirtyRanges[closest].end) {
+                    closest = jj;
+                }
+            }
+            // Merging with the new range may be cheaper than merging two existing ones
+            size_t newGap = SIZE_MAX;
+            if (ii > 0) {
+                newGap = offset - dirtyRanges[ii - 1].end;
+            }
+            if (ii < dirtyCount && dirtyRanges[ii].start - end < newGap) {
+                newGap = dirtyRanges[ii].start - end;
+            }
+            if (newGap < (size_t)(dirtyRanges[closest + 1].start - dirtyRanges[closest].end)) {
+                if (ii > 0 && newGap == offset - dirtyRanges[ii - 1].end) {
+                    dirtyRanges[ii - 1].end = (uint16_t) end;
+                }
+                else {
+                    dirtyRanges[ii].start = (uint16_t) offset;
+                }
+                return;
+            }
+            dirtyRanges[closest].end = dirtyRanges[closest + 1].end;
+            memmove(&dirtyRanges[closest + 1], &dirtyRanges[closest + 2], (dirtyCount - closest - 2) * sizeof(DirtyRange));
+            dirtyCount--;
+            if (ii > closest) {
+                ii--;
+            }
+        }
+
+        memmove(&dirtyRanges[ii + 1], &dirtyRanges[ii], (dirtyCount - ii) * sizeof(DirtyRange));
+        dirtyRanges[ii].start = (uint16_t) offset;
+        dirtyRanges[ii].end = (uint16_t) end;
+        dirtyCount++;
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::markAllDirty() {
+    WITH_LOCK(*this) {
+        allDirty = true;
+        dirtyCount = 0;
+    }
+}
+
 
 bool StorageHelperRK::PersistentDataBase::validate(size_t dataSize) {
     bool isValid = false;
@@ -124,6 +303,7 @@ bool StorageHelperRK::PersistentDataBase::validate(size_t dataSize) {
             for(size_t ii = (size_t)dataSize; ii < savedDataSize; ii++) {
                 p[ii] = 0;
             }
+            markAllDirty();
         }
         savedDataHeader->size = (uint16_t) savedDataSize;
         savedDataHeader->hash = getHash();
@@ -144,6 +324,7 @@ void StorageHelperRK::PersistentDataBase::initialize() {
     savedDataHeader->version = savedDataVersion;
     savedDataHeader->size = (uint16_t) savedDataSize;
     savedDataHeader->hash = getHash();
+    markAllDirty();
 }
 
 void StorageHelperRK::PersistentDataBase::save() {
@@ -175,6 +356,7 @@ bool StorageHelperRK::PersistentDataEEPROM::load() {
 
 void StorageHelperRK::PersistentDataEEPROM::save() {
     WITH_LOCK(*this) {
+        refreshHash();
         for(int idx = 0; idx < (int) savedDataSize; idx++) {
             EEPROM.write(idx, ((const uint8_t *)savedDataHeader)[idx]);
         }
@@ -229,6 +411,7 @@ bool StorageHelperRK::PersistentDataFileSystem::load() {
 
 void StorageHelperRK::PersistentDataFileSystem::save() {
     WITH_LOCK(*this) {
+        refreshHash();
         int fd = fs->open(filename, O_RDWR | O_CREAT | O_TRUNC);
         if (fd != -1) {            
             size_t count = fs->write((const uint8_t *)savedDataHeader, savedDataSize);
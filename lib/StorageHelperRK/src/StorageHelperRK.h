@@ -568,7 +568,7 @@ public:
             uint16_t version;               //!< savedDataVersion, should rarely, if ever, change
             uint16_t size;                  //!< size of the whole structure, including the user data after it
             uint32_t hash;                  //!< hash value for verifying data integrity
-            uint32_t reserved1;             //!< reserved for future use
+            uint32_t generation;            //!< incremented on each save to a PersistentDataFRAM with two slots, otherwise 0
             // You cannot change the size of this structure without changing the version number!
         };
         
@@ -617,6 +617,25 @@ public:
             return *this;
         }
 
+        /**
+         * @brief Compute the hash when the data is saved instead of on every change
+         * 
+         * @param value true to defer hashing until save()
+         * @return PersistentDataBase& 
+         * 
+         * Normally every set call runs murmur3_32 over the whole structure. With deferred hashing a set call only
+         * marks the hash stale and save() computes it once before writing. Only use this where the stored copy is
+         * written by save() (FRAM, EEPROM, file) - retained memory is read back as-is after a reset so its hash must
+         * always be current.
+         */
+        PersistentDataBase &withDeferredHash(bool value = true) {
+            WITH_LOCK(*this) {
+                deferHash = value;
+                refreshHash();
+            }
+            return *this;
+        }
+
 
         
 
@@ -698,7 +717,9 @@ public:
 
                     T oldValue = *(T *)p;
                     if (oldValue != value) {
+                        recordUndo(offset, sizeof(T));
                         *(T *)p = value;
+                        markDirty(offset, sizeof(T));
                         updateHash();
                     }
                 }
@@ -740,11 +761,123 @@ public:
         /**
          * @brief Update the hash
          * 
+         * Call this after changing the structure directly. Inside a BatchUpdate this only notes that
+         * something changed; with withDeferredHash() it marks the hash stale. Either way the data is
+         * scheduled to be saved.
          */
         void updateHash();
 
+        /**
+         * @brief Compute the hash now if a deferred hash is stale. save() calls this before writing.
+         */
+        void refreshHash();
+
+        /**
+         * @brief Groups several set calls into one update
+         * 
+         * The data is locked for the life of this object and rehashing and save scheduling are held until it
+         * is destroyed, when they happen once if anything changed. Batches can be nested.
+         * 
+         * ```
+         * {
+         *     StorageHelperRK::PersistentDataBase::BatchUpdate batch(current);
+         *     current.set_hourlyCount(hourly);
+         *     current.set_dailyCount(daily);
+         * }
+         * ```
+         */
+        class BatchUpdate {
+        public:
+            explicit BatchUpdate(PersistentDataBase &data) : data(data) {
+                data.beginBatch();
+            }
+            ~BatchUpdate() {
+                data.endBatch();
+            }
+            BatchUpdate(const BatchUpdate&) = delete;
+            BatchUpdate& operator=(const BatchUpdate&) = delete;
+
+        protected:
+            PersistentDataBase &data; //!< Data being updated
+        };
+
+        /**
+         * @brief A BatchUpdate that can be undone
+         * 
+         * Set calls made while the transaction is open change the RAM copy as usual and the old bytes are kept
+         * in an undo log inside this object. commit() (or the destructor) ends it with one rehash and one save,
+         * like a BatchUpdate. rollback() puts the old bytes back instead - use it when a message turns out to be
+         * bad part way through applying it.
+         * 
+         * Only changes made through setValue() and setValueString() are logged. If the log fills up the
+         * transaction can no longer be rolled back and rollback() commits instead and returns false.
+         * 
+         * Getting the commit to storage atomically is up to the backend - see PersistentDataFRAM::withJournal().
+         */
+        class Transaction {
+        public:
+            explicit Transaction(PersistentDataBase &data);
+            ~Transaction();
+            Transaction(const Transaction&) = delete;
+            Transaction& operator=(const Transaction&) = delete;
+
+            /**
+             * @brief Keep the changes - one rehash and one deferred save
+             */
+            void commit();
+
+            /**
+             * @brief Undo the changes made since the transaction started
+             * 
+             * @return true if the changes were undone, false if the undo log overflowed and they were kept
+             */
+            bool rollback();
+
+            static const size_t UNDO_BYTES = 192; //!< Old values plus 4 bytes per set call
+
+        protected:
+            friend class PersistentDataBase;
+
+            /**
+             * @brief Save the bytes about to be overwritten - entries are data then offset and size so they can be walked backwards
+             */
+            void saveUndo(size_t offset, size_t size);
+
+            /**
+             * @brief Close the transaction and end the batch
+             */
+            void close();
+
+            PersistentDataBase &data;       //!< Data being updated
+            Transaction *outer;             //!< Enclosing transaction on the same data, or nullptr
+            uint8_t undo[UNDO_BYTES];       //!< Undo log
+            size_t undoUsed = 0;            //!< Bytes used in undo
+            bool undoOverflow = false;      //!< A change did not fit in undo
+            bool open = true;               //!< Neither commit() nor rollback() has been called
+        };
+
+        /**
+         * @brief Record that bytes in the structure have changed and need to be written on the next save
+         * 
+         * @param offset Offset into the structure, normally offsetof(field, T)
+         * @param size Number of bytes changed
+         * 
+         * setValue() and setValueString() call this for you. If you change the structure directly (memset, memcpy
+         * of a record) call it before updateHash(). Ranges that touch or are close together are merged; if there
+         * are more than MAX_DIRTY_RANGES the closest two are merged, so the worst case is one larger write.
+         */
+        void markDirty(size_t offset, size_t size);
+
+        /**
+         * @brief Mark the whole structure to be written on the next save. Used after initialize().
+         */
+        void markAllDirty();
+
         static const uint32_t HASH_SEED = 0x851c2a3f; //!< Murmur32 hash seed value (randomly generated)
 
+        static const size_t MAX_DIRTY_RANGES = 8; //!< Separate byte ranges remembered between saves
+        static const size_t DIRTY_RANGE_MERGE_GAP = 4; //!< Ranges this close are merged - a separate FRAM write costs 3 bytes of I2C addressing
+
     protected:
         /**
          * This class cannot be copied
@@ -779,6 +912,36 @@ public:
          */
         virtual void initialize();
 
+        /**
+         * @brief Byte range [start, end) of the structure changed since the last save
+         */
+        struct DirtyRange {
+            uint16_t start;                 //!< First changed byte
+            uint16_t end;                   //!< One past the last changed byte
+        };
+
+        /**
+         * @brief Start a BatchUpdate - locks the data and holds rehashing until the matching endBatch()
+         */
+        void beginBatch();
+
+        /**
+         * @brief End a BatchUpdate - rehashes and schedules a save if anything changed, then unlocks
+         */
+        void endBatch();
+
+        /**
+         * @brief Log the bytes about to change so an open Transaction can undo them. Call before changing them.
+         */
+        void recordUndo(size_t offset, size_t size);
+
+        /**
+         * @brief Forget the dirty ranges. Call after the changes have been written.
+         */
+        void clearDirty() {
+            dirtyCount = 0;
+            allDirty = false;
+        }
 
         SavedDataHeader *savedDataHeader = 0; //!< Pointer to the saved data header, which is followed by the data
         uint32_t savedDataSize = 0;     //!< Size of the saved data (header + actual data)
@@ -790,6 +953,16 @@ public:
         uint32_t saveDelayMs = 1000; //!< How long to wait to save before writing file to disk. Set to 0 to write immediately.
 
         bool logData = false; //!< Log data when read and saved
+
+        DirtyRange dirtyRanges[MAX_DIRTY_RANGES]; //!< Changed byte ranges, sorted by start and not overlapping
+        size_t dirtyCount = 0;          //!< Number of entries used in dirtyRanges
+        bool allDirty = false;          //!< The whole structure needs writing - after initialize() or padding a shorter saved structure
+
+        bool deferHash = false;         //!< Hash computed by save() rather than on every change
+        bool hashStale = false;         //!< The hash in the header does not cover the latest changes
+        uint16_t batchDepth = 0;        //!< Number of open BatchUpdate objects
+        bool batchChanged = false;      //!< Something changed inside the open BatchUpdate
+        Transaction *transaction = nullptr; //!< Innermost open Transaction
     };
 
     /**
@@ -886,28 +1059,410 @@ public:
          */
         virtual bool load() {
             WITH_LOCK(*this) {
-                fram.readData(framOffset, (uint8_t*)savedDataHeader, savedDataSize);
-                if (!validate(savedDataHeader->size)) {
-                    initialize();
+                if (secondOffset >= 0) {
+                    // Two slots - use the valid one with the newer generation
+                    bool validB = loadSlot(secondOffset);
+                    uint32_t generationB = savedDataHeader->generation;
+                    bool validA = loadSlot(framOffset);
+                    secondActive = validB && (!validA || (int32_t)(generationB - savedDataHeader->generation) > 0);
+                    if (secondActive) {
+                        loadSlot(secondOffset);
+                    }
+                    else if (!validA) {
+                        initialize();
+                    }
+                }
+                else {
+                    fram.readData(framOffset, (uint8_t*)savedDataHeader, savedDataSize);
+                    replayJournal();
+                    finishChunkedSave();
+                    if (!validate(savedDataHeader->size)) {
+                        initialize();
+                    }
                 }
             }
 
             return true;
         }
 
+        /**
+         * @brief Keep two copies of the data and alternate between them
+         * 
+         * @param secondOffset Offset into FRAM of the second copy. It must not overlap any other data.
+         * @return PersistentDataFRAM& 
+         * 
+         * Each save writes the whole structure to the copy that was not used last, with a generation number one
+         * higher. load() uses the valid copy with the newer generation. A reset part way through a save only
+         * spoils the copy being written, and the previous save is still there. This costs twice the FRAM and a
+         * full write per save, so it suits small structures - use withJournal() for large ones. Call this
+         * before load(). The first offset is the one given to the constructor, so existing data stays readable.
+         */
+        PersistentDataFRAM &withSecondSlot(int secondOffset) {
+            this->secondOffset = secondOffset;
+            return *this;
+        }
+
+        /**
+         * @brief Make each save atomic by writing the changes to a journal in FRAM first
+         * 
+         * @param journalOffset Offset into FRAM of the journal. It must not overlap any other data.
+         * @param journalSize Bytes reserved for the journal. journalSizeFor() gives the size that holds any save whole,
+         * and it must hold at least the header and a record.
+         * @return PersistentDataFRAM& 
+         * 
+         * Without a journal a reset part way through save() leaves a structure whose hash does not match, and
+         * load() initializes it. With a journal the changed ranges and the header are written to the journal
+         * and sealed with a hash, then copied into place, then the journal is cleared. load() finishes a sealed
+         * journal and ignores one that was not sealed, so the data is always either the last save or the one
+         * before it. Each save writes the changes twice. Call this before load().
+         * 
+         * A save whose changes do not fit - after initialize(), or many records changed at once - is split into
+         * chunks that are journaled and copied one at a time, last byte first, with the header in the last chunk.
+         * A marker at the end of the journal is set for the whole save. If a reset interrupts it, load() finishes
+         * the chunk that was sealed and then accepts the data as it is, each chunk as it was before the save or
+         * after it, and rehashes it. Use withJournalRecords() so that ranges are only cut between records.
+         */
+        PersistentDataFRAM &withJournal(int journalOffset, size_t journalSize) {
+            this->journalOffset = journalOffset;
+            this->journalSize = journalSize;
+            return *this;
+        }
+
+        /**
+         * @brief Where a save too big for the journal may cut a range - between the records of an array
+         * 
+         * @param recordOffset Offset into the structure of the first record
+         * @param recordSize Size of each record
+         * @return PersistentDataFRAM& 
+         * 
+         * Without this a range is cut wherever the journal is full. A record bigger than the journal is still cut.
+         */
+        PersistentDataFRAM &withJournalRecords(size_t recordOffset, size_t recordSize) {
+            this->recordOffset = recordOffset;
+            this->recordSize = recordSize;
+            return *this;
+        }
+
+        /**
+         * @brief Journal size that holds any save of a structure whole, so a save is never split into chunks
+         * 
+         * @param savedDataSize Size of the whole structure, including the header
+         */
+        static constexpr size_t journalSizeFor(size_t savedDataSize) {
+            return JOURNAL_HEADER_SIZE + CHUNK_MARKER_SIZE + (MAX_DIRTY_RANGES + 1) * JOURNAL_ENTRY_SIZE + savedDataSize;
+        }
+
         /**
          * @brief Save the persistent data file. You normally do not need to call this; it will be saved automatically.
+         * 
+         * Only the header (which holds the hash) and the byte ranges marked dirty since the last save are written,
+         * so changing one field costs a few bytes on the I2C bus rather than the whole structure. With two slots
+         * the whole structure is written to the slot not used last.
          */
         virtual void save() {
             WITH_LOCK(*this) {
-                fram.writeData(framOffset, (const uint8_t*)savedDataHeader, savedDataSize);
+                if (secondOffset >= 0) {
+                    savedDataHeader->generation++;
+                    savedDataHeader->hash = getHash();
+                    hashStale = false;
+                    fram.writeData((secondActive) ? framOffset : secondOffset, (const uint8_t*)savedDataHeader, savedDataSize);
+                    secondActive = !secondActive;
+                }
+                else {
+                    refreshHash();
+                    if (journalCapacity() < JOURNAL_ENTRY_SIZE + sizeof(SavedDataHeader)) {     // No journal
+                        for(size_t ii = 0; ii < rangeCount(); ii++) {
+                            size_t start, end;
+                            journalRange(ii, start, end);
+                            if (start < end) {
+                                fram.writeData(framOffset + start, (const uint8_t*)savedDataHeader + start, end - start);
+                            }
+                        }
+                    }
+                    else if (journalLength() <= journalCapacity()) {
+                        JournalPiece pieces[MAX_DIRTY_RANGES + 1];
+                        size_t count = 0;
+                        for(size_t ii = 0; ii < rangeCount(); ii++) {
+                            size_t start, end;
+                            journalRange(ii, start, end);
+                            if (start < end) {
+                                pieces[count++] = {(uint16_t)start, (uint16_t)end};
+                            }
+                        }
+                        commitChunk(pieces, count);
+                    }
+                    else {
+                        saveInChunks();
+                    }
+                }
+                clearDirty();
             }
             PersistentDataBase::save();
         } 
 
     protected:
+        /**
+         * @brief Read one slot and validate it - used by load() with two slots
+         */
+        bool loadSlot(int offset) {
+            fram.readData(offset, (uint8_t*)savedDataHeader, savedDataSize);
+            if (savedDataHeader->magic != savedDataMagic || savedDataHeader->size > savedDataSize) {
+                return false;               // Never written, or not this structure - don't hash past the end
+            }
+            return validate(savedDataHeader->size);
+        }
+
+        /**
+         * @brief Header at the start of the journal
+         */
+        struct JournalHeader {
+            uint32_t magic;                 //!< JOURNAL_MAGIC when sealed, 0 when clear
+            uint16_t length;                //!< Bytes of entries following the header
+            uint16_t reserved;              //!< Always 0
+            uint32_t hash;                  //!< Chained murmur3_32 of the entries
+        };
+
+        /**
+         * @brief Set in the last bytes of the journal while a save is written in chunks
+         */
+        struct ChunkMarker {
+            uint32_t magic;                 //!< CHUNK_MAGIC while set, 0 when clear
+            uint32_t check;                 //!< ~CHUNK_MAGIC while set - a marker torn part way through is not set
+        };
+
+        /**
+         * @brief Byte range [start, end) of the structure written by one journal entry
+         */
+        struct JournalPiece {
+            uint16_t start;                 //!< First byte
+            uint16_t end;                   //!< One past the last byte
+        };
+
+        /**
+         * @brief Number of ranges a save writes - the header and then the dirty ranges
+         */
+        size_t rangeCount() const {
+            return (allDirty) ? 2 : dirtyCount + 1;
+        }
+
+        /**
+         * @brief Range ii of a save - 0 is the saved data header, then the dirty ranges after it
+         */
+        void journalRange(size_t ii, size_t &start, size_t &end) const {
+            if (ii == 0) {
+                start = 0;
+                end = sizeof(SavedDataHeader);
+                return;
+            }
+            if (allDirty) {
+                start = sizeof(SavedDataHeader);
+                end = savedDataSize;
+                return;
+            }
+            start = dirtyRanges[ii - 1].start;
+            end = dirtyRanges[ii - 1].end;
+            if (start < sizeof(SavedDataHeader)) {
+                start = sizeof(SavedDataHeader);
+            }
+        }
+
+        /**
+         * @brief Bytes of journal entries the whole save needs
+         */
+        size_t journalLength() const {
+            size_t length = 0;
+            for(size_t ii = 0; ii < rangeCount(); ii++) {
+                size_t start, end;
+                journalRange(ii, start, end);
+                if (start < end) {
+                    length += JOURNAL_ENTRY_SIZE + (end - start);
+                }
+            }
+            return length;
+        }
+
+        /**
+         * @brief Bytes of journal entries one chunk can hold
+         */
+        size_t journalCapacity() const {
+            return (journalSize > JOURNAL_HEADER_SIZE + CHUNK_MARKER_SIZE) ? journalSize - JOURNAL_HEADER_SIZE - CHUNK_MARKER_SIZE : 0;
+        }
+
+        /**
+         * @brief Hash of one journal entry, chained from the previous one
+         */
+        uint32_t journalHash(uint32_t hash, uint16_t offset, uint16_t size) const {
+            return StorageHelperRK::murmur3_32((const uint8_t *)savedDataHeader + offset, size, hash ^ ((uint32_t)size << 16 | offset));
+        }
+
+        /**
+         * @brief Journal the pieces, seal the journal, copy them into place and clear the journal
+         */
+        void commitChunk(const JournalPiece *pieces, size_t count) {
+            JournalHeader journal = {JOURNAL_MAGIC, 0, 0, JOURNAL_MAGIC};
+            size_t addr = journalOffset + sizeof(JournalHeader);
+            for(size_t ii = 0; ii < count; ii++) {
+                uint16_t entry[2] = {pieces[ii].start, (uint16_t)(pieces[ii].end - pieces[ii].start)};
+                fram.writeData(addr, (const uint8_t *)entry, sizeof(entry));
+                fram.writeData(addr + sizeof(entry), (const uint8_t *)savedDataHeader + entry[0], entry[1]);
+                addr += sizeof(entry) + entry[1];
+                journal.length += sizeof(entry) + entry[1];
+                journal.hash = journalHash(journal.hash, entry[0], entry[1]);
+            }
+            fram.writeData(journalOffset, (const uint8_t *)&journal, sizeof(journal));   // Sealed - from here load() finishes the chunk
+
+            for(size_t ii = 0; ii < count; ii++) {
+                fram.writeData(framOffset + pieces[ii].start, (const uint8_t*)savedDataHeader + pieces[ii].start, pieces[ii].end - pieces[ii].start);
+            }
+            clearJournal();
+        }
+
+        /**
+         * @brief Where a range ending at end may be cut so that [cut, end) has at most room bytes - end if nowhere
+         */
+        size_t chunkCut(size_t start, size_t end, size_t room) const {
+            size_t cut = end - room;
+            if (recordSize > 0 && cut > recordOffset) {
+                size_t aligned = recordOffset + (cut - recordOffset + recordSize - 1) / recordSize * recordSize;
+                if (aligned < end) {
+                    return aligned;
+                }
+                return end;             // Not a whole record - wait for an empty chunk
+            }
+            return (cut > start) ? cut : start;
+        }
+
+        /**
+         * @brief Write a save too big for the journal as several chunks - see withJournal()
+         */
+        void saveInChunks() {
+            ChunkMarker marker = {CHUNK_MAGIC, ~CHUNK_MAGIC};
+            fram.writeData(chunkMarkerOffset(), (const uint8_t *)&marker, sizeof(marker));
+
+            JournalPiece pieces[MAX_DIRTY_RANGES + 1];
+            size_t count = 0;
+            size_t used = 0;
+            for(size_t ii = rangeCount() - 1; ii > 0; ii--) {
+                size_t start, end;
+                journalRange(ii, start, end);
+                while(start < end) {
+                    size_t room = (used + JOURNAL_ENTRY_SIZE < journalCapacity()) ? journalCapacity() - used - JOURNAL_ENTRY_SIZE : 0;
+                    size_t cut = (end - start <= room) ? start : chunkCut(start, end, room);
+                    if (cut == end && count == 0) {
+                        cut = end - room;   // A record bigger than the journal - cut it anyway
+                    }
+                    if (cut < end && count < MAX_DIRTY_RANGES + 1) {
+                        pieces[count++] = {(uint16_t)cut, (uint16_t)end};
+                        used += JOURNAL_ENTRY_SIZE + (end - cut);
+                        end = cut;
+                    }
+                    else {
+                        commitChunk(pieces, count);
+                        count = 0;
+                        used = 0;
+                    }
+                }
+            }
+            if (count) {
+                commitChunk(pieces, count);
+            }
+            JournalPiece header = {0, (uint16_t)sizeof(SavedDataHeader)};
+            commitChunk(&header, 1);                    // The new hash goes in last
+
+            marker = {0, 0};
+            fram.writeData(chunkMarkerOffset(), (const uint8_t *)&marker, sizeof(marker));
+        }
+
+        void clearJournal() {
+            JournalHeader journal = {0, 0, 0, 0};
+            fram.writeData(journalOffset, (const uint8_t *)&journal, sizeof(journal));
+        }
+
+        size_t chunkMarkerOffset() const {
+            return journalOffset + journalSize - sizeof(ChunkMarker);
+        }
+
+        /**
+         * @brief Finish a save that was interrupted after its journal was sealed. Called by load().
+         * 
+         * The entries are read over the data just loaded. If the journal turns out not to be sealed the
+         * data is read again, which leaves it as it was before the interrupted save.
+         */
+        void replayJournal() {
+            if (journalSize == 0) {
+                return;
+            }
+            JournalHeader journal;
+            fram.readData(journalOffset, (uint8_t *)&journal, sizeof(journal));
+            if (journal.magic != JOURNAL_MAGIC || journal.length > journalCapacity()) {
+                return;
+            }
+
+            uint32_t hash = JOURNAL_MAGIC;
+            size_t addr = journalOffset + sizeof(JournalHeader);
+            size_t last = addr + journal.length;
+            bool valid = true;
+            while(addr < last) {
+                uint16_t entry[2];
+                fram.readData(addr, (uint8_t *)entry, sizeof(entry));
+                if (addr + sizeof(entry) + entry[1] > last || (size_t)entry[0] + entry[1] > savedDataSize) {
+                    valid = false;
+                    break;
+                }
+                fram.readData(addr + sizeof(entry), (uint8_t *)savedDataHeader + entry[0], entry[1]);
+                hash = journalHash(hash, entry[0], entry[1]);
+                addr += sizeof(entry) + entry[1];
+            }
+
+            if (valid && hash == journal.hash) {
+                Log.info("finishing interrupted save from journal");
+                fram.writeData(framOffset, (const uint8_t*)savedDataHeader, savedDataSize);
+            }
+            else {
+                fram.readData(framOffset, (uint8_t*)savedDataHeader, savedDataSize);
+            }
+            clearJournal();
+        }
+
+        /**
+         * @brief Accept the data left by a save that was interrupted between chunks. Called by load() after replayJournal().
+         * 
+         * Each chunk is as it was before the save or after it, but the header still has the old hash. The
+         * data is rehashed if the header is this structure's, and the marker is cleared only once that is written.
+         */
+        void finishChunkedSave() {
+            if (journalSize == 0) {
+                return;
+            }
+            ChunkMarker marker;
+            fram.readData(chunkMarkerOffset(), (uint8_t *)&marker, sizeof(marker));
+            if (marker.magic != CHUNK_MAGIC || marker.check != ~CHUNK_MAGIC) {
+                return;
+            }
+            if (savedDataHeader->magic == savedDataMagic && savedDataHeader->version == savedDataVersion && savedDataHeader->size <= savedDataSize) {
+                Log.info("finishing save interrupted between chunks");
+                savedDataHeader->hash = getHash();
+                fram.writeData(framOffset, (const uint8_t*)savedDataHeader, sizeof(SavedDataHeader));
+            }
+            marker = {0, 0};
+            fram.writeData(chunkMarkerOffset(), (const uint8_t *)&marker, sizeof(marker));
+        }
+
         MB85RC &fram; //!< Reference to FRAM object
         int framOffset; //!< Offset into FRAM to save the data
+        int secondOffset = -1; //!< Offset into FRAM of the second slot, -1 for one slot
+        bool secondActive = false; //!< The second slot holds the newest data - the next save goes to the first
+        int journalOffset = 0; //!< Offset into FRAM of the journal
+        size_t journalSize = 0; //!< Bytes reserved for the journal, 0 for no journal
+        size_t recordOffset = 0; //!< Offset into the structure of the first record - see withJournalRecords()
+        size_t recordSize = 0; //!< Size of each record, 0 to cut ranges anywhere
+
+        static const uint32_t JOURNAL_MAGIC = 0x4a524e4c; //!< "JRNL" - marks a sealed journal
+        static const uint32_t CHUNK_MAGIC = 0x43484e4b; //!< "CHNK" - marks a save being written in chunks
+        static const size_t JOURNAL_HEADER_SIZE = 12; //!< sizeof(JournalHeader)
+        static const size_t CHUNK_MARKER_SIZE = 8; //!< sizeof(ChunkMarker)
+        static const size_t JOURNAL_ENTRY_SIZE = 4; //!< Offset and size in front of each journaled range
+        static_assert(sizeof(JournalHeader) == JOURNAL_HEADER_SIZE && sizeof(ChunkMarker) == CHUNK_MARKER_SIZE, "journal layout");
     };
     #endif // defined(__MB85RC256V_FRAM_RK) || defined(DOXYGEN_BUILD)
 
@@ -0,0 +1,97 @@
+#include "SimChannel.h"
+#include "SimClock.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+namespace sim {
+
+uint32_t airtimeMs(const RadioParams &params, uint8_t payloadLen) {
+    double symbolMs = (double)(1UL << params.spreadingFactor) * 1000.0 / params.bandwidthHz;
+    double preambleMs = (params.preambleSymbols + 4.25) * symbolMs;
+    int lowDatarate = (params.lowDatarateOptimize) ? 1 : 0;
+    double numerator = 8.0 * payloadLen - 4.0 * params.spreadingFactor + 28 + 16;	// Explicit header, CRC on
+    double payloadSymbols = 8 + std::max(ceil(numerator / (4.0 * (params.spreadingFactor - 2 * lowDatarate))) * (params.codingRate + 4), 0.0);
+    return (uint32_t)ceil(preambleMs + payloadSymbols * symbolMs);
+}
+
+Channel &Channel::instance() {
+    static Channel channel;
+    return channel;
+}
+
+void Channel::attach(Radio *radio) {
+    if (std::find(radios.begin(), radios.end(), radio) == radios.end()) radios.push_back(radio);
+}
+
+bool Channel::busy() const {
+    for (auto &tx : onAir) {
+        if (tx->endMs > nowMs()) return true;
+    }
+    return false;
+}
+
+uint64_t Channel::transmit(Radio *sender, const uint8_t *frame, uint8_t len, const RadioParams &params) {
+    auto tx = std::make_shared<Transmission>();
+    tx->sender = sender;
+    tx->frame.assign(frame, frame + len);
+    tx->startMs = nowMs();
+    tx->endMs = tx->startMs + (uint64_t)(airtimeMs(params, len) * airtimeScale);
+    tx->frequencyMHz = params.frequencyMHz;
+    tx->spreadingFactor = params.spreadingFactor;
+    tx->collided = false;
+    for (Radio *radio : radios) {
+        if (radio != sender && radio->listening() && tunedTo(radio, *tx)) tx->listeners.push_back(radio);
+        else if (radio != sender) stats.missed++;
+    }
+
+    for (auto &other : onAir) {                                     // Anything still on the air on the same channel at the same spreading factor ruins both frames
+        if (other->endMs <= tx->startMs) continue;                  // Its last symbol is out - just not delivered yet
+        if (other->frequencyMHz != tx->frequencyMHz || other->spreadingFactor != tx->spreadingFactor) continue;
+        if (!other->collided) stats.collided++;
+        other->collided = true;
+        tx->collided = true;
+    }
+    if (tx->collided) stats.collided++;
+
+    stats.frames++;
+    stats.airtimeMs += tx->endMs - tx->startMs;
+    if (tx->startMs >= busyUntilMs) stats.busyMs += tx->endMs - tx->startMs;
+    else if (tx->endMs > busyUntilMs) stats.busyMs += tx->endMs - busyUntilMs;
+    busyUntilMs = std::max(busyUntilMs, tx->endMs);
+
+    sender->lastTxStartMs = tx->startMs;
+    sender->lastTxEndMs = tx->endMs;
+    onAir.push_back(tx);
+    at(tx->endMs, [this, tx]() { finish(tx); });
+    return tx->endMs;
+}
+
+void Channel::finish(std::shared_ptr<Transmission> tx) {
+    onAir.erase(std::find(onAir.begin(), onAir.end(), tx));
+    if (verbose()) {                                                // to, from, id, flags, then the router header and mesh type
+        fprintf(stderr, "%010llu [AIR] %3u>%3u id %3u flags %02x len %3u %s", (unsigned long long)tx->startMs, tx->frame[1], tx->frame[0],
+                tx->frame[2], tx->frame[3], (unsigned)tx->frame.size(), (tx->collided) ? "COLLIDED" : "ok");
+        if (tx->frame.size() >= 10) fprintf(stderr, " | dest %u src %u flags %u type %u", tx->frame[4], tx->frame[5], tx->frame[8], tx->frame[9]);
+        fprintf(stderr, " until %llu\n", (unsigned long long)tx->endMs);
+    }
+    if (tx->collided) return;
+
+    for (Radio *radio : tx->listeners) {
+        bool transmittedDuring = radio->lastTxStartMs != UINT64_MAX && radio->lastTxStartMs < tx->endMs && radio->lastTxEndMs > tx->startMs;
+        if (transmittedDuring || !radio->listening() || !tunedTo(radio, *tx)) {	// Half duplex - or went to sleep or retuned part way through
+            stats.missed++;
+            continue;
+        }
+        if (randomUnit() < lossProbability) {
+            stats.lost++;
+            continue;
+        }
+        stats.delivered++;
+        int16_t rssi = tx->sender->linkRssi + (int16_t)randomRange(0, 5) - 2;
+        int8_t snr = tx->sender->linkSnr + (int8_t)randomRange(0, 3) - 1;
+        radio->receive(tx->frame.data(), (uint8_t)tx->frame.size(), rssi, snr);
+    }
+}
+
+}
@@ -0,0 +1,133 @@
+/**
+ * @file SimChannel.h
+ * @brief The air the park shares - airtime, collisions, half duplex and random loss for every simulated radio
+ *
+ * @details Every radio in the park is assumed to hear every other one, which is the worst case for collisions.
+ * A frame is received only if the receiver was listening on the frame's channel at its spreading factor for the whole
+ * frame, nothing else on that channel at that spreading factor was on the air at any point during it (there is no capture
+ * effect - different channels and spreading factors are far enough apart not to collide) and it survives the random loss.  Frames are raw RadioHead frames:
+ * the 4 byte RH header followed by whatever the sender put after it.
+ */
+
+#ifndef __SIM_CHANNEL_H
+#define __SIM_CHANNEL_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+
+namespace sim {
+
+/**
+ * @brief Modem settings that set the airtime of a frame
+ */
+struct RadioParams {
+    float frequencyMHz = 915.0;
+    uint8_t spreadingFactor = 7;
+    uint32_t bandwidthHz = 125000;
+    uint8_t codingRate = 1;                     // 1 - 4 for 4/5 - 4/8
+    bool lowDatarateOptimize = false;
+    uint16_t preambleSymbols = 8;
+};
+
+/**
+ * @brief Time on air for a frame of payloadLen bytes (RH header included) - Semtech SX1276 datasheet formula,
+ * explicit header and CRC on as RH_RF95 configures them
+ */
+uint32_t airtimeMs(const RadioParams &params, uint8_t payloadLen);
+
+/**
+ * @brief Anything with an antenna - the gateway's driver and each simulated node
+ */
+class Radio {
+public:
+    virtual ~Radio() {}
+
+    /**
+     * @brief True while the receiver is on - not transmitting, idle or asleep
+     */
+    virtual bool listening() const = 0;
+
+    /**
+     * @brief Channel and spreading factor the receiver is set to - frames sent on any other channel or at any other
+     * spreading factor are not heard
+     */
+    virtual const RadioParams &radioParams() const = 0;
+
+    /**
+     * @brief A frame arrived intact - called at the moment its last symbol ends
+     */
+    virtual void receive(const uint8_t *frame, uint8_t len, int16_t rssi, int8_t snr) = 0;
+
+    int16_t linkRssi = -90;                     // Link budget to the rest of the park - applied to everything this radio sends
+    int8_t linkSnr = 8;
+    uint64_t lastTxStartMs = UINT64_MAX;        // UINT64_MAX - has never transmitted
+    uint64_t lastTxEndMs = 0;
+};
+
+struct ChannelStats {
+    uint32_t frames = 0;                        // Transmissions started
+    uint32_t collided = 0;                      // Transmissions that overlapped another on the same channel and spreading factor - lost at every receiver
+    uint32_t delivered = 0;                     // Receptions - one per listening radio per intact frame
+    uint32_t lost = 0;                          // Receptions dropped by the random loss
+    uint32_t missed = 0;                        // Receptions a radio missed because it was not listening, or not on the frame's channel and spreading factor
+    uint64_t busyMs = 0;                        // Time with at least one transmission on the air
+    uint64_t airtimeMs = 0;                     // Sum of every transmission - more than busyMs when frames overlap
+};
+
+class Channel {
+public:
+    static Channel &instance();
+
+    void attach(Radio *radio);
+
+    /**
+     * @brief Puts a frame on the air starting now
+     *
+     * @return uint64_t - the time in milliseconds when the last symbol has been sent
+     */
+    uint64_t transmit(Radio *sender, const uint8_t *frame, uint8_t len, const RadioParams &params);
+
+    /**
+     * @brief True while any transmission is on the air - what channel activity detection would report.  Only the
+     * preamble on the receiver's channel at its spreading factor is detected on a real radio; this is the worst case
+     */
+    bool busy() const;
+
+    void setLossProbability(double probability) { lossProbability = probability; }
+
+    /**
+     * @brief Scales every frame's airtime - 0 puts frames on the air for no time at all, which the benchmarks use
+     * so that only the firmware's own work is measured
+     */
+    void setAirtimeScale(double scale) { airtimeScale = scale; }
+
+    ChannelStats stats;
+
+private:
+    struct Transmission {
+        Radio *sender;
+        std::vector<uint8_t> frame;
+        uint64_t startMs;
+        uint64_t endMs;
+        float frequencyMHz;
+        uint8_t spreadingFactor;
+        bool collided;
+        std::vector<Radio *> listeners;         // Radios that were listening when the preamble started
+    };
+
+    void finish(std::shared_ptr<Transmission> tx);
+    static bool tunedTo(const Radio *radio, const Transmission &tx) {
+        return radio->radioParams().frequencyMHz == tx.frequencyMHz && radio->radioParams().spreadingFactor == tx.spreadingFactor;
+    }
+
+    std::vector<Radio *> radios;
+    std::vector<std::shared_ptr<Transmission>> onAir;
+    uint64_t busyUntilMs = 0;
+    double lossProbability = 0.0;
+    double airtimeScale = 1.0;
+};
+
+}
+
+#endif  /* __SIM_CHANNEL_H */
@@ -0,0 +1,65 @@
+#include "SimClock.h"
+#include <map>
+#include <random>
+
+namespace sim {
+
+static uint64_t currentMs = 0;
+static time_t startEpoch = 0;
+static std::multimap<uint64_t, std::function<void()>> events;	// Ordered by due time - equal times run in the order scheduled
+static std::mt19937 generator(1);
+static bool logging = false;
+
+uint64_t nowMs() {
+    return currentMs;
+}
+
+time_t epoch() {
+    return startEpoch + (time_t)(currentMs / 1000);
+}
+
+void setStartEpoch(time_t start) {
+    startEpoch = start;
+}
+
+void advance(uint64_t ms) {
+    uint64_t target = currentMs + ms;
+    while (!events.empty() && events.begin()->first <= target) {
+        auto next = events.begin();
+        if (next->first > currentMs) currentMs = next->first;
+        std::function<void()> fn = std::move(next->second);
+        events.erase(next);
+        fn();                                                       // May schedule more events - the loop picks them up
+    }
+    currentMs = target;
+}
+
+void at(uint64_t whenMs, std::function<void()> fn) {
+    events.emplace(whenMs, std::move(fn));
+}
+
+void seed(uint32_t value) {
+    generator.seed(value);
+}
+
+uint32_t randomU32() {
+    return generator();
+}
+
+double randomUnit() {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+}
+
+void setVerbose(bool verbose) {
+    logging = verbose;
+}
+
+bool verbose() {
+    return logging;
+}
+
+void halt(const char *reason) {
+    throw Halt{reason};
+}
+
+}
@@ -0,0 +1,75 @@
+/**
+ * @file SimClock.h
+ * @brief Virtual time for the host simulation - every stand-in in sim/hal reads the clock from here
+ *
+ * @details Time only moves when something asks it to: delay(), Particle.process(), System.sleep() and the radio
+ * driver's polling all call advance().  While the clock moves, scheduled events (nodes waking, frames ending on
+ * the channel) run in time order, so the gateway firmware and the simulated nodes interleave the way they would
+ * in the field without any threads.
+ */
+
+#ifndef __SIM_CLOCK_H
+#define __SIM_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <functional>
+
+namespace sim {
+
+/**
+ * @brief Milliseconds since the simulation started
+ */
+uint64_t nowMs();
+
+/**
+ * @brief Wall clock time for Time.now() - the start epoch plus the virtual milliseconds
+ */
+time_t epoch();
+
+/**
+ * @brief Sets the wall clock time the simulation starts at - call before setup()
+ */
+void setStartEpoch(time_t start);
+
+/**
+ * @brief Moves the clock forward, running every event that falls due on the way
+ */
+void advance(uint64_t ms);
+
+/**
+ * @brief Runs fn at an absolute time in milliseconds - events in the past run on the next advance()
+ */
+void at(uint64_t whenMs, std::function<void()> fn);
+
+/**
+ * @brief Runs fn delayMs from now
+ */
+inline void after(uint64_t delayMs, std::function<void()> fn) { at(nowMs() + delayMs, fn); }
+
+/**
+ * @brief Seeded random numbers so a run can be repeated exactly
+ */
+void seed(uint32_t value);
+uint32_t randomU32();
+double randomUnit();                            // [0, 1)
+inline uint32_t randomRange(uint32_t low, uint32_t high) { return (high > low) ? low + randomU32() % (high - low) : low; }
+
+/**
+ * @brief Logging switch for the firmware's Log calls - off unless the run asks for it
+ */
+void setVerbose(bool verbose);
+bool verbose();
+
+/**
+ * @brief Thrown when the firmware resets or powers itself down - sim_main catches it, reports and exits
+ */
+struct Halt {
+    const char *reason;
+};
+
+[[noreturn]] void halt(const char *reason);
+
+}
+
+#endif  /* __SIM_CLOCK_H */
@@ -0,0 +1,17 @@
+#include "SimCloud.h"
+#include "SimClock.h"
+
+namespace sim {
+
+Cloud &cloud() {
+    static Cloud instance;
+    return instance;
+}
+
+void Cloud::record(const char *name, const char *data, bool queued) {
+    publishes.push_back(Publish{nowMs(), name, data, queued});
+    countByName[name]++;
+    bytes += publishes.back().data.size();
+}
+
+}
@@ -0,0 +1,45 @@
+/**
+ * @file SimCloud.h
+ * @brief What the gateway would have sent to the Particle cloud during a simulation run
+ *
+ * @details Particle.publish() and PublishQueuePosix::publish() land here instead of on a cellular modem, so the
+ * run summary can count webhooks per node and check the data that would have reached Ubidots.
+ */
+
+#ifndef __SIM_CLOUD_H
+#define __SIM_CLOUD_H
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <vector>
+
+namespace sim {
+
+struct Publish {
+    uint64_t atMs;
+    std::string name;
+    std::string data;
+    bool queued;                                // Went through PublishQueuePosix rather than straight to Particle.publish()
+};
+
+struct Cloud {
+    std::string gatewayDeviceID = "e00fce68ffffffffffffffff";
+    uint64_t connectDelayMs = 30000;            // Cellular connection time once Particle.connect() is called
+    uint64_t connectedAtMs = 0;                 // 0 - not connected or connecting
+    uint32_t connections = 0;
+    uint64_t connectedMs = 0;                   // Time spent connected, for the power budget
+    uint64_t sleepMs = 0;                       // Time spent in System.sleep()
+
+    std::vector<Publish> publishes;
+    std::map<std::string, uint32_t> countByName;
+    uint64_t bytes = 0;
+
+    void record(const char *name, const char *data, bool queued);
+};
+
+Cloud &cloud();
+
+}
+
+#endif  /* __SIM_CLOUD_H */
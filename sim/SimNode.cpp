@@ -0,0 +1,288 @@
+#include "SimNode.h"
+#include "SimClock.h"
+#include "LoRA_Codec.h"
+#include "ChannelPlan.h"
+#include "RH_RF95.h"
+#include <algorithm>
+#include <string.h>
+
+namespace sim {
+
+// Over the air values from LoRA_Functions.cpp and RadioHead - the node firmware uses the same ones
+enum { JOIN_REQ = 1, JOIN_ACK = 2, DATA_RPT = 3, DATA_ACK = 4, COMPACT_RPT = 8 };
+enum { MESH_APPLICATION = 0, MESH_ROUTE_DISCOVERY_REQUEST = 1, MESH_ROUTE_DISCOVERY_RESPONSE = 2 };
+const uint8_t FLAGS_ACK = 0x80;
+const uint8_t FLAGS_RETRY = 0x40;
+const uint8_t BROADCAST = 0xFF;
+const uint8_t HEADER_LEN = 4 + 5 + 1;               // RH header, router header, mesh message type
+
+SimNode::SimNode(uint8_t index, const std::string &deviceID, const NodeConfig &config) : index(index), id(deviceID), config(config) {
+    checksum = 0;
+    for (char c : id) {                                             // Same checksum as LoRA_Functions::stringCheckSum()
+        if (c >= '0' && c <= '9') checksum += c - '0';
+        else if (c >= 'a' && c <= 'f') checksum += 10 + c - 'a';
+        else if (c >= 'A' && c <= 'F') checksum += 10 + c - 'A';
+    }
+    clockErrorMs = (int64_t)randomRange(0, 2 * config.maxClockErrorMs + 1) - config.maxClockErrorMs;
+    linkRssi = -(int16_t)randomRange(70, 121);
+    linkSnr = (int8_t)((linkRssi + 125) / 4 - 5);
+    fullPowerRssi = linkRssi;
+    fullPowerSnr = linkSnr;
+    defaultRadio = config.radio;
+    Channel::instance().attach(this);
+}
+
+void SimNode::start(uint8_t nodeNumber, uint16_t slotOffsetSeconds) {
+    myAddress = (nodeNumber) ? nodeNumber : UNCONFIGURED;
+    slotOffset = slotOffsetSeconds;
+    scheduleNextReport();
+}
+
+bool SimNode::listening() const {
+    return phase != Phase::ASLEEP && !transmitting;
+}
+
+void SimNode::scheduleNextReport() {
+    uint64_t periodMs = (uint64_t)config.frequencyMinutes * 60000;
+    int64_t localNow = (int64_t)epoch() * 1000 + (int64_t)(nowMs() % 1000) + clockErrorMs;
+    int64_t boundary = (localNow / (int64_t)periodMs + 1) * (int64_t)periodMs;
+    int64_t wakeLocal = boundary + slotOffset * 1000 + randomRange(0, config.maxWakeJitterMs);
+    int64_t wakeIn = wakeLocal - localNow;
+    after((uint64_t)wakeIn, [this]() { wake(); });
+}
+
+void SimNode::wake() {
+    uint8_t payload[64];
+    uint8_t len;
+    uint8_t routedFlags;
+
+    phase = Phase::SENDING;
+    exchangeStartMs = nowMs();
+    applyDataRate();
+    if (joined()) {
+        uint32_t field[RPT_FIELD_COUNT];
+        hourly = randomRange(0, 60);
+        daily += hourly;
+        messageCount++;
+        field[RPT_MAGIC] = config.magicNumber;
+        field[RPT_NODE_ID] = checksum;
+        field[RPT_HOURLY] = hourly;
+        field[RPT_DAILY] = daily;
+        field[RPT_SENSOR_TYPE] = 1;
+        field[RPT_TEMP] = 25;
+        field[RPT_BATT_CHG] = 85;
+        field[RPT_BATT_STATE] = 2;
+        field[RPT_RESETS] = 0;
+        field[RPT_MESSAGE_COUNT] = messageCount;
+        field[RPT_SUCCESS_COUNT] = successCount;
+        field[RPT_RSSI] = (uint16_t)reportedRssi;
+        field[RPT_SNR] = (uint16_t)reportedSnr;
+        const PayloadSchema &schema = (config.compactReports) ? COMPACT_DATA_REPORT_SCHEMA : DATA_REPORT_SCHEMA;
+        len = schema.encode(field, payload, sizeof(payload));
+        routedFlags = (config.compactReports) ? COMPACT_RPT : DATA_RPT;
+        counters.reports++;
+    }
+    else {                                                          // Join request - magic, nodeID, deviceID and sensor type
+        payload[0] = config.magicNumber >> 8;
+        payload[1] = config.magicNumber & 0xFF;
+        payload[2] = checksum >> 8;
+        payload[3] = checksum & 0xFF;
+        memset(payload + 4, 0, 25);
+        memcpy(payload + 4, id.c_str(), std::min<size_t>(id.size(), 24));
+        payload[29] = 1;
+        len = 30;
+        routedFlags = JOIN_REQ;
+        counters.joins++;
+    }
+
+    bool report = joined();
+    sendReliable(buildFrame(GATEWAY, GATEWAY, routedFlags, MESH_APPLICATION, payload, len), [this, report](bool delivered) {
+        if (!delivered) {
+            finishExchange(false);
+            return;
+        }
+        if (report) counters.hopAcked++;
+        phase = Phase::WAIT_APP_ACK;
+        uint32_t thisExchange = exchange;
+        after(config.appAckTimeoutMs, [this, thisExchange]() {
+            if (thisExchange == exchange) finishExchange(false);
+        });
+    });
+}
+
+std::vector<uint8_t> SimNode::buildFrame(uint8_t to, uint8_t routedDest, uint8_t routedFlags, uint8_t msgType, const uint8_t *data, uint8_t len) {
+    const uint8_t header[HEADER_LEN] = {to, myAddress, 0, 0,                            // RH header - id and flags set per transmission
+                                        routedDest, myAddress, 0, routedSequence++, routedFlags,	// RHRouter header - dest, source, hops, id, flags
+                                        msgType};                                       // RHMesh header
+    size_t payload = std::min<size_t>(len, RH_RF95_MAX_PAYLOAD_LEN - HEADER_LEN);      // What fits in the FIFO after the headers
+    std::vector<uint8_t> frame(HEADER_LEN + payload);
+    memcpy(frame.data(), header, HEADER_LEN);
+    memcpy(frame.data() + HEADER_LEN, data, payload);
+    return frame;
+}
+
+void SimNode::sendReliable(std::vector<uint8_t> frame, std::function<void(bool)> done) {
+    pending = std::move(frame);
+    pendingDone = std::move(done);
+    attempt = 0;
+    hopSequence++;
+    transmitPending();
+}
+
+void SimNode::airSend(std::vector<uint8_t> frame, std::function<void()> sent) {
+    airQueue.emplace_back(std::move(frame), std::move(sent));
+    if (!transmitting) airNext();
+}
+
+void SimNode::airNext() {
+    if (airQueue.empty()) return;
+    transmitting = true;                                            // Half duplex - deaf from the switch to transmit
+    after(config.turnaroundMs, [this]() {
+        uint64_t endMs = Channel::instance().transmit(this, airQueue.front().first.data(), (uint8_t)airQueue.front().first.size(), config.radio);
+        at(endMs, [this]() {
+            std::function<void()> sent = std::move(airQueue.front().second);
+            airQueue.pop_front();
+            transmitting = false;
+            if (sent) sent();
+            if (!transmitting) airNext();
+        });
+    });
+}
+
+void SimNode::transmitPending() {
+    pending[2] = hopSequence;
+    pending[3] = (attempt) ? FLAGS_RETRY : 0;
+    if (pending[8] == DATA_RPT || pending[8] == COMPACT_RPT) counters.transmissions++;
+    if (phase == Phase::SENDING) phase = Phase::WAIT_HOP_ACK;
+    uint32_t thisGeneration = ++generation;
+    airSend(pending, [this, thisGeneration]() {                     // Timeout starts once the frame is out - as in RHReliableDatagram
+        uint32_t timeout = config.timeoutMs + config.timeoutMs * randomRange(0, 256) / 256;
+        after(timeout, [this, thisGeneration]() { hopTimeout(thisGeneration); });
+    });
+}
+
+void SimNode::hopTimeout(uint32_t thisGeneration) {
+    if (thisGeneration != generation || pending.empty()) return;
+    if (++attempt <= config.retries) {
+        transmitPending();
+        return;
+    }
+    pending.clear();
+    std::function<void(bool)> done = std::move(pendingDone);
+    done(false);
+}
+
+void SimNode::sendHopAck(uint8_t to, uint8_t id) {
+    airSend({to, myAddress, id, FLAGS_ACK, '!'}, nullptr);
+}
+
+void SimNode::receive(const uint8_t *frame, uint8_t len, int16_t rssi, int8_t snr) {
+    if (len < 4 || (frame[0] != myAddress && frame[0] != BROADCAST)) return;
+    uint8_t from = frame[1];
+    uint8_t hopId = frame[2];
+    uint8_t flags = frame[3];
+    lastRssi = rssi;
+    lastSnr = snr;
+
+    if (flags & FLAGS_ACK) {
+        if (!pending.empty() && frame[0] == myAddress && from == GATEWAY && hopId == hopSequence) {
+            generation++;                                           // Cancels the retry timeout
+            pending.clear();
+            std::function<void(bool)> done = std::move(pendingDone);
+            done(true);
+        }
+        return;
+    }
+
+    bool duplicate = (hopId == seenIds[from]);
+    if (!pending.empty()) {                                         // Inside sendtoWait() - only re-acknowledges what it has seen
+        if (frame[0] == myAddress && duplicate) sendHopAck(from, hopId);
+        return;
+    }
+    if (frame[0] == myAddress) sendHopAck(from, hopId);
+    if ((flags & FLAGS_RETRY) && duplicate) {
+        counters.duplicates++;
+        return;
+    }
+    seenIds[from] = hopId;
+    if (len < HEADER_LEN) return;
+
+    uint8_t routedDest = frame[4];
+    uint8_t routedSource = frame[5];
+    uint8_t routedFlags = frame[8];
+    uint8_t msgType = frame[9];
+
+    if (msgType == MESH_ROUTE_DISCOVERY_REQUEST && routedDest == BROADCAST && len >= HEADER_LEN + 2) {
+        if (frame[HEADER_LEN] == 1 && frame[HEADER_LEN + 1] == myAddress) {	// Looking for us - answer along the way it came
+            counters.discoveryAnswered++;
+            sendReliable(buildFrame(from, routedSource, 0, MESH_ROUTE_DISCOVERY_RESPONSE, frame + HEADER_LEN, len - HEADER_LEN), [](bool) {});
+        }
+    }
+    else if (msgType == MESH_APPLICATION && routedDest == myAddress) {
+        handleApplication(routedFlags & 0x0F, frame + HEADER_LEN, len - HEADER_LEN);
+    }
+}
+
+void SimNode::handleApplication(uint8_t routedFlags, const uint8_t *payload, uint8_t len) {
+    if (phase != Phase::WAIT_APP_ACK) return;
+
+    if (routedFlags == DATA_ACK && joined()) {
+        uint32_t field[ACK_FIELD_COUNT];
+        const PayloadSchema &schema = (config.compactReports) ? COMPACT_DATA_ACK_SCHEMA : DATA_ACK_SCHEMA;
+        if (!schema.decode(payload, len, field) || field[ACK_MAGIC] != config.magicNumber) return;
+        counters.appAcked++;
+        counters.ackLatencyMs.push_back((uint32_t)(nowMs() - exchangeStartMs));
+        successCount++;
+        reportedRssi = lastRssi;
+        reportedSnr = lastSnr;
+        if (field[ACK_FREQUENCY]) config.frequencyMinutes = field[ACK_FREQUENCY];
+        slotOffset = field[ACK_SLOT_OFFSET];
+        assignedSpreadingFactor = field[ACK_SPREADING_FACTOR];      // Taken up at the next wake - our hop ack for this still goes at the current rate
+        assignedTxPower = field[ACK_TX_POWER];
+        assignedChannel = field[ACK_CHANNEL];
+        clockErrorMs = (int64_t)field[ACK_TIME] * 1000 - ((int64_t)epoch() * 1000 + (int64_t)(nowMs() % 1000));	// Clock set to the whole second
+        if (field[ACK_ALERT] == 1) myAddress = UNCONFIGURED;        // The gateway no longer knows us - join again
+        finishExchange(true);
+    }
+    else if (routedFlags == JOIN_ACK && !joined()) {
+        uint32_t field[JACK_FIELD_COUNT];
+        if (!JOIN_ACK_SCHEMA.decode(payload, len, field) || field[JACK_MAGIC] != config.magicNumber) return;
+        if (field[JACK_ALERT] != 0 || field[JACK_NODE_NUMBER] == 0 || field[JACK_NODE_NUMBER] >= UNCONFIGURED) return;
+        counters.joinAcked++;
+        myAddress = field[JACK_NODE_NUMBER];
+        if (field[JACK_FREQUENCY]) config.frequencyMinutes = field[JACK_FREQUENCY];
+        slotOffset = field[JACK_SLOT_OFFSET];
+        assignedChannel = field[JACK_CHANNEL];                      // Taken up at the next wake, like a data acknowledgement's
+        clockErrorMs = (int64_t)field[JACK_TIME] * 1000 - ((int64_t)epoch() * 1000 + (int64_t)(nowMs() % 1000));
+        finishExchange(true);
+    }
+}
+
+void SimNode::finishExchange(bool success) {
+    if (!success && (assignedSpreadingFactor || assignedTxPower || assignedChannel)) {	// The gateway gives up on our rate and channel when it misses us too
+        counters.fallbacks++;
+        assignedSpreadingFactor = 0;
+        assignedTxPower = 0;
+        assignedChannel = 0;
+    }
+    exchange++;
+    pending.clear();
+    generation++;
+    phase = Phase::ASLEEP;                                          // Any hop ack still on the air finishes - then the radio sleeps
+    scheduleNextReport();
+}
+
+void SimNode::applyDataRate() {
+    config.radio = defaultRadio;
+    config.radio.frequencyMHz = channelFrequency((joined()) ? assignedChannel : 0);
+    if (joined() && assignedSpreadingFactor) {
+        config.radio.spreadingFactor = assignedSpreadingFactor;
+        config.radio.lowDatarateOptimize = (1000.0 * (1UL << assignedSpreadingFactor) / config.radio.bandwidthHz > 16.0);	// Same threshold as RH_RF95::setLowDatarate()
+    }
+    int8_t powerDrop = (joined() && assignedTxPower) ? 23 - assignedTxPower : 0;
+    linkRssi = fullPowerRssi - powerDrop;
+    linkSnr = fullPowerSnr - powerDrop;
+    if (config.radio.spreadingFactor < defaultRadio.spreadingFactor && joined()) counters.fastReports++;
+}
+
+}
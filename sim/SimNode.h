@@ -0,0 +1,133 @@
+/**
+ * @file SimNode.h
+ * @brief A LoRA node as the gateway sees it on the air - wakes in its slot, reports, waits for the acknowledgement
+ *
+ * @details The node firmware is not in this repository, so a node is modelled at the frame level instead of by
+ * running RHMesh: it builds the same RH / router / mesh headers the node's RHMesh would, retries with
+ * RHReliableDatagram's timeout and RETRY flag, acknowledges and de-duplicates unicast frames, and answers the
+ * gateway's route discovery for its own address.  Nodes are leaf nodes - they never forward for each other.
+ * Payloads are built and read with the schemas in LoRA_Codec.h so a change to a frame layout shows up here too.
+ */
+
+#ifndef __SIM_NODE_H
+#define __SIM_NODE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include "SimChannel.h"
+
+namespace sim {
+
+struct NodeConfig {
+    uint16_t magicNumber = 0;
+    uint16_t frequencyMinutes = 60;
+    uint16_t timeoutMs = 2000;                  // RHReliableDatagram timeout - the node uses the gateway's setting
+    uint8_t retries = 3;
+    uint32_t appAckTimeoutMs = 15000;           // How long a node waits for the data or join acknowledgement
+    uint32_t maxClockErrorMs = 2000;            // Each node's clock is off by up to this much either way
+    uint32_t maxWakeJitterMs = 1000;            // Wake up and sensor time before the report goes out
+    uint32_t turnaroundMs = 10;                 // From the end of a received frame to our answer going on the air
+    bool compactReports = false;
+    RadioParams radio;
+};
+
+struct NodeStats {
+    uint32_t reports = 0;                       // Report exchanges started
+    uint32_t transmissions = 0;                 // Report frames sent - first tries and retries
+    uint32_t hopAcked = 0;                      // Reports the gateway's radio acknowledged
+    uint32_t appAcked = 0;                      // Reports answered with a data acknowledgement
+    uint32_t joins = 0;
+    uint32_t joinAcked = 0;
+    uint32_t discoveryAnswered = 0;
+    uint32_t duplicates = 0;                    // Unicast frames received again because our hop ack was lost
+    uint32_t fastReports = 0;                   // Report exchanges started faster than the default data rate
+    uint32_t fallbacks = 0;                     // Exchanges at an assigned data rate or channel that failed - the next is at the defaults
+    std::vector<uint32_t> ackLatencyMs;         // First transmission to data acknowledgement
+};
+
+class SimNode : public Radio {
+public:
+    SimNode(uint8_t index, const std::string &deviceID, const NodeConfig &config);
+
+    /**
+     * @brief Starts the node - joined nodes report in their slot, others send a join request first
+     *
+     * @param nodeNumber - 0 for a node that has not joined yet
+     * @param slotOffsetSeconds - where in the period the node reports, as the gateway last told it
+     */
+    void start(uint8_t nodeNumber, uint16_t slotOffsetSeconds);
+
+    virtual bool listening() const;
+    virtual const RadioParams &radioParams() const { return config.radio; }
+    virtual void receive(const uint8_t *frame, uint8_t len, int16_t rssi, int8_t snr);
+
+    const std::string &deviceID() const { return id; }
+    uint16_t radioID() const { return checksum; }
+    uint8_t address() const { return myAddress; }
+    bool joined() const { return myAddress != UNCONFIGURED; }
+    const NodeStats &stats() const { return counters; }
+
+    static const uint8_t UNCONFIGURED = 254;
+    static const uint8_t GATEWAY = 0;
+
+private:
+    enum class Phase { ASLEEP, SENDING, WAIT_HOP_ACK, WAIT_APP_ACK };
+
+    void wake();
+    void scheduleNextReport();
+    void sendReliable(std::vector<uint8_t> frame, std::function<void(bool)> done);
+    void airSend(std::vector<uint8_t> frame, std::function<void()> sent);
+    void airNext();
+    void transmitPending();
+    void hopTimeout(uint32_t generation);
+    void sendHopAck(uint8_t to, uint8_t id);
+    void handleApplication(uint8_t routedFlags, const uint8_t *payload, uint8_t len);
+    void finishExchange(bool success);
+    void applyDataRate();
+    std::vector<uint8_t> buildFrame(uint8_t to, uint8_t routedDest, uint8_t routedFlags, uint8_t msgType, const uint8_t *data, uint8_t len);
+
+    uint8_t index;
+    std::string id;
+    uint16_t checksum;
+    NodeConfig config;
+    NodeStats counters;
+
+    uint8_t myAddress = UNCONFIGURED;
+    uint16_t slotOffset = 0;
+    int64_t clockErrorMs;
+    RadioParams defaultRadio;                   // What the node joins at and falls back to
+    int16_t fullPowerRssi;                      // Link budget at 23dBm - linkRssi and linkSnr drop as the power comes down
+    int8_t fullPowerSnr;
+    uint8_t assignedSpreadingFactor = 0;        // From the last data acknowledgement - 0 for the default
+    uint8_t assignedTxPower = 0;
+    uint8_t assignedChannel = 0;                // From the last join or data acknowledgement
+
+    Phase phase = Phase::ASLEEP;
+    bool transmitting = false;
+    std::deque<std::pair<std::vector<uint8_t>, std::function<void()>>> airQueue;	// Frames waiting for the radio
+    uint64_t exchangeStartMs = 0;
+    uint32_t exchange = 0;                      // Bumped when an exchange ends - cancels its acknowledgement timeout
+    int16_t lastRssi = 0;
+    int8_t lastSnr = 0;
+
+    std::vector<uint8_t> pending;               // Frame waiting for its hop ack
+    std::function<void(bool)> pendingDone;
+    uint8_t attempt = 0;
+    uint32_t generation = 0;                    // Bumped to cancel a timeout that is no longer wanted
+    uint8_t hopSequence = 0;
+    uint8_t routedSequence = 0;
+    uint8_t messageCount = 0;
+    uint8_t successCount = 0;
+    uint16_t hourly = 0;
+    uint16_t daily = 0;
+    int16_t reportedRssi = 0;
+    int8_t reportedSnr = 0;
+    uint8_t seenIds[256] = {};
+};
+
+}
+
+#endif  /* __SIM_NODE_H */
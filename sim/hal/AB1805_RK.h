@@ -0,0 +1,28 @@
+/**
+ * @file AB1805_RK.h
+ * @brief Host stand-in for the AB1805 RTC / watchdog - the virtual clock never drifts and nothing watches the loop
+ */
+
+#ifndef __AB1805_RK_H
+#define __AB1805_RK_H
+
+#include "Particle.h"
+#include "SimClock.h"
+
+class AB1805 {
+public:
+    AB1805(TwoWire &wire = Wire, uint8_t i2cAddr = 0x69) {}
+
+    void setup(bool callBegin = true) {}
+    void loop() {}
+    AB1805 &withFOUT(pin_t pin) { return *this; }
+    bool isRTCSet() { return true; }
+    bool setWDT(int seconds = -1) { return true; }
+    bool stopWDT() { return setWDT(0); }
+    bool resumeWDT() { return setWDT(-1); }
+    bool deepPowerDown(int seconds = 30) { sim::halt("AB1805 deep power down"); }
+
+    static const int WATCHDOG_MAX_SECONDS = 124;
+};
+
+#endif  /* __AB1805_RK_H */
@@ -0,0 +1,7 @@
+// Host stand-in - everything the libraries want from Arduino.h is in the simulated Particle.h
+#ifndef __SIM_ARDUINO_H
+#define __SIM_ARDUINO_H
+
+#include "Particle.h"
+
+#endif  /* __SIM_ARDUINO_H */
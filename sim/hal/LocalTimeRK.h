@@ -0,0 +1,76 @@
+/**
+ * @file LocalTimeRK.h
+ * @brief Host stand-in for LocalTimeRK - a fixed UTC offset instead of the POSIX timezone rules
+ *
+ * @details The simulation runs for hours or days, so daylight saving changes are not modelled.  The offset
+ * defaults to US Eastern daylight time; sim_main can change it.
+ */
+
+#ifndef __LOCALTIMERK_H
+#define __LOCALTIMERK_H
+
+#include "Particle.h"
+
+class LocalTimePosixTimezone {
+public:
+    LocalTimePosixTimezone(const char *tzStr = "") {}
+};
+
+class LocalTimeHMS {
+public:
+    int8_t hour = 0;
+    int8_t minute = 0;
+    int8_t second = 0;
+};
+
+class LocalTimeYMD {
+public:
+    int getYear() const { return year; }
+    int getMonth() const { return month; }
+    int getDay() const { return day; }
+
+    int year = 0;
+    int month = 0;
+    int day = 0;
+};
+
+class LocalTime {
+public:
+    static LocalTime &instance() {
+        static LocalTime localTime;
+        return localTime;
+    }
+    LocalTime &withConfig(LocalTimePosixTimezone config) { return *this; }
+
+    int offsetSeconds = -4 * 3600;               // EDT
+};
+
+class LocalTimeConvert {
+public:
+    LocalTimeConvert &withCurrentTime() { time = Time.now(); return *this; }
+    LocalTimeConvert &withTime(time_t value) { time = value; return *this; }
+    void convert() { localTime = time + LocalTime::instance().offsetSeconds; }
+
+    LocalTimeHMS getLocalTimeHMS() const {
+        LocalTimeHMS hms;
+        hms.hour = Time.hour(localTime);
+        hms.minute = Time.minute(localTime);
+        hms.second = Time.second(localTime);
+        return hms;
+    }
+
+    LocalTimeYMD getLocalTimeYMD() const {
+        LocalTimeYMD ymd;
+        ymd.year = Time.year(localTime);
+        ymd.month = Time.month(localTime);
+        ymd.day = Time.day(localTime);
+        return ymd;
+    }
+
+    String format(const char *fmt) { return Time.format(localTime, fmt); }
+
+    time_t time = 0;
+    time_t localTime = 0;
+};
+
+#endif  /* __LOCALTIMERK_H */
@@ -0,0 +1,50 @@
+#include "MB85RC256V-FRAM-RK.h"
+
+const char *MB85RC::backingFile = nullptr;
+
+void MB85RC::begin() {
+	if (loaded) return;
+	loaded = true;
+	if (!backingFile) return;
+	FILE *fp = fopen(backingFile, "rb");
+	if (!fp) return;											// First run - starts erased and the file appears on the first write
+	size_t count = fread(memory.data(), 1, memorySize, fp);
+	fclose(fp);
+	if (count < memorySize) memset(memory.data() + count, 0, memorySize - count);
+}
+
+bool MB85RC::erase() {
+	memset(memory.data(), 0, memorySize);
+	save();
+	return true;
+}
+
+bool MB85RC::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
+	if (framAddr + dataLen > memorySize) return false;
+	memcpy(data, memory.data() + framAddr, dataLen);
+	return true;
+}
+
+bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
+	if (framAddr + dataLen > memorySize) return false;
+	memcpy(memory.data() + framAddr, data, dataLen);
+	writes++;
+	bytesWritten += dataLen;
+	save();
+	return true;
+}
+
+bool MB85RC::moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes) {
+	if (framAddrFrom + numBytes > memorySize || framAddrTo + numBytes > memorySize) return false;
+	memmove(memory.data() + framAddrTo, memory.data() + framAddrFrom, numBytes);
+	save();
+	return true;
+}
+
+void MB85RC::save() {
+	if (!backingFile) return;
+	FILE *fp = fopen(backingFile, "wb");
+	if (!fp) return;
+	fwrite(memory.data(), 1, memorySize, fp);
+	fclose(fp);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file MB85RC256V-FRAM-RK.h
+ * @brief Host stand-in for the MB85RC FRAM - the memory is a RAM buffer written through to a file
+ *
+ * @details The file carries the gateway's persistent data from one simulation run to the next the way the FRAM
+ * carries it across a reset.  With no file set the FRAM starts erased every run.
+ */
+
+#ifndef __MB85RC256V_FRAM_RK
+#define __MB85RC256V_FRAM_RK
+
+#include "Particle.h"
+#include <vector>
+
+class MB85RC {
+public:
+	MB85RC(TwoWire &wire, size_t memorySize, int addr = 0) : memorySize(memorySize), memory(memorySize, 0) {}
+	virtual ~MB85RC() {}
+
+	void begin();
+	inline size_t length() { return memorySize; }
+	bool erase();
+
+    template <typename T> T &get(size_t framAddr, T &t) {
+        readData(framAddr, (uint8_t *)&t, sizeof(T));
+        return t;
+    }
+
+    template <typename T> const T &put(size_t framAddr, const T &t) {
+        writeData(framAddr, (const uint8_t *)&t, sizeof(T));
+        return t;
+    }
+
+	virtual bool readData(size_t framAddr, uint8_t *data, size_t dataLen);
+	virtual bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen);
+	virtual bool moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes);
+
+	/**
+	 * @brief File that backs every FRAM in the simulation - set before setup(), nullptr for none
+	 */
+	static const char *backingFile;
+
+	uint32_t writes = 0;						// Write transactions and bytes - the FRAM write budget in the run summary
+	uint64_t bytesWritten = 0;
+
+protected:
+	void save();
+
+	size_t memorySize;
+	std::vector<uint8_t> memory;
+	bool loaded = false;
+};
+
+class MB85RC64 : public MB85RC {
+public:
+	MB85RC64(TwoWire &wire, int addr = 0) : MB85RC(wire, 8192, addr) {};
+};
+
+class MB85RC256V : public MB85RC {
+public:
+	MB85RC256V(TwoWire &wire, int addr = 0) : MB85RC(wire, 32768, addr) {};
+};
+
+#endif /* __MB85RC256V_FRAM_RK */
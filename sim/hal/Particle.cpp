@@ -0,0 +1,225 @@
+#include "Particle.h"
+#include "SimClock.h"
+#include "SimCloud.h"
+#include <ctype.h>
+
+Logger Log;
+USBSerial Serial;
+TimeClass Time;
+SystemClass System;
+ParticleClass Particle;
+CellularClass Cellular;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+// ************************************************************************
+// *****                     Arduino / Wiring                         *****
+// ************************************************************************
+static int pinState[32];
+static bool pinStateSet[32];
+
+system_tick_t millis() {
+    return (system_tick_t)sim::nowMs();
+}
+
+unsigned long micros() {
+    return (unsigned long)(sim::nowMs() * 1000);
+}
+
+void delay(unsigned long ms) {
+    sim::advance(ms);
+}
+
+void delayMicroseconds(unsigned int us) {
+}
+
+void pinMode(pin_t pin, int mode) {
+    if (pin < 32 && !pinStateSet[pin]) pinState[pin] = (mode == INPUT_PULLUP) ? HIGH : LOW;
+}
+
+void digitalWrite(pin_t pin, int value) {
+    if (pin < 32) {
+        pinState[pin] = value;
+        pinStateSet[pin] = true;
+    }
+}
+
+int32_t digitalRead(pin_t pin) {
+    return (pin < 32) ? pinState[pin] : LOW;
+}
+
+int32_t analogRead(pin_t pin) {
+    return 930;                                                     // About 25C on the TMP36
+}
+
+void pinSetFast(pin_t pin) { digitalWrite(pin, HIGH); }
+void pinResetFast(pin_t pin) { digitalWrite(pin, LOW); }
+bool attachInterrupt(pin_t pin, void (*handler)(), int mode) { return true; }
+void detachInterrupt(pin_t pin) {}
+void interrupts() {}
+void noInterrupts() {}
+
+long random(long max) {
+    return (max > 0) ? (long)(sim::randomU32() % (uint32_t)max) : 0;
+}
+
+long random(long min, long max) {
+    return (max > min) ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned int seed) {
+}
+
+// ************************************************************************
+// *****                           String                             *****
+// ************************************************************************
+String::String(float value, int decimals) : String((double)value, decimals) {}
+
+String::String(double value, int decimals) {
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "%.*f", decimals, value);
+    v = tmp;
+}
+
+void String::trim() {
+    size_t start = 0, end = v.size();
+    while (start < end && isspace((unsigned char)v[start])) start++;
+    while (end > start && isspace((unsigned char)v[end - 1])) end--;
+    v = v.substr(start, end - start);
+}
+
+String &String::toLowerCase() {
+    for (char &c : v) c = tolower((unsigned char)c);
+    return *this;
+}
+
+String String::format(const char *fmt, ...) {
+    char tmp[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    return String(tmp);
+}
+
+// ************************************************************************
+// *****                           Logging                            *****
+// ************************************************************************
+static void logLine(const char *level, const char *fmt, va_list args) {
+    if (!sim::verbose()) return;
+    char tmp[512];
+    vsnprintf(tmp, sizeof(tmp), fmt, args);
+    uint64_t ms = sim::nowMs();
+    fprintf(stderr, "%010llu [%s] %s\n", (unsigned long long)ms, level, tmp);
+}
+
+#define LOG_FORWARD(level) va_list args; va_start(args, fmt); logLine(level, fmt, args); va_end(args)
+
+void Logger::trace(const char *fmt, ...) const { }
+void Logger::info(const char *fmt, ...) const { LOG_FORWARD("INFO"); }
+void Logger::warn(const char *fmt, ...) const { LOG_FORWARD("WARN"); }
+void Logger::error(const char *fmt, ...) const { LOG_FORWARD("ERROR"); }
+void Logger::printf(const char *fmt, ...) const { LOG_FORWARD("INFO"); }
+void Logger::dump(const void *data, size_t size) const {}
+void Logger::print(const char *str) const {}
+
+size_t USBSerial::print(const char *s) { if (sim::verbose()) fputs(s, stderr); return strlen(s); }
+size_t USBSerial::print(char c) { if (sim::verbose()) fputc(c, stderr); return 1; }
+size_t USBSerial::print(long n, int base) { return print((base == HEX) ? String::format("%lx", n).c_str() : String::format("%ld", n).c_str()); }
+size_t USBSerial::println(const char *s) { return print(s) + print('\n'); }
+size_t USBSerial::println(long n, int base) { return print(n, base) + print('\n'); }
+size_t USBSerial::printlnf(const char *fmt, ...) {
+    char tmp[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    return println(tmp);
+}
+
+// ************************************************************************
+// *****                        Locks and RTOS                        *****
+// ************************************************************************
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex) { *mutex = new std::recursive_mutex(); return 0; }
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex) { delete mutex; return 0; }
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex) { mutex->lock(); return 0; }
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex) { return mutex->try_lock() ? 0 : 1; }
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex) { mutex->unlock(); return 0; }
+
+// ************************************************************************
+// *****                            Time                              *****
+// ************************************************************************
+static struct tm breakDown(time_t t) {
+    struct tm result;
+    gmtime_r(&t, &result);
+    return result;
+}
+
+time32_t TimeClass::now() { return (time32_t)sim::epoch(); }
+bool TimeClass::isValid() { return sim::epoch() > 1500000000; }
+int TimeClass::hour(time_t t) { return breakDown(t).tm_hour; }
+int TimeClass::minute(time_t t) { return breakDown(t).tm_min; }
+int TimeClass::second(time_t t) { return breakDown(t).tm_sec; }
+int TimeClass::day(time_t t) { return breakDown(t).tm_mday; }
+int TimeClass::month(time_t t) { return breakDown(t).tm_mon + 1; }
+int TimeClass::year(time_t t) { return breakDown(t).tm_year + 1900; }
+
+String TimeClass::timeStr(time_t t) {
+    return format((t) ? t : now(), "%a %b %e %H:%M:%S %Y");
+}
+
+String TimeClass::format(time_t t, const char *fmt) {
+    char tmp[64];
+    struct tm parts = breakDown(t);
+    strftime(tmp, sizeof(tmp), fmt, &parts);
+    return String(tmp);
+}
+
+// ************************************************************************
+// *****                       System and power                       *****
+// ************************************************************************
+String SystemClass::deviceID() {
+    return String(sim::cloud().gatewayDeviceID);
+}
+
+void SystemClass::reset() {
+    sim::halt("System.reset()");
+}
+
+SystemSleepResult SystemClass::sleep(const SystemSleepConfiguration &config) {
+    sim::cloud().sleepMs += config.durationMs;
+    sim::advance(config.durationMs);                                // Nodes keep to their schedule while the gateway sleeps
+    return SystemSleepResult();                                     // Woke on time - the user button is never pressed
+}
+
+// ************************************************************************
+// *****                   Cloud and cellular                         *****
+// ************************************************************************
+bool ParticleClass::connected() {
+    return sim::cloud().connectedAtMs != 0 && sim::nowMs() >= sim::cloud().connectedAtMs;
+}
+
+void ParticleClass::connect() {
+    if (sim::cloud().connectedAtMs == 0) {
+        sim::cloud().connectedAtMs = sim::nowMs() + sim::cloud().connectDelayMs;
+        sim::cloud().connections++;
+    }
+}
+
+void ParticleClass::disconnect() {
+    if (connected()) sim::cloud().connectedMs += sim::nowMs() - sim::cloud().connectedAtMs;
+    sim::cloud().connectedAtMs = 0;
+}
+
+void ParticleClass::process() {
+    sim::advance(1);
+}
+
+String ParticleClass::deviceID() {
+    return System.deviceID();
+}
+
+bool ParticleClass::publish(const char *name, const char *data, PublishFlags flags) {
+    sim::cloud().record(name, data, false);
+    return connected();
+}
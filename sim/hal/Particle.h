@@ -0,0 +1,372 @@
+/**
+ * @file Particle.h
+ * @brief Host stand-in for the parts of Device OS this firmware uses - lets the gateway build and run on Linux
+ *
+ * @details Time is virtual.  millis(), Time.now(), delay() and System.sleep() all read or move the simulation clock
+ * in SimClock.h, which also runs the simulated radio channel and nodes.  Nothing here talks to real hardware.
+ * Only what the application and its libraries call is provided - add to it as the firmware grows.
+ */
+
+#ifndef __SIM_PARTICLE_H
+#define __SIM_PARTICLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+#include <mutex>
+#include <string>
+#include <functional>
+#include <deque>                                                    // Before min/max below - sim code uses it
+
+typedef uint8_t byte;
+typedef uint16_t pin_t;
+typedef uint32_t system_tick_t;
+typedef int32_t time32_t;
+
+// ************************************************************************
+// *****                     Arduino / Wiring                         *****
+// ************************************************************************
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define CHANGE 1
+#define RISING 2
+#define FALLING 3
+#define HEX 16
+#define DEC 10
+
+enum : pin_t { D0 = 0, D1, D2, D3, D4, D5, D6, D7, D8, A0 = 19, A1 = 18, A2 = 17, A3 = 16, A4 = 15, A5 = 14 };
+#define PIN_INVALID 0xFF
+
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#endif
+#ifndef max
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+
+system_tick_t millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(pin_t pin, int mode);
+void digitalWrite(pin_t pin, int value);
+int32_t digitalRead(pin_t pin);
+int32_t analogRead(pin_t pin);
+void pinSetFast(pin_t pin);
+void pinResetFast(pin_t pin);
+bool attachInterrupt(pin_t pin, void (*handler)(), int mode);
+void detachInterrupt(pin_t pin);
+void interrupts();
+void noInterrupts();
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned int seed);
+
+// ************************************************************************
+// *****                           String                             *****
+// ************************************************************************
+class String {
+public:
+    String() {}
+    String(const char *s) { if (s) v = s; }
+    String(const std::string &s) : v(s) {}
+    explicit String(int value) : v(std::to_string(value)) {}
+    explicit String(unsigned value) : v(std::to_string(value)) {}
+    explicit String(long value) : v(std::to_string(value)) {}
+    explicit String(unsigned long value) : v(std::to_string(value)) {}
+    explicit String(float value, int decimals = 2);
+    explicit String(double value, int decimals = 2);
+    explicit String(char c) : v(1, c) {}
+
+    const char *c_str() const { return v.c_str(); }
+    operator const char *() const { return v.c_str(); }
+    unsigned length() const { return v.size(); }
+    char charAt(unsigned i) const { return (i < v.size()) ? v[i] : 0; }
+    char operator[](unsigned i) const { return charAt(i); }
+    char &operator[](unsigned i) { return v[i]; }
+
+    bool equals(const String &s) const { return v == s.v; }
+    bool equals(const char *s) const { return v == (s ? s : ""); }
+    bool operator==(const String &s) const { return equals(s); }
+    bool operator==(const char *s) const { return equals(s); }
+    bool operator!=(const String &s) const { return !equals(s); }
+    bool operator!=(const char *s) const { return !equals(s); }
+    bool operator<(const String &s) const { return v < s.v; }
+
+    String &operator+=(const String &s) { v += s.v; return *this; }
+    String &operator+=(const char *s) { if (s) v += s; return *this; }
+    String &operator+=(char c) { v += c; return *this; }
+    bool concat(const String &s) { v += s.v; return true; }
+    bool concat(const char *s) { if (s) v += s; return true; }
+    bool concat(char c) { v += c; return true; }
+    bool reserve(unsigned size) { v.reserve(size); return true; }
+
+    int indexOf(char c, unsigned from = 0) const { size_t i = v.find(c, from); return (i == std::string::npos) ? -1 : (int)i; }
+    int indexOf(const char *s, unsigned from = 0) const { size_t i = v.find(s, from); return (i == std::string::npos) ? -1 : (int)i; }
+    String substring(unsigned from) const { return (from < v.size()) ? String(v.substr(from)) : String(); }
+    String substring(unsigned from, unsigned to) const { return (from < v.size() && to > from) ? String(v.substr(from, to - from)) : String(); }
+    bool startsWith(const String &s) const { return v.compare(0, s.v.size(), s.v) == 0; }
+    void toCharArray(char *buf, unsigned size) const { if (size) { strncpy(buf, v.c_str(), size - 1); buf[size - 1] = 0; } }
+    void getBytes(unsigned char *buf, unsigned size) const { toCharArray((char *)buf, size); }
+    long toInt() const { return atol(v.c_str()); }
+    float toFloat() const { return atof(v.c_str()); }
+    void remove(unsigned index) { if (index < v.size()) v.erase(index); }
+    void remove(unsigned index, unsigned count) { if (index < v.size()) v.erase(index, count); }
+    void trim();
+    String &toLowerCase();
+
+    static String format(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+    std::string v;
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r += b; return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r += b; return r; }
+
+// ************************************************************************
+// *****                           Logging                            *****
+// ************************************************************************
+typedef enum { LOG_LEVEL_ALL = 1, LOG_LEVEL_TRACE = 1, LOG_LEVEL_INFO = 30, LOG_LEVEL_WARN = 40, LOG_LEVEL_ERROR = 50, LOG_LEVEL_NONE = 70 } LogLevel;
+
+class Logger {
+public:
+    Logger() {}
+    explicit Logger(const char *name) {}                            // Categories are not filtered
+    void trace(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void info(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void warn(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void error(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void dump(const void *data, size_t size) const;
+    void print(const char *str) const;
+    void printf(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+};
+extern Logger Log;
+
+class SerialLogHandler {
+public:
+    SerialLogHandler(LogLevel level = LOG_LEVEL_INFO) {}
+};
+
+class USBSerial {
+public:
+    void begin(long baud = 9600) {}
+    bool isConnected() { return true; }
+    size_t print(const char *s);
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(char c);
+    size_t print(long n, int base = DEC);
+    size_t println(const char *s = "");
+    size_t println(const String &s) { return println(s.c_str()); }
+    size_t println(long n, int base = DEC);
+    size_t printlnf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+extern USBSerial Serial;
+
+// ************************************************************************
+// *****                        Locks and RTOS                        *****
+// ************************************************************************
+typedef std::recursive_mutex *os_mutex_recursive_t;
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex);
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex);
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex);
+
+#define WITH_LOCK(lock) for (std::unique_lock<typename std::remove_reference<decltype(lock)>::type> __lock_guard((lock)); __lock_guard; __lock_guard.unlock())
+#define SINGLE_THREADED_BLOCK()
+#define ATOMIC_BLOCK()
+
+// ************************************************************************
+// *****                      Application macros                      *****
+// ************************************************************************
+#define SYSTEM_MODE(mode)
+#define SYSTEM_THREAD(state)
+#define STARTUP(code)
+#define PRODUCT_ID(id)
+#define PRODUCT_VERSION(version)
+#define FEATURE_RESET_INFO 1
+
+// The wait macros spin Particle.process() - which moves the simulation clock - so they end on virtual time
+#define waitFor(condition, timeout) ({ system_tick_t __start = millis(); while (!(condition)() && millis() - __start < (system_tick_t)(timeout)) Particle.process(); (condition)(); })
+#define waitForNot(condition, timeout) ({ system_tick_t __start = millis(); while ((condition)() && millis() - __start < (system_tick_t)(timeout)) Particle.process(); !(condition)(); })
+#define waitUntil(condition) ({ while (!(condition)()) Particle.process(); })
+
+// ************************************************************************
+// *****                            Time                              *****
+// ************************************************************************
+class TimeClass {
+public:
+    time32_t now();
+    time_t local() { return now(); }
+    bool isValid();
+    int hour() { return hour(now()); }
+    int hour(time_t t);
+    int minute() { return minute(now()); }
+    int minute(time_t t);
+    int second() { return second(now()); }
+    int second(time_t t);
+    int day() { return day(now()); }
+    int day(time_t t);
+    int month(time_t t);
+    int year(time_t t);
+    String timeStr(time_t t = 0);
+    String format(time_t t, const char *fmt);
+    String format(const char *fmt) { return format(now(), fmt); }
+    void zone(float offset) {}
+};
+extern TimeClass Time;
+
+// ************************************************************************
+// *****                       System and power                       *****
+// ************************************************************************
+enum class SystemSleepMode : uint8_t { NONE, STOP, ULTRA_LOW_POWER, HIBERNATE };
+
+class SystemSleepConfiguration {
+public:
+    SystemSleepConfiguration &mode(SystemSleepMode m) { sleepMode = m; return *this; }
+    SystemSleepConfiguration &gpio(pin_t pin, int mode) { wakePin = pin; return *this; }
+    SystemSleepConfiguration &duration(system_tick_t ms) { durationMs = ms; return *this; }
+    SystemSleepConfiguration &flag(int) { return *this; }
+
+    SystemSleepMode sleepMode = SystemSleepMode::NONE;
+    pin_t wakePin = PIN_INVALID;
+    system_tick_t durationMs = 0;
+};
+
+class SystemSleepResult {
+public:
+    pin_t wakeupPin() const { return pin; }
+    pin_t pin = PIN_INVALID;
+};
+
+enum class SystemPowerFeature : uint32_t { NONE = 0, PMIC_DETECTION = 1, USE_VIN_SETTINGS_WITH_USB_HOST = 2, DISABLE = 4 };
+
+class SystemPowerConfiguration {
+public:
+    SystemPowerConfiguration &powerSourceMaxCurrent(uint16_t) { return *this; }
+    SystemPowerConfiguration &powerSourceMinVoltage(uint16_t) { return *this; }
+    SystemPowerConfiguration &batteryChargeCurrent(uint16_t) { return *this; }
+    SystemPowerConfiguration &batteryChargeVoltage(uint16_t) { return *this; }
+    SystemPowerConfiguration &feature(SystemPowerFeature) { return *this; }
+};
+
+typedef uint64_t system_event_t;
+enum : system_event_t { out_of_memory = 1ULL << 18, reset_pending = 1ULL << 19 };
+
+class SystemClass {
+public:
+    String deviceID();
+    uint32_t freeMemory() { return 80000; }
+    void reset();
+    SystemSleepResult sleep(const SystemSleepConfiguration &config);
+    bool on(system_event_t events, void (*handler)(system_event_t, int)) { return true; }
+    void enableFeature(int feature) {}
+    int setPowerConfiguration(const SystemPowerConfiguration &conf) { return 0; }
+    int batteryState() { return 3; }                            // Charged
+    float batteryCharge() { return 87.5; }
+    int resetReason() { return 0; }
+};
+extern SystemClass System;
+
+class FuelGauge {
+public:
+    void quickStart() {}
+    float getSoC() { return 87.5; }
+};
+
+class PMIC {
+public:
+    PMIC(bool lock = false) {}
+    bool enableCharging() { return true; }
+    bool disableCharging() { return true; }
+};
+
+// ************************************************************************
+// *****                   Cloud and cellular                         *****
+// ************************************************************************
+typedef enum { PRIVATE = 0x01, PUBLIC = 0x00, WITH_ACK = 0x08, NO_ACK = 0x02 } PublishFlag;
+typedef int PublishFlags;
+inline PublishFlags operator|(PublishFlag a, PublishFlag b) { return (int)a | (int)b; }
+
+class ParticleClass {
+public:
+    bool connected();
+    void connect();
+    void disconnect();
+    void process();
+    bool publish(const char *name, const char *data, PublishFlags flags = PRIVATE);
+    bool publish(const char *name, PublishFlags flags = PRIVATE) { return publish(name, "", flags); }
+    String deviceID();
+    void syncTime() {}
+    bool syncTimeDone() { return true; }
+    template <class T> bool function(const char *name, int (T::*fn)(String), T *instance) { return true; }
+    bool function(const char *name, int (*fn)(String)) { return true; }
+    template <class T> bool variable(const char *name, T value) { return true; }
+    template <class T, class U> bool variable(const char *name, T value, U type) { return true; }
+};
+extern ParticleClass Particle;
+
+enum RadioAccessTechnology { NET_ACCESS_TECHNOLOGY_UNKNOWN = 0, NET_ACCESS_TECHNOLOGY_LTE_CAT_M1 = 8 };
+
+class CellularSignal {
+public:
+    RadioAccessTechnology getAccessTechnology() const { return NET_ACCESS_TECHNOLOGY_LTE_CAT_M1; }
+    float getStrength() const { return 62.5; }
+    float getQuality() const { return 48.0; }
+};
+
+class CellularClass {
+public:
+    CellularSignal RSSI() { return CellularSignal(); }
+    void on() { modemOn = true; }
+    void off() { modemOn = false; }
+    void connect() {}
+    void disconnect() {}
+    bool isOn() { return modemOn; }
+    bool isOff() { return !modemOn; }
+    bool ready() { return modemOn; }
+private:
+    bool modemOn = true;
+};
+extern CellularClass Cellular;
+
+// ************************************************************************
+// *****                   EEPROM (StorageHelperRK only)              *****
+// ************************************************************************
+class EEPROMClass {
+public:
+    template <typename T> T &get(int idx, T &t) { memcpy(&t, memory + idx, sizeof(T)); return t; }
+    template <typename T> const T &put(int idx, const T &t) { memcpy(memory + idx, &t, sizeof(T)); return t; }
+    uint8_t read(int idx) { return memory[idx]; }
+    void write(int idx, uint8_t value) { memory[idx] = value; }
+    size_t length() { return sizeof(memory); }
+private:
+    uint8_t memory[4096] = {};
+};
+extern EEPROMClass EEPROM;
+
+// ************************************************************************
+// *****                        Buses (unused)                        *****
+// ************************************************************************
+class TwoWire {
+public:
+    void begin() {}
+    void lock() {}
+    void unlock() {}
+};
+extern TwoWire Wire;
+
+#endif  /* __SIM_PARTICLE_H */
@@ -0,0 +1,37 @@
+/**
+ * @file PublishQueuePosixRK.h
+ * @brief Host stand-in for PublishQueuePosixRK - queued events are recorded in sim::cloud() for the run summary
+ */
+
+#ifndef __PUBLISHQUEUEPOSIXRK_H
+#define __PUBLISHQUEUEPOSIXRK_H
+
+#include "Particle.h"
+#include "SimCloud.h"
+
+enum class PublishQueuePriority : uint8_t { BACKGROUND = 0, NORMAL = 1, URGENT = 2 };
+
+class PublishQueuePosix {
+public:
+    static PublishQueuePosix &instance() {
+        static PublishQueuePosix queue;
+        return queue;
+    }
+
+    void setup() {}
+    void loop() {}
+    bool publish(const char *eventName, const char *data, PublishFlags flags = PRIVATE) {
+        sim::cloud().record(eventName, data, true);
+        return true;
+    }
+    bool publish(const char *eventName, const char *data, PublishFlags flags, PublishQueuePriority priority, uint8_t coalesceKey = 0) {
+        sim::cloud().record(eventName, data, true);
+        return true;
+    }
+    bool getCanSleep() const { return true; }   // The cloud side is not modelled - the queue always drains
+    PublishQueuePosix &withRamQueueSize(size_t size) { return *this; }
+    PublishQueuePosix &withFileQueueSize(size_t size) { return *this; }
+    PublishQueuePosix &withRingLogSize(size_t size) { return *this; }
+};
+
+#endif  /* __PUBLISHQUEUEPOSIXRK_H */
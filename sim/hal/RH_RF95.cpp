@@ -0,0 +1,147 @@
+#include "RH_RF95.h"
+#include "SimClock.h"
+
+bool RH_RF95::init()
+{
+    if (!RHGenericDriver::init())
+	return false;
+    sim::Channel::instance().attach(this);
+    setModeIdle();
+    return true;
+}
+
+bool RH_RF95::setModemConfig(ModemConfigChoice index)
+{
+    switch (index)
+    {
+    case Bw125Cr45Sf128:   params.bandwidthHz = 125000; params.codingRate = 1; params.spreadingFactor = 7;  break;
+    case Bw500Cr45Sf128:   params.bandwidthHz = 500000; params.codingRate = 1; params.spreadingFactor = 7;  break;
+    case Bw31_25Cr48Sf512: params.bandwidthHz = 31250;  params.codingRate = 4; params.spreadingFactor = 9;  break;
+    case Bw125Cr48Sf4096:  params.bandwidthHz = 125000; params.codingRate = 4; params.spreadingFactor = 12; params.lowDatarateOptimize = true; break;
+    case Bw125Cr45Sf2048:  params.bandwidthHz = 125000; params.codingRate = 1; params.spreadingFactor = 11; break;
+    default: return false;
+    }
+    return true;
+}
+
+void RH_RF95::setLowDatarate()
+{
+    float symbolTime = 1000.0 * (1UL << params.spreadingFactor) / params.bandwidthHz;	// ms - same 16 ms threshold as the SX1276 driver
+    params.lowDatarateOptimize = (symbolTime > 16.0);
+}
+
+bool RH_RF95::available()
+{
+    if (_mode != RHModeTx)
+    {
+	setModeRx();
+	if (_rxHead != _rxTail)
+	{
+	    const RxFrame& frame = _rxQueue[_rxTail % RH_RF95_RX_QUEUE_LEN];
+	    _rxHeaderTo    = frame.buf[0];
+	    _rxHeaderFrom  = frame.buf[1];
+	    _rxHeaderId    = frame.buf[2];
+	    _rxHeaderFlags = frame.buf[3];
+	    return true;
+	}
+    }
+    sim::advance(1);							// The wait loops poll without a delay - let the channel move on
+    return false;
+}
+
+bool RH_RF95::waitAvailableTimeout(uint16_t timeout, uint16_t polldelay)
+{
+    uint64_t startMs = sim::nowMs();					// Blocks like the device, which sleeps on the interrupt - no poll delay
+    while (sim::nowMs() - startMs < timeout)
+    {
+	if (available())
+	    return true;
+    }
+    return false;
+}
+
+bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
+{
+    if (!available())
+	return false;
+    const RxFrame& frame = _rxQueue[_rxTail % RH_RF95_RX_QUEUE_LEN];
+    if (buf && len)
+    {
+	if (*len > frame.len-RH_RF95_HEADER_LEN)
+	    *len = frame.len-RH_RF95_HEADER_LEN;
+	memcpy(buf, frame.buf+RH_RF95_HEADER_LEN, *len);
+    }
+    _lastRssi = frame.rssi;
+    _lastSNR = frame.snr;
+    _rxTail++;
+    return true;
+}
+
+bool RH_RF95::send(const uint8_t* data, uint8_t len)
+{
+    if (len > RH_RF95_MAX_MESSAGE_LEN)
+	return false;
+
+    waitPacketSent();
+    setModeIdle();
+
+    if (!waitCAD())
+	return false;
+
+    uint8_t frame[RH_RF95_MAX_PAYLOAD_LEN];
+    frame[0] = _txHeaderTo;
+    frame[1] = _txHeaderFrom;
+    frame[2] = _txHeaderId;
+    frame[3] = _txHeaderFlags;
+    memcpy(frame + RH_RF95_HEADER_LEN, data, len);
+
+    enterMode(RHModeTx);
+    _txEndMs = sim::Channel::instance().transmit(this, frame, len + RH_RF95_HEADER_LEN, params);
+    sim::at(_txEndMs, [this]() {					// TX_DONE - the real driver drops back to standby
+	if (_mode == RHModeTx) {
+	    _txGood++;
+	    setModeIdle();
+	}
+    });
+    return true;
+}
+
+bool RH_RF95::waitPacketSent()
+{
+    if (_mode == RHModeTx && _txEndMs > sim::nowMs())
+	sim::advance(_txEndMs - sim::nowMs());
+    return true;
+}
+
+void RH_RF95::receive(const uint8_t *frame, uint8_t len, int16_t rssi, int8_t snr)
+{
+    if (len < RH_RF95_HEADER_LEN)
+	return;
+    if (!(_promiscuous || frame[0] == _thisAddress || frame[0] == RH_BROADCAST_ADDRESS))
+	return;
+    if ((uint8_t)(_rxHead - _rxTail) >= RH_RF95_RX_QUEUE_LEN)
+    {
+	_rxOverflow++;
+	return;
+    }
+    RxFrame& slot = _rxQueue[_rxHead % RH_RF95_RX_QUEUE_LEN];
+    memcpy(slot.buf, frame, len);
+    slot.len = len;
+    slot.rssi = rssi;
+    slot.snr = snr;
+    _rxGood++;
+    _rxHead++;
+}
+
+void RH_RF95::enterMode(RHMode mode)
+{
+    if (_mode == RHModeRx)
+	_rxOnMs += sim::nowMs() - _modeSinceMs;
+    _modeSinceMs = sim::nowMs();
+    _mode = mode;
+}
+
+uint64_t RH_RF95::receiverOnMs() const
+{
+    return _rxOnMs + ((_mode == RHModeRx) ? sim::nowMs() - _modeSinceMs : 0);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file RH_RF95.h
+ * @brief Host stand-in for the RH_RF95 driver - the SX1276 is replaced by the shared channel in SimChannel.h
+ *
+ * @details Keeps the real driver's public interface and receive queue semantics (RH_RF95_RX_QUEUE_LEN frames,
+ * overflow counted, RSSI / SNR kept per frame) so RHMesh and LoRA_Functions run unchanged.  Transmissions take
+ * their real airtime for the configured modem settings.  available() moves the clock on by a millisecond when
+ * nothing is queued - RadioHead's wait loops poll it with no delay and would otherwise never see time pass.
+ * waitAvailableTimeout() runs the clock on until a frame is queued, as the device sleeps on the radio interrupt.
+ */
+
+#ifndef RH_RF95_h
+#define RH_RF95_h
+
+#include <RHGenericDriver.h>
+#include "SimChannel.h"
+
+#define RH_RF95_FIFO_SIZE 255
+#define RH_RF95_MAX_PAYLOAD_LEN RH_RF95_FIFO_SIZE
+#define RH_RF95_HEADER_LEN 4
+
+#ifndef RH_RF95_RX_QUEUE_LEN
+ #define RH_RF95_RX_QUEUE_LEN 4
+#endif
+#if (RH_RF95_RX_QUEUE_LEN < 1) || (RH_RF95_RX_QUEUE_LEN > 128) || (RH_RF95_RX_QUEUE_LEN & (RH_RF95_RX_QUEUE_LEN - 1))
+ #error RH_RF95_RX_QUEUE_LEN must be a power of 2 from 1 to 128
+#endif
+
+#ifndef RH_RF95_MAX_MESSAGE_LEN
+ #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
+#endif
+
+class RH_RF95 : public RHGenericDriver, public sim::Radio {
+public:
+    typedef enum {
+	Bw125Cr45Sf128 = 0,
+	Bw500Cr45Sf128,
+	Bw31_25Cr48Sf512,
+	Bw125Cr48Sf4096,
+	Bw125Cr45Sf2048,
+    } ModemConfigChoice;
+
+    RH_RF95(uint8_t slaveSelectPin = 10, uint8_t interruptPin = 2) {}
+
+    virtual bool    init();
+    bool            setModemConfig(ModemConfigChoice index);
+    virtual bool    available();
+    virtual bool    waitAvailableTimeout(uint16_t timeout, uint16_t polldelay = 0);
+    virtual bool    recv(uint8_t* buf, uint8_t* len);
+    virtual bool    send(const uint8_t* data, uint8_t len);
+    virtual bool    waitPacketSent();
+    void            setPreambleLength(uint16_t bytes) { params.preambleSymbols = bytes; }
+    virtual uint8_t maxMessageLength() { return RH_RF95_MAX_MESSAGE_LEN; }
+    bool            setFrequency(float centre) { params.frequencyMHz = centre; return true; }
+    void            setModeIdle() { enterMode(RHModeIdle); }
+    void            setModeRx() { enterMode(RHModeRx); }
+    void            setTxPower(int8_t power, bool useRFO = false) {}
+    virtual bool    sleep() { enterMode(RHModeSleep); return true; }
+    virtual bool    isChannelActive() { return sim::Channel::instance().busy(); }
+    int             lastSNR() { return _lastSNR; }
+    uint16_t        rxOverflow() { return _rxOverflow; }
+    void            setSpreadingFactor(uint8_t sf) { params.spreadingFactor = sf; }
+    void            setSignalBandwidth(long sbw) { params.bandwidthHz = sbw; }
+    void            setCodingRate4(uint8_t denominator) { params.codingRate = denominator - 4; }
+    void            setLowDatarate();
+
+    // sim::Radio
+    virtual bool    listening() const { return _mode == RHModeRx; }
+    virtual const sim::RadioParams &radioParams() const { return params; }
+    virtual void    receive(const uint8_t *frame, uint8_t len, int16_t rssi, int8_t snr);
+
+    uint64_t        receiverOnMs() const;		// Time spent in receive mode - the listening windows as the radio saw them
+
+private:
+    void            enterMode(RHMode mode);
+
+    typedef struct {
+        int16_t rssi;
+        int8_t  snr;
+        uint8_t len;
+        uint8_t buf[RH_RF95_MAX_PAYLOAD_LEN];
+    } RxFrame;
+
+    RxFrame          _rxQueue[RH_RF95_RX_QUEUE_LEN];
+    uint8_t          _rxHead = 0;
+    uint8_t          _rxTail = 0;
+    uint16_t         _rxOverflow = 0;
+    int8_t           _lastSNR = 0;
+    uint64_t         _txEndMs = 0;
+    uint64_t         _modeSinceMs = 0;
+    uint64_t         _rxOnMs = 0;
+    sim::RadioParams params;
+};
+
+#endif
@@ -0,0 +1,7 @@
+// Host stand-in - everything the libraries want from SPI.h is in the simulated Particle.h
+#ifndef __SIM_SPI_H
+#define __SIM_SPI_H
+
+#include "Particle.h"
+
+#endif  /* __SIM_SPI_H */
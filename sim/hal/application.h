@@ -0,0 +1,7 @@
+// Host stand-in - everything the libraries want from application.h is in the simulated Particle.h
+#ifndef __SIM_APPLICATION_H
+#define __SIM_APPLICATION_H
+
+#include "Particle.h"
+
+#endif  /* __SIM_APPLICATION_H */
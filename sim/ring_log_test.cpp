@@ -0,0 +1,504 @@
+/**
+ * @file ring_log_test.cpp
+ * @brief Host tests for PublishQueueRingLog, the single file publish queue
+ *
+ * @details The ring log only needs POSIX file calls, so it runs unchanged against a file in /tmp.  Each event
+ * carries its number and a pattern that depends on it, so a record read back can be checked byte for byte.  To cut
+ * the power part way through an append, write() is replaced for the whole program and stops passing bytes to the
+ * file once a budget runs out.
+ *
+ *   ring_log_test [-v]
+ */
+
+#include "Particle.h"
+#include "PublishQueueRingLogRK.h"
+#include "SimClock.h"
+#include <deque>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+static bool verbose = false;
+
+#define CHECK(cond, ...) do { if (!(cond)) { failures++; fprintf(stderr, "FAIL %s:%d: %s - ", __FILE__, __LINE__, #cond); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } } while (0)
+
+static long writeBudget = -1;                                       // Bytes that reach the file before the power fails, -1 for no limit
+static uint64_t bytesWritten = 0;
+
+/**
+ * @brief write() with a power failure
+ *
+ * Record bytes are cut at any byte.  The ring header is written whole or not at all: the flash file system
+ * commits a file's data at fsync(), which follows every header write, so it is never seen half written.
+ */
+extern "C" ssize_t write(int fd, const void *buf, size_t count) {
+    size_t allowed = count;
+    if (writeBudget >= 0) {
+        bool header = count == sizeof(PublishQueueRingLogHeader) && lseek(fd, 0, SEEK_CUR) == 0;
+        allowed = ((size_t)writeBudget < count) ? (header ? 0 : (size_t)writeBudget) : count;
+        writeBudget = (allowed < count) ? 0 : writeBudget - (long)allowed;
+    }
+    if (allowed) {
+        ssize_t result = syscall(SYS_write, fd, buf, allowed);
+        if (result < 0) {
+            return result;
+        }
+        bytesWritten += result;
+    }
+    return count;                                                   // After a power failure nothing is left to report the error to
+}
+
+static const uint16_t SLOT_SIZE = 32;
+static const size_t NUM_SLOTS = 16;
+static const size_t RING_SIZE = SLOT_SIZE * NUM_SLOTS;
+static const uint32_t CORRUPT = 0xffffffff;                         // drain() found a record it could not read
+
+static char path[64];
+
+/**
+ * @brief Length of event n - 1 to 3 slots
+ */
+static size_t eventLength(uint32_t n) {
+    return 4 + (n * 37) % 72;
+}
+
+static uint32_t slotsFor(uint32_t n) {
+    return (sizeof(PublishQueueRingLogRecord) + eventLength(n) + SLOT_SIZE - 1) / SLOT_SIZE;
+}
+
+static bool append(PublishQueueRingLog &ring, uint32_t n, uint8_t coalesceKey = 0) {
+    uint8_t buf[128];
+    size_t len = eventLength(n);
+    memcpy(buf, &n, sizeof(n));
+    for(size_t ii = sizeof(n); ii < len; ii++) {
+        buf[ii] = (uint8_t)(n + ii);
+    }
+    return ring.append(buf, len, coalesceKey);
+}
+
+/**
+ * @brief Read and remove the oldest event, CORRUPT if it could not be read or is not what was appended
+ */
+static uint32_t pop(PublishQueueRingLog &ring) {
+    uint8_t buf[128];
+    uint32_t sequence, n = CORRUPT;
+    size_t len;
+    if (ring.readFront(sequence, buf, sizeof(buf), len) && len >= sizeof(n)) {
+        memcpy(&n, buf, sizeof(n));
+        bool match = len == eventLength(n);
+        for(size_t ii = sizeof(n); match && ii < len; ii++) {
+            match = buf[ii] == (uint8_t)(n + ii);
+        }
+        if (!match) {
+            n = CORRUPT;
+        }
+    }
+    ring.removeFront();
+    return n;
+}
+
+/**
+ * @brief Open the ring log after a reset and read every event out of it
+ */
+static std::vector<uint32_t> drain() {
+    PublishQueueRingLog ring;
+    std::vector<uint32_t> result;
+    if (!ring.open(path, RING_SIZE, SLOT_SIZE)) {
+        result.push_back(CORRUPT);
+        return result;
+    }
+    size_t numRecords = ring.getNumRecords();
+    while(ring.getFrontSequence() != 0) {
+        result.push_back(pop(ring));
+    }
+    if (result.size() != numRecords) {
+        result.push_back(CORRUPT);                                  // Count did not match what was there
+    }
+    return result;
+}
+
+static std::string describe(const std::vector<uint32_t> &events) {
+    std::string result;
+    for(uint32_t n : events) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), (n == CORRUPT) ? " ?" : " %u", (unsigned)n);
+        result += buf;
+    }
+    return result.empty() ? " (empty)" : result;
+}
+
+static std::vector<uint8_t> readFile() {
+    std::vector<uint8_t> result;
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        uint8_t buf[256];
+        size_t count;
+        while((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            result.insert(result.end(), buf, buf + count);
+        }
+        fclose(fp);
+    }
+    return result;
+}
+
+static void writeFile(const std::vector<uint8_t> &contents) {
+    FILE *fp = fopen(path, "wb");
+    if (fp) {
+        fwrite(contents.data(), 1, contents.size(), fp);
+        fclose(fp);
+    }
+}
+
+/**
+ * @brief Flip one byte of the file, offset bytes into the slot that holds sequence
+ */
+static void corrupt(uint32_t sequence, size_t offset) {
+    std::vector<uint8_t> contents = readFile();
+    size_t pos = sizeof(PublishQueueRingLogHeader) + (sequence % NUM_SLOTS) * SLOT_SIZE + offset;
+    if (pos < contents.size()) {
+        contents[pos] ^= 0x5a;
+        writeFile(contents);
+    }
+}
+
+//
+// Ring log
+//
+
+static void testWrapAround() {
+    unlink(path);
+    PublishQueueRingLog ring;
+    ring.open(path, RING_SIZE, SLOT_SIZE);
+    std::deque<uint32_t> expected;
+
+    for(uint32_t n = 1; n <= 200; n++) {
+        CHECK(append(ring, n), "append %u", (unsigned)n);
+        expected.push_back(n);
+        while(expected.size() > 3) {                                // At most 4 events of 3 slots - never full
+            uint32_t got = pop(ring);
+            CHECK(got == expected.front(), "read %u, expected %u", (unsigned)got, (unsigned)expected.front());
+            expected.pop_front();
+        }
+        if (n % 25 == 0) {                                          // Reset with events queued across the end of the ring
+            ring.close();
+            ring.open(path, RING_SIZE, SLOT_SIZE);
+            CHECK(ring.getNumRecords() == expected.size(), "%u records after reopening, expected %u", (unsigned)ring.getNumRecords(), (unsigned)expected.size());
+        }
+    }
+    CHECK(ring.getFrontSequence() > 10 * NUM_SLOTS, "front sequence %u - the ring did not go round", (unsigned)ring.getFrontSequence());
+    ring.close();
+
+    std::vector<uint32_t> events = drain();
+    CHECK(events == std::vector<uint32_t>(expected.begin(), expected.end()), "left%s", describe(events).c_str());
+}
+
+static void testFull() {
+    unlink(path);
+    PublishQueueRingLog ring;
+    ring.open(path, RING_SIZE, SLOT_SIZE);
+
+    const uint32_t LAST = 40;
+    for(uint32_t n = 1; n <= LAST; n++) {
+        CHECK(append(ring, n), "append %u", (unsigned)n);
+    }
+    std::vector<uint8_t> tooBig(ring.getMaxRecordSize() + 1);
+    CHECK(!ring.append(tooBig.data(), tooBig.size()), "record larger than the ring");
+
+    // The newest events that fit, oldest discarded first
+    uint32_t first = LAST, slots = slotsFor(LAST);
+    while(slots + slotsFor(first - 1) <= NUM_SLOTS) {
+        slots += slotsFor(--first);
+    }
+    CHECK(ring.getNumRecords() == LAST - first + 1, "%u records, expected %u", (unsigned)ring.getNumRecords(), (unsigned)(LAST - first + 1));
+    ring.close();
+
+    std::vector<uint32_t> events = drain();
+    std::vector<uint32_t> expected;
+    for(uint32_t n = first; n <= LAST; n++) {
+        expected.push_back(n);
+    }
+    CHECK(events == expected, "left%s, expected%s", describe(events).c_str(), describe(expected).c_str());
+}
+
+static void testCorruptRecord() {
+    for(size_t offset : {sizeof(PublishQueueRingLogRecord) + 5, (size_t)0}) {     // Data, then the record header
+        unlink(path);
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        for(uint32_t n = 1; n <= 3; n++) {
+            append(ring, n);
+        }
+        ring.close();
+        corrupt(1 + slotsFor(1), offset);
+
+        std::vector<uint32_t> events = drain();
+        std::vector<uint32_t> expected = {1, CORRUPT, 3};
+        CHECK(events == expected, "corrupted at offset %u, left%s", (unsigned)offset, describe(events).c_str());
+    }
+}
+
+/**
+ * @brief Cut the power at every byte of one append and open the ring log again
+ *
+ * @param before Events to queue first
+ * @param n Event appended when the power fails
+ */
+static void tornAppend(uint32_t before, uint32_t n) {
+    unlink(path);
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        for(uint32_t ii = 1; ii <= before; ii++) {
+            append(ring, ii);
+        }
+    }
+    std::vector<uint8_t> image = readFile();
+    std::vector<uint32_t> old = drain();
+
+    writeFile(image);
+    uint64_t start = bytesWritten;
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        start = bytesWritten;
+        append(ring, n);
+    }
+    long length = (long)(bytesWritten - start);
+
+    for(long cut = 0; cut <= length; cut++) {
+        writeFile(image);
+        {
+            PublishQueueRingLog ring;
+            ring.open(path, RING_SIZE, SLOT_SIZE);
+            writeBudget = cut;
+            append(ring, n);
+        }
+        writeBudget = -1;
+        {
+            PublishQueueRingLog ring;                               // The append after the reset goes in
+            ring.open(path, RING_SIZE, SLOT_SIZE);
+            append(ring, 999);
+        }
+
+        // The oldest events may have been discarded to make room, the torn one is there or not
+        std::vector<uint32_t> events = drain();
+        bool ok = !events.empty() && events.back() == 999;
+        if (ok) {
+            events.pop_back();
+            bool appended = !events.empty() && events.back() == n;
+            if (appended) {
+                events.pop_back();
+            }
+            ok = (cut < length || appended) && events.size() <= old.size() &&
+                std::equal(events.begin(), events.end(), old.end() - events.size());
+        }
+        CHECK(ok, "%u queued, cut at byte %ld of %ld, left%s", (unsigned)before, cut, length, describe(drain()).c_str());
+    }
+    if (verbose) {
+        printf("  %ld byte append, every byte cut\n", length);
+    }
+}
+
+static void testTornAppend() {
+    tornAppend(3, 4);
+}
+
+static void testTornAppendWhenFull() {
+    tornAppend(20, 21);                                             // Discards the oldest and wraps the end of the ring
+}
+
+//
+// Coalesce keys
+//
+
+/**
+ * @brief Ring log with its header open to the tests
+ */
+class RingLogAccess : public PublishQueueRingLog {
+public:
+    using PublishQueueRingLog::header;
+    using PublishQueueRingLog::writeHeader;
+};
+
+static void testCoalesceFront() {
+    unlink(path);
+    PublishQueueRingLog ring;
+    ring.open(path, RING_SIZE, SLOT_SIZE);
+    append(ring, 1, 1);
+    uint32_t second = ring.getFrontSequence() + slotsFor(1);
+    append(ring, 2, 1);                                             // Replaces 1, which is at the front
+    CHECK(ring.getNumRecords() == 1, "%u records", (unsigned)ring.getNumRecords());
+    CHECK(ring.getFrontSequence() == second, "front %u, expected %u - replaced record left at the front", (unsigned)ring.getFrontSequence(), (unsigned)second);
+    ring.close();
+
+    std::vector<uint32_t> events = drain();
+    CHECK(events == std::vector<uint32_t>({2}), "left%s", describe(events).c_str());
+}
+
+static void testCoalesceMiddle() {
+    unlink(path);
+    PublishQueueRingLog ring;
+    ring.open(path, RING_SIZE, SLOT_SIZE);
+    append(ring, 1);
+    append(ring, 2, 1);
+    append(ring, 3, 2);
+    append(ring, 4, 1);                                             // Replaces 2, behind 1
+    CHECK(ring.getNumRecords() == 3, "%u records", (unsigned)ring.getNumRecords());
+
+    std::vector<uint32_t> events;
+    while(ring.getFrontSequence() != 0) {
+        events.push_back(pop(ring));
+    }
+    CHECK(events == std::vector<uint32_t>({1, 3, 4}), "read%s", describe(events).c_str());
+    CHECK(ring.getNumRecords() == 0, "%u records when empty", (unsigned)ring.getNumRecords());
+}
+
+static void testSupersede() {
+    unlink(path);
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        append(ring, 1, 3);
+        append(ring, 2);
+        append(ring, 3, 4);
+        ring.supersede(5);                                          // No record with this key
+        CHECK(ring.getNumRecords() == 3, "%u records after superseding an unused key", (unsigned)ring.getNumRecords());
+        ring.supersede(4);
+        ring.supersede(3);
+        CHECK(ring.getNumRecords() == 1, "%u records", (unsigned)ring.getNumRecords());
+    }
+
+    // The newer events were only in RAM, so after a reset the one behind the front is sent after all
+    std::vector<uint32_t> events = drain();
+    CHECK(events == std::vector<uint32_t>({2, 3}), "left%s", describe(events).c_str());
+}
+
+static void testRescan() {
+    unlink(path);
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        append(ring, 1);
+        append(ring, 2, 1);
+        append(ring, 3, 2);
+        append(ring, 4, 1);
+        append(ring, 5, 2);
+    }
+
+    // The keys are found again, so the count leaves out 2 and 3 and a new event replaces 4
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        CHECK(ring.getNumRecords() == 3, "%u records after reopening", (unsigned)ring.getNumRecords());
+        append(ring, 6, 1);
+        CHECK(ring.getNumRecords() == 3, "%u records after replacing a record from before the reset", (unsigned)ring.getNumRecords());
+    }
+    std::vector<uint32_t> events = drain();
+    CHECK(events == std::vector<uint32_t>({1, 5, 6}), "left%s", describe(events).c_str());
+}
+
+static void testRescanHeader() {
+    unlink(path);
+    uint32_t first;
+    {
+        RingLogAccess ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        append(ring, 1, 1);
+        first = ring.getFrontSequence();
+        append(ring, 2);
+        append(ring, 3, 1);                                         // Drops 1 from the front
+
+        // A header from before 1 was dropped, with a count that is wrong as well
+        ring.header.head = first;
+        ring.header.numRecords = 7;
+        ring.writeHeader();
+    }
+
+    RingLogAccess ring;
+    ring.open(path, RING_SIZE, SLOT_SIZE);
+    CHECK(ring.getNumRecords() == 2, "%u records after reopening", (unsigned)ring.getNumRecords());
+    CHECK(ring.header.head != first && ring.header.numRecords == 2, "head %u count %u - replaced record left at the front",
+        (unsigned)ring.header.head, (unsigned)ring.header.numRecords);
+    ring.close();
+
+    std::vector<uint32_t> events = drain();
+    CHECK(events == std::vector<uint32_t>({2, 3}), "left%s", describe(events).c_str());
+}
+
+/**
+ * @brief Cut the power at every byte of an append that replaces a queued event
+ */
+static void testTornCoalesce() {
+    unlink(path);
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        append(ring, 1);
+        append(ring, 2, 1);
+        append(ring, 3);
+    }
+    std::vector<uint8_t> image = readFile();
+
+    long length;
+    {
+        PublishQueueRingLog ring;
+        ring.open(path, RING_SIZE, SLOT_SIZE);
+        uint64_t start = bytesWritten;
+        append(ring, 4, 1);
+        length = (long)(bytesWritten - start);
+    }
+
+    for(long cut = 0; cut <= length; cut++) {
+        writeFile(image);
+        {
+            PublishQueueRingLog ring;
+            ring.open(path, RING_SIZE, SLOT_SIZE);
+            writeBudget = cut;
+            append(ring, 4, 1);
+        }
+        writeBudget = -1;
+
+        // Without the new event the one it would have replaced is still there
+        std::vector<uint32_t> events = drain();
+        bool ok = events == std::vector<uint32_t>({1, 3, 4}) || (cut < length && events == std::vector<uint32_t>({1, 2, 3}));
+        CHECK(ok, "cut at byte %ld of %ld, left%s", cut, length, describe(events).c_str());
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) verbose = true;
+        else {
+            fprintf(stderr, "usage: ring_log_test [-v]\n");
+            return 2;
+        }
+    }
+    sim::setVerbose(verbose);
+    snprintf(path, sizeof(path), "/tmp/ring_log_test_%d", (int)getpid());
+
+    struct Test { const char *name; void (*run)(); } tests[] = {
+        {"wrap around", testWrapAround},
+        {"full ring discards the oldest", testFull},
+        {"corrupted record", testCorruptRecord},
+        {"torn append", testTornAppend},
+        {"torn append to a full ring", testTornAppendWhenFull},
+        {"replaced record at the front", testCoalesceFront},
+        {"replaced record behind the front", testCoalesceMiddle},
+        {"supersede", testSupersede},
+        {"keys found again on open", testRescan},
+        {"open recounts and drops from the front", testRescanHeader},
+        {"torn append that replaces", testTornCoalesce},
+    };
+    for (const Test &test : tests) {
+        int before = failures;
+        test.run();
+        printf("%-40s %s\n", test.name, (failures == before) ? "ok" : "FAILED");
+    }
+    unlink(path);
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file sim_main.cpp
+ * @brief Runs the gateway firmware against a park of simulated nodes and prints what happened as JSON
+ *
+ * @details setup() and loop() are the real ones from LoRA_Particle_Gateway.cpp.  Nodes are created with
+ * deterministic deviceIDs from the seed, so a run with the same arguments gives the same result and a run with
+ * --fram picks up the node table a previous run left behind.  With --min-delivery the exit code is 1 if fewer than
+ * that share of reports were acknowledged or the firmware halted, so make check can fail on a regression.
+ *
+ *   gateway_sim [--nodes N] [--hours H] [--loss P] [--seed S] [--fram FILE] [--join] [--compact] [--min-delivery P] [-v]
+ */
+
+#include "Particle.h"
+#include "MB85RC256V-FRAM-RK.h"
+#include <RHMeshETX.h>
+#include <RH_RF95.h>
+#include "MyPersistentData.h"
+#include "LoRA_Functions.h"
+#include "SimClock.h"
+#include "SimChannel.h"
+#include "SimCloud.h"
+#include "SimNode.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+void setup();
+void loop();
+
+extern RH_RF95 driver;                                              // From LoRA_Functions.cpp
+extern RHMeshETX manager;
+extern MB85RC64 fram;                                               // From MyPersistentData.cpp
+
+struct Options {
+    int nodes = 100;
+    double hours = 24;
+    double loss = 0.0;
+    uint32_t seed = 1;
+    const char *fram = nullptr;
+    bool join = false;
+    bool compact = false;
+    bool verbose = false;
+    double minDelivery = 0.0;                                       // Exit 1 below this share of reports acknowledged, or if the firmware halted
+    time_t start = 1686837000;                                      // 2023-06-15 13:50:00 UTC - mid morning at the park
+};
+
+static void usage() {
+    fprintf(stderr, "usage: gateway_sim [--nodes N] [--hours H] [--loss P] [--seed S] [--fram FILE] [--join] [--compact] [--min-delivery P] [-v]\n");
+    exit(2);
+}
+
+static Options parseArgs(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(arg, "--nodes") && hasValue) options.nodes = atoi(argv[++i]);
+        else if (!strcmp(arg, "--hours") && hasValue) options.hours = atof(argv[++i]);
+        else if (!strcmp(arg, "--loss") && hasValue) options.loss = atof(argv[++i]);
+        else if (!strcmp(arg, "--seed") && hasValue) options.seed = strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(arg, "--fram") && hasValue) options.fram = argv[++i];
+        else if (!strcmp(arg, "--start") && hasValue) options.start = strtol(argv[++i], nullptr, 10);
+        else if (!strcmp(arg, "--min-delivery") && hasValue) options.minDelivery = atof(argv[++i]);
+        else if (!strcmp(arg, "--join")) options.join = true;
+        else if (!strcmp(arg, "--compact")) options.compact = true;
+        else if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) options.verbose = true;
+        else usage();
+    }
+    if (options.nodes < 1 || options.nodes > nodeIDData::MAX_NODES || options.hours <= 0 || options.loss < 0 || options.loss >= 1 || options.minDelivery < 0 || options.minDelivery > 1) usage();
+    return options;
+}
+
+static std::string makeDeviceID() {
+    static const char hex[] = "0123456789abcdef";
+    std::string id = "e00fce68";                                    // Particle deviceIDs share a prefix
+    while (id.size() < 24) id += hex[sim::randomU32() & 0x0F];
+    return id;
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+int main(int argc, char **argv) {
+    Options options = parseArgs(argc, argv);
+    sim::seed(options.seed);
+    sim::setVerbose(options.verbose);
+    sim::setStartEpoch(options.start);
+    sim::Channel::instance().setLossProbability(options.loss);
+    MB85RC::backingFile = options.fram;
+
+    const char *halted = nullptr;
+    std::vector<std::unique_ptr<sim::SimNode>> nodes;
+    uint64_t endMs = (uint64_t)(options.hours * 3600000.0);
+
+    try {
+        setup();
+
+        sim::NodeConfig config;
+        config.magicNumber = sysStatus.get_magicNumber();
+        config.frequencyMinutes = sysStatus.get_frequencyMinutes();
+        config.radio = driver.radioParams();
+        config.compactReports = options.compact;
+        for (int i = 0; i < options.nodes; i++) {
+            nodes.emplace_back(new sim::SimNode(i, makeDeviceID(), config));
+            sim::SimNode &node = *nodes.back();
+            if (options.join) {
+                node.start(0, 0);
+                continue;
+            }
+            uint8_t nodeNumber = nodeDatabase.findNode(node.deviceID().c_str());	// Already in a node table kept with --fram
+            if (nodeNumber == 0) nodeNumber = nodeDatabase.addNode(node.deviceID().c_str(), node.radioID());
+            nodeDatabase.set_lastConnect(nodeNumber, Time.now() - sysStatus.get_frequencyMinutes() * 60);	// Reported last period
+            node.start(nodeNumber, LoRA_Functions::instance().getSlotOffset(nodeNumber));
+        }
+        nodeDatabase.flush(true);
+
+        while (sim::nowMs() < endMs) {
+            loop();
+            sim::advance(1);
+        }
+    }
+    catch (const sim::Halt &halt) {
+        halted = halt.reason;
+    }
+
+    // Summary
+    const sim::ChannelStats &channel = sim::Channel::instance().stats;
+    std::vector<uint32_t> latencies;
+    uint32_t reports = 0, transmissions = 0, hopAcked = 0, appAcked = 0, joins = 0, joinAcked = 0, joined = 0, duplicates = 0, fastReports = 0, fallbacks = 0;
+    uint32_t worstNode = 0;
+    double worstDelivery = 2.0;
+    for (auto &node : nodes) {
+        const sim::NodeStats &stats = node->stats();
+        reports += stats.reports;
+        transmissions += stats.transmissions;
+        hopAcked += stats.hopAcked;
+        appAcked += stats.appAcked;
+        joins += stats.joins;
+        joinAcked += stats.joinAcked;
+        duplicates += stats.duplicates;
+        fastReports += stats.fastReports;
+        fallbacks += stats.fallbacks;
+        if (node->joined()) joined++;
+        latencies.insert(latencies.end(), stats.ackLatencyMs.begin(), stats.ackLatencyMs.end());
+        double delivery = (stats.reports) ? (double)stats.appAcked / stats.reports : 1.0;
+        if (delivery < worstDelivery) {
+            worstDelivery = delivery;
+            worstNode = node->address();
+        }
+    }
+    uint64_t listenMs = driver.receiverOnMs();
+    sim::Cloud &cloud = sim::cloud();
+
+    printf("{\n");
+    printf("  \"config\": {\"nodes\": %d, \"hours\": %.2f, \"loss\": %.3f, \"seed\": %u, \"join\": %s, \"compact\": %s},\n",
+           options.nodes, options.hours, options.loss, options.seed, options.join ? "true" : "false", options.compact ? "true" : "false");
+    printf("  \"simulatedSeconds\": %llu,\n", (unsigned long long)(sim::nowMs() / 1000));
+    printf("  \"halted\": %s%s%s,\n", halted ? "\"" : "", halted ? halted : "null", halted ? "\"" : "");
+    printf("  \"nodes\": {\"joined\": %u, \"reports\": %u, \"transmissions\": %u, \"hopAcked\": %u, \"appAcked\": %u, \"delivery\": %.4f, \"worstNode\": %u, \"worstDelivery\": %.4f, \"joins\": %u, \"joinAcked\": %u, \"duplicates\": %u, \"fastReports\": %u, \"fallbacks\": %u},\n",
+           joined, reports, transmissions, hopAcked, appAcked, (reports) ? (double)appAcked / reports : 0.0, worstNode, (worstDelivery > 1.0) ? 0.0 : worstDelivery, joins, joinAcked, duplicates, fastReports, fallbacks);
+    printf("  \"ackLatencyMs\": {\"count\": %zu, \"p50\": %u, \"p95\": %u, \"p99\": %u, \"max\": %u},\n",
+           latencies.size(), percentile(latencies, 0.50), percentile(latencies, 0.95), percentile(latencies, 0.99), percentile(latencies, 1.0));
+    printf("  \"channel\": {\"frames\": %u, \"collided\": %u, \"delivered\": %u, \"lost\": %u, \"missed\": %u, \"busySeconds\": %.1f, \"airtimeSeconds\": %.1f},\n",
+           channel.frames, channel.collided, channel.delivered, channel.lost, channel.missed, channel.busyMs / 1000.0, channel.airtimeMs / 1000.0);
+    printf("  \"gateway\": {\"listenSeconds\": %.1f, \"windowUtilization\": %.4f, \"retransmissions\": %u, \"rxOverflow\": %u, \"framWrites\": %u, \"framBytes\": %llu, \"sleepSeconds\": %.1f, \"cellularConnections\": %u},\n",
+           listenMs / 1000.0, (listenMs) ? (double)channel.busyMs / listenMs : 0.0, (unsigned)manager.retransmissions(), driver.rxOverflow(),
+           fram.writes, (unsigned long long)fram.bytesWritten, cloud.sleepMs / 1000.0, cloud.connections);
+    printf("  \"publishes\": {\"total\": %zu, \"bytes\": %llu", cloud.publishes.size(), (unsigned long long)cloud.bytes);
+    for (auto &entry : cloud.countByName) printf(", \"%s\": %u", entry.first.c_str(), entry.second);
+    printf("}\n}\n");
+
+    double delivery = (reports) ? (double)appAcked / reports : 0.0;
+    if (options.minDelivery > 0 && halted) {
+        fprintf(stderr, "FAIL: halted - %s\n", halted);
+        return 1;
+    }
+    if (delivery < options.minDelivery) {
+        fprintf(stderr, "FAIL: delivery %.4f below %.4f\n", delivery, options.minDelivery);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,446 @@
+/**
+ * @file storage_test.cpp
+ * @brief Host tests for the power-safe parts of StorageHelperRK's PersistentDataFRAM
+ *
+ * @details A small structure of checksummed records is saved to the MB85RC stand-in.  The tests roll back
+ * transactions, and cut the power part way through saves by letting the FRAM take only the first N bytes written,
+ * for every N up to the length of the save, then load the structure again from what was left - with the journal,
+ * split into chunks when the save does not fit it, and with two slots.  Each load that finishes a save is cut at
+ * every byte as well.
+ *
+ *   storage_test [-v]
+ */
+
+#include "Particle.h"
+#include "MB85RC256V-FRAM-RK.h"
+#include "StorageHelperRK.h"
+#include "SimClock.h"
+#include <functional>
+#include <vector>
+
+static int failures = 0;
+static bool verbose = false;
+
+#define CHECK(cond, ...) do { if (!(cond)) { failures++; fprintf(stderr, "FAIL %s:%d: %s - ", __FILE__, __LINE__, #cond); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } } while (0)
+
+/**
+ * @brief FRAM that loses power after a number of bytes have been written
+ */
+class TornFRAM : public MB85RC64 {
+public:
+    TornFRAM() : MB85RC64(Wire) {}
+
+    bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen) override {
+        if (budget < 0) {
+            return MB85RC::writeData(framAddr, data, dataLen);
+        }
+        size_t count = ((size_t)budget < dataLen) ? (size_t)budget : dataLen;
+        if (count) {
+            MB85RC::writeData(framAddr, data, count);
+        }
+        budget -= count;
+        return true;
+    }
+
+    std::vector<uint8_t> image() const { return memory; }
+    void restore(const std::vector<uint8_t> &image) { memory = image; }
+
+    long budget = -1;                                               // Bytes written before the power fails, -1 for no limit
+};
+
+/**
+ * @brief Structure under test - a count and an array of records that each carry a check of their own value
+ */
+class TestData : public StorageHelperRK::PersistentDataFRAM {
+public:
+    static const size_t RECORDS = 40;
+    static const int DATA_OFFSET = 0;
+    static const int JOURNAL_OFFSET = 1024;                         // Room for 156 bytes of changes, a third of the records
+    static const size_t JOURNAL_SIZE = 176;
+    static const int SECOND_OFFSET = 2048;
+
+    struct Record {
+        uint32_t value;
+        uint32_t inverse;                                           // ~value
+        uint16_t low;                                               // value & 0xffff
+        uint16_t index;
+    };
+
+    struct Data {
+        SavedDataHeader header;
+        uint16_t count;
+        uint16_t reserved;
+        Record records[RECORDS];
+    };
+
+    Data data;
+    int initialized = 0;                                            // load() found nothing valid
+
+    enum class Mode { JOURNAL, SECOND_SLOT };
+
+    TestData(MB85RC &fram, Mode mode = Mode::JOURNAL) : PersistentDataFRAM(fram, DATA_OFFSET, &data.header, sizeof(Data), 0x54455354, 1) {
+        if (mode == Mode::JOURNAL) {
+            withJournal(JOURNAL_OFFSET, JOURNAL_SIZE);
+            withJournalRecords(offsetof(Data, records), sizeof(Record));
+        }
+        else if (mode == Mode::SECOND_SLOT) {
+            withSecondSlot(SECOND_OFFSET);
+        }
+    }
+
+    void initialize() override {
+        initialized++;
+        PersistentDataBase::initialize();
+    }
+
+    uint16_t get_count() const { return getValue<uint16_t>(offsetof(Data, count)); }
+    void set_count(uint16_t value) { setValue<uint16_t>(offsetof(Data, count), value); }
+
+    uint32_t get_value(size_t index) const { return getValue<uint32_t>(recordOffset(index) + offsetof(Record, value)); }
+
+    /**
+     * @brief Set a record the way the firmware does, one field at a time
+     */
+    void set_value(size_t index, uint32_t value) {
+        size_t offset = recordOffset(index);
+        setValue<uint32_t>(offset + offsetof(Record, value), value);
+        setValue<uint32_t>(offset + offsetof(Record, inverse), ~value);
+        setValue<uint16_t>(offset + offsetof(Record, low), (uint16_t)value);
+        setValue<uint16_t>(offset + offsetof(Record, index), (uint16_t)index);
+    }
+
+    /**
+     * @brief Start over from zero like a new structure - the next save writes all of it
+     */
+    void reset() {
+        PersistentDataBase::initialize();
+    }
+
+    void set_generation(uint32_t generation) { data.header.generation = generation; }
+
+    static size_t recordOffset(size_t index) { return offsetof(Data, records) + index * sizeof(Record); }
+
+    static bool recordValid(const Record &record, size_t index) {
+        return record.inverse == ~record.value && record.low == (uint16_t)record.value && record.index == index;
+    }
+};
+
+/**
+ * @brief Bring the data up to date - millis() starts at 0, which the save delay reads as nothing to save
+ */
+static void save(TestData &testData) {
+    sim::advance(1);
+    testData.flush(true);
+}
+
+/**
+ * @brief FRAM holding a saved structure with every record set to its index plus base
+ */
+static std::vector<uint8_t> baseline(TestData::Mode mode, uint32_t base) {
+    TornFRAM fram;
+    TestData testData(fram, mode);
+    testData.load();
+    testData.set_count(TestData::RECORDS);
+    for(size_t ii = 0; ii < TestData::RECORDS; ii++) {
+        testData.set_value(ii, base + ii);
+    }
+    save(testData);
+    if (mode == TestData::Mode::SECOND_SLOT) {
+        testData.set_value(0, base);                                // Unchanged - a second save so both slots are valid
+        testData.set_count(TestData::RECORDS - 1);
+        testData.set_count(TestData::RECORDS);
+        save(testData);
+    }
+    return fram.image();
+}
+
+static bool sameData(const TestData::Data &a, const TestData::Data &b) {
+    return a.count == b.count && memcmp(a.records, b.records, sizeof(a.records)) == 0;
+}
+
+//
+// Transactions
+//
+
+static void testRollback() {
+    TornFRAM fram;
+    fram.restore(baseline(TestData::Mode::JOURNAL, 100));
+    TestData testData(fram);
+    testData.load();
+    TestData::Data before = testData.data;
+
+    {
+        StorageHelperRK::PersistentDataBase::Transaction t(testData);
+        testData.set_value(3, 900);
+        testData.set_value(3, 901);                                 // Set twice - rollback goes back to before the first
+        testData.set_count(7);
+        CHECK(testData.get_value(3) == 901, "value %u", (unsigned)testData.get_value(3));
+        CHECK(t.rollback(), "rollback with room in the log");
+    }
+    CHECK(sameData(testData.data, before), "rollback restores every field");
+    save(testData);
+
+    TestData reloaded(fram);
+    reloaded.load();
+    CHECK(reloaded.initialized == 0, "hash matches after rollback");
+    CHECK(sameData(reloaded.data, before), "FRAM holds the data from before the transaction");
+}
+
+static void testCommit() {
+    TornFRAM fram;
+    fram.restore(baseline(TestData::Mode::JOURNAL, 100));
+    TestData testData(fram);
+    testData.load();
+
+    {
+        StorageHelperRK::PersistentDataBase::Transaction t(testData);
+        testData.set_value(3, 900);
+        testData.set_count(7);
+    }                                                               // Destructor commits
+    save(testData);
+
+    TestData reloaded(fram);
+    reloaded.load();
+    CHECK(reloaded.initialized == 0, "hash matches after commit");
+    CHECK(reloaded.get_value(3) == 900 && reloaded.get_count() == 7, "value %u count %u", (unsigned)reloaded.get_value(3), (unsigned)reloaded.get_count());
+}
+
+static void testNestedRollback() {
+    TornFRAM fram;
+    fram.restore(baseline(TestData::Mode::JOURNAL, 100));
+    TestData testData(fram);
+    testData.load();
+
+    StorageHelperRK::PersistentDataBase::Transaction outer(testData);
+    testData.set_value(1, 500);
+    {
+        StorageHelperRK::PersistentDataBase::Transaction inner(testData);
+        testData.set_value(2, 600);
+        CHECK(inner.rollback(), "inner rollback");
+    }
+    CHECK(testData.get_value(1) == 500, "inner rollback keeps the outer change, got %u", (unsigned)testData.get_value(1));
+    CHECK(testData.get_value(2) == 102, "inner rollback undoes its own change, got %u", (unsigned)testData.get_value(2));
+
+    {
+        StorageHelperRK::PersistentDataBase::Transaction inner(testData);
+        testData.set_value(2, 700);
+    }
+    CHECK(outer.rollback(), "outer rollback");
+    CHECK(testData.get_value(1) == 101 && testData.get_value(2) == 102, "outer rollback undoes committed inner changes too, got %u %u",
+        (unsigned)testData.get_value(1), (unsigned)testData.get_value(2));
+}
+
+static void testUndoOverflow() {
+    TornFRAM fram;
+    fram.restore(baseline(TestData::Mode::JOURNAL, 100));
+    TestData testData(fram);
+    testData.load();
+
+    {
+        StorageHelperRK::PersistentDataBase::Transaction t(testData);
+        for(size_t ii = 0; ii < TestData::RECORDS; ii++) {
+            testData.set_value(ii, 2000 + ii);
+        }
+        CHECK(!t.rollback(), "rollback reports an overflowed log");
+    }
+    CHECK(testData.get_value(0) == 2000 && testData.get_value(TestData::RECORDS - 1) == 2000 + TestData::RECORDS - 1, "overflowed transaction keeps its changes");
+    save(testData);
+
+    TestData reloaded(fram);
+    reloaded.load();
+    CHECK(reloaded.initialized == 0, "hash matches after an overflowed rollback");
+    CHECK(sameData(reloaded.data, testData.data), "overflowed transaction is saved");
+}
+
+//
+// Power failures
+//
+
+/**
+ * @brief Load the structure from what a power failure left and check it against the data before and after the save
+ *
+ * @param whole The save fit in the journal, so the structure must come back as it was before or after the save.
+ * Otherwise each record and the count must.
+ */
+static void checkTorn(const TestData &reloaded, const TestData::Data &before, const TestData::Data &after, bool whole, long cut) {
+    CHECK(reloaded.initialized == 0, "cut at byte %ld - load initialized the data", cut);
+    if (whole) {
+        CHECK(sameData(reloaded.data, before) || sameData(reloaded.data, after), "cut at byte %ld - data is neither before nor after the save", cut);
+        return;
+    }
+    CHECK(reloaded.data.count == before.count || reloaded.data.count == after.count, "cut at byte %ld - count %u", cut, (unsigned)reloaded.data.count);
+    for(size_t ii = 0; ii < TestData::RECORDS; ii++) {
+        const TestData::Record &record = reloaded.data.records[ii];
+        bool known = record.value == before.records[ii].value || record.value == after.records[ii].value;
+        CHECK(TestData::recordValid(record, ii) && known, "cut at byte %ld - record %u is torn", cut, (unsigned)ii);
+    }
+}
+
+/**
+ * @brief Cut the power at every byte of one save, then at every byte of the load that recovers from it
+ *
+ * @param mode Journal or two slots
+ * @param image FRAM before the save
+ * @param change Changes to save
+ * @param whole The save fits in the journal - see checkTorn()
+ */
+static void tornSave(TestData::Mode mode, const std::vector<uint8_t> &image, std::function<void(TestData &)> change, bool whole) {
+    TornFRAM fram;
+
+    // The save without a power failure, for its length and what it leaves
+    fram.restore(image);
+    TestData uncut(fram, mode);
+    uncut.load();
+    TestData::Data before = uncut.data;
+    change(uncut);
+    TestData::Data after = uncut.data;
+    uint64_t start = fram.bytesWritten;
+    save(uncut);
+    long length = (long)(fram.bytesWritten - start);
+    CHECK(length > 0, "save wrote nothing");
+
+    for(long cut = 0; cut <= length; cut++) {
+        fram.restore(image);
+        TestData testData(fram, mode);
+        testData.load();
+        change(testData);
+        fram.budget = cut;
+        save(testData);
+        fram.budget = -1;
+        std::vector<uint8_t> torn = fram.image();
+
+        start = fram.bytesWritten;
+        TestData reloaded(fram, mode);
+        reloaded.load();
+        long recovery = (long)(fram.bytesWritten - start);
+        checkTorn(reloaded, before, after, whole, cut);
+        if (cut == length) {
+            CHECK(sameData(reloaded.data, after), "complete save did not load");
+        }
+
+        // A second power failure while load() finishes the save comes back the same
+        for(long recoveryCut = 0; recoveryCut < recovery; recoveryCut++) {
+            fram.restore(torn);
+            fram.budget = recoveryCut;
+            TestData interrupted(fram, mode);
+            interrupted.load();
+            fram.budget = -1;
+            TestData recovered(fram, mode);
+            recovered.load();
+            CHECK(recovered.initialized == 0 && sameData(recovered.data, reloaded.data), "cut at byte %ld, then at byte %ld of the recovery", cut, recoveryCut);
+        }
+
+        // The next save lands on top of whatever was recovered
+        fram.restore(torn);
+        TestData next(fram, mode);
+        next.load();
+        next.set_value(1, 77777);
+        save(next);
+        TestData nextReloaded(fram, mode);
+        nextReloaded.load();
+        CHECK(nextReloaded.initialized == 0 && sameData(nextReloaded.data, next.data), "cut at byte %ld - the save after it was lost", cut);
+    }
+    if (verbose) {
+        printf("  %ld byte save, every byte cut\n", length);
+    }
+}
+
+static void testJournalOneRecord() {
+    tornSave(TestData::Mode::JOURNAL, baseline(TestData::Mode::JOURNAL, 100), [](TestData &testData) {
+        testData.set_value(5, 5005);
+    }, true);
+}
+
+static void testJournalScattered() {
+    tornSave(TestData::Mode::JOURNAL, baseline(TestData::Mode::JOURNAL, 100), [](TestData &testData) {
+        for(size_t ii = 0; ii < TestData::RECORDS; ii += 13) {
+            testData.set_value(ii, 5000 + ii);
+        }
+        testData.set_count(TestData::RECORDS - 1);
+    }, true);
+}
+
+static void testJournalManyRanges() {
+    tornSave(TestData::Mode::JOURNAL, baseline(TestData::Mode::JOURNAL, 100), [](TestData &testData) {
+        for(size_t ii = 0; ii < TestData::RECORDS; ii += 3) {
+            testData.set_value(ii, 5000 + ii);                      // More ranges than are tracked - the closest merge
+        }
+    }, false);
+}
+
+static void testChunkedAllRecords() {
+    tornSave(TestData::Mode::JOURNAL, baseline(TestData::Mode::JOURNAL, 100), [](TestData &testData) {
+        for(size_t ii = 0; ii < TestData::RECORDS; ii++) {
+            testData.set_value(ii, 5000 + ii);
+        }
+    }, false);
+}
+
+static void testChunkedAfterReset() {
+    tornSave(TestData::Mode::JOURNAL, baseline(TestData::Mode::JOURNAL, 100), [](TestData &testData) {
+        testData.reset();
+        testData.set_count(TestData::RECORDS);
+        for(size_t ii = 0; ii < TestData::RECORDS; ii++) {
+            testData.set_value(ii, 5000 + ii);
+        }
+    }, false);
+}
+
+static void testSecondSlot() {
+    tornSave(TestData::Mode::SECOND_SLOT, baseline(TestData::Mode::SECOND_SLOT, 100), [](TestData &testData) {
+        testData.set_value(5, 5005);
+        testData.set_count(TestData::RECORDS - 1);
+    }, true);
+}
+
+static void testGenerationWrap() {
+    TornFRAM fram;
+    TestData testData(fram, TestData::Mode::SECOND_SLOT);
+    testData.load();
+    testData.set_generation(0xfffffffe);
+    testData.set_value(0, 1);
+    save(testData);                                                 // Second slot, generation 0xffffffff
+    testData.set_value(0, 2);
+    save(testData);                                                 // First slot, generation 0
+
+    TestData reloaded(fram, TestData::Mode::SECOND_SLOT);
+    reloaded.load();
+    CHECK(reloaded.initialized == 0, "both slots valid");
+    CHECK(reloaded.get_value(0) == 2 && reloaded.data.header.generation == 0, "value %u generation %u - wrapped generation is newer",
+        (unsigned)reloaded.get_value(0), (unsigned)reloaded.data.header.generation);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) verbose = true;
+        else {
+            fprintf(stderr, "usage: storage_test [-v]\n");
+            return 2;
+        }
+    }
+    sim::setVerbose(verbose);
+
+    struct Test { const char *name; void (*run)(); } tests[] = {
+        {"rollback", testRollback},
+        {"commit", testCommit},
+        {"nested rollback", testNestedRollback},
+        {"undo overflow", testUndoOverflow},
+        {"journaled save of one record", testJournalOneRecord},
+        {"journaled save of scattered records", testJournalScattered},
+        {"save with more ranges than tracked", testJournalManyRanges},
+        {"chunked save of every record", testChunkedAllRecords},
+        {"chunked save after a reset", testChunkedAfterReset},
+        {"second slot save", testSecondSlot},
+        {"second slot generation wrap", testGenerationWrap},
+    };
+    for (const Test &test : tests) {
+        int before = failures;
+        test.run();
+        printf("%-40s %s\n", test.name, (failures == before) ? "ok" : "FAILED");
+    }
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+/**
+ * @file ChannelPlan.h
+ * @brief The LoRA channels the park uses in the 902 - 928MHz ISM band - shared by the gateway and the node firmware
+ *
+ * @details Channel 0 is the original carrier.  Every node joins on it, relayed nodes stay on it, and a node falls back to
+ * it when an exchange on its own channel fails.  The others are spaced 200kHz apart below it, so a 125kHz signal on
+ * one does not land on its neighbours and the top channel stays inside the band.
+ *
+ * The gateway has one radio, so it listens on one channel at a time: it tunes to each slot's channel until the slot's node
+ * has been heard (see LoRA_Functions::tuneToSlot()).  Neighbouring slots are on different channels, so a node that runs over its slot or retries
+ * into the next one does not collide with the node reporting there.
+ *
+ * This file only depends on the C standard headers so the node firmware can include it unchanged.
+ */
+
+#ifndef __CHANNEL_PLAN_H
+#define __CHANNEL_PLAN_H
+
+#include <stdint.h>
+
+constexpr uint8_t CHANNEL_COUNT = 8;            // Channels 0 - 7
+constexpr float CHANNEL_0_MHZ = 926.84;         // Center frequency for the omni-directional antenna I am using - every node joins here
+constexpr float CHANNEL_SPACING_MHZ = 0.2;
+
+/**
+ * @brief Center frequency of a channel in MHz - out of range channels are channel 0
+ */
+constexpr float channelFrequency(uint8_t channel) {
+    return (channel < CHANNEL_COUNT) ? CHANNEL_0_MHZ - channel * CHANNEL_SPACING_MHZ : CHANNEL_0_MHZ;
+}
+
+/**
+ * @brief Channel for a node that reports alone in a slot - the slots take turns through the channels
+ *
+ * @param slot - slot number, 0 is the join slot and is always on channel 0
+ */
+constexpr uint8_t slotChannel(uint16_t slot) {
+    return slot % CHANNEL_COUNT;
+}
+
+static_assert(channelFrequency(CHANNEL_COUNT - 1) > 902.0 + CHANNEL_SPACING_MHZ / 2, "Channel plan runs out of the ISM band");
+
+#endif  /* __CHANNEL_PLAN_H */
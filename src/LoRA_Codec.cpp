@@ -0,0 +1,113 @@
+#include "LoRA_Codec.h"
+
+void PayloadWriter::putFixed(uint32_t value, uint8_t width) {
+    if (overflow || width > size - used) {
+        overflow = true;
+        return;
+    }
+    for (int8_t shift = (width - 1) * 8; shift >= 0; shift -= 8) {
+        buf[used++] = (uint8_t)(value >> shift);
+    }
+}
+
+void PayloadWriter::putVarint(uint32_t value) {
+    do {
+        if (overflow || used >= size) {
+            overflow = true;
+            return;
+        }
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buf[used++] = (value) ? (byte | 0x80) : byte;
+    } while (value);
+}
+
+uint32_t PayloadReader::getFixed(uint8_t width) {
+    if (underflow || width > len - index) {
+        underflow = true;
+        return 0;
+    }
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < width; i++) {
+        value = (value << 8) | buf[index++];
+    }
+    return value;
+}
+
+uint32_t PayloadReader::getVarint() {
+    uint32_t value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {               // A uint32_t takes at most 5 bytes
+        if (underflow || index >= len) break;
+        uint8_t byte = buf[index++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    underflow = true;
+    return 0;
+}
+
+uint8_t PayloadSchema::optionalCount() const {
+    uint8_t optional = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (fields[i].optional) optional++;
+    }
+    return optional;
+}
+
+uint8_t PayloadSchema::encode(const uint32_t values[], uint8_t *buf, uint8_t size) const {
+    PayloadWriter writer(buf, size);
+    bool bitmapWritten = false;
+
+    for (uint8_t i = 0; i < count; i++) {
+        const PayloadField &field = fields[i];
+        if (field.optional) {
+            if (!bitmapWritten) {                                   // Presence bitmap goes in front of the first optional field
+                uint32_t bits = 0;
+                uint8_t bit = 0;
+                for (uint8_t j = i; j < count; j++) {
+                    if (!fields[j].optional) continue;
+                    if (values[j] != 0) bits |= (1UL << bit);
+                    bit++;
+                }
+                for (uint8_t b = 0; b < (bit + 7) / 8; b++) writer.putByte(bits >> (b * 8));
+                bitmapWritten = true;
+            }
+            if (values[i] == 0) continue;                           // Not sent - the bitmap says so
+        }
+        switch (field.coding) {
+            case FieldCoding::FIXED: writer.putFixed(values[i], field.width); break;
+            case FieldCoding::VARINT: writer.putVarint(values[i]); break;
+            case FieldCoding::ZIGZAG: writer.putZigzag((int32_t)values[i]); break;
+        }
+    }
+    return (writer.ok()) ? writer.length() : 0;
+}
+
+bool PayloadSchema::decode(const uint8_t *buf, uint8_t len, uint32_t values[]) const {
+    PayloadReader reader(buf, len);
+    return decode(reader, values);
+}
+
+bool PayloadSchema::decode(PayloadReader &reader, uint32_t values[]) const {
+    uint32_t bits = 0;
+    uint8_t bit = 0;
+    bool bitmapRead = false;
+
+    for (uint8_t i = 0; i < count; i++) {
+        const PayloadField &field = fields[i];
+        values[i] = 0;
+        if (field.optional) {
+            if (!bitmapRead) {
+                for (uint8_t b = 0; b < (optionalCount() + 7) / 8; b++) bits |= (uint32_t)reader.getByte() << (b * 8);
+                bitmapRead = true;
+            }
+            if (!(bits & (1UL << bit++))) continue;                 // Not sent - stays 0
+        }
+        switch (field.coding) {
+            case FieldCoding::FIXED: values[i] = reader.getFixed(field.width); break;
+            case FieldCoding::VARINT: values[i] = reader.getVarint(); break;
+            case FieldCoding::ZIGZAG: values[i] = (uint32_t)reader.getZigzag(); break;
+        }
+    }
+    return reader.ok();
+}
@@ -0,0 +1,189 @@
+/**
+ * @file LoRA_Codec.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Schema driven encoder / decoder for the LoRA frames - shared by the gateway and the node firmware
+ * @version 0.1
+ * @date 2023-03-20
+ *
+ * @details Each frame is described by a constexpr table of fields.  A field is either fixed width (big endian, like the
+ * original hand packed frames), an unsigned varint or a zigzag varint for values that can go negative.  Optional fields
+ * are left off the air when they are zero; a presence bitmap written just before the first optional field says which
+ * ones were sent.  Values are passed as an array of uint32_t indexed by the field enums below.
+ *
+ * This file only depends on the C standard headers so the node firmware can include it unchanged.
+ */
+
+#ifndef __LORA_CODEC_H
+#define __LORA_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief How a field is carried on the air
+ */
+enum class FieldCoding : uint8_t {
+    FIXED,                                      // width bytes, most significant first
+    VARINT,                                     // 7 bits per byte, low bits first, high bit set if more follow
+    ZIGZAG                                      // signed value mapped to an unsigned varint - small magnitudes stay short
+};
+
+/**
+ * @brief One entry in a frame schema
+ */
+struct PayloadField {
+    FieldCoding coding;
+    uint8_t width;                              // Bytes on the air - FIXED fields only
+    bool optional;                              // Left out when zero and flagged in the presence bitmap - at most 32 per frame
+};
+
+/**
+ * @brief Writes fields into a caller supplied buffer - once a write does not fit, ok() stays false
+ */
+class PayloadWriter {
+public:
+    PayloadWriter(uint8_t *buf, uint8_t size) : buf(buf), size(size) {}
+
+    void putFixed(uint32_t value, uint8_t width);
+    void putVarint(uint32_t value);
+    void putZigzag(int32_t value) { putVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31)); }
+    void putByte(uint8_t value) { putFixed(value, 1); }
+
+    uint8_t length() const { return used; }     // Bytes written so far
+    bool ok() const { return !overflow; }
+
+private:
+    uint8_t *buf;
+    uint8_t size;
+    uint8_t used = 0;
+    bool overflow = false;
+};
+
+/**
+ * @brief Reads fields from a received frame - once a read runs past the end, ok() stays false and reads return 0
+ */
+class PayloadReader {
+public:
+    PayloadReader(const uint8_t *buf, uint8_t len, uint8_t start = 0) : buf(buf), len(len), index(start) {}
+
+    uint32_t getFixed(uint8_t width);
+    uint32_t getVarint();
+    int32_t getZigzag() { uint32_t value = getVarint(); return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+    uint8_t getByte() { return getFixed(1); }
+
+    uint8_t position() const { return index; }  // Bytes consumed so far
+    bool ok() const { return !underflow; }
+
+private:
+    const uint8_t *buf;
+    uint8_t len;
+    uint8_t index;
+    bool underflow = false;
+};
+
+/**
+ * @brief A frame layout - an ordered table of fields
+ */
+struct PayloadSchema {
+    const PayloadField *fields;
+    uint8_t count;
+
+    /**
+     * @brief Encodes values[0 .. count-1] into buf
+     *
+     * @return uint8_t - length of the frame, 0 if it did not fit in size bytes
+     */
+    uint8_t encode(const uint32_t values[], uint8_t *buf, uint8_t size) const;
+
+    /**
+     * @brief Decodes a frame into values[0 .. count-1] - optional fields that were not sent are 0
+     *
+     * @return true - every field was present in the len bytes received
+     */
+    bool decode(const uint8_t *buf, uint8_t len, uint32_t values[]) const;
+
+    /**
+     * @brief Decodes the fields from where reader is - for a frame that goes on past the schema, reader is left after them
+     *
+     * @return true - every field was present
+     */
+    bool decode(PayloadReader &reader, uint32_t values[]) const;
+
+    /**
+     * @brief Number of optional fields - sets the size of the presence bitmap, one bit each
+     */
+    uint8_t optionalCount() const;
+};
+
+template <size_t N>
+constexpr PayloadSchema makeSchema(const PayloadField (&fields)[N]) {
+    static_assert(N < 256, "Too many fields for one frame");
+    return PayloadSchema{fields, (uint8_t)N};
+}
+
+constexpr PayloadField fixedField(uint8_t width) { return PayloadField{FieldCoding::FIXED, width, false}; }
+constexpr PayloadField varintField(bool optional = false) { return PayloadField{FieldCoding::VARINT, 0, optional}; }
+constexpr PayloadField zigzagField(bool optional = false) { return PayloadField{FieldCoding::ZIGZAG, 0, optional}; }
+
+// ************************************************************************
+// *****                         Frame Schemas                        *****
+// ************************************************************************
+// Every frame starts with the magic number and, from a node, the nodeID as fixed fields so a receiver can screen
+// it before decoding.  The fixed layouts match the byte maps in LoRA_Functions.h; the compact layouts carry the
+// same fields and are used by nodes that send a COMPACT_RPT.
+
+// Data report - values indexed by DataReportField
+enum DataReportField { RPT_MAGIC, RPT_NODE_ID, RPT_HOURLY, RPT_DAILY, RPT_SENSOR_TYPE, RPT_TEMP, RPT_BATT_CHG, RPT_BATT_STATE,
+                       RPT_RESETS, RPT_MESSAGE_COUNT, RPT_SUCCESS_COUNT, RPT_RSSI, RPT_SNR, RPT_FIELD_COUNT };
+
+constexpr PayloadField DATA_REPORT_FIELDS[] = {
+    fixedField(2), fixedField(2), fixedField(2), fixedField(2), fixedField(1), fixedField(1), fixedField(1), fixedField(1),
+    fixedField(1), fixedField(1), fixedField(1), fixedField(2), fixedField(2) };
+constexpr PayloadField COMPACT_DATA_REPORT_FIELDS[] = {
+    fixedField(2), fixedField(2), varintField(), varintField(), varintField(), zigzagField(), varintField(), varintField(),
+    varintField(true), fixedField(1), fixedField(1), zigzagField(), zigzagField() };
+
+constexpr PayloadSchema DATA_REPORT_SCHEMA = makeSchema(DATA_REPORT_FIELDS);
+constexpr PayloadSchema COMPACT_DATA_REPORT_SCHEMA = makeSchema(COMPACT_DATA_REPORT_FIELDS);
+
+// Data acknowledgement - values indexed by DataAckField
+enum DataAckField { ACK_MAGIC, ACK_TIME, ACK_FREQUENCY, ACK_ALERT, ACK_SENSOR_TYPE, ACK_OPEN_HOURS, ACK_MESSAGE_NUMBER, ACK_SLOT_OFFSET, ACK_SPREADING_FACTOR, ACK_TX_POWER, ACK_CHANNEL, ACK_FIELD_COUNT };
+
+constexpr PayloadField DATA_ACK_FIELDS[] = {
+    fixedField(2), fixedField(4), fixedField(2), fixedField(1), fixedField(1), fixedField(1), fixedField(1), fixedField(2),
+    fixedField(1), fixedField(1), fixedField(1) };
+constexpr PayloadField COMPACT_DATA_ACK_FIELDS[] = {
+    fixedField(2), fixedField(4), varintField(), varintField(true), varintField(), varintField(), fixedField(1), varintField(true),
+    varintField(true), varintField(true), varintField(true) };
+
+constexpr PayloadSchema DATA_ACK_SCHEMA = makeSchema(DATA_ACK_FIELDS);
+constexpr PayloadSchema COMPACT_DATA_ACK_SCHEMA = makeSchema(COMPACT_DATA_ACK_FIELDS);
+
+// Join acknowledgement - values indexed by JoinAckField
+enum JoinAckField { JACK_MAGIC, JACK_TIME, JACK_FREQUENCY, JACK_ALERT, JACK_NODE_NUMBER, JACK_SENSOR_TYPE, JACK_SLOT_OFFSET, JACK_CHANNEL, JACK_FIELD_COUNT };
+
+constexpr PayloadField JOIN_ACK_FIELDS[] = {
+    fixedField(2), fixedField(4), fixedField(2), fixedField(1), fixedField(1), fixedField(1), fixedField(2), fixedField(1) };
+
+constexpr PayloadSchema JOIN_ACK_SCHEMA = makeSchema(JOIN_ACK_FIELDS);
+
+// Batched data report - values indexed by BatchReportField.  The node's health and the first record; the later records
+// follow as varint deltas, read on from where the schema leaves off
+enum BatchReportField { BRPT_MAGIC, BRPT_NODE_ID, BRPT_VERSION, BRPT_SENSOR_TYPE, BRPT_TEMP, BRPT_BATT_CHG, BRPT_BATT_STATE,
+                        BRPT_RESETS, BRPT_MESSAGE_COUNT, BRPT_SUCCESS_COUNT, BRPT_RSSI, BRPT_SNR, BRPT_RECORD_COUNT,
+                        BRPT_TIMESTAMP, BRPT_HOURLY, BRPT_DAILY, BRPT_FIELD_COUNT };
+
+constexpr PayloadField BATCH_REPORT_FIELDS[] = {
+    fixedField(2), fixedField(2), fixedField(1), fixedField(1), fixedField(1), fixedField(1), fixedField(1), fixedField(1),
+    fixedField(1), fixedField(1), fixedField(2), fixedField(2), fixedField(1), fixedField(4), fixedField(2), fixedField(2) };
+
+constexpr PayloadSchema BATCH_REPORT_SCHEMA = makeSchema(BATCH_REPORT_FIELDS);
+
+static_assert(sizeof(DATA_REPORT_FIELDS) / sizeof(PayloadField) == RPT_FIELD_COUNT, "Data report schema out of step with its fields");
+static_assert(sizeof(COMPACT_DATA_REPORT_FIELDS) / sizeof(PayloadField) == RPT_FIELD_COUNT, "Compact data report schema out of step with its fields");
+static_assert(sizeof(DATA_ACK_FIELDS) / sizeof(PayloadField) == ACK_FIELD_COUNT, "Data ack schema out of step with its fields");
+static_assert(sizeof(COMPACT_DATA_ACK_FIELDS) / sizeof(PayloadField) == ACK_FIELD_COUNT, "Compact data ack schema out of step with its fields");
+static_assert(sizeof(JOIN_ACK_FIELDS) / sizeof(PayloadField) == JACK_FIELD_COUNT, "Join ack schema out of step with its fields");
+static_assert(sizeof(BATCH_REPORT_FIELDS) / sizeof(PayloadField) == BRPT_FIELD_COUNT, "Batch report schema out of step with its fields");
+
+#endif  /* __LORA_CODEC_H */
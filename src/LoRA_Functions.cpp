@@ -1,10 +1,12 @@
 #include "LoRA_Functions.h"
-#include <RHMesh.h>
+#include "PublishQueuePosixRK.h"
+#include <RHMeshETX.h>
 #include <RH_RF95.h>						        // https://docs.particle.io/reference/device-os/libraries/r/RH_RF95/
 #include "device_pinout.h"
 #include "MyPersistentData.h"
-#include "JsonParserGeneratorRK.h"
 #include "Particle_Functions.h"
+#include "LoRA_Codec.h"
+#include "ChannelPlan.h"
 
 // Singleton instantiation - from template
 LoRA_Functions *LoRA_Functions::_instance;
@@ -23,34 +25,45 @@ LoRA_Functions::LoRA_Functions() {
 LoRA_Functions::~LoRA_Functions() {
 }
 
-// ************************************************************************
-// ******** JSON Object - Scoped to LoRA_Functions Class        ***********
-// ************************************************************************
-// JSON for node data
-JsonParserStatic<1024, 50> jp;						// Make this global - reduce possibility of fragmentation
-
-
 // ************************************************************************
 // *****                      LoRA Setup                              *****
 // ************************************************************************
-// In this implementation - we have one gateway with a fixed node  number of 0 and up to 10 nodes with node numbers 1-10 ...
-// In an unconfigured node, there will be a node number of greater than 10 triggering a join request
-// Configured nodes will be stored in a JSON object by the gateway with three fields: node number, Particle deviceID and Time stamp of last contact
+// In this implementation - we have one gateway with a fixed node  number of 0 and up to nodeIDData::MAX_NODES (200) nodes with node numbers 1-200 ...
+// In an unconfigured node, there will be a node number of nodeIDData::UNCONFIGURED_NODE (254) triggering a join request
+// Configured nodes are stored by the gateway in a binary node table in FRAM (see nodeIDData) - the record for node n is at index n-1
 //
 const uint8_t GATEWAY_ADDRESS = 0;
-// const double RF95_FREQ = 915.0;				 	// Frequency - ISM
-const double RF95_FREQ = 926.84;				// Center frequency for the omni-directional antenna I am using
+const uint8_t ROUTE_HEADROOM = 16;					// Routes to addresses that are not nodes - unconfigured nodes (254) and stray addresses
+static_assert(RH_ROUTING_TABLE_SIZE >= nodeIDData::MAX_NODES + ROUTE_HEADROOM, "The mesh routing table must hold a route to every node and still have room to spare");
+static_assert(RH_ROUTING_TABLE_SIZE < 256, "The mesh routing table is indexed with uint8_t");
+const uint16_t HOP_TIMEOUT_MS = 2000;				// RHReliableDatagram timeout - a retry goes out 1 - 2 times this after the last try
+const uint16_t EXCHANGE_AIRTIME_MS = 2720;			// At SF11: data report 905ms, hop ack 496ms, data acknowledgement 823ms and its hop ack 496ms
+const uint16_t REPORT_AIRTIME_MS = 905;				// The report again, if the first try is lost
+const uint16_t ACK_AIRTIME_MS = 823;				// The data acknowledgement - its retry timeout starts once it is sent
+const uint16_t CLOCK_GUARD_MS = 2000;				// Node wake jitter (up to 1s) plus the node's clock being set to the whole second
+const uint16_t SLOT_SECONDS = (EXCHANGE_AIRTIME_MS + HOP_TIMEOUT_MS + REPORT_AIRTIME_MS + CLOCK_GUARD_MS + 999) / 1000;	// 8 - an exchange with one retry stays in its slot
+const uint16_t SLOT_GUARD_SECONDS = 30;				// Listen past the last occupied slot for retries and clock drift
+const uint16_t LISTEN_WAIT_MS = 500;				// Longest we block the loop waiting for the radio interrupt to queue a frame
+const uint16_t RETUNE_WAIT_MS = 50;					// Shorter wait in the last second of a slot - the next slot's channel is tuned to within this of it starting
+const uint8_t DEFAULT_SPREADING_FACTOR = 11;		// Bw125Cr45Sf2048 - every node can be heard at this rate, joins and fallbacks use it
+const uint8_t MIN_SPREADING_FACTOR = 7;				// SF7 takes about 1/16th the airtime of SF11
+const int8_t MAX_TX_POWER = 23;						// dBm on PA_BOOST - the default
+const int8_t MIN_TX_POWER = 5;
+const int8_t ADR_MARGIN_DB = 10;					// SNR a node's data rate keeps above the demodulation floor - for fades, foliage and people in the way
+const int8_t ADR_POWER_STEP_DB = 3;					// Transmit power comes down in steps of this much spare margin
+const int8_t ADR_FALLBACK_DB = 3;					// Taken off a node's SNR history each time it falls back to the default rate
+const int8_t ADR_SNR_UNKNOWN = -128;				// No report from the node since startup
 
 // Define the message flags
-typedef enum { NULL_STATE, JOIN_REQ, JOIN_ACK, DATA_RPT, DATA_ACK, ALERT_RPT, ALERT_ACK} LoRA_State;
-char loraStateNames[7][16] = {"Null", "Join Req", "Join Ack", "Data Report", "Data Ack", "Alert Rpt", "Alert Ack"};
+typedef enum { NULL_STATE, JOIN_REQ, JOIN_ACK, DATA_RPT, DATA_ACK, ALERT_RPT, ALERT_ACK, BATCH_RPT, COMPACT_RPT} LoRA_State;	// New types go on the end - these are sent over the air
+char loraStateNames[9][16] = {"Null", "Join Req", "Join Ack", "Data Report", "Data Ack", "Alert Rpt", "Alert Ack", "Batch Report", "Compact Report"};
 static LoRA_State lora_state = NULL_STATE;
 
 // Singleton instance of the radio driver
 RH_RF95 driver(RFM95_CS, RFM95_INT);
 
 // Class to manage message delivery and receipt, using the driver declared above
-RHMesh manager(driver, GATEWAY_ADDRESS);
+RHMeshETX manager(driver, GATEWAY_ADDRESS);
 
 // Mesh has much greater memory requirements, and you may need to limit the
 // max message length to prevent wierd crashes
@@ -63,6 +76,107 @@ RHMesh manager(driver, GATEWAY_ADDRESS);
 // #define RH_MESH_MAX_MESSAGE_LEN 50
 uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];               // Related to max message size - RadioHead example note: dont put this on the stack:
 
+const uint8_t BATCH_VERSION = 1;					// Batched data report format this gateway understands
+const uint8_t MAX_BATCH_RECORDS = 24;				// A day of hourly reports - more than a frame can hold
+struct BatchRecord {
+	time_t timestamp;
+	uint16_t hourly;
+	uint16_t daily;
+};
+BatchRecord batchRecords[MAX_BATCH_RECORDS];		// Records from the last batched report - waiting to be published
+uint8_t batchRecordCount = 0;
+uint8_t messageLen = 0;								// Length of the message in buf
+bool compactReport = false;							// The node sent a compact data report - so it gets a compact acknowledgement
+
+time_t windowStartTime = 0;							// When the current listening window opened
+uint8_t nodeLateSeconds[nodeIDData::MAX_NODES];		// Running average of how many seconds each node reports after its slot - RAM only, relearned after a reset
+int8_t nodeSnrLow[nodeIDData::MAX_NODES];			// Low water mark of each node's SNR at full power - drops at once, recovers 1dB a report. RAM only
+uint8_t radioSpreadingFactor = DEFAULT_SPREADING_FACTOR;	// What the gateway's radio is listening at now
+uint8_t radioChannel = 0;							// And on which channel - see ChannelPlan.h
+
+struct PendingAcknowledgement {						// An acknowledgement on its way to a node - the radio keeps receiving until its hop ack comes back
+	uint8_t handle;									// From manager.sendtoAsync() - 0 if the entry is free
+	uint8_t nodeNumber;
+	time_t slotEnd;									// Retries stop here if the next slot needs the radio on another channel or rate
+	time_t retryUntil;								// Otherwise here - after the first retry, which the node waiting in its slot is listening for
+	char message[128];								// Published as status once the node has it
+};
+PendingAcknowledgement pendingAcks[RH_RELIABLE_DATAGRAM_MAX_PENDING];
+
+static void slotTuning(time_t now, uint8_t &channel, uint8_t &spreadingFactor);
+
+static int8_t demodulationFloor(uint8_t spreadingFactor) {	// Lowest SNR in dB the SX1276 demodulates at - SF7 about -7.5dB, 2.5dB lower each step to SF12
+	return -5 - (int8_t)(spreadingFactor - 6) * 5 / 2;
+}
+
+static void clearAssignments(uint8_t nodeNumber) {	// Back to the default rate and power on channel 0 - what a node uses when unsure
+	StorageHelperRK::PersistentDataBase::Transaction transaction(routeTable);
+	routeTable.set_spreadingFactor(nodeNumber, 0);
+	routeTable.set_txPower(nodeNumber, 0);
+	routeTable.set_channel(nodeNumber, 0);
+}
+
+static void acknowledgementComplete(uint8_t handle, uint8_t attempts, bool acked) {	// Called by the manager once a node has its acknowledgement or the retries run out
+	for (PendingAcknowledgement &ack : pendingAcks) {
+		if (ack.handle != handle) continue;
+		// Assignments stay as they are either way - a node sleeps once it has its acknowledgement, so a lost hop ack usually means
+		// it has the new rate and channel.  If it does not, it misses its next slot and resetUnheardAssignments() catches that
+		if (!acked) Log.info("Node %d response not acknowledged after %d tries", ack.nodeNumber, attempts);
+		else {
+			Log.info(ack.message);
+			if (Particle.connected()) Particle.publish("status", ack.message, PRIVATE);
+		}
+		ack.handle = 0;
+		return;
+	}
+}
+
+static bool sendAcknowledgement(uint8_t nodeAddress, uint8_t len, uint8_t flags, const char *message) {	// Queues the acknowledgement in buf - false if it could not be sent
+	PendingAcknowledgement *ack = nullptr;
+	for (PendingAcknowledgement &entry : pendingAcks) {
+		if (entry.handle == 0) {
+			ack = &entry;
+			break;
+		}
+	}
+	uint8_t handle = 0;
+	uint8_t result = (ack) ? manager.sendtoAsync(buf, len, nodeAddress, flags, &handle) : (uint8_t)RH_ROUTER_ERROR_BUSY;
+	if (result != RH_ROUTER_ERROR_NONE) {
+		Log.info("Node %d acknowledgement could not be sent - error %d", nodeAddress, result);
+		return false;
+	}
+	time_t secondsPerPeriod = sysStatus.get_frequencyMinutes() * 60;
+	time_t now = Time.now();										// Read once - a second tick between two reads would put slotEnd a slot late
+	ack->handle = handle;
+	ack->nodeNumber = current.get_nodeNumber();
+	ack->slotEnd = now - (now % secondsPerPeriod) % SLOT_SECONDS + SLOT_SECONDS;
+	ack->retryUntil = max(ack->slotEnd, now + (ACK_AIRTIME_MS + 2 * HOP_TIMEOUT_MS + 999) / 1000);	// A report late in its slot still gets a retry
+	snprintf(ack->message, sizeof(ack->message), "%s", message);
+	return true;
+}
+
+static void expireAcknowledgements() {				// Gives up on acknowledgements that hold the radio past their time - they are completed as not acknowledged
+	time_t now = Time.now();
+	uint8_t channel, spreadingFactor;
+	slotTuning(now, channel, spreadingFactor);
+	bool retune = channel != radioChannel || spreadingFactor != radioSpreadingFactor;	// The slot we are in has a node on another channel or rate
+	for (PendingAcknowledgement &ack : pendingAcks) {
+		if (ack.handle == 0 || now < ((retune) ? ack.slotEnd : ack.retryUntil)) continue;
+		Log.info("Node %d acknowledgement given up %s", ack.nodeNumber, (retune) ? "- the next slot needs the radio" : "after its retry");
+		if (!manager.cancelSend(ack.handle)) ack.handle = 0;	// Already completed - the entry is free
+	}
+}
+
+static void tuneRadio(uint8_t channel, uint8_t spreadingFactor) {
+	driver.setModeIdle();							// Retuned in standby - the next look at the receive queue turns the receiver back on
+	driver.setFrequency(channelFrequency(channel));
+	driver.setSpreadingFactor(spreadingFactor);
+	driver.setLowDatarate();						// Symbol time changes with the spreading factor
+	manager.setSnrRange(demodulationFloor(spreadingFactor), 10);	// Links within 10dB of the floor lose packets
+	radioChannel = channel;
+	radioSpreadingFactor = spreadingFactor;
+}
+
 bool LoRA_Functions::setup(bool gatewayID) {
     // Set up the Radio Module
 	LoRA_Functions::initializeRadio();
@@ -70,31 +184,25 @@ bool LoRA_Functions::setup(bool gatewayID) {
 	if (gatewayID == true) {
 		sysStatus.set_nodeNumber(GATEWAY_ADDRESS);							// Gateway - Manager is initialized by default with GATEWAY_ADDRESS - make sure it is stored in FRAM
 		Log.info("LoRA Radio initialized as a gateway (address %d) with a deviceID of %s", GATEWAY_ADDRESS, System.deviceID().c_str());
+		for (uint8_t i = 0; i < nodeIDData::MAX_NODES; i++) nodeSnrLow[i] = ADR_SNR_UNKNOWN;
 	}
-	else if (sysStatus.get_nodeNumber() > 0 && sysStatus.get_nodeNumber() <= 10) {
+	else if (sysStatus.get_nodeNumber() > 0 && sysStatus.get_nodeNumber() <= nodeIDData::MAX_NODES) {
 		manager.setThisAddress(sysStatus.get_nodeNumber());// Node - use the Node address in valid range from memory
 		Log.info("LoRA Radio initialized as node %i and a deviceID of %s", manager.thisAddress(), System.deviceID().c_str());
 	}
 	else {																						// Else, we will set as an unconfigured node
-		sysStatus.set_nodeNumber(11);
-		manager.setThisAddress(11);
+		sysStatus.set_nodeNumber(nodeIDData::UNCONFIGURED_NODE);
+		manager.setThisAddress(nodeIDData::UNCONFIGURED_NODE);
 		Log.info("LoRA Radio initialized as an unconfigured node %i and a deviceID of %s", manager.thisAddress(), System.deviceID().c_str());
 	}
 
-	// Here is where we load the JSON object from memory and parse
-	jp.addString(nodeDatabase.get_nodeIDJson());				// Read in the JSON string from memory
-	Log.info("The node string is: %s",nodeDatabase.get_nodeIDJson().c_str());
-
-	if (jp.parse()) Log.info("Parsed Successfully");
-	else {
-		nodeDatabase.resetNodeIDs();
-		Log.info("Parsing error resetting nodeID database");
-	}
+	Log.info("The node table has %d of %d nodes configured", nodeDatabase.get_nodeCount(), nodeIDData::MAX_NODES);
 	return true;
 }
 
 void LoRA_Functions::loop() {
-												
+	expireAcknowledgements();
+	manager.pollSends();							// Retries acknowledgements still waiting on their hop ack - in every state, not just while listening
 }
 
 
@@ -111,6 +219,9 @@ void LoRA_Functions::clearBuffer() {
 }
 
 void LoRA_Functions::sleepLoRaRadio() {
+	LoRA_Functions::instance().resetUnheardAssignments();	// Before the routes are saved - they are written together
+	LoRA_Functions::instance().saveRoutes();			// Keep what the mesh learned this window for after a reset
+	if (driver.rxOverflow()) Log.info("Radio receive queue overflowed - %d frames dropped since startup", driver.rxOverflow());
 	driver.sleep();                             	// Here is where we will power down the LoRA radio module
 }
 
@@ -124,15 +235,46 @@ bool  LoRA_Functions::initializeRadio() {  			// Set up the Radio Module
 		Log.info("init failed");					// Defaults after init are 434.0MHz, 0.05MHz AFC pull-in, modulation FSK_Rb2_4Fd36
 		return false;
 	}
-	driver.setFrequency(RF95_FREQ);					// Frequency is typically 868.0 or 915.0 in the Americas, or 433.0 in the EU - Are there more settings possible here?
+	driver.setFrequency(channelFrequency(0));		// Frequency is typically 868.0 or 915.0 in the Americas, or 433.0 in the EU - see ChannelPlan.h
 	driver.setTxPower(23, false);                   // If you are using RFM95/96/97/98 modules which uses the PA_BOOST transmitter pin, then you can set transmitter powers from 5 to 23 dBm (13dBm default).  PA_BOOST?
 	driver.setModemConfig(RH_RF95::Bw125Cr45Sf2048);
 	//driver.setModemConfig(RH_RF95::Bw125Cr48Sf4096);	// This optimized the radio for long range - https://www.airspayce.com/mikem/arduino/RadioHead/classRH__RF95.html
 	driver.setLowDatarate();						// https://www.airspayce.com/mikem/arduino/RadioHead/classRH__RF95.html#a8e2df6a6d2cb192b13bd572a7005da67
-	manager.setTimeout(2000);						// 200mSec is the default - may need to extend once we play with other settings on the modem - https://www.airspayce.com/mikem/arduino/RadioHead/classRHReliableDatagram.html
+	manager.setTimeout(HOP_TIMEOUT_MS);						// 200mSec is the default - may need to extend once we play with other settings on the modem - https://www.airspayce.com/mikem/arduino/RadioHead/classRHReliableDatagram.html
+	manager.setSendCallback(acknowledgementComplete);	// Acknowledgements are sent without waiting - see sendAcknowledgement()
+	tuneRadio(0, DEFAULT_SPREADING_FACTOR);			// Nodes switch to their own channel and data rate only in their slot - see tuneToSlot()
+	LoRA_Functions::instance().restoreRoutes();		// Otherwise each node's first acknowledgement waits on a route discovery
 return true;
 }
 
+void LoRA_Functions::restoreRoutes() {
+	uint8_t restored = 0;
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeIDData::MAX_NODES; nodeNumber++) {
+		uint8_t nextHop = routeTable.get_nextHop(nodeNumber);
+		if (nextHop == 0 || !nodeDatabase.nodeInTable(nodeNumber)) continue;
+		manager.addRouteTo(nodeNumber, nextHop);
+		restored++;
+	}
+	if (restored) Log.info("Restored %d mesh routes from FRAM", restored);
+}
+
+void LoRA_Functions::saveRoutes() {
+	uint8_t aged = manager.ageRoutes();				// Routes through weak or silent relays - the next report will bring a better one
+	if (aged) Log.info("Dropped %d mesh routes through degraded links", aged);
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeIDData::MAX_NODES; nodeNumber++) {
+		RHRouter::RoutingTableEntry *route = manager.getRouteTo(nodeNumber);
+		uint8_t nextHop = (route && route->state == RHRouter::Valid && route->next_hop <= nodeIDData::MAX_NODES) ? route->next_hop : 0;
+		routeTable.set_nextHop(nodeNumber, nextHop);	// Only marked to be written if it changed
+	}
+}
+
+void LoRA_Functions::learnRoute(uint8_t from, uint8_t lastHop, uint8_t hops) {
+	manager.offerRoute(from, lastHop, (lastHop == from) ? 0 : hops);	// Kept only if fewer transmissions are expected than the route we have
+	if (lastHop != from) manager.offerRoute(lastHop, lastHop, 0);	// The relay is in range too
+	RHRouter::RoutingTableEntry *route = manager.getRouteTo(from);
+	if (route && nodeDatabase.nodeInTable(from) && route->next_hop <= nodeIDData::MAX_NODES) routeTable.set_nextHop(from, route->next_hop);
+}
+
 
 // ************************************************************************
 // *****                      Gateway Functions                       *****
@@ -141,20 +283,29 @@ return true;
 // Common across message types - these messages are general for send and receive
 
 bool LoRA_Functions::listenForLoRAMessageGateway() {
-	uint8_t len = sizeof(buf);
+	uint8_t len = sizeof(buf) - 1;													// Leave room for the terminator
 	uint8_t from;  
 	uint8_t dest;
 	uint8_t id;
 	uint8_t messageFlag;
 	uint8_t hops;
+	expireAcknowledgements();														// Before tuning - an acknowledgement from the last slot would hold the radio
+	LoRA_Functions::instance().tuneToSlot();										// The channel and rate of the slot we are in - frames already queued are not affected
+	uint32_t waitMs = ((Time.now() + 1) % SLOT_SECONDS == 0) ? RETUNE_WAIT_MS : LISTEN_WAIT_MS;
+	waitMs = min(waitMs, manager.pollSends());										// Wake in time to retry an acknowledgement
+	if (!driver.waitAvailableTimeout(waitMs)) return false;							// Sleeps on the radio interrupt until it queues a frame - no polling
 	if (manager.recvfromAck(buf, &len, &from, &dest, &id, &messageFlag, &hops))	{	// We have received a message - need to validate it
 		buf[len] = 0;
+		messageLen = len;
+		batchRecordCount = 0;														// Only a batched report leaves records to publish
 
 		// First we will validate that this node belongs in this network by checking the magic number
 		if (!((buf[0] << 8 | buf[1]) == sysStatus.get_magicNumber())) {
 			Log.info("Node %d message magic number of %d did not match the Magic Number in memory %d - Ignoring", current.get_nodeNumber(),(buf[0] << 8 | buf[1]), sysStatus.get_magicNumber());
 			return false;
 		}
+		LoRA_Functions::instance().learnRoute(from, manager.headerFrom(), hops);	// The acknowledgement goes back the best way reports have come - no route discovery
+		StorageHelperRK::PersistentDataBase::Transaction transaction(current);	// One rehash and save for all the fields this message sets
 		current.set_nodeNumber(from);												// Captures the nodeNumber 
 		current.set_tempNodeNumber(0);												// Clear for new response
 		current.set_hops(hops);														// How many hops to get here
@@ -163,19 +314,25 @@ bool LoRA_Functions::listenForLoRAMessageGateway() {
 		Log.info("Node %d with ID %d a %s message with RSSI/SNR of %d / %d in %d hops", current.get_nodeNumber(), current.get_nodeID(), loraStateNames[lora_state], driver.lastRssi(), driver.lastSNR(), current.get_hops());
 
 		// Next we need to test the nodeNumber / deviceID to make sure this node is properly configured
-		if (current.get_nodeNumber() < 11 && !LoRA_Functions::instance().nodeConfigured(current.get_nodeNumber(),current.get_nodeID())) {
+		if (current.get_nodeNumber() <= nodeIDData::MAX_NODES && !LoRA_Functions::instance().nodeConfigured(current.get_nodeNumber(),current.get_nodeID())) {
 			Log.info("Node not properly configured, resetting node number");
 			current.set_tempNodeNumber(current.get_nodeNumber());					// Store node number in temp for the repsonse
-			current.set_nodeNumber(11);												// Set node number to 11
+			current.set_nodeNumber(nodeIDData::UNCONFIGURED_NODE);					// Set node number to unconfigured
 		}
-		else if (current.get_nodeNumber() >= 11) {
+		else if (current.get_nodeNumber() > nodeIDData::MAX_NODES) {
 			current.set_tempNodeNumber(from);										// We need this address for the reply					
-			current.set_nodeNumber(11);												// This way an unconfigured nor invalid node ends up wtih a node number of 11
+			current.set_nodeNumber(nodeIDData::UNCONFIGURED_NODE);					// This way an unconfigured nor invalid node ends up wtih the unconfigured node number
 		}
 
-		if (lora_state == DATA_RPT) {if(!LoRA_Functions::instance().decipherDataReportGateway()) return false;}
-		else if (lora_state == JOIN_REQ) {if(!LoRA_Functions::instance().decipherJoinRequestGateway()) return false;}
-		else {Log.info("Invalid message flag, returning"); return false;}
+		bool deciphered = false;
+		if (lora_state == DATA_RPT || lora_state == COMPACT_RPT) deciphered = LoRA_Functions::instance().decipherDataReportGateway();
+		else if (lora_state == BATCH_RPT) deciphered = LoRA_Functions::instance().decipherBatchReportGateway();
+		else if (lora_state == JOIN_REQ) deciphered = LoRA_Functions::instance().decipherJoinRequestGateway();
+		else Log.info("Invalid message flag, returning");
+		if (!deciphered) {
+			transaction.rollback();													// A bad message leaves current as it was
+			return false;
+		}
 
 		// At this point the message is valid and has been deciphered - now we need to send a response - if there is a change in freuqency, it is applied here
 		if (sysStatus.get_updatedFrequencyMinutes() > 0) {              			// If we are to change the update frequency, we need to tell the nodes (or at least one node) about it.
@@ -188,7 +345,6 @@ bool LoRA_Functions::listenForLoRAMessageGateway() {
 		else if (lora_state == JOIN_ACK) { if(LoRA_Functions::instance().acknowledgeJoinRequestGateway()) return true;}
 		else {Log.info("Invalid message flag"); return false;}
 	}
-	else LoRA_Functions::clearBuffer();
 	return false;
 
 }
@@ -196,39 +352,108 @@ bool LoRA_Functions::listenForLoRAMessageGateway() {
 // These are the receive and respond messages for data reports
 
 bool LoRA_Functions::decipherDataReportGateway() {			// Receives the data report and loads results into current object for reporting
-	current.set_hourlyCount(buf[4] << 8 | buf[5]);
-	current.set_dailyCount(buf[6] << 8 | buf[7]);
-	current.set_sensorType(buf[8]);
-	current.set_internalTempC(buf[9]);
-	current.set_stateOfCharge(buf[10]);
-	current.set_batteryState(buf[11]);
-	current.set_resetCount(buf[12]);
-	current.set_messageCount(buf[13]);
-	current.set_successCount(buf[14]);
-	current.set_RSSI(buf[15] << 8 | buf[16]);				// These values are from the node based on the last successful data report
-	current.set_SNR(buf[17] << 8 | buf[18]);
+	uint32_t field[RPT_FIELD_COUNT];
+	compactReport = (lora_state == COMPACT_RPT);
+	const PayloadSchema &schema = (compactReport) ? COMPACT_DATA_REPORT_SCHEMA : DATA_REPORT_SCHEMA;
+	if (!schema.decode(buf, messageLen, field)) {
+		Log.info("Data report too short (%d bytes)", messageLen);
+		return false;
+	}
+	current.set_hourlyCount(field[RPT_HOURLY]);
+	current.set_dailyCount(field[RPT_DAILY]);
+	current.set_sensorType(field[RPT_SENSOR_TYPE]);
+	current.set_internalTempC(field[RPT_TEMP]);
+	current.set_stateOfCharge(field[RPT_BATT_CHG]);
+	current.set_batteryState(field[RPT_BATT_STATE]);
+	current.set_resetCount(field[RPT_RESETS]);
+	current.set_messageCount(field[RPT_MESSAGE_COUNT]);
+	current.set_successCount(field[RPT_SUCCESS_COUNT]);
+	current.set_RSSI(field[RPT_RSSI]);						// These values are from the node based on the last successful data report
+	current.set_SNR(field[RPT_SNR]);
 
 	lora_state = DATA_ACK;		// Prepare to respond
 	return true;
 }
 
+bool LoRA_Functions::decipherBatchReportGateway() {		// Receives a batched data report - node health once, then the records
+	uint32_t field[BRPT_FIELD_COUNT];
+	PayloadReader reader(buf, messageLen);
+	if (!BATCH_REPORT_SCHEMA.decode(reader, field)) {			// Leaves the reader at the second record
+		Log.info("Batched report too short (%d bytes)", messageLen);
+		return false;
+	}
+	compactReport = false;
+	if (field[BRPT_VERSION] != BATCH_VERSION) {
+		Log.info("Batched report version %d not supported", (int)field[BRPT_VERSION]);
+		return false;
+	}
+	current.set_sensorType(field[BRPT_SENSOR_TYPE]);
+	current.set_internalTempC(field[BRPT_TEMP]);
+	current.set_stateOfCharge(field[BRPT_BATT_CHG]);
+	current.set_batteryState(field[BRPT_BATT_STATE]);
+	current.set_resetCount(field[BRPT_RESETS]);
+	current.set_messageCount(field[BRPT_MESSAGE_COUNT]);
+	current.set_successCount(field[BRPT_SUCCESS_COUNT]);
+	current.set_RSSI(field[BRPT_RSSI]);
+	current.set_SNR(field[BRPT_SNR]);
+
+	uint8_t records = field[BRPT_RECORD_COUNT];
+	if (records == 0 || records > MAX_BATCH_RECORDS) {
+		Log.info("Batched report with %d records - ignoring", records);
+		return false;
+	}
+
+	BatchRecord record;
+	record.timestamp = (time_t)field[BRPT_TIMESTAMP];
+	record.hourly = field[BRPT_HOURLY];
+	record.daily = field[BRPT_DAILY];
+	batchRecords[0] = record;
+
+	for (uint8_t i = 1; i < records; i++) {
+		record.timestamp += reader.getVarint();
+		record.hourly = reader.getVarint();
+		record.daily = record.daily + reader.getZigzag();
+		if (!reader.ok()) {
+			Log.info("Batched report truncated at record %d of %d", i, records);
+			return false;
+		}
+		batchRecords[i] = record;
+	}
+	batchRecordCount = records;
+
+	current.set_hourlyCount(record.hourly);				// The newest record is the node's current state
+	current.set_dailyCount(record.daily);
+	Log.info("Batched report with %d records from %s", records, Time.timeStr(batchRecords[0].timestamp).c_str());
+
+	lora_state = DATA_ACK;		// Same acknowledgement as a single data report
+	return true;
+}
+
+uint8_t LoRA_Functions::getBatchRecordCount() {
+	return batchRecordCount;
+}
+
+time_t LoRA_Functions::getBatchRecord(uint8_t index, uint16_t &hourly, uint16_t &daily) const {
+	if (index >= batchRecordCount) return 0;
+	hourly = batchRecords[index].hourly;
+	daily = batchRecords[index].daily;
+	return batchRecords[index].timestamp;
+}
+
 bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to a data message 
 	char messageString[128];
+	uint32_t field[ACK_FIELD_COUNT];
 
-	// buf[0] - buf[1] is magic number - processed above
-	buf[2] = ((uint8_t) ((Time.now()) >> 24)); 		// Fourth byte - current time
-	buf[3] = ((uint8_t) ((Time.now()) >> 16));		// Third byte
-	buf[4] = ((uint8_t) ((Time.now()) >> 8));		// Second byte
-	buf[5] = ((uint8_t) (Time.now()));		    	// First byte			
-	buf[6] = highByte(sysStatus.get_frequencyMinutes());	// Frequency of reports set by the gateway
-	buf[7] = lowByte(sysStatus.get_frequencyMinutes());	
+	field[ACK_MAGIC] = sysStatus.get_magicNumber();
+	field[ACK_TIME] = Time.now();						// Set the node's clock
+	field[ACK_FREQUENCY] = sysStatus.get_frequencyMinutes();	// Frequency of reports set by the gateway
 	// The next few bytes of the response will depend on whether the node is configured or not
-	if (current.get_nodeNumber() == 11) {			// This is a data report from an unconfigured node - need to tell it to rejoin
+	if (current.get_nodeNumber() == nodeIDData::UNCONFIGURED_NODE) {			// This is a data report from an unconfigured node - need to tell it to rejoin
 		Log.info("Node %d is invalid, setting alert code to 1", current.get_nodeNumber());
 		current.set_alertCodeNode(1);				// This will ensure the node rejoins the network
 		current.set_alertTimestampNode(Time.now());
-		buf[8] = current.get_alertCodeNode();												
-		buf[9] = current.get_sensorType();			// Since the node is unconfigured, we need to beleive it when it tells us the type
+		field[ACK_ALERT] = current.get_alertCodeNode();
+		field[ACK_SENSOR_TYPE] = current.get_sensorType();	// Since the node is unconfigured, we need to beleive it when it tells us the type
 	}
 	else {											// This is a data report from a configured node - will use the node database
 		current.set_alertCodeNode(LoRA_Functions::getAlert(current.get_nodeNumber()));
@@ -238,12 +463,12 @@ bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to
 			int newSensorType = LoRA_Functions::getType(current.get_nodeNumber());
 			Log.info("In data acknowledge, changing type to from %d to %d", current.get_sensorType(), newSensorType );
 			current.set_sensorType(newSensorType);	// Update current value for data report
-			buf[9] = newSensorType;
+			field[ACK_SENSOR_TYPE] = newSensorType;
 		}
-		else buf[9] = current.get_sensorType();
+		else field[ACK_SENSOR_TYPE] = current.get_sensorType();
 
 		if (current.get_alertCodeNode() != 0) LoRA_Functions::changeAlert(current.get_nodeNumber(),0); 	// The alert was serviced or applied - no longer pending
-		buf[8] = current.get_alertCodeNode();
+		field[ACK_ALERT] = current.get_alertCodeNode();
 
 		// At this point we can update the last connection time in the node database
 		float successPercent;
@@ -252,8 +477,15 @@ bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to
 		LoRA_Functions::instance().nodeUpdate(current.get_nodeNumber(), successPercent);
 
 	}
-	buf[10] = current.get_openHours();
-	buf[11] = current.get_messageCount();			// Repeat back message number
+	field[ACK_OPEN_HOURS] = current.get_openHours();
+	field[ACK_MESSAGE_NUMBER] = current.get_messageCount();	// Repeat back message number
+	field[ACK_SLOT_OFFSET] = LoRA_Functions::getSlotOffset(current.get_nodeNumber());	// When this node should report next period
+	LoRA_Functions::instance().adaptDataRate(current.get_nodeNumber());			// Unconfigured nodes stay on the defaults
+	LoRA_Functions::instance().assignChannel(current.get_nodeNumber(), false);
+	field[ACK_SPREADING_FACTOR] = routeTable.get_spreadingFactor(current.get_nodeNumber());	// Data rate and channel for the next report - the node switches after this exchange
+	field[ACK_TX_POWER] = routeTable.get_txPower(current.get_nodeNumber());
+	field[ACK_CHANNEL] = routeTable.get_channel(current.get_nodeNumber());
+	uint8_t len = ((compactReport) ? COMPACT_DATA_ACK_SCHEMA : DATA_ACK_SCHEMA).encode(field, buf, sizeof(buf));	// Answer in the format the node used
 
 	// nodeDatabase.flush(true);					// Save updates to the nodID database
 	// current.flush(true);							// Save values reported by the nodes
@@ -261,19 +493,11 @@ bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to
 
 	byte nodeAddress = (current.get_tempNodeNumber() == 0) ? current.get_nodeNumber() : current.get_tempNodeNumber();  // get the return address right
 
-	if (manager.sendtoWait(buf, 12, nodeAddress, DATA_ACK) == RH_ROUTER_ERROR_NONE) {
-		digitalWrite(BLUE_LED,LOW);
-
-		snprintf(messageString,sizeof(messageString),"Node %d data report %d acknowledged with alert %d, and RSSI / SNR of %d / %d", current.get_nodeNumber(), buf[10], buf[8], current.get_RSSI(), current.get_SNR());
-		Log.info(messageString);
-		if (Particle.connected()) Particle.publish("status", messageString,PRIVATE);
-		return true;
-	}
-	else {
-		Log.info("Node %d data report response not acknowledged", nodeAddress);
-		digitalWrite(BLUE_LED,LOW);
-		return false;
-	}
+	snprintf(messageString,sizeof(messageString),"Node %d data report %d acknowledged with alert %d, SF%d at %ddBm on channel %d and RSSI / SNR of %d / %d", current.get_nodeNumber(), (int)field[ACK_MESSAGE_NUMBER], (int)field[ACK_ALERT], (field[ACK_SPREADING_FACTOR]) ? (int)field[ACK_SPREADING_FACTOR] : DEFAULT_SPREADING_FACTOR, (field[ACK_TX_POWER]) ? (int)field[ACK_TX_POWER] : MAX_TX_POWER, (int)field[ACK_CHANNEL], current.get_RSSI(), current.get_SNR());
+	bool sent = sendAcknowledgement(nodeAddress, len, DATA_ACK, messageString);	// Status is published when the node has it
+	digitalWrite(BLUE_LED,LOW);
+	if (!sent && nodeDatabase.nodeInTable(current.get_nodeNumber())) clearAssignments(current.get_nodeNumber());
+	return sent;
 }
 
 
@@ -302,334 +526,193 @@ bool LoRA_Functions::decipherJoinRequestGateway() {			// Ths only question here
 
 bool LoRA_Functions::acknowledgeJoinRequestGateway() {
 	char messageString[128];
+	uint32_t field[JACK_FIELD_COUNT];
 	Log.info("Acknowledge Join Request");
 	// This is a response to a data message and a specific payload and message flag
 	// Send a reply back to the originator client
      
-	buf[0] = highByte(sysStatus.get_magicNumber());					// Magic number - so you can trust me
-	buf[1] = lowByte(sysStatus.get_magicNumber());					// Magic number - so you can trust me
-	buf[2] = ((uint8_t) ((Time.now()) >> 24));  					// Fourth byte - current time
-	buf[3] = ((uint8_t) ((Time.now()) >> 16));						// Third byte
-	buf[4] = ((uint8_t) ((Time.now()) >> 8));						// Second byte
-	buf[5] = ((uint8_t) (Time.now()));		    					// First byte		
-	buf[6] = highByte(sysStatus.get_frequencyMinutes());			// Frequency of reports - for Gateways
-	buf[7] = lowByte(sysStatus.get_frequencyMinutes());	
-	buf[8] = (current.get_nodeNumber() != 11) ?  0 : 1;				// Clear the alert code for the node unless the nodeNumber process failed
-	buf[9] = current.get_nodeNumber();								
-	buf[10] = current.get_sensorType();								// In a join request the node type overwrites the node database value
-
+	field[JACK_MAGIC] = sysStatus.get_magicNumber();				// Magic number - so you can trust me
+	field[JACK_TIME] = Time.now();									// Set the node's clock
+	field[JACK_FREQUENCY] = sysStatus.get_frequencyMinutes();		// Frequency of reports - for Gateways
+	field[JACK_ALERT] = (current.get_nodeNumber() != nodeIDData::UNCONFIGURED_NODE) ?  0 : 1;	// Clear the alert code for the node unless the nodeNumber process failed
+	field[JACK_NODE_NUMBER] = current.get_nodeNumber();
+	field[JACK_SENSOR_TYPE] = current.get_sensorType();				// In a join request the node type overwrites the node database value
+	field[JACK_SLOT_OFFSET] = LoRA_Functions::getSlotOffset(current.get_nodeNumber());	// When this node should report
+	if (nodeDatabase.nodeInTable(current.get_nodeNumber())) {
+		clearAssignments(current.get_nodeNumber());					// A new node starts at the default data rate
+		nodeSnrLow[current.get_nodeNumber() - 1] = ADR_SNR_UNKNOWN;
+		LoRA_Functions::instance().assignChannel(current.get_nodeNumber(), true);
+	}
+	field[JACK_CHANNEL] = routeTable.get_channel(current.get_nodeNumber());	// Where to report from the next period
+	uint8_t len = JOIN_ACK_SCHEMA.encode(field, buf, sizeof(buf));
 
 	digitalWrite(BLUE_LED,HIGH);			        				// Sending data
 
 	byte nodeAddress = (current.get_tempNodeNumber() == 0) ? current.get_nodeNumber() : current.get_tempNodeNumber();  // get the return address right
 
-	Log.info("Sending response to %d with free memory = %li", nodeAddress, System.freeMemory());
+	Log.info("Sending response to %d with free memory = %lu", nodeAddress, (unsigned long)System.freeMemory());
 
-	if (manager.sendtoWait(buf, 11, nodeAddress, JOIN_ACK) == RH_ROUTER_ERROR_NONE) {
-		current.set_tempNodeNumber(0);								// Temp no longer needed
-		digitalWrite(BLUE_LED,LOW);
-		snprintf(messageString,sizeof(messageString),"Node %d joined with sensorType %s, alert %d and RSSI / SNR of %d / %d", nodeAddress, (buf[10] ==0)? "car":"person",current.get_alertCodeNode(), current.get_RSSI(), current.get_SNR());
-		Log.info(messageString);
-		if (Particle.connected()) Particle.publish("status", messageString,PRIVATE);
-		return true;
-	}
-	else {
-		Log.info("Node %d join response not acknowledged", current.get_tempNodeNumber()); // Acknowledgement not received - this needs more attention as node is in undefined state
-		digitalWrite(BLUE_LED,LOW);
-		return false;
-	}
+	snprintf(messageString,sizeof(messageString),"Node %d joined with sensorType %s, alert %d, channel %d and RSSI / SNR of %d / %d", nodeAddress, (field[JACK_SENSOR_TYPE] == 0)? "car":"person",current.get_alertCodeNode(), (int)field[JACK_CHANNEL], current.get_RSSI(), current.get_SNR());
+	bool sent = sendAcknowledgement(nodeAddress, len, JOIN_ACK, messageString);	// Status is published when the node has it
+	digitalWrite(BLUE_LED,LOW);
+	if (sent) current.set_tempNodeNumber(0);						// Temp no longer needed
+	else if (nodeDatabase.nodeInTable(current.get_nodeNumber())) clearAssignments(current.get_nodeNumber());	// If it did join it reports on channel 0
+	return sent;
 }
 
 // ************************************************************************
 // *****             Node Management  Functions                       *****
 // ************************************************************************
 
-/* NodeID JSON structure
-{nodes:[
-	{
-		{node:(int)nodeNumber},
-		{dID: (String)deviceID},
-		{rID: (int)radioID},
-		{last: (time_t)lastConnectTime},
-		{type: (int)sensorType},
-		{succ: (float)successfulSent%},
-		{pend: (int)pendingAlerts}
-	},
-	....]
-}
+/* Node table record - see nodeIDData::NodeRecord
+	node number - implied by the position in the table (record n-1 is node n)
+	deviceID - 24 character Particle deviceID packed into 12 bytes
+	radioID - checksum of the deviceID
+	lastConnect - time_t of the last contact
+	sensorType - (int)sensorType
+	successPercent - (float)successfulSent%
+	pendingAlert - (int)pendingAlerts
 */
 
 
-// These functions access data in the nodeID JSON
+// These functions access data in the node table
 uint8_t LoRA_Functions::findNodeNumber(const char* deviceID, int radioID) {
-	int index=1;															// Variables to hold values for the function
-	String nodeDeviceID;
-	int nodeNumber;
+	uint8_t nodeNumber;
 
 	if (radioID != LoRA_Functions::stringCheckSum(deviceID)) {
-		Log.info("DeviceID and checksum mismatch - setting node to 11");
-		return 11;															// Return value for unconfigured node
+		Log.info("DeviceID and checksum mismatch - setting node to unconfigured");
+		return nodeIDData::UNCONFIGURED_NODE;								// Return value for unconfigured node
 	}
 	else Log.info("Checksum validated");
 
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	for (int i=0; i<10; i++) {												// Iterate through the array looking for a match
-		nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, i);
-		if(nodeObjectContainer == NULL) {
-			Log.info("findNodeNumber ran out of entries at i = %d",i);
-			break;															// Ran out of entries - no match found
-		} 
-		jp.getValueByKey(nodeObjectContainer, "dID", nodeDeviceID);			// Get the deviceID and compare
-		if (nodeDeviceID == deviceID) {
-			jp.getValueByKey(nodeObjectContainer, "node", nodeNumber);		// A match!
-			return nodeNumber;												// All is good - return node number for the deviceID passed to the function
-		}
-		index++;															// This will be the node number for the next node if no match is found
-	}
+	nodeNumber = nodeDatabase.findNode(deviceID);							// Hash index lookup on the deviceID
+	if (nodeNumber > 0) return nodeNumber;									// All is good - return node number for the deviceID passed to the function
+
 	// If we got to here, the deviceID was not a match for any entry and a new nodeNumer will be assigned
-	nodeNumber = index;
-	JsonModifier mod(jp);
+	nodeNumber = nodeDatabase.addNode(deviceID, radioID);
+	if (nodeNumber == 0) {
+		Log.info("Could not add deviceID %s to the node table - setting node to unconfigured", deviceID);
+		return nodeIDData::UNCONFIGURED_NODE;
+	}
 
 	Log.info("New node will be assigned number %d, deviceID of %s",nodeNumber, deviceID);
+	nodeDatabase.set_lastConnect(nodeNumber, Time.now());
+	nodeDatabase.set_sensorType(nodeNumber, 3);								// This is a temp value that will be updated
 
-	mod.startAppend(jp.getOuterArray());
-		mod.startObject();
-		mod.insertKeyValue("node", nodeNumber);
-		mod.insertKeyValue("dID", deviceID);
-		mod.insertKeyValue("rID",radioID);
-		mod.insertKeyValue("last", Time.now());
-		mod.insertKeyValue("type", (int)3);									// This is a temp value that will be updated
-		mod.insertKeyValue("succ",(float)0.0);								// This is a temp value that will be updated
-		mod.insertKeyValue("pend",(int)0);
-		mod.finishObjectOrArray();
-	mod.finish();
-
-	nodeDatabase.set_nodeIDJson(jp.getBuffer());									// This should backup the nodeID database - now updated to persistent storage
-
-	return index;
+	return nodeNumber;
 }
 
-String LoRA_Functions::findDeviceID(int nodeNumber, int radioID)  {
-	String nodeDeviceID;
-	int nodeRadioID;
+bool LoRA_Functions::findDeviceID(int nodeNumber, int radioID, char *deviceID)  {
+	deviceID[0] = '\0';
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return false;				// Ran out of entries - no match found
+	if (nodeDatabase.get_radioID(nodeNumber) != radioID) return false;		// Not the right nodeNumber / nodeID combo
 
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);
-	if(nodeObjectContainer == NULL) return "null";							// Ran out of entries - no match found
-
-	jp.getValueByKey(nodeObjectContainer,"rID", nodeRadioID);				// Get the radioID to see if it is a match
-	if (nodeRadioID != radioID) return "null";								// Not the right nodeNumber / nodeID combo
-
-	jp.getValueByKey(nodeObjectContainer, "dID", nodeDeviceID);				// Get the deviceID and compare
-	if (nodeDeviceID == NULL) return "null";
-	else return nodeDeviceID;
+	return nodeDatabase.get_deviceID(nodeNumber, deviceID);					// Unpacked straight into the caller's buffer - no String
 }
 
 bool LoRA_Functions::nodeConfigured(int nodeNumber, int radioID)  {
-	if (nodeNumber > 10) return false;
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return false;				// Ran out of entries - no match found
 
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);
-	if(nodeObjectContainer == NULL) return false;							// Ran out of entries - no match found
-	
-	jp.getValueByKey(nodeObjectContainer, "rID", radioID);					// Get the radioID for the node number in question
-
-	if (radioID == current.get_nodeID()) return true;
+	if (nodeDatabase.get_radioID(nodeNumber) == radioID) return true;
 	else {
-		Log.info("Node not configured");  // See the raw JSON string
+		Log.info("Node not configured");
 		return false;
 	}
 }
 
 bool LoRA_Functions::nodeUpdate(int nodeNumber, float successPercent)  {
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return false;				// Ran out of entries - no match found
 
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);
-	if(nodeObjectContainer == NULL) return false;							// Ran out of entries - no match found
-
-	const JsonParserGeneratorRK::jsmntok_t *value;
-
-	jp.getValueTokenByKey(nodeObjectContainer, "last", value);			// Update last connection time
-	JsonModifier mod(jp);
-	mod.startModify(value);
-	mod.insertValue((int)Time.now());
-	mod.finish();
-
-	jp.getValueTokenByKey(nodeObjectContainer, "succ", value);			// Update the success percentage value
-	mod.startModify(value);
-	mod.insertValue((float)successPercent);
-	mod.finish();
+	// Learn how late this node tends to be relative to its slot so the window can allow for it
+	time_t secondsPerPeriod = sysStatus.get_frequencyMinutes() * 60;
+	int lateSeconds = (int)(Time.now() % secondsPerPeriod) - (LoRA_Functions::getSlotOffset(nodeNumber) + SLOT_SECONDS);
+	lateSeconds = constrain(lateSeconds, 0, 255);
+	nodeLateSeconds[nodeNumber - 1] = (3 * nodeLateSeconds[nodeNumber - 1] + lateSeconds) / 4;
 
-	nodeDatabase.set_nodeIDJson(jp.getBuffer());									// This should backup the nodeID database - now updated to persistent storage
+	StorageHelperRK::PersistentDataBase::Transaction transaction(nodeDatabase);	// Both fields reach FRAM in the same save
+	nodeDatabase.set_lastConnect(nodeNumber, Time.now());					// Update last connection time
+	nodeDatabase.set_successPercent(nodeNumber, successPercent);			// Update the success percentage value
 	return true;
 }
 
 byte LoRA_Functions::getType(int nodeNumber) {
-	int type;
-
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);
-	if(nodeObjectContainer == NULL) {
+	if (!nodeDatabase.nodeInTable(nodeNumber)) {
 		Log.info("From getType function Node number not found so returning %d",current.get_sensorType());
 		return current.get_sensorType();									// Ran out of entries, go with what was reported by the node
 	} 
 
-	jp.getValueByKey(nodeObjectContainer, "type", type);
+	int type = nodeDatabase.get_sensorType(nodeNumber);
 	Log.info("Returning sensor type %d",type);
 	return type;
 }
 
 bool LoRA_Functions::changeType(int nodeNumber, int newType) {
-	if (nodeNumber > 10) return false;
-	int type;
-
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);
-	if(nodeObjectContainer == NULL) return false;								// Ran out of entries 
-
-	jp.getValueByKey(nodeObjectContainer, "type", type);
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return false;				// Ran out of entries 
 
-	Log.info("Changing sensor type from %d to %d", type, newType);
-
-	const JsonParserGeneratorRK::jsmntok_t *value;
-
-	jp.getValueTokenByKey(nodeObjectContainer, "type", value);
-
-	JsonModifier mod(jp);
-
-	mod.startModify(value);
-
-	mod.insertValue((int)newType);
-	mod.finish();
-
-	nodeDatabase.set_nodeIDJson(jp.getBuffer());									// This should backup the nodeID database - now updated to persistent storage
+	Log.info("Changing sensor type from %d to %d", nodeDatabase.get_sensorType(nodeNumber), newType);
+	nodeDatabase.set_sensorType(nodeNumber, newType);
 
 	return true;
-
 }
 
 byte LoRA_Functions::getAlert(int nodeNumber) {
-	if (nodeNumber > 10) return 255;										// Not a configured node
-
-	int pendingAlert;
-
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);
-	if(nodeObjectContainer == NULL) {
+	if (!nodeDatabase.nodeInTable(nodeNumber)) {
 		Log.info("From getAlert function, Node number not found");
-		return 255;															// Ran out of entries 
+		return 255;															// Not a configured node
 	} 
 
-	jp.getValueByKey(nodeObjectContainer, "pend", pendingAlert);
-
-	return pendingAlert;
-
+	return nodeDatabase.get_pendingAlert(nodeNumber);
 }
 
 bool LoRA_Functions::changeAlert(int nodeNumber, int newAlert) {
-	int currentAlert;
-
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array
-
-	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, nodeNumber-1);	// find the entry for the node of interest
-	if(nodeObjectContainer == NULL) return false;							// Ran out of entries - node number entry not found triggers alert
-
-	jp.getValueByKey(nodeObjectContainer, "pend", currentAlert);			// Now we have the oject for the specific node
-	Log.info("Changing pending alert from %d to %d", currentAlert, newAlert);
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return false;				// Node number entry not found
 
-	const JsonParserGeneratorRK::jsmntok_t *value;							// Node we have the key value pair for the "pend"ing alerts	
-	jp.getValueTokenByKey(nodeObjectContainer, "pend", value);
+	Log.info("Changing pending alert from %d to %d", nodeDatabase.get_pendingAlert(nodeNumber), newAlert);
+	nodeDatabase.set_pendingAlert(nodeNumber, newAlert);					// Updates the record - saved to FRAM on the next flush
 
-	JsonModifier mod(jp);													// Create a modifier object
-	mod.startModify(value);													// Update the pending alert value for the selected node
-	mod.insertValue((int)newAlert);
-	mod.finish();
-
-	nodeDatabase.set_nodeIDJson(jp.getBuffer());									// This updates the JSON object but doe not commit to to persistent storage
+	return true;
+}
 
+// One node's entry for printNodeData and publishNodeData
+static bool formatNodeData(uint8_t nodeNumber, char *data, size_t dataLen) {
+	char nodeDeviceID[25];
+	nodeIDData::RecordView record(nodeDatabase, nodeNumber);					// Reads the record in place under one lock
+	if (!record) return false;
+	record.deviceID(nodeDeviceID);
+	snprintf(data, dataLen, "{\"node\":%d,\"dID\":\"%s\",\"rID\":%d,\"last\":\"%s\",\"type\":%d,\"succ\":%4.2f,\"pend\":%d}", nodeNumber, nodeDeviceID, record->radioID, Time.timeStr(record->lastConnect).c_str(), record->sensorType, record->successPercent, record->pendingAlert);
 	return true;
 }
 
 void LoRA_Functions::printNodeData(bool publish) {
-	int nodeNumber;
-	int radioID;
-	String nodeDeviceID;
-	int lastConnect;
-	int sensorType;
-	float successPercent;
-	int pendingAlert;
 	char data[256];
 
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	for (int i=0; i<10; i++) {												// Iterate through the array looking for a match
-		nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, i);
-		if(nodeObjectContainer == NULL) {
-			break;								// Ran out of entries 
-		} 
-		jp.getValueByKey(nodeObjectContainer, "dID", nodeDeviceID);
-		jp.getValueByKey(nodeObjectContainer,"rID", radioID);
-		jp.getValueByKey(nodeObjectContainer, "node", nodeNumber);
-		jp.getValueByKey(nodeObjectContainer, "last", lastConnect);
-		jp.getValueByKey(nodeObjectContainer, "type", sensorType);
-		jp.getValueByKey(nodeObjectContainer, "succ", successPercent);
-		jp.getValueByKey(nodeObjectContainer, "pend", pendingAlert);
-
-		snprintf(data, sizeof(data), "Node %d, deviceID: %s, checksum %d, lastConnected: %s, type %d, success %4.2f with pending alert %d", nodeNumber, nodeDeviceID.c_str(), radioID, Time.timeStr(lastConnect).c_str(), sensorType, successPercent, pendingAlert);
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeDatabase.get_nodeCount(); nodeNumber++) {
+		if (!formatNodeData(nodeNumber, data, sizeof(data))) break;
 		Log.info(data);
 		if (Particle.connected() && publish) {
 			Particle.publish("nodeData", data, PRIVATE);
 			delay(1000);
 		}
 	}
+}
 
-	// Log.info(nodeDatabase.get_nodeIDJson());  // See the raw JSON string
+bool LoRA_Functions::publishNodeData(uint8_t nodeNumber) {
+	char data[256];
 
+	if (!formatNodeData(nodeNumber, data, sizeof(data))) return false;
+	Log.info(data);
+	PublishQueuePosix::instance().publish("nodeData", data, PRIVATE | WITH_ACK);	// Queued - nodes join while we are disconnected
+	return true;
 }
 
 bool LoRA_Functions::nodeConnectionsHealthy() {								// Connections are healthy if at least one node connected in last two periods
 // Resets the LoRA Radio if not healthy
 	
-	int lastConnect;
 	time_t secondsPerPeriod = sysStatus.get_frequencyMinutes() * 60;
 	bool health = true;
 
-	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
-	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
-	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array (I beleive)
-
-	for (int i=0; i<10; i++) {												// Iterate through the array looking for a match
-		nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, i);
-		if(nodeObjectContainer == NULL) break;								// Ran out of entries 
-
-		jp.getValueByKey(nodeObjectContainer, "last", lastConnect);
-
-		if ((Time.now() - lastConnect) > secondsPerPeriod) {				// If any of the nodes fail to connect - will extend loRA dwell time
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeDatabase.get_nodeCount(); nodeNumber++) {
+		if ((Time.now() - nodeDatabase.get_lastConnect(nodeNumber)) > secondsPerPeriod) {	// If any of the nodes fail to connect - will extend loRA dwell time
 			health = false;
 			break;															// Don't need to keep checking
 		}
@@ -640,9 +723,150 @@ bool LoRA_Functions::nodeConnectionsHealthy() {								// Connections are health
 	return health;
 }
 
-int LoRA_Functions::stringCheckSum(String str){												// This function is made for the Particle DeviceID
+// Time slotted reporting - each node gets its own slot after the reporting boundary so reports don't collide
+static uint16_t slotsPerPeriod() {
+	uint16_t slots = (sysStatus.get_frequencyMinutes() * 60 / 2) / SLOT_SECONDS;	// Listen for at most half the period
+	return (slots > 1) ? slots - 1 : 1;										// Slot 0 is for join requests
+}
+
+uint16_t LoRA_Functions::getSlotOffset(int nodeNumber) {
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return 0;					// Unconfigured nodes report in the join slot
+	return (((nodeNumber - 1) % slotsPerPeriod()) + 1) * SLOT_SECONDS;
+}
+
+uint16_t LoRA_Functions::getListeningWindow() {
+	uint16_t occupiedSlots = (nodeDatabase.get_nodeCount() < slotsPerPeriod()) ? nodeDatabase.get_nodeCount() : slotsPerPeriod();
+	uint8_t mostLate = 0;
+
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeDatabase.get_nodeCount(); nodeNumber++) {	// Extend the window for nodes that habitually report late
+		if (nodeLateSeconds[nodeNumber - 1] > mostLate) mostLate = nodeLateSeconds[nodeNumber - 1];
+	}
+	return (occupiedSlots + 1) * SLOT_SECONDS + SLOT_GUARD_SECONDS + mostLate;	// Join slot, occupied slots, a guard for retries and the latest node
+}
+
+void LoRA_Functions::startListeningWindow() {
+	windowStartTime = Time.now();
+}
+
+static time_t windowPeriodStart() {
+	time_t secondsPerPeriod = sysStatus.get_frequencyMinutes() * 60;
+	return ((windowStartTime + secondsPerPeriod / 2) / secondsPerPeriod) * secondsPerPeriod;	// Nearest reporting boundary - the gateway may wake a little early or late
+}
+
+bool LoRA_Functions::acknowledgementsInFlight() {
+	return manager.sendsInFlight() > 0;
+}
+
+bool LoRA_Functions::allNodesReported() {
+	time_t secondsPerPeriod = sysStatus.get_frequencyMinutes() * 60;
+	time_t periodStart = windowPeriodStart();
+	uint16_t expected = 0;
+
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeDatabase.get_nodeCount(); nodeNumber++) {
+		time_t lastConnect = nodeDatabase.get_lastConnect(nodeNumber);
+		if (lastConnect >= periodStart) {
+			expected++;														// Reported this period
+			continue;
+		}
+		if (lastConnect >= periodStart - 2 * secondsPerPeriod) return false;	// Still waiting on a node that has been reporting
+	}
+	return (expected > 0);
+}
+
+// Adaptive data rate and channels - nodes close in report faster and quieter on a channel of their own, which frees the
+// air and saves their batteries.  The radio hears one spreading factor on one channel at a time, so a node only leaves the
+// defaults if it has a slot to itself
+static uint8_t slotOwner(uint16_t slot) {									// The node that reports alone in a slot - 0 for the join slot, a shared slot or past the slots
+	if (slot < 1 || slot > slotsPerPeriod() || !nodeDatabase.nodeInTable(slot)) return 0;
+	if (slot + slotsPerPeriod() <= nodeIDData::MAX_NODES && nodeDatabase.nodeInTable(slot + slotsPerPeriod())) return 0;
+	return slot;
+}
+
+static bool reportsAlone(uint8_t nodeNumber) {							// Heard directly, not late and the only node in its slot - it gets no second chance there
+	RHRouter::RoutingTableEntry *route = manager.getRouteTo(nodeNumber);
+	return current.get_hops() == 0 && route && route->next_hop == nodeNumber && nodeLateSeconds[nodeNumber - 1] == 0
+		&& slotOwner(LoRA_Functions::instance().getSlotOffset(nodeNumber) / SLOT_SECONDS) == nodeNumber;
+}
+
+static void slotTuning(time_t now, uint8_t &channel, uint8_t &spreadingFactor) {	// The channel and rate the radio should be on for the slot now falls in
+	time_t secondsPerPeriod = sysStatus.get_frequencyMinutes() * 60;
+	uint8_t owner = slotOwner((now % secondsPerPeriod) / SLOT_SECONDS);
+	if (owner && nodeDatabase.get_lastConnect(owner) >= windowPeriodStart()) owner = 0;	// Already heard - the rest of its slot is for late nodes and retries on the defaults
+	channel = (owner) ? routeTable.get_channel(owner) : 0;
+	spreadingFactor = (owner && routeTable.get_spreadingFactor(owner)) ? routeTable.get_spreadingFactor(owner) : DEFAULT_SPREADING_FACTOR;
+}
+
+void LoRA_Functions::tuneToSlot() {
+	if (manager.sendsInFlight()) return;									// Retries go out on the channel and rate the node is listening on
+	uint8_t channel, spreadingFactor;
+	slotTuning(Time.now(), channel, spreadingFactor);
+	if (channel != radioChannel || spreadingFactor != radioSpreadingFactor) tuneRadio(channel, spreadingFactor);
+}
+
+void LoRA_Functions::adaptDataRate(uint8_t nodeNumber) {
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return;
+	uint8_t spreadingFactor = (routeTable.get_spreadingFactor(nodeNumber)) ? routeTable.get_spreadingFactor(nodeNumber) : DEFAULT_SPREADING_FACTOR;
+	int8_t txPower = (routeTable.get_txPower(nodeNumber)) ? routeTable.get_txPower(nodeNumber) : MAX_TX_POWER;
+	int8_t &snrLow = nodeSnrLow[nodeNumber - 1];
+
+	if (spreadingFactor != radioSpreadingFactor || routeTable.get_channel(nodeNumber) != radioChannel) {	// Heard outside its rate or channel - the node fell back to the defaults
+		Log.info("Node %d reported at SF%d on channel %d instead of SF%d on channel %d - back to the defaults", nodeNumber, radioSpreadingFactor, radioChannel, spreadingFactor, routeTable.get_channel(nodeNumber));
+		if (snrLow != ADR_SNR_UNKNOWN) snrLow = max(snrLow - ADR_FALLBACK_DB, -100);
+		clearAssignments(nodeNumber);
+		spreadingFactor = DEFAULT_SPREADING_FACTOR;
+		txPower = MAX_TX_POWER;
+	}
+
+	// The worse of the two directions, as if the node had sent at full power
+	int sample = min(driver.lastSNR() + (MAX_TX_POWER - txPower), (int)(int16_t)current.get_SNR());
+	sample = constrain(sample, -100, 100);
+	snrLow = (snrLow == ADR_SNR_UNKNOWN) ? sample : min(sample, snrLow + 1);
+
+	// Only a node that reports alone and inside its slot can leave the default
+	int intoSlot = (int)(Time.now() % (sysStatus.get_frequencyMinutes() * 60)) - LoRA_Functions::getSlotOffset(nodeNumber);
+	bool eligible = reportsAlone(nodeNumber) && intoSlot >= 0 && intoSlot < SLOT_SECONDS;
+
+	uint8_t wanted = DEFAULT_SPREADING_FACTOR;
+	while (eligible && wanted > MIN_SPREADING_FACTOR && snrLow - demodulationFloor(wanted - 1) >= ADR_MARGIN_DB) wanted--;
+	uint8_t newSpreadingFactor = (wanted < spreadingFactor) ? spreadingFactor - 1 : wanted;	// Speed up a step at a time, slow down at once
+
+	int8_t newTxPower = MAX_TX_POWER;
+	if (newSpreadingFactor == MIN_SPREADING_FACTOR) {						// Nothing faster to spend the spare margin on - turn the power down
+		int spare = snrLow - demodulationFloor(MIN_SPREADING_FACTOR) - ADR_MARGIN_DB;
+		if (spare > 0) newTxPower = max(MAX_TX_POWER - (spare / ADR_POWER_STEP_DB) * ADR_POWER_STEP_DB, (int)MIN_TX_POWER);
+	}
+
+	if (newSpreadingFactor != spreadingFactor || newTxPower != txPower) Log.info("Node %d with SNR low of %ddB moves to SF%d at %ddBm", nodeNumber, snrLow, newSpreadingFactor, newTxPower);
+	StorageHelperRK::PersistentDataBase::Transaction transaction(routeTable);
+	routeTable.set_spreadingFactor(nodeNumber, (newSpreadingFactor == DEFAULT_SPREADING_FACTOR) ? 0 : newSpreadingFactor);
+	routeTable.set_txPower(nodeNumber, (newTxPower == MAX_TX_POWER) ? 0 : newTxPower);
+}
+
+void LoRA_Functions::assignChannel(uint8_t nodeNumber, bool joining) {
+	if (!nodeDatabase.nodeInTable(nodeNumber)) return;
+	uint16_t slot = getSlotOffset(nodeNumber) / SLOT_SECONDS;
+	bool eligible = (joining) ? current.get_hops() == 0 && slotOwner(slot) == nodeNumber : reportsAlone(nodeNumber);	// A joining node has no route or lateness yet
+	uint8_t channel = (eligible) ? slotChannel(slot) : 0;
+
+	if (channel != routeTable.get_channel(nodeNumber)) Log.info("Node %d moves to channel %d", nodeNumber, channel);
+	routeTable.set_channel(nodeNumber, channel);
+}
+
+void LoRA_Functions::resetUnheardAssignments() {
+	time_t periodStart = windowPeriodStart();
+
+	for (uint8_t nodeNumber = 1; nodeNumber <= nodeDatabase.get_nodeCount(); nodeNumber++) {
+		if (routeTable.get_spreadingFactor(nodeNumber) == 0 && routeTable.get_txPower(nodeNumber) == 0 && routeTable.get_channel(nodeNumber) == 0) continue;
+		if (nodeDatabase.get_lastConnect(nodeNumber) >= periodStart) continue;
+		Log.info("Node %d missed its slot at SF%d on channel %d - back to the defaults", nodeNumber, routeTable.get_spreadingFactor(nodeNumber), routeTable.get_channel(nodeNumber));
+		if (nodeSnrLow[nodeNumber - 1] != ADR_SNR_UNKNOWN) nodeSnrLow[nodeNumber - 1] = max(nodeSnrLow[nodeNumber - 1] - ADR_FALLBACK_DB, -100);
+		clearAssignments(nodeNumber);
+	}
+}
+
+int LoRA_Functions::stringCheckSum(const char *str){											// This function is made for the Particle DeviceID
     int result = 0;
-    for(unsigned int i = 0; i < str.length(); i++){
+    for(unsigned int i = 0; str[i] != '\0'; i++){
       int asciiCode = (int)str[i];
 
       if (asciiCode >=48 && asciiCode <58) {              // 0-9
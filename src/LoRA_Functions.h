@@ -25,6 +25,39 @@ buf[15-16] RSSI                             // From the Node's perspective
 buf[17-18] SNR                              // From the Node's perspective
 */
 
+// Format of a compact data report - the same fields as a data report, sized to their values (see LoRA_Codec.h)
+/*
+magicNumber and nodeID (2 bytes each), then varints for hourly, daily, sensorType, zigzag temp, varints for battChg and
+battState, a one byte presence bitmap, resets (varint, only sent when not zero), messageCount and successCount
+(1 byte each) and zigzag RSSI and SNR.  It is answered with a compact data acknowledgement: magicNumber (2),
+Time.now() (4), frequencyMinutes varint, presence bitmap, alertCode varint if not zero, sensorType and openHours varints,
+message number (1), then slotOffset, spreadingFactor, txPower and channel varints if not zero.
+*/
+
+// Format of a batched data report - several timestamped counts in one frame, acknowledged with a data acknowledgement.
+// Up to the first record it is BATCH_REPORT_SCHEMA in LoRA_Codec.h
+/*
+buf[0 - 1] magicNumber                      // Magic number for devices
+buf[2 - 3] nodeID                           // nodeID for verification
+buf[4] batchVersion                         // Format version of the rest of the frame - currently 1
+buf[5] sensorType                           // What sensor type is it
+buf[6] temp;                                // Enclosure temp
+buf[7] battChg;                             // State of charge
+buf[8] battState;                           // Battery State
+buf[9] resets                               // Reset count
+buf[10] messageCount;                       // Sequential message number
+buf[11] successCount;                       // How many successful sends
+buf[12-13] RSSI                             // From the Node's perspective
+buf[14-15] SNR                              // From the Node's perspective
+buf[16] recordCount                         // Number of count records that follow - oldest first
+buf[17-20] timestamp                        // Time of the first record
+buf[21-22] hourly                           // Hourly count of the first record
+buf[23-24] daily                            // Daily count of the first record
+buf[25 ...] each later record as three varints (7 bits per byte, low bits first, high bit set if more follow):
+            seconds since the previous record, hourly count, and the zigzag encoded change in daily count
+            from the previous record (daily can drop when it resets at midnight)
+*/
+
 // Format of a data acknowledgement
 /*    
     buf[0 - 1 ] magicNumber                 // Magic Number
@@ -34,6 +67,10 @@ buf[17-18] SNR                              // From the Node's perspective
     buf[9] sensorType                       // Let's the Gateway reset the sensor if needed 
     buf[10] openHours                        // From the Gateway to the node - is the park open?
     buf[11] message number                  // Parrot this back to see if it matches
+    buf[12 - 13] slotOffset                 // Seconds after the reporting boundary when this node should transmit
+    buf[14] spreadingFactor                 // Spreading factor for the node's next report - 0 for the default (SF11)
+    buf[15] txPower                         // Transmit power in dBm for the node's next report - 0 for the default (23dBm)
+    buf[16] channel                         // Channel for the node's next report (see ChannelPlan.h) - 0 for the join channel
 */
 
 // Format of a join request
@@ -52,7 +89,8 @@ buf[29] sensorType				            // Identifies sensor type to Gateway
     buf[8] alertCodeNode                   // Gateway can set an alert code here
     buf[9]  newNodeNumber                   // New Node Number for device
     buf[10]  sensorType				        // Gateway confirms sensor type
-
+    buf[11 - 12] slotOffset                 // Seconds after the reporting boundary when this node should transmit
+    buf[13] channel                         // Channel for the node's reports (see ChannelPlan.h) - 0 to stay on the join channel
 */
 
 #ifndef __LORA_FUNCTIONS_H
@@ -89,6 +127,9 @@ public:
     /**
      * @brief Perform application loop operations; call this from global application loop()
      * 
+     * @details Retries acknowledgements whose hop ack has not come back - in every state, so a node's retries keep to
+     * the radio's timeout while the gateway reports or connects.
+     * 
      * You typically use LoRA_Functions::instance().loop();
      */
     void loop();
@@ -113,15 +154,85 @@ public:
     /**
      * @brief Initialize the LoRA radio
      * 
+     * @details Loads the routes saved in FRAM so the first acknowledgements after a reset don't wait on route discovery
+     * 
      */
    bool initializeRadio();
 
+    /**
+     * @brief Loads the routes saved in FRAM into the mesh routing table
+     * 
+     */
+    void restoreRoutes();
+
+    /**
+     * @brief Saves the mesh routes to the nodes in FRAM - picks up routes RHMesh discovered or dropped itself
+     * 
+     * @details Routes through degraded links are dropped first.  Only routes that changed are written
+     * 
+     */
+    void saveRoutes();
+
+    /**
+     * @brief Offers the route a message from a node came by as the route back to it - the route the acknowledgement will take
+     * 
+     * @details The mesh keeps the route it expects to take the fewest transmissions, from the signal and acknowledgements of each neighbour
+     * 
+     * @param from - the node that sent the message
+     * @param lastHop - the node that passed it to us, from itself if it is in range
+     * @param hops - the number of relays the message passed through
+     */
+    void learnRoute(uint8_t from, uint8_t lastHop, uint8_t hops);
+
+    /**
+     * @brief Tunes the radio to the channel and spreading factor of the slot we are in - channel 0 at the default outside the
+     * slots of nodes given their own, and for the rest of such a slot once its node has been heard
+     * 
+     */
+    void tuneToSlot();
+
+    /**
+     * @brief Works out the spreading factor and transmit power a node should use for its next report, from the SNR of this one
+     * 
+     * @details Both directions count - the gateway's SNR of the report, scaled to full power, and the SNR the node reports for
+     * our last acknowledgement.  A node speeds up one spreading factor per report while its worst recent SNR stays ADR_MARGIN_DB
+     * above the demodulation floor, and slows down at once when it doesn't.  Power only comes down at SF7.  Nodes that are
+     * relayed, late or share their slot stay at the default.  A node heard at the default or on channel 0 when it was given
+     * something else fell back, and its assignments are cleared.  The result is saved in the route table for the acknowledgement.
+     * 
+     * @param nodeNumber - the node that sent the report in buf
+     */
+    void adaptDataRate(uint8_t nodeNumber);
+
+    /**
+     * @brief Works out the channel a node should report on from the next period - see ChannelPlan.h
+     * 
+     * @details A node that reports alone in its slot gets that slot's channel.  Relayed nodes, late nodes and nodes that share
+     * their slot stay on channel 0.  The result is saved in the route table for the acknowledgement.
+     * 
+     * @param nodeNumber - the node being acknowledged
+     * @param joining - true for a join request, which is heard in the join slot and before the node has a route
+     */
+    void assignChannel(uint8_t nodeNumber, bool joining);
+
+    /**
+     * @brief Puts nodes that were given a channel or a faster data rate but were not heard this period back on the defaults
+     * 
+     * @details A node that gets no acknowledgement on its assigned channel and rate goes back to the defaults too, so both
+     * ends agree again by the next period
+     * 
+     */
+    void resetUnheardAssignments();
+
 
     // Generic Gateway Functions
     /**
      * @brief This function is used to listen for all message types
      * 
-     * @details - Use polling with this function - executed in main LoRA_STATE every loop transit
+     * @details - Executed in main LoRA_STATE every loop transit.  Frames are queued by the radio interrupt; this blocks
+     * (without spinning) for up to half a second waiting for one, so the loop still services the state machine.
+     * Acknowledgements are sent without waiting for the node's hop ack, so reports from other nodes are received while
+     * they are in flight.  The hop acks come in here too, and the wait is cut short when one is due for a retry.
      * 
      * @param None
      * 
@@ -147,6 +258,29 @@ public:
      * @return false 
      */
     bool decipherDataReportGateway();   
+    /**
+     * @brief Function that unpacks a batched data report - node health plus several timestamped counts
+     * 
+     * @details The records are held until the reporting state fans them out with getBatchRecord()
+     * 
+     * @return true - the frame was a supported version and every record decoded
+     * @return false 
+     */
+    bool decipherBatchReportGateway();
+    /**
+     * @brief Returns the number of records left by the last batched data report - zero after a single data report
+     * 
+     */
+    uint8_t getBatchRecordCount();
+    /**
+     * @brief Returns one batched record's hourly and daily counts - current is left as the newest record set it
+     * 
+     * @param index - 0 is the oldest record
+     * @param hourly - the record's hourly count, untouched if the index is out of range
+     * @param daily - the record's daily count, untouched if the index is out of range
+     * @return time_t - when the node took the record, 0 if the index is out of range
+     */
+    time_t getBatchRecord(uint8_t index, uint16_t &hourly, uint16_t &daily) const;
     /**
      * @brief Function that unpacks a Join request from a node
      * 
@@ -165,17 +299,23 @@ public:
      * @brief Sends an acknolwedgement from the gateway to the node after successfully unpacking an alert report.
      * Also sends the number of seconds until next transmission window.
      * 
+     * @details Returns once the acknowledgement is transmitted.  The status message is published when the node's hop ack
+     * comes back; if it never does the node is put back on the defaults.
+     * 
      * @param nextSeconds 
-     * @return true 
-     * @return false 
+     * @return true - the acknowledgement is on its way
+     * @return false - there was no route to the node or too many acknowledgements are in flight
      */
     bool acknowledgeDataReportGateway();    // Gateway- acknowledged receipt of a data report
     /**
      * @brief Sends an acknolwedgement from the gateway to the node after successfully unpacking a data report.
      * Also sends the number of seconds until next transmission window.
+     * 
+     * @details Like acknowledgeDataReportGateway(), returns once the acknowledgement is transmitted.
+     * 
      * @param nextSeconds 
-     * @return true 
-     * @return false 
+     * @return true - the acknowledgement is on its way
+     * @return false - there was no route to the node or too many acknowledgements are in flight
      */
     bool acknowledgeJoinRequestGateway();   // Gateway - acknowledged receipt of a join request
     /**
@@ -198,10 +338,11 @@ public:
      * @brief Returns the deviceID for a provided node number.  this is used in composing Particle publish payloads
      *
      * @param nodeNumber
-     * @returns device ID
+     * @param deviceID - buffer of at least 25 characters, set to an empty string if there is no match
+     * @returns true if the node number and radioID match a node in the table
      * 
      */
-    String findDeviceID(int nodeNumber, int radioID);
+    bool findDeviceID(int nodeNumber, int radioID, char *deviceID);
     /**
      * @brief Get Type is a function that returns the sensor Type for a given node number
      * 
@@ -241,6 +382,16 @@ public:
      * 
      */
     void printNodeData(bool publish);
+
+    /**
+     * @brief Queues one node's entry from printNodeData as a nodeData event
+     *
+     * @details Packed webhooks identify nodes by number - the cloud maps them to deviceIDs with these events
+     *
+     * @param nodeNumber
+     * @return false if the node is not in the table
+     */
+    bool publishNodeData(uint8_t nodeNumber);
     /**
      * @brief Returns true if node is configured and false if it is not
      * 
@@ -267,13 +418,54 @@ public:
      */
     bool nodeConnectionsHealthy();
 
+    /**
+     * @brief Returns the transmit slot offset for a node - time slotted reporting keeps nodes from colliding
+     * 
+     * @details Slot 0 is left open for join requests from unconfigured nodes.  Configured nodes get one
+     * slot each in node number order, wrapping if there are more nodes than slots in the period.
+     * 
+     * @param nodeNumber 
+     * @return uint16_t - seconds after the reporting boundary that the node should transmit
+     */
+    uint16_t getSlotOffset(int nodeNumber);
+
+    /**
+     * @brief Returns how long the gateway needs to listen to hear every occupied slot
+     * 
+     * @return uint16_t - seconds from the start of the LoRA window
+     */
+    uint16_t getListeningWindow();
+
+    /**
+     * @brief Marks the start of a listening window - nodes that report after this count as reported for the period
+     * 
+     */
+    void startListeningWindow();
+
+    /**
+     * @brief Returns true once every node we expect to hear from this period has reported
+     * 
+     * @details Expected nodes are those that reported in one of the last two periods - a node that has gone
+     * quiet does not hold the window open.  Uses the last contact time in the node table.
+     * 
+     * @return true - all expected nodes have reported and been acknowledged
+     * @return false - still waiting or there are no expected nodes
+     */
+    bool allNodesReported();
+
+    /**
+     * @brief Returns true while an acknowledgement is waiting for the node's hop ack - keep the radio listening until it is not
+     * 
+     */
+    bool acknowledgementsInFlight();
+
     /**
      * @brief computes a two digit checksum based on the Particle deviceID
      * 
      * @param str - a 24 character hex number string
      * @return int - a value from 0 to 360 based on the character string
      */
-    int stringCheckSum(String str);
+    int stringCheckSum(const char *str);
 
 protected:
     /**
@@ -35,8 +35,8 @@
 // v7.00 - Added Signal to Noise Ratio to hourly reporting / webhook, battery level monitoring improvements, added power cycle function - Optimized for stick antenna - new center freq
 // v9.00 - Breaking Change - v10 Node Required - Node Now Reports RSSI / SNR to Gateway, Simplified Join Request Logic, Storing / reporting hops
 
-#define DEFAULT_LORA_WINDOW 5
 #define STAY_CONNECTED 60
+#define LORA_GRACE_SECONDS 10						// Once every expected node has reported, keep listening this long after the last message
 
 // Particle Libraries
 #include "PublishQueuePosixRK.h"			        // https://github.com/rickkas7/PublishQueuePosixRK
@@ -49,6 +49,7 @@
 #include "Particle_Functions.h"							// Particle specific functions
 #include "take_measurements.h"						// Manages interactions with the sensors (default is temp for charging)
 #include "MyPersistentData.h"						// Where my persistent storage files are kept
+#include "Webhook_Batch.h"							// Packs node reports into fewer publishes
 
 // Support for Particle Products (changes coming in 4.x - https://docs.particle.io/cards/firmware/macros/product_id/)
 PRODUCT_VERSION(9);									// For now, we are putting nodes and gateways in the same product group - need to deconflict #
@@ -57,7 +58,8 @@ char currentPointRelease[6] ="9.00";
 // Prototype functions
 void publishStateTransition(void);                  // Keeps track of state machine changes - for debugging
 void userSwitchISR();                               // interrupt service routime for the user switch
-void publishWebhook(uint8_t nodeNumber);			// Publish data based on node number
+void publishWebhook(uint8_t nodeNumber);									// Publish data based on node number - now, with current's counts
+void publishWebhook(uint8_t nodeNumber, time_t timestamp, uint16_t hourly, uint16_t daily);	// A node's counts taken at timestamp - 0 is now
 void softDelay(uint32_t t);                 		// Soft delay is safer than delay
 
 // System Health Variables
@@ -77,6 +79,7 @@ void outOfMemoryHandler(system_event_t event, int param);
 
 // Program Variables
 volatile bool userSwitchDectected = false;	
+const uint8_t GATEWAY_REPORT_KEY = 1;				// Publish queue coalesce key - a queued gateway report is replaced by the next one
 
 void setup() 
 {
@@ -90,6 +93,7 @@ void setup()
 	sysStatus.setup();
 	current.setup();
 	nodeDatabase.setup();
+	routeTable.setup();
 
     Particle_Functions::instance().setup();         // Sets up all the Particle functions and variables defined in particle_fn.h
                          
@@ -98,6 +102,7 @@ void setup()
 
 	System.on(out_of_memory, outOfMemoryHandler);   // Enabling an out of memory handler is a good safety tip. If we run out of memory a System.reset() is done.
 
+	PublishQueuePosix::instance().withFileQueueSize(2000).withRingLogSize(512 * 1024);	// Several days of batched reports if we can't connect
 	PublishQueuePosix::instance().setup();          // Initialize PublishQueuePosixRK
 
 	LoRA_Functions::instance().setup(true);			// Start the LoRA radio (true for Gateway and false for Node)
@@ -156,7 +161,7 @@ void loop() {
 				Log.info("Woke with user button");
 			}
 			else {															   // Awoke for time
-				Log.info("Awoke at %s with %li free memory", Time.format(Time.now(), "%T").c_str(), System.freeMemory());
+				Log.info("Awoke at %s with %lu free memory", Time.format(Time.now(), "%T").c_str(), (unsigned long)System.freeMemory());
 			}
 			state = IDLE_STATE;
 
@@ -164,32 +169,46 @@ void loop() {
 
 		case LoRA_STATE: {														// Enter this state every reporting period and stay here for 5 minutes
 			static system_tick_t startLoRAWindow = 0;
-			static byte connectionWindow = 0;
+			static system_tick_t lastLoRAMessage = 0;
+			static uint16_t connectionWindow = 0;											// Seconds
 
 			if (state != oldState) {
-				if (oldState != REPORTING_STATE) startLoRAWindow = millis();    // Mark when we enter this state - for timeouts - but multiple messages won't keep us here forever
+				if (oldState != REPORTING_STATE) {
+					startLoRAWindow = millis();    								// Mark when we enter this state - for timeouts - but multiple messages won't keep us here forever
+					lastLoRAMessage = millis();
+					LoRA_Functions::instance().startListeningWindow();				// Nodes that report from here on count for this period
+				}
 				publishStateTransition();                   					// We will apply the back-offs before sending to ERROR state - so if we are here we will take action
 				conv.withCurrentTime().convert();								// Get the time and convert to Local
 				if (conv.getLocalTimeHMS().hour >= sysStatus.get_openTime() && conv.getLocalTimeHMS().hour <= sysStatus.get_closeTime()) current.set_openHours(true);
 				else current.set_openHours(false);
 
-				if (sysStatus.get_connectivityMode() == 0) connectionWindow = DEFAULT_LORA_WINDOW;
-				else connectionWindow = STAY_CONNECTED;
+				if (sysStatus.get_connectivityMode() == 0) connectionWindow = LoRA_Functions::instance().getListeningWindow();	// Just long enough for the occupied slots
+				else connectionWindow = STAY_CONNECTED * 60;
 
-				Log.info("Gateway is listening for %d minutes for LoRA messages and the park is %s (%d / %d / %d)", (sysStatus.get_connectivityMode() == 0) ? DEFAULT_LORA_WINDOW : 60, (current.get_openHours()) ? "open":"closed", conv.getLocalTimeHMS().hour, sysStatus.get_openTime(), sysStatus.get_closeTime());
+				Log.info("Gateway is listening for %d seconds for LoRA messages and the park is %s (%d / %d / %d)", connectionWindow, (current.get_openHours()) ? "open":"closed", conv.getLocalTimeHMS().hour, sysStatus.get_openTime(), sysStatus.get_closeTime());
 			} 
 
 			if (LoRA_Functions::instance().listenForLoRAMessageGateway()) {
+				lastLoRAMessage = millis();
+				if (current.get_alertCodeNode() == 1 && sysStatus.get_webhookEncoding() == (uint8_t)Webhook_Batch::Encoding::PACKED) {
+					LoRA_Functions::instance().publishNodeData(current.get_nodeNumber());	// Packed reports only carry the node number - tell the cloud whose it is
+				}
 				if (current.get_alertCodeNode() != 1 && current.get_openHours()) {				// We don't report Join alerts or after hours
 					state = REPORTING_STATE; 													// Received and acknowledged data from a node - need to report the alert
 				}
 			}
 
-			if ((millis() - startLoRAWindow) > (connectionWindow *60000UL)) { 					// Keeps us in listening mode for the specified windpw - then back to idle unless in test mode - keeps listening
-				Log.info("Listening window over");
+			bool windowOver = (millis() - startLoRAWindow) > (connectionWindow * 1000UL);		// Keeps us in listening mode for the specified windpw - then back to idle unless in test mode - keeps listening
+			bool allReported = sysStatus.get_connectivityMode() == 0 && (millis() - lastLoRAMessage) > (LORA_GRACE_SECONDS * 1000UL) && LoRA_Functions::instance().allNodesReported();	// No need to wait out the window
+
+			if (state == LoRA_STATE && (windowOver || allReported) && !LoRA_Functions::instance().acknowledgementsInFlight()) {	// Hop acks for the last acknowledgements need the radio
+				if (windowOver) Log.info("Listening window over");
+				else Log.info("All nodes reported - closing listening window after %lu seconds", (millis() - startLoRAWindow) / 1000UL);
 				LoRA_Functions::instance().nodeConnectionsHealthy();							// Will see if any nodes checked in - if not - will reset
 				LoRA_Functions::instance().sleepLoRaRadio();									// Done with the LoRA phase - put the radio to sleep
 				LoRA_Functions::instance().printNodeData(false);
+				Webhook_Batch::instance().flush();												// The window's node reports go to the queue together
 				nodeDatabase.flush(true);
 				if (Time.hour() != Time.hour(sysStatus.get_lastConnection()) && current.get_openHours()) state = CONNECTING_STATE;  	// Only Connect once an hour after the LoRA window is over and if the park is open			
 				else if (sysStatus.get_alertCodeGateway() != 0) state = ERROR_STATE;
@@ -199,7 +218,14 @@ void loop() {
 
 		case REPORTING_STATE: {
 			publishStateTransition();
-			publishWebhook(current.get_nodeNumber());							// Gateway or node webhook
+			if (LoRA_Functions::instance().getBatchRecordCount() == 0) publishWebhook(current.get_nodeNumber());	// Gateway or node webhook
+			else {																// A batched report - one webhook per record, oldest first
+				for (uint8_t i = 0; i < LoRA_Functions::instance().getBatchRecordCount(); i++) {
+					uint16_t hourly = 0, daily = 0;
+					time_t timestamp = LoRA_Functions::instance().getBatchRecord(i, hourly, daily);
+					publishWebhook(current.get_nodeNumber(), timestamp, hourly, daily);
+				}
+			}
 			current.set_alertCodeNode(0);										// Zero alert code after send
 			sysStatus.set_messageCount(sysStatus.get_messageCount() + 1);		// Increment the message counter 
 			state = LoRA_STATE;
@@ -214,6 +240,7 @@ void loop() {
 					current.resetEverything();
 					Log.info("New Day - Resetting everything");
 				}
+				Webhook_Batch::instance().flush();										// Any node reports still waiting go out on this connection
 				publishWebhook(sysStatus.get_nodeNumber());								// Before we connect - let's send the gateway's webhook
 				if (!Particle.connected()) Particle.connect();							// Time to connect to Particle
 				connectingTimeout = millis();
@@ -271,11 +298,14 @@ void loop() {
 
 	ab1805.loop();                                  // Keeps the RTC synchronized with the Boron's clock
 
+	Webhook_Batch::instance().loop();				// Sends batched node reports that have waited long enough
+
 	PublishQueuePosix::instance().loop();           // Check to see if we need to tend to the message 
 
 	sysStatus.loop();
 	current.loop();
 	nodeDatabase.loop();
+	routeTable.loop();
 
 	LoRA_Functions::instance().loop();				// Check to see if Node connections are healthy
 
@@ -318,27 +348,63 @@ void userSwitchISR() {
  * 
  * @details Nodes and Gateways will use the same format for this webook - data sources will change
  * 
- * 
+ * @param nodeNumber - 0 is the gateway
+ * @param timestamp - when a batched record was taken, 0 is now
+ * @param hourly, daily - the node's counts, passed in so a batched report's records don't have to go through current
  */
 
 void publishWebhook(uint8_t nodeNumber) {
+	publishWebhook(nodeNumber, 0, current.get_hourlyCount(), current.get_dailyCount());
+}
+
+void publishWebhook(uint8_t nodeNumber, time_t timestamp, uint16_t hourly, uint16_t daily) {
 	char data[256];                             						// Store the date in this character array - not global
 	// Battery conect information - https://docs.particle.io/reference/device-os/firmware/boron/#batterystate-
     const char* batteryContext[8] = {"Unknown","Not Charging","Charging","Charged","Discharging","Fault","Diconnected"};
 
 	if (!Time.isValid()) return;										// A webhook without a valid timestamp is worthless
-	unsigned long endTimePeriod = Time.now() - (Time.second() + 1);		// Moves the timestamp withing the reporting boundary - so 18:00:14 becomes 17:59:59 - helps in Ubidots reporting
+	if (timestamp == 0) timestamp = Time.now();							// Batched reports carry the time the node took each count
+	unsigned long endTimePeriod = timestamp - (Time.second(timestamp) + 1);	// Moves the timestamp withing the reporting boundary - so 18:00:14 becomes 17:59:59 - helps in Ubidots reporting
 
 	if (nodeNumber > 0) {												// Webhook for a node
-		String deviceID = LoRA_Functions::instance().findDeviceID(nodeNumber, current.get_nodeID());
-		if (deviceID == "null") return;									// A webhook without a deviceID is worthless
+		char deviceID[25];
+		if (!LoRA_Functions::instance().findDeviceID(nodeNumber, current.get_nodeID(), deviceID)) return;	// A webhook without a deviceID is worthless
 
 		float percentSuccess = ((current.get_successCount() * 1.0)/ current.get_messageCount())*100.0;
 
-		snprintf(data, sizeof(data), "{\"deviceid\":\"%s\", \"hourly\":%u, \"daily\":%u, \"sensortype\":%d, \"battery\":%4.2f,\"key1\":\"%s\",\"temp\":%d, \"resets\":%d,\"alerts\": %d, \"node\": %d, \"rssi\":%d,  \"snr\":%d, \"hops\":%d, \"msg\":%d, \"success\":%4.2f, \"timestamp\":%lu000}",\
-		deviceID.c_str(), current.get_hourlyCount(), current.get_dailyCount(), current.get_sensorType(), current.get_stateOfCharge(), batteryContext[current.get_batteryState()],\
+		if (sysStatus.get_webhookEncoding() == (uint8_t)Webhook_Batch::Encoding::PACKED) {	// Layout in webhooks/Ubidots-LoRA-Nodes-z85-v1.md - little endian
+			uint8_t record[Webhook_Batch::PACKED_RECORD_SIZE];
+			uint16_t battery = (uint16_t)(current.get_stateOfCharge() * 100.0 + 0.5);
+			uint16_t success = (current.get_messageCount()) ? (uint16_t)(percentSuccess * 100.0 + 0.5) : 0;
+			record[0] = current.get_nodeNumber();
+			record[1] = current.get_sensorType();
+			record[2] = hourly & 0xFF;
+			record[3] = hourly >> 8;
+			record[4] = daily & 0xFF;
+			record[5] = daily >> 8;
+			for (int i = 0; i < 4; i++) record[6 + i] = (uint32_t)endTimePeriod >> (8 * i);
+			record[10] = battery & 0xFF;
+			record[11] = battery >> 8;
+			record[12] = current.get_batteryState();
+			record[13] = current.get_internalTempC();
+			record[14] = current.get_resetCount();
+			record[15] = current.get_alertCodeNode();
+			record[16] = (uint16_t)current.get_RSSI() & 0xFF;
+			record[17] = (uint16_t)current.get_RSSI() >> 8;
+			record[18] = (uint16_t)current.get_SNR() & 0xFF;
+			record[19] = (uint16_t)current.get_SNR() >> 8;
+			record[20] = current.get_hops();
+			record[21] = current.get_messageCount();
+			record[22] = success & 0xFF;
+			record[23] = success >> 8;
+			Webhook_Batch::instance().addPacked(record);					// Node number instead of deviceID - the cloud learns those from nodeData
+			return;
+		}
+
+		snprintf(data, sizeof(data), "{\"deviceid\":\"%s\",\"hourly\":%u,\"daily\":%u,\"sensortype\":%d,\"battery\":%4.2f,\"key1\":\"%s\",\"temp\":%d,\"resets\":%d,\"alerts\":%d,\"node\":%d,\"rssi\":%d,\"snr\":%d,\"hops\":%d,\"msg\":%d,\"success\":%4.2f,\"timestamp\":%lu000}",\
+		deviceID, hourly, daily, current.get_sensorType(), current.get_stateOfCharge(), batteryContext[current.get_batteryState()],\
 		current.get_internalTempC(), current.get_resetCount(), current.get_alertCodeNode(), current.get_nodeNumber(), current.get_RSSI(), current.get_SNR(), current.get_hops(), current.get_messageCount(), percentSuccess, endTimePeriod);
-		PublishQueuePosix::instance().publish("Ubidots-LoRA-Node-v1", data, PRIVATE | WITH_ACK);
+		Webhook_Batch::instance().add(data);							// Several node records go out in one Ubidots-LoRA-Nodes-v1 event
 	}
 	else {																// Webhook for the gateway
 		takeMeasurements();												// Loads the current values for the Gateway
@@ -346,7 +412,7 @@ void publishWebhook(uint8_t nodeNumber) {
 		snprintf(data, sizeof(data), "{\"deviceid\":\"%s\", \"hourly\":%u, \"daily\":%u, \"sensortype\":%d, \"battery\":%4.2f,\"key1\":\"%s\",\"temp\":%d, \"resets\":%d, \"msg\":%d, \"timestamp\":%lu000}",\
 		Particle.deviceID().c_str(), 0, 0, sysStatus.get_sensorType(), current.get_stateOfCharge(), batteryContext[current.get_batteryState()],\
 		current.get_internalTempC(), sysStatus.get_resetCount(), sysStatus.get_messageCount(), endTimePeriod);
-		PublishQueuePosix::instance().publish("Ubidots-LoRA-Gateway-v1", data, PRIVATE | WITH_ACK);
+		PublishQueuePosix::instance().publish("Ubidots-LoRA-Gateway-v1", data, PRIVATE | WITH_ACK, PublishQueuePriority::BACKGROUND, GATEWAY_REPORT_KEY);	// Health only - sent after the counts, latest one only
 	}
 	return;
 }
@@ -2,10 +2,14 @@
 #include "MB85RC256V-FRAM-RK.h"
 #include "StorageHelperRK.h"
 #include "MyPersistentData.h"
+#include "ChannelPlan.h"
 
 
 MB85RC64 fram(Wire, 0);
 
+static_assert(FramLayout::END <= FramLayout::FRAM_SIZE, "Persistent data does not fit in the MB85RC64 FRAM");
+static_assert(FramLayout::NODE_TABLE == 200, "Node table has moved - gateways in the field would lose it on update");
+
 // *******************  SysStatus Storage Object **********************
 //
 // ********************************************************************
@@ -20,7 +24,7 @@ sysStatusData &sysStatusData::instance() {
     return *_instance;
 }
 
-sysStatusData::sysStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, 0, &sysData.sysHeader, sizeof(SysData), SYS_DATA_MAGIC, SYS_DATA_VERSION) {
+sysStatusData::sysStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, FramLayout::SYS_SLOT_A, &sysData.sysHeader, sizeof(SysData), SYS_DATA_MAGIC, SYS_DATA_VERSION) {
 
 };
 
@@ -30,7 +34,9 @@ sysStatusData::~sysStatusData() {
 void sysStatusData::setup() {
     fram.begin();
     sysStatus
+        .withSecondSlot(FramLayout::SYS_SLOT_B)	// A reset part way through a save leaves the other copy
     //    .withLogData(true)
+        .withDeferredHash()                             // Hashed once per save rather than on every set call
         .withSaveDelayMs(500)
         .load();
 
@@ -85,6 +91,7 @@ void sysStatusData::initialize() {
     sysStatus.set_openTime(6);
     sysStatus.set_closeTime(22);
     sysStatus.set_verizonSIM(false);
+    sysStatus.set_webhookEncoding(0);
 
     // If you manually update fields here, be sure to update the hash
     updateHash();
@@ -226,8 +233,16 @@ void sysStatusData::set_sensorType(uint8_t value) {
     setValue<uint8_t>(offsetof(SysData, sensorType), value);
 }
 
+uint8_t sysStatusData::get_webhookEncoding() const {
+    return getValue<uint8_t>(offsetof(SysData, webhookEncoding));
+}
+
+void sysStatusData::set_webhookEncoding(uint8_t value) {
+    setValue<uint8_t>(offsetof(SysData, webhookEncoding), value);
+}
+
 // *****************  Current Status Storage Object *******************
-// Offset of 100 bytes - make room for SysStatus
+//
 // ********************************************************************
 
 currentStatusData *currentStatusData::_instance;
@@ -240,7 +255,7 @@ currentStatusData &currentStatusData::instance() {
     return *_instance;
 }
 
-currentStatusData::currentStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, 100, &currentData.currentHeader, sizeof(CurrentData), CURRENT_DATA_MAGIC, CURRENT_DATA_VERSION) {
+currentStatusData::currentStatusData() : StorageHelperRK::PersistentDataFRAM(::fram, FramLayout::CURRENT_SLOT_A, &currentData.currentHeader, sizeof(CurrentData), CURRENT_DATA_MAGIC, CURRENT_DATA_VERSION) {
 };
 
 currentStatusData::~currentStatusData() {
@@ -250,7 +265,9 @@ void currentStatusData::setup() {
     fram.begin();
 
     current
+        .withSecondSlot(FramLayout::CURRENT_SLOT_B)	// A reset part way through a save leaves the other copy
     //    .withLogData(true)
+        .withDeferredHash()                             // Hashed once per save rather than on every set call
         .withSaveDelayMs(500)
         .load();
 
@@ -287,7 +304,7 @@ void currentStatusData::initialize() {
 
 void currentStatusData::resetEverything() {                             // The device is waking up in a new day or is a new install
   Log.info("A new day - resetting everything");
-  current.set_nodeNumber(11);
+  current.set_nodeNumber(nodeIDData::UNCONFIGURED_NODE);
   current.set_tempNodeNumber(0);
   current.set_nodeID(0);
   current.set_alertCodeNode(0);
@@ -463,7 +480,9 @@ void currentStatusData::set_productVersion(uint16_t value) {
 
 // *******************  nodeID Storage Object **********************
 //
-// ******************** Offset of 200         **********************
+//
+
+static_assert(nodeIDData::MAX_NODES < nodeIDData::UNCONFIGURED_NODE, "Node numbers must not reach the unconfigured node address");
 
 nodeIDData *nodeIDData::_instance;
 
@@ -475,7 +494,7 @@ nodeIDData &nodeIDData::instance() {
     return *_instance;
 }
 
-nodeIDData::nodeIDData() : StorageHelperRK::PersistentDataFRAM(::fram, 200, &nodeData.nodeHeader, sizeof(NodeData), NODEID_DATA_MAGIC, NODEID_DATA_VERSION) {
+nodeIDData::nodeIDData() : StorageHelperRK::PersistentDataFRAM(::fram, FramLayout::NODE_TABLE, &nodeData.nodeHeader, sizeof(NodeData), NODEID_DATA_MAGIC, NODEID_DATA_VERSION) {
 
 };
 
@@ -486,10 +505,15 @@ void nodeIDData::setup() {
     fram.begin();
 
     nodeDatabase
+        .withJournal(FramLayout::NODE_JOURNAL, JOURNAL_SIZE)	// A reset part way through a save must not wipe the node table
+        .withJournalRecords(offsetof(NodeData, nodes), sizeof(NodeRecord))	// A save too big for the journal is split between node records
     //    .withLogData(true)
+        .withDeferredHash()                             // Hashed once per save rather than on every set call
         .withSaveDelayMs(500)
         .load();
 
+    nodeIDData::rebuildIndex();                         // The deviceID index lives in RAM - build it from the table we just loaded
+
     // Log.info("sizeof(NodeData): %u", sizeof(NodeData)); 
 }
 
@@ -498,39 +522,290 @@ void nodeIDData::loop() {
 }
 
 void nodeIDData::resetNodeIDs() {
-    String blank = "{\"nodes\":[]}";
-    Log.info("Resettig NodeID config to: %s", blank.c_str());
-    nodeDatabase.set_nodeIDJson(blank);
+    Log.info("Resetting NodeID table - %d nodes removed", nodeDatabase.get_nodeCount());
+    WITH_LOCK(*this) {
+        memset(nodeData.nodes, 0, sizeof(nodeData.nodes));
+        nodeData.nodeCount = 0;
+        markDirty(offsetof(NodeData, nodeCount), sizeof(NodeData) - offsetof(NodeData, nodeCount));
+        updateHash();
+    }
+    nodeIDData::rebuildIndex();
     nodeDatabase.flush(true);
-    Log.info("NodeID data is now %s", nodeDatabase.get_nodeIDJson().c_str());
 }
 
 bool nodeIDData::validate(size_t dataSize) {
     bool valid = PersistentDataFRAM::validate(dataSize);
+    if (valid) {
+        if (nodeDatabase.get_nodeCount() > MAX_NODES) {
+            Log.info("nodeID data not valid nodeCount=%d", nodeDatabase.get_nodeCount());
+            valid = false;
+        }
+    }
     if (!valid) Log.info("nodeID data is %s",(valid) ? "valid": "not valid");
     return valid;
 }
 
 void nodeIDData::initialize() {
+    Log.info("Initializing data");
+    PersistentDataFRAM::initialize();                   // Zeros the node table
+    nodeIDData::resetNodeIDs();
+    updateHash();                                       // If you manually update fields here, be sure to update the hash
+}
+
+uint16_t nodeIDData::get_nodeCount() const {
+    return getValue<uint16_t>(offsetof(NodeData, nodeCount));
+}
+
+bool nodeIDData::nodeInTable(uint8_t nodeNumber) const {
+    return (nodeNumber >= 1 && nodeNumber <= nodeDatabase.get_nodeCount());
+}
+
+uint16_t nodeIDData::get_radioID(uint8_t nodeNumber) const {
+    if (!nodeInTable(nodeNumber)) return 0;
+    return getValue<uint16_t>(nodeOffset(nodeNumber, offsetof(NodeRecord, radioID)));
+}
+
+void nodeIDData::set_radioID(uint8_t nodeNumber, uint16_t value) {
+    setNodeValue<uint16_t>(nodeNumber, offsetof(NodeRecord, radioID), value);
+}
+
+uint32_t nodeIDData::get_lastConnect(uint8_t nodeNumber) const {
+    if (!nodeInTable(nodeNumber)) return 0;
+    return getValue<uint32_t>(nodeOffset(nodeNumber, offsetof(NodeRecord, lastConnect)));
+}
 
-    Log.info("Erasing FRAM region");
-    for (unsigned int i=0; i < sizeof(NodeData); i++) {
-        fram.writeData(i+200,(uint8_t *)0xFF,2);
+void nodeIDData::set_lastConnect(uint8_t nodeNumber, uint32_t value) {
+    setNodeValue<uint32_t>(nodeNumber, offsetof(NodeRecord, lastConnect), value);
+}
+
+float nodeIDData::get_successPercent(uint8_t nodeNumber) const {
+    if (!nodeInTable(nodeNumber)) return 0.0;
+    return getValue<float>(nodeOffset(nodeNumber, offsetof(NodeRecord, successPercent)));
+}
+
+void nodeIDData::set_successPercent(uint8_t nodeNumber, float value) {
+    setNodeValue<float>(nodeNumber, offsetof(NodeRecord, successPercent), value);
+}
+
+uint8_t nodeIDData::get_sensorType(uint8_t nodeNumber) const {
+    if (!nodeInTable(nodeNumber)) return 0;
+    return getValue<uint8_t>(nodeOffset(nodeNumber, offsetof(NodeRecord, sensorType)));
+}
+
+void nodeIDData::set_sensorType(uint8_t nodeNumber, uint8_t value) {
+    setNodeValue<uint8_t>(nodeNumber, offsetof(NodeRecord, sensorType), value);
+}
+
+uint8_t nodeIDData::get_pendingAlert(uint8_t nodeNumber) const {
+    if (!nodeInTable(nodeNumber)) return 0;
+    return getValue<uint8_t>(nodeOffset(nodeNumber, offsetof(NodeRecord, pendingAlert)));
+}
+
+void nodeIDData::set_pendingAlert(uint8_t nodeNumber, uint8_t value) {
+    setNodeValue<uint8_t>(nodeNumber, offsetof(NodeRecord, pendingAlert), value);
+}
+
+bool nodeIDData::get_deviceID(uint8_t nodeNumber, char *deviceID) const {
+    deviceID[0] = '\0';
+    if (!nodeInTable(nodeNumber)) return false;
+    WITH_LOCK(*this) {
+        unpackDeviceID(nodeData.nodes[nodeNumber - 1].deviceID, deviceID);
     }
+    return true;
+}
+
+uint8_t nodeIDData::findNode(const char *deviceID) const {
+    uint8_t packedID[DEVICE_ID_BYTES];
+    uint8_t nodeNumber = 0;
+
+    if (!packDeviceID(deviceID, packedID)) return 0;
+    WITH_LOCK(*this) {
+        nodeNumber = deviceIndex[indexSlot(packedID)];  // Either the matching node or an empty (0) slot
+    }
+    return nodeNumber;
+}
+
+uint8_t nodeIDData::addNode(const char *deviceID, uint16_t radioID) {
+    uint8_t packedID[DEVICE_ID_BYTES];
+    uint8_t nodeNumber = 0;
+
+    if (!packDeviceID(deviceID, packedID)) return 0;
+    WITH_LOCK(*this) {
+        if (nodeData.nodeCount >= MAX_NODES) {
+            Log.info("Node table is full - %d nodes", nodeData.nodeCount);
+            return 0;
+        }
+        nodeNumber = nodeData.nodeCount + 1;
+        NodeRecord &record = nodeData.nodes[nodeNumber - 1];
+        memset(&record, 0, sizeof(record));
+        memcpy(record.deviceID, packedID, DEVICE_ID_BYTES);
+        record.radioID = radioID;
+        nodeData.nodeCount = nodeNumber;
+        deviceIndex[indexSlot(packedID)] = nodeNumber;
+        markDirty(offsetof(NodeData, nodeCount), sizeof(nodeData.nodeCount));
+        markDirty(nodeOffset(nodeNumber, 0), sizeof(NodeRecord));
+        updateHash();
+    }
+    return nodeNumber;
+}
+
+void nodeIDData::rebuildIndex() {
+    WITH_LOCK(*this) {
+        memset(deviceIndex, 0, sizeof(deviceIndex));
+        for (uint8_t nodeNumber = 1; nodeNumber <= nodeData.nodeCount; nodeNumber++) {
+            deviceIndex[indexSlot(nodeData.nodes[nodeNumber - 1].deviceID)] = nodeNumber;
+        }
+    }
+}
+
+uint16_t nodeIDData::indexSlot(const uint8_t *packedID) const {
+    // Open addressing with linear probing - the index is at least twice the size of the table so there is always an empty slot
+    uint16_t slot = StorageHelperRK::murmur3_32(packedID, DEVICE_ID_BYTES, HASH_SEED) & (NODE_INDEX_SIZE - 1);
+    while (deviceIndex[slot] != 0 && memcmp(nodeData.nodes[deviceIndex[slot] - 1].deviceID, packedID, DEVICE_ID_BYTES) != 0) {
+        slot = (slot + 1) & (NODE_INDEX_SIZE - 1);
+    }
+    return slot;
+}
+
+bool nodeIDData::packDeviceID(const char *deviceID, uint8_t *packedID) {
+    if (strlen(deviceID) != DEVICE_ID_BYTES * 2) return false;
+    for (uint8_t i = 0; i < DEVICE_ID_BYTES * 2; i++) {
+        char c = deviceID[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = 10 + c - 'a';
+        else if (c >= 'A' && c <= 'F') nibble = 10 + c - 'A';
+        else return false;                              // Not a Particle deviceID
+        if (i % 2 == 0) packedID[i / 2] = nibble << 4;
+        else packedID[i / 2] |= nibble;
+    }
+    return true;
+}
+
+void nodeIDData::unpackDeviceID(const uint8_t *packedID, char *deviceID) {
+    static const char hexDigits[] = "0123456789abcdef";
+    for (uint8_t i = 0; i < DEVICE_ID_BYTES; i++) {
+        deviceID[i * 2] = hexDigits[packedID[i] >> 4];
+        deviceID[i * 2 + 1] = hexDigits[packedID[i] & 0x0F];
+    }
+    deviceID[DEVICE_ID_BYTES * 2] = '\0';
+}
+
+// *******************  Route Table Storage Object **********************
+//
+// ********************************************************************
+
+routeTableData *routeTableData::_instance;
+
+// [static]
+routeTableData &routeTableData::instance() {
+    if (!_instance) {
+        _instance = new routeTableData();
+    }
+    return *_instance;
+}
+
+routeTableData::routeTableData() : StorageHelperRK::PersistentDataFRAM(::fram, FramLayout::ROUTE_TABLE, &routeData.routeHeader, sizeof(RouteData), ROUTE_DATA_MAGIC, ROUTE_DATA_VERSION) {
+};
+
+routeTableData::~routeTableData() {
+}
+
+void routeTableData::setup() {
+    fram.begin();
+
+    routeTable
+        .withJournal(FramLayout::ROUTE_JOURNAL, JOURNAL_SIZE)	// Saves are atomic, like the node table's
+    //    .withLogData(true)
+        .withDeferredHash()                             // Hashed once per save rather than on every set call
+        .withSaveDelayMs(500)
+        .load();
+}
+
+void routeTableData::loop() {
+    routeTable.flush(false);
+}
+
+void routeTableData::clearRoutes() {
+    Log.info("Clearing the saved mesh routes and data rates");
+    WITH_LOCK(*this) {
+        memset(routeData.nextHop, 0, sizeof(routeData.nextHop));
+        memset(routeData.spreadingFactor, 0, sizeof(routeData.spreadingFactor));
+        memset(routeData.txPower, 0, sizeof(routeData.txPower));
+        memset(routeData.channel, 0, sizeof(routeData.channel));
+        markDirty(offsetof(RouteData, nextHop), sizeof(RouteData) - offsetof(RouteData, nextHop));
+        updateHash();
+    }
+    routeTable.flush(true);
+}
+
+bool routeTableData::validate(size_t dataSize) {
+    bool valid = PersistentDataFRAM::validate(dataSize);
+    if (valid) {
+        for (uint8_t nodeNumber = 1; nodeNumber <= nodeIDData::MAX_NODES; nodeNumber++) {
+            if (routeData.nextHop[nodeNumber - 1] > nodeIDData::MAX_NODES) {
+                Log.info("route data not valid nextHop=%d for node %d", routeData.nextHop[nodeNumber - 1], nodeNumber);
+                valid = false;
+                break;
+            }
+            uint8_t sf = routeData.spreadingFactor[nodeNumber - 1];
+            uint8_t power = routeData.txPower[nodeNumber - 1];
+            uint8_t channel = routeData.channel[nodeNumber - 1];
+            if ((sf != 0 && (sf < 7 || sf > 12)) || (power != 0 && (power < 2 || power > 23)) || channel >= CHANNEL_COUNT) {
+                Log.info("route data not valid spreadingFactor=%d txPower=%d channel=%d for node %d", sf, power, channel, nodeNumber);
+                valid = false;
+                break;
+            }
+        }
+    }
+    if (!valid) Log.info("route data is %s",(valid) ? "valid": "not valid");
+    return valid;
+}
+
+void routeTableData::initialize() {
+    PersistentDataFRAM::initialize();                   // Zeros the table - no routes known, every node at the default data rate on channel 0
+
+    Log.info("Route Data Initialized");
 
-    Log.info("Initializing data");
-    PersistentDataFRAM::initialize();
-    nodeIDData::resetNodeIDs();
     updateHash();                                       // If you manually update fields here, be sure to update the hash
 }
 
+uint8_t routeTableData::get_nextHop(uint8_t nodeNumber) const {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return 0;
+    return getValue<uint8_t>(offsetof(RouteData, nextHop) + nodeNumber - 1);
+}
+
+void routeTableData::set_nextHop(uint8_t nodeNumber, uint8_t value) {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return;
+    setValue<uint8_t>(offsetof(RouteData, nextHop) + nodeNumber - 1, value);
+}
+
+uint8_t routeTableData::get_spreadingFactor(uint8_t nodeNumber) const {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return 0;
+    return getValue<uint8_t>(offsetof(RouteData, spreadingFactor) + nodeNumber - 1);
+}
+
+void routeTableData::set_spreadingFactor(uint8_t nodeNumber, uint8_t value) {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return;
+    setValue<uint8_t>(offsetof(RouteData, spreadingFactor) + nodeNumber - 1, value);
+}
+
+uint8_t routeTableData::get_txPower(uint8_t nodeNumber) const {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return 0;
+    return getValue<uint8_t>(offsetof(RouteData, txPower) + nodeNumber - 1);
+}
+
+void routeTableData::set_txPower(uint8_t nodeNumber, uint8_t value) {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return;
+    setValue<uint8_t>(offsetof(RouteData, txPower) + nodeNumber - 1, value);
+}
 
-String nodeIDData::get_nodeIDJson() const {
-	String result;
-	getValueString(offsetof(NodeData, nodeIDJson), sizeof(NodeData::nodeIDJson), result);
-	return result;
+uint8_t routeTableData::get_channel(uint8_t nodeNumber) const {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return 0;
+    return getValue<uint8_t>(offsetof(RouteData, channel) + nodeNumber - 1);
 }
 
-bool nodeIDData::set_nodeIDJson(const char *str) {
-	return setValueString(offsetof(NodeData, nodeIDJson), sizeof(NodeData::nodeIDJson), str);
+void routeTableData::set_channel(uint8_t nodeNumber, uint8_t value) {
+    if (nodeNumber < 1 || nodeNumber > nodeIDData::MAX_NODES) return;
+    setValue<uint8_t>(offsetof(RouteData, channel) + nodeNumber - 1, value);
 }
@@ -10,6 +10,7 @@
 #define current currentStatusData::instance()
 #define sysStatus sysStatusData::instance()
 #define nodeDatabase nodeIDData::instance()
+#define routeTable routeTableData::instance()
 
 /**
  * This class is a singleton; you do not create one as a global, on the stack, or with new.
@@ -91,6 +92,7 @@ public:
 		uint8_t closeTime;                                // Close time 24 hours
 		bool verizonSIM;                                  // Are we using a Verizon SIM?
 		uint8_t sensorType;								  // What sensor if any is on this device (0-none, 1-PIR, 2-Pressure, ...)
+		uint8_t webhookEncoding;						  // How node reports are published (0-JSON records, 1-packed Z85 records)
 	};
 	SysData sysData;
 
@@ -169,6 +171,9 @@ public:
 	uint8_t get_sensorType() const;
 	void set_sensorType(uint8_t value);
 
+	uint8_t get_webhookEncoding() const;
+	void set_webhookEncoding(uint8_t value);
+
 	uint16_t get_RSSI() const;
 	void set_RSSI(uint16_t value);
 
@@ -477,6 +482,22 @@ public:
 	 */
 	void initialize();
 
+	static const uint8_t MAX_NODES = 200;				  // Node numbers 1 - MAX_NODES can be assigned by the gateway - 24 bytes of FRAM per node
+	static const uint8_t UNCONFIGURED_NODE = 254;		  // Address used by nodes that have not joined - outside the assignable range and not the broadcast address
+	static const uint16_t NODE_INDEX_SIZE = 512;		  // Slots in the deviceID hash index - power of two and at least twice MAX_NODES
+	static const uint8_t DEVICE_ID_BYTES = 12;			  // A Particle deviceID is 24 hex characters - stored as 12 bytes
+	static const size_t JOURNAL_SIZE = 512;				  // FRAM journal that makes node table saves atomic - a save of more than about 19 records goes in chunks
+
+	class NodeRecord {
+	public:
+		// Fixed layout - 24 bytes per node.  The record for node n is nodes[n-1] so lookup by node number needs no search.
+		uint8_t deviceID[DEVICE_ID_BYTES];				  // Particle deviceID packed two hex characters per byte
+		uint32_t lastConnect;							  // Time of last contact (Time.now() is 32 bits on Particle)
+		float successPercent;							  // Percent of messages the node sent that were delivered
+		uint16_t radioID;								  // Checksum of the deviceID - the node sends this with every report
+		uint8_t sensorType;								  // What sensor is on the node (0-car, 1-person, ...)
+		uint8_t pendingAlert;							  // Alert code to send to the node on its next report
+	};
 
 	class NodeData {
 	public:
@@ -485,7 +506,9 @@ public:
 		// Your fields go here. Once you've added a field you cannot add fields
 		// (except at the end), insert fields, remove fields, change size of a field.
 		// Doing so will cause the data to be corrupted!
-		char nodeIDJson[1024];                             // JSON string that stores the nodeID data
+		uint16_t nodeCount;								  // Number of nodes that have joined - nodes are numbered 1 to nodeCount
+		uint16_t reserved;								  // Keeps the node records 32-bit aligned
+		NodeRecord nodes[MAX_NODES];					  // The node table
 	};
 	NodeData nodeData;
 
@@ -494,9 +517,10 @@ public:
 	/**
 	 * @brief For the Get functions, used to retrieve the value of the variable
 	 * 
-	 * @details Specific to the location in the object and the type of the variable
+	 * @details Specific to the location in the object and the type of the variable.  Node fields
+	 * take the node number (1 - MAX_NODES) and return 0 for a node that is not in the table.
 	 * 
-	 * @param Nothing needed
+	 * @param nodeNumber for the node fields
 	 * 
 	 * @returns The value of the variable in the corret type
 	 * 
@@ -505,17 +529,96 @@ public:
 	/**
 	 * @brief For the Set functions, used to set the value of the variable
 	 * 
-	 * @details Specific to the location in the object and the type of the variable
+	 * @details Specific to the location in the object and the type of the variable.  Only the
+	 * record that changed is marked to be written back to FRAM.
 	 * 
-	 * @param Value to set the variable - correct type - for Strings they are truncated if too long
+	 * @param nodeNumber for the node fields and the value to set the variable - correct type
 	 * 
 	 * @returns None needed
 	 * 
 	 */
 
-	String get_nodeIDJson() const;
-	bool set_nodeIDJson(const char *str);
-	
+	uint16_t get_nodeCount() const;
+
+	uint16_t get_radioID(uint8_t nodeNumber) const;
+	void set_radioID(uint8_t nodeNumber, uint16_t value);
+
+	uint32_t get_lastConnect(uint8_t nodeNumber) const;
+	void set_lastConnect(uint8_t nodeNumber, uint32_t value);
+
+	float get_successPercent(uint8_t nodeNumber) const;
+	void set_successPercent(uint8_t nodeNumber, float value);
+
+	uint8_t get_sensorType(uint8_t nodeNumber) const;
+	void set_sensorType(uint8_t nodeNumber, uint8_t value);
+
+	uint8_t get_pendingAlert(uint8_t nodeNumber) const;
+	void set_pendingAlert(uint8_t nodeNumber, uint8_t value);
+
+	/**
+	 * @brief Get the deviceID for a node as a 24 character hex string
+	 * 
+	 * @param nodeNumber 
+	 * @param deviceID - buffer of at least 25 characters
+	 * @return true if the node is in the table
+	 */
+	bool get_deviceID(uint8_t nodeNumber, char *deviceID) const;
+
+	/**
+	 * @brief Returns true if the node number has been assigned to a device
+	 * 
+	 */
+	bool nodeInTable(uint8_t nodeNumber) const;
+
+	/**
+	 * @brief Looks up a deviceID using the hash index
+	 * 
+	 * @param deviceID - a 24 character hex string
+	 * @return uint8_t - the node number or 0 if the deviceID is not in the table
+	 */
+	uint8_t findNode(const char *deviceID) const;
+
+	/**
+	 * @brief Adds a device to the end of the node table
+	 * 
+	 * @param deviceID - a 24 character hex string
+	 * @param radioID - the checksum of the deviceID
+	 * @return uint8_t - the new node number or 0 if the table is full or the deviceID is not valid
+	 */
+	uint8_t addNode(const char *deviceID, uint16_t radioID);
+
+	/**
+	 * @brief Read-only view of a node record in place - the table stays locked while the view exists
+	 * 
+	 * @details Reads every field of a record for one lock and no copies.  Keep the view short lived - don't
+	 * hold one across a publish or a delay.  Test it before use, it is false for a node not in the table.
+	 * 
+	 */
+	class RecordView {
+	public:
+		RecordView(const nodeIDData &table, uint8_t nodeNumber) : table(table) {
+			table.lock();
+			record = (table.nodeInTable(nodeNumber)) ? &table.nodeData.nodes[nodeNumber - 1] : nullptr;
+		}
+		~RecordView() {
+			table.unlock();
+		}
+		RecordView(const RecordView&) = delete;
+		RecordView& operator=(const RecordView&) = delete;
+
+		explicit operator bool() const { return record != nullptr; }
+		const NodeRecord *operator->() const { return record; }
+
+		/**
+		 * @brief Unpacks the deviceID into a buffer of at least 25 characters
+		 * 
+		 */
+		void deviceID(char *deviceID) const { nodeIDData::unpackDeviceID(record->deviceID, deviceID); }
+
+	protected:
+		const nodeIDData &table;
+		const NodeRecord *record;
+	};
 
 	//Members here are internal only and therefore protected
 protected:
@@ -550,8 +653,213 @@ protected:
 
     //Since these variables are only used internally - They can be private. 
 	static const uint32_t NODEID_DATA_MAGIC = 0x20a99e60;
-	static const uint16_t NODEID_DATA_VERSION = 2;
+	static const uint16_t NODEID_DATA_VERSION = 3;		  // Version 3 - binary node table replaced the JSON string
+
+	/**
+	 * @brief Offset of a field in the record for a node - used with getValue / setValue
+	 * 
+	 */
+	size_t nodeOffset(uint8_t nodeNumber, size_t fieldOffset) const {
+		return offsetof(NodeData, nodes) + (nodeNumber - 1) * sizeof(NodeRecord) + fieldOffset;
+	}
+
+	/**
+	 * @brief Sets a field in a node record - setValue() marks just those bytes to be written on the next save
+	 * 
+	 */
+	template<class T>
+	void setNodeValue(uint8_t nodeNumber, size_t fieldOffset, T value) {
+		if (nodeNumber < 1 || nodeNumber > MAX_NODES) return;
+		setValue<T>(nodeOffset(nodeNumber, fieldOffset), value);
+	}
+
+	/**
+	 * @brief Rebuilds the deviceID hash index from the node table - after load or reset
+	 * 
+	 */
+	void rebuildIndex();
+
+	/**
+	 * @brief Finds the hash index slot for a packed deviceID - either its slot or the empty slot where it would go
+	 * 
+	 */
+	uint16_t indexSlot(const uint8_t *packedID) const;
+
+	/**
+	 * @brief Converts between the 24 character hex deviceID and the 12 bytes stored in the table
+	 * 
+	 */
+	static bool packDeviceID(const char *deviceID, uint8_t *packedID);
+	static void unpackDeviceID(const uint8_t *packedID, char *deviceID);
+
+	uint8_t deviceIndex[NODE_INDEX_SIZE] = {};			  // deviceID hash index (RAM only) - node number or 0 for an empty slot
+
+};
+
+// *******************  Route Table Storage Object **********************
+//
+// ********************************************************************
+
+/**
+ * @details The next hop toward each node and the data rate and channel it was last given, saved so the mesh routing table
+ * and the assignments survive a reset without a route discovery per node.  Losing it only costs those discoveries
+ * and a few reports at the default data rate on channel 0, so it keeps one copy - no slots or journal.
+ */
+class routeTableData : public StorageHelperRK::PersistentDataFRAM {
+public:
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     * 
+     * Use MyPersistentData::instance() to instantiate the singleton.
+     */
+    static routeTableData &instance();
+
+    /**
+     * @brief Perform setup operations; call this from global application setup()
+     * 
+     * You typically use MyPersistentData::instance().setup();
+     */
+    void setup();
+
+    /**
+     * @brief Perform application loop operations; call this from global application loop()
+     * 
+     * You typically use MyPersistentData::instance().loop();
+     */
+    void loop();
+
+	/**
+	 * @brief Forgets every route, data rate and channel - when node numbers are handed out again
+	 * 
+	 */
+	void clearRoutes();
+
+	/**
+	 * @brief Validates values and, if valid, checks that data is in the correct range.
+	 * 
+	 */
+	bool validate(size_t dataSize);
+
+	/**
+	 * @brief Will reinitialize data if it is found not to be valid
+	 * 
+	 */
+	void initialize();
+
+	class RouteData {
+	public:
+		// This structure must always begin with the header (16 bytes)
+		StorageHelperRK::PersistentDataBase::SavedDataHeader routeHeader;
+		// Your fields go here. Once you've added a field you cannot add fields
+		// (except at the end), insert fields, remove fields, change size of a field.
+		// Doing so will cause the data to be corrupted!
+		uint8_t nextHop[nodeIDData::MAX_NODES];			  // Next hop toward node n is nextHop[n-1] - the node itself if it is in range, 0 if no route is known
+		uint8_t spreadingFactor[nodeIDData::MAX_NODES];	  // Spreading factor node n was told to report at - 0 for the default
+		uint8_t txPower[nodeIDData::MAX_NODES];			  // Transmit power in dBm node n was told to use - 0 for the default
+		uint8_t channel[nodeIDData::MAX_NODES];			  // Channel node n was told to report on (see ChannelPlan.h) - 0 is where every node starts
+	};
+	RouteData routeData;
+
+	static constexpr size_t JOURNAL_SIZE = StorageHelperRK::PersistentDataFRAM::journalSizeFor(sizeof(RouteData));	// Any save whole - a node's rate and channel are in different arrays and must change together
+
+	/**
+	 * @brief Next hop toward a node - 0 if no route is known or the node number is out of range
+	 * 
+	 */
+	uint8_t get_nextHop(uint8_t nodeNumber) const;
+	void set_nextHop(uint8_t nodeNumber, uint8_t value);
+
+	/**
+	 * @brief Spreading factor a node was told to report at - 0 for the default or if the node number is out of range
+	 * 
+	 */
+	uint8_t get_spreadingFactor(uint8_t nodeNumber) const;
+	void set_spreadingFactor(uint8_t nodeNumber, uint8_t value);
+
+	/**
+	 * @brief Transmit power in dBm a node was told to use - 0 for the default or if the node number is out of range
+	 * 
+	 */
+	uint8_t get_txPower(uint8_t nodeNumber) const;
+	void set_txPower(uint8_t nodeNumber, uint8_t value);
+
+	/**
+	 * @brief Channel a node was told to report on - 0 if it was not told or the node number is out of range
+	 * 
+	 */
+	uint8_t get_channel(uint8_t nodeNumber) const;
+	void set_channel(uint8_t nodeNumber, uint8_t value);
+
+	//Members here are internal only and therefore protected
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     * 
+     * Use MyPersistentData::instance() to instantiate the singleton.
+     */
+    routeTableData();
 
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~routeTableData();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    routeTableData(const routeTableData&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    routeTableData& operator=(const routeTableData&) = delete;
+
+    /**
+     * @brief Singleton instance of this class
+     * 
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static routeTableData *_instance;
+
+    //Since these variables are only used internally - They can be private. 
+	static const uint32_t ROUTE_DATA_MAGIC = 0x3c71e0a5;
+	static const uint16_t ROUTE_DATA_VERSION = 3;
+};
+
+/**
+ * @brief Offset of the FRAM region after one at offset with size bytes - kept 32-bit aligned
+ * 
+ */
+constexpr size_t framRegionAfter(size_t offset, size_t size) {
+	return (offset + size + 3) & ~(size_t)3;
+}
+
+/**
+ * This class places the persistent objects in the MB85RC64 FRAM
+ * 
+ * @details Each region starts where the one before it ends, so a structure that grows moves what follows it
+ * instead of overlapping it.  sysStatus and current are small and keep two copies (A/B slots) so a reset part
+ * way through a save leaves the previous copy.  The node table is too big for two copies and uses a journal, and
+ * so does the route table.
+ * 
+ * The order puts sysStatus slot A at 0 and the node table at 200 - where they were before there were two slots -
+ * so a gateway keeps its settings and its node table across the update.  current starts afresh once.  New regions
+ * go on the end.
+ */
+class FramLayout {
+public:
+	static constexpr size_t FRAM_SIZE = 8192;			  // MB85RC64
+
+	static constexpr size_t SYS_SLOT_A = 0;
+	static constexpr size_t SYS_SLOT_B = framRegionAfter(SYS_SLOT_A, sizeof(sysStatusData::SysData));
+	static constexpr size_t CURRENT_SLOT_A = framRegionAfter(SYS_SLOT_B, sizeof(sysStatusData::SysData));
+	static constexpr size_t NODE_TABLE = framRegionAfter(CURRENT_SLOT_A, sizeof(currentStatusData::CurrentData));
+	static constexpr size_t NODE_JOURNAL = framRegionAfter(NODE_TABLE, sizeof(nodeIDData::NodeData));
+	static constexpr size_t CURRENT_SLOT_B = framRegionAfter(NODE_JOURNAL, nodeIDData::JOURNAL_SIZE);
+	static constexpr size_t ROUTE_TABLE = framRegionAfter(CURRENT_SLOT_B, sizeof(currentStatusData::CurrentData));
+	static constexpr size_t ROUTE_JOURNAL = framRegionAfter(ROUTE_TABLE, sizeof(routeTableData::RouteData));
+	static constexpr size_t END = framRegionAfter(ROUTE_JOURNAL, routeTableData::JOURNAL_SIZE);
 };
 
 
@@ -4,6 +4,7 @@
 #include "MyPersistentData.h"
 #include "Particle_Functions.h"
 #include "LoRA_Functions.h"
+#include "Webhook_Batch.h"
 #include "JsonParserGeneratorRK.h"
 
 char openTimeStr[8] = " ";
@@ -43,23 +44,47 @@ void Particle_Functions::loop() {
     // Put your code to run during the application thread loop here
 }
 
+const size_t MAX_COMMAND_LEN = 622;					// Longest argument the cloud passes to a Particle function
+
+// Copies a string value out of the command without making a String - values are short words or numbers
+// Returns false if the value does not fit in valueLen - a missing key leaves value empty
+static bool getStringByKey(const JsonParser &jp, const JsonParserGeneratorRK::jsmntok_t *container, const char *key, char *value, size_t valueLen) {
+	const JsonParserGeneratorRK::jsmntok_t *token;
+	value[0] = '\0';
+	if (!jp.getValueTokenByKey(container, key, token)) return true;
+	size_t len = valueLen;													// Comes back as the length the whole value needs
+	if (jp.getTokenValue(token, value, len) && len <= valueLen) return true;
+	value[0] = '\0';														// Never act on a truncated word
+	return false;
+}
+
 int Particle_Functions::jsonFunctionParser(String command) {
     // const char * const commandString = "{\"cmd\":[{\"node\":1,\"var\":\"hourly\",\"fn\":\"reset\"},{\"node\":0,\"var\":1,\"fn\":\"lowpowermode\"},{\"node\":2,\"var\":\"daily\",\"fn\":\"report\"}]}";
     // String to put into Uber command window {"cmd":[{"node":1,"var":"hourly","fn":"reset"},{"node":0,"var":1,"fn":"lowpowermode"},{"node":2,"var":"daily","fn":"report"}]}
 
 	int nodeNumber;
-	String variable;
-	String function;
+	char variable[16];
+	char function[16];
   char * pEND;
   char messaging[64];
   bool success = true;
 
-	JsonParserStatic<1024, 80> jp;	// Global parser that supports up to 256 bytes of data and 20 tokens
-
   Log.info(command.c_str());
 
-	jp.clear();
-	jp.addString(command);
+	if (command.length() > MAX_COMMAND_LEN) {
+		Log.info("Command too long - %u bytes", command.length());
+    Particle.publish("cmd", "Command too long",PRIVATE);
+		return 0;
+	}
+	char commandBuf[MAX_COMMAND_LEN + 1];									// The parser gets its own copy - the String's buffer is not ours to hand out
+	size_t commandLen = command.length();
+	memcpy(commandBuf, command.c_str(), commandLen);
+	commandBuf[commandLen] = '\0';
+
+	JsonParserGeneratorRK::jsmntok_t tokens[80];
+	JsonParser jp(commandBuf, sizeof(commandBuf), tokens, 80);
+	jp.setOffset(commandLen);
+
 	if (!jp.parse()) {
 		Log.info("Parsing failed - check syntax");
     Particle.publish("cmd", "Parsing failed - check syntax",PRIVATE);
@@ -77,25 +102,31 @@ int Particle_Functions::jsonFunctionParser(String command) {
 			else break;								                    // Ran out of entries 
 		} 
 		jp.getValueByKey(cmdObjectContainer, "node", nodeNumber);
-		jp.getValueByKey(cmdObjectContainer, "var", variable);
-		jp.getValueByKey(cmdObjectContainer, "fn", function);
+		if (!getStringByKey(jp, cmdObjectContainer, "var", variable, sizeof(variable)) || !getStringByKey(jp, cmdObjectContainer, "fn", function, sizeof(function))) {
+			snprintf(messaging,sizeof(messaging),"Command %d has a var or fn longer than %u characters", i, (unsigned)(sizeof(function) - 1));
+			Log.info(messaging);
+			if (Particle.connected()) Particle.publish("cmd",messaging,PRIVATE);
+			success = false;
+			continue;
+		}
 
     // In this section we will parse and execute the commands from the console or JSON - assumes connection to Particle
     // ****************  Note: currently there is no valudiation on the nodeNumbers ***************************
     // Reset Function
-		if (function == "reset") {
+		if (strcmp(function, "reset") == 0) {
       // Format - function - reset, node - nodeNumber, variables - either "current", "all" or "nodeData"
       // Test - {"cmd":[{"node":1,"var":"all","fn":"reset"}]}
       if (nodeNumber == 0) {
-        if (variable == "nodeData") {
+        if (strcmp(variable, "nodeData") == 0) {
           snprintf(messaging,sizeof(messaging),"Resetting the gateway's node Data");
           nodeDatabase.resetNodeIDs();
+          routeTable.clearRoutes();                   // Node numbers will be handed out again
           Log.info("Resetting the Gateway node so new database is in effect");
           Particle.publish("Alert","Resetting Gateway",PRIVATE);
           delay(2000);
           System.reset();
         }
-        else if (variable == "all") {
+        else if (strcmp(variable, "all") == 0) {
             snprintf(messaging,sizeof(messaging),"Resetting the gateway's system and current data");
             sysStatus.initialize();                     // All will reset system values as well
             current.resetEverything();
@@ -105,7 +136,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
         current.resetEverything();
       } 
       else {
-        if (variable == "all") {
+        if (strcmp(variable, "all") == 0) {
           snprintf(messaging,sizeof(messaging),"Resetting node %d's system and current data", nodeNumber);
           LoRA_Functions::instance().changeAlert(nodeNumber,5);    // Alertcode 5 will reset all data on the node
         }
@@ -116,7 +147,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
       }
     }
     // Reporting Frequency Function
-    else if (function == "freq") {   
+    else if (strcmp(function, "freq") == 0) {   
       // Format - function - freq, node - 0, variables - 2-60 (must be divisiable by two)
       // Test - {"cmd":[{"node":0,"var":"5","fn":"freq"}]}
       int tempValue = strtol(variable,&pEND,10);                       // Looks for the first integer and interprets it
@@ -130,10 +161,10 @@ int Particle_Functions::jsonFunctionParser(String command) {
       }
     }
     // Stay Connected
-    else if (function == "stay") {
+    else if (strcmp(function, "stay") == 0) {
       // Format - function - rpt, node - 0, variables - true or false
       // Test - {"cmd":[{"node":0,"var":"true" or "false","fn":"stay"}]}
-      if (variable == "true") {
+      if (strcmp(variable, "true") == 0) {
         snprintf(messaging,sizeof(messaging),"Going to keep Gateway on Particle and LoRA networks");
         sysStatus.set_connectivityMode(1);
       }
@@ -146,14 +177,14 @@ int Particle_Functions::jsonFunctionParser(String command) {
       }
     }
     // Node ID Report
-    else if (function == "rpt") {
+    else if (strcmp(function, "rpt") == 0) {
       // Format - function - rpt, node - 0, variables - NA
       // Test - {"cmd":[{"node":0,"var":" ","fn":"rpt"}]}
       snprintf(messaging,sizeof(messaging),"Printing nodeID Data");
       LoRA_Functions::instance().printNodeData(true);
     }
     // Setting Open and close hours
-    else if (function == "open") {
+    else if (strcmp(function, "open") == 0) {
       // Format - function - open, node - 0, variables - 0-12 open hour
       // Test - {"cmd":[{"node":0, "var":"6","fn":"open"}]}
       int tempValue = strtol(variable,&pEND,10);                       // Looks for the first integer and interprets it
@@ -166,7 +197,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
         success = false;                                                       // Make sure it falls in a valid range or send a "fail" result
       }
     }
-    else if (function == "close") {
+    else if (strcmp(function, "close") == 0) {
       // Format - function - close, node - 0, variables - 13-24 open hour
       // Test - {"cmd":[{"node":0, "var":"21","fn":"close"}]}
       int tempValue = strtol(variable,&pEND,10);                       // Looks for the first integer and interprets it
@@ -180,7 +211,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
       }
     }
     // Setting the sensor type
-    else if (function == "type") {
+    else if (strcmp(function, "type") == 0) {
       // Format - function - type, node - nodeNumber, variables - 0 (car), 1(person), 2(TBD) 
       // Test - {"cmd":[{"node":1, "var":"1","fn":"type"}]}
       int tempValue = strtol(variable,&pEND,10);                       // Looks for the first integer and interprets it
@@ -195,7 +226,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
       }
     }
     // Setting a Verizon SIM flag
-    else if (function == "sim") {
+    else if (strcmp(function, "sim") == 0) {
       // Format - function - sim, node - 0, variables - 0 (Particle), 1(Verizon)
       // Test - {"cmd":[{"node":0, "var":"1","fn":"sim"}]}
       int tempValue = strtol(variable,&pEND,10);                       // Looks for the first integer and interprets it
@@ -208,8 +239,28 @@ int Particle_Functions::jsonFunctionParser(String command) {
         success = false;                                                       // Make sure it falls in a valid range or send a "fail" result
       }
     }
+    // Webhook encoding for node reports
+    else if (strcmp(function, "hook") == 0) {
+      // Format - function - hook, node - 0, variables - json or packed
+      // Test - {"cmd":[{"node":0, "var":"packed","fn":"hook"}]}
+      if (strcmp(variable, "json") == 0) {
+        snprintf(messaging,sizeof(messaging),"Sending node reports as JSON records");
+        sysStatus.set_webhookEncoding((uint8_t)Webhook_Batch::Encoding::JSON);
+      }
+      else if (strcmp(variable, "packed") == 0) {
+        snprintf(messaging,sizeof(messaging),"Sending node reports as packed records");
+        sysStatus.set_webhookEncoding((uint8_t)Webhook_Batch::Encoding::PACKED);
+        for (uint8_t node = 1; node <= nodeDatabase.get_nodeCount(); node++) {
+          LoRA_Functions::instance().publishNodeData(node);            // The cloud needs each node's deviceID to read packed reports
+        }
+      }
+      else {
+        snprintf(messaging,sizeof(messaging),"Hook encoding - must be json or packed");
+        success = false;                                                       // Make sure it falls in a valid range or send a "fail" result
+      }
+    }
     // Power Cycle the Device
-    else if (function == "pwr") {
+    else if (strcmp(function, "pwr") == 0) {
       // Format - function - pwr, node - 0, variables - 1
       // Test - {"cmd":[{"node":0, "var":"1","fn":"pwr"}]}
       int tempValue = strtol(variable,&pEND,10);                       // Looks for the first integer and interprets it
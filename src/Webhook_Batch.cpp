@@ -0,0 +1,96 @@
+#include "Particle.h"
+#include "PublishQueuePosixRK.h"
+#include "Webhook_Batch.h"
+
+const char *Webhook_Batch::JSON_EVENT_NAME = "Ubidots-LoRA-Nodes-v1";
+const char *Webhook_Batch::PACKED_EVENT_NAME = "Ubidots-LoRA-Nodes-z85-v1";
+
+static const char BATCH_PREFIX[] = "{\"records\":[";
+static const char BATCH_SUFFIX[] = "]}";
+
+// Z85 (ZeroMQ RFC 32) - no quotes or backslashes, so the event can go into a webhook's JSON body as it is
+static const char Z85_ALPHABET[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
+
+Webhook_Batch *Webhook_Batch::_instance;
+
+// [static]
+Webhook_Batch &Webhook_Batch::instance() {
+    if (!_instance) {
+        _instance = new Webhook_Batch();
+    }
+    return *_instance;
+}
+
+Webhook_Batch::Webhook_Batch() {
+}
+
+Webhook_Batch::~Webhook_Batch() {
+}
+
+void Webhook_Batch::loop() {
+    if (recordCount && millis() - firstRecordAt > maxAgeSeconds * 1000UL) {
+        Log.info("Sending %d batched node records after %d seconds", recordCount, maxAgeSeconds);
+        flush();
+    }
+}
+
+char *Webhook_Batch::reserve(Encoding recordEncoding, size_t len) {
+    size_t suffixLen = (recordEncoding == Encoding::JSON) ? sizeof(BATCH_SUFFIX) - 1 : 0;
+    size_t separatorLen = (recordEncoding == Encoding::JSON && recordCount) ? 1 : 0;
+
+    if (recordCount && (recordEncoding != encoding || length + separatorLen + len + suffixLen > MAX_EVENT_SIZE)) {
+        flush();
+        separatorLen = 0;
+    }
+
+    if (recordCount == 0) {
+        encoding = recordEncoding;
+        length = 0;
+        if (encoding == Encoding::JSON) {
+            strcpy(event, BATCH_PREFIX);
+            length = sizeof(BATCH_PREFIX) - 1;
+        }
+        firstRecordAt = millis();
+    }
+    if (separatorLen) event[length++] = ',';
+    char *p = event + length;
+    length += len;
+    event[length] = '\0';
+    recordCount++;
+    return p;
+}
+
+bool Webhook_Batch::add(const char *record) {
+    size_t recordLen = strlen(record);
+
+    if (sizeof(BATCH_PREFIX) - 1 + recordLen + sizeof(BATCH_SUFFIX) - 1 > MAX_EVENT_SIZE) {	// Would not fit even on its own
+        Log.info("Node record of %u bytes is too long to publish", (unsigned)recordLen);
+        return false;
+    }
+    memcpy(reserve(Encoding::JSON, recordLen), record, recordLen);
+    return true;
+}
+
+bool Webhook_Batch::addPacked(const uint8_t *record) {
+    char *p = reserve(Encoding::PACKED, PACKED_RECORD_SIZE / 4 * 5);
+
+    for (size_t ii = 0; ii < PACKED_RECORD_SIZE; ii += 4) {         // Each 4 bytes, big endian, as 5 base 85 digits
+        uint32_t value = (uint32_t)record[ii] << 24 | (uint32_t)record[ii + 1] << 16 | (uint32_t)record[ii + 2] << 8 | record[ii + 3];
+        for (int digit = 4; digit >= 0; digit--) {
+            p[digit] = Z85_ALPHABET[value % 85];
+            value /= 85;
+        }
+        p += 5;
+    }
+    return true;
+}
+
+void Webhook_Batch::flush() {
+    if (recordCount == 0) return;
+    if (encoding == Encoding::JSON) {
+        memcpy(event + length, BATCH_SUFFIX, sizeof(BATCH_SUFFIX)); // Room for this was kept by reserve()
+    }
+    PublishQueuePosix::instance().publish((encoding == Encoding::JSON) ? JSON_EVENT_NAME : PACKED_EVENT_NAME, event, PRIVATE | WITH_ACK, PublishQueuePriority::URGENT);	// Counts go before anything else queued
+    recordCount = 0;
+    length = 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file Webhook_Batch.h - Singleton approach
+ * @brief Collects node reports over the LoRA window and sends them to the publish queue several to an event
+ *
+ * @details Each node report used to be its own PublishQueuePosix event - a Particle data operation and a slice of modem
+ * airtime per node per hour.  Records are packed into one event and the event goes to the queue when the next record
+ * would not fit in a publish, when the oldest record has waited maxAgeSeconds or when flush() is called - before we
+ * connect and when the LoRA window closes.
+ *
+ * Each encoding has its own event name, so the cloud knows how to read it:
+ * - Ubidots-LoRA-Nodes-v1 - {"records":[{...},{...}]}, each record with the keys of the single node webhook
+ * - Ubidots-LoRA-Nodes-z85-v1 - fixed size binary records (PACKED_RECORD_SIZE bytes) in Z85, one after the other
+ *
+ * The webhooks and the packed record layout are in the webhooks directory.
+ */
+
+#ifndef __WEBHOOK_BATCH_H
+#define __WEBHOOK_BATCH_H
+
+#include "Particle.h"
+
+/**
+ * This class is a singleton; you do not create one as a global, on the stack, or with new.
+ *
+ * From global application loop you must call:
+ * Webhook_Batch::instance().loop();
+ */
+class Webhook_Batch {
+public:
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     *
+     * Use Webhook_Batch::instance() to instantiate the singleton.
+     */
+    static Webhook_Batch &instance();
+
+    /**
+     * @brief Perform application loop operations; call this from global application loop()
+     *
+     * @details Sends the records to the publish queue once the oldest has waited maxAgeSeconds
+     */
+    void loop();
+
+    /**
+     * @brief Adds one JSON node record to the batch
+     *
+     * @details A batch holds one encoding - records of the other encoding waiting to go are sent first
+     *
+     * @param record A JSON object - one node's report with the keys of the Ubidots-LoRA-Node-v1 webhook
+     *
+     * @return true if the record was added, false if it could never fit in an event on its own
+     */
+    bool add(const char *record);
+
+    /**
+     * @brief Adds one packed node record to the batch
+     *
+     * @param record PACKED_RECORD_SIZE bytes laid out as in webhooks/Ubidots-LoRA-Nodes-z85-v1.md
+     *
+     * @return true if the record was added
+     */
+    bool addPacked(const uint8_t *record);
+
+    /**
+     * @brief Sends the records collected so far to the publish queue as one event
+     *
+     * @details Does nothing if there are no records
+     */
+    void flush();
+
+    /**
+     * @brief Sets how long the first record in a batch can wait before the batch is sent
+     *
+     * @details Matters when we stay connected and listening - otherwise the LoRA window closing flushes the batch first
+     */
+    Webhook_Batch &withMaxAgeSeconds(uint16_t seconds) { maxAgeSeconds = seconds; return *this; }
+
+    /**
+     * @brief Number of records waiting to be sent
+     */
+    uint8_t getRecordCount() const { return recordCount; }
+
+    enum class Encoding : uint8_t { JSON = 0, PACKED = 1 };  // Stored in sysStatus webhookEncoding
+
+    static const size_t MAX_EVENT_SIZE = 1024;                  // Particle.publish() data limit on the Boron
+    static const size_t PACKED_RECORD_SIZE = 24;                // A multiple of 4 - Z85 encodes 4 bytes as 5 characters
+    static const char *JSON_EVENT_NAME;                         // "Ubidots-LoRA-Nodes-v1"
+    static const char *PACKED_EVENT_NAME;                       // "Ubidots-LoRA-Nodes-z85-v1"
+
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     *
+     * Use Webhook_Batch::instance() to instantiate the singleton.
+     */
+    Webhook_Batch();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~Webhook_Batch();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    Webhook_Batch(const Webhook_Batch&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    Webhook_Batch& operator=(const Webhook_Batch&) = delete;
+
+    /**
+     * @brief Makes room for len more characters of the given encoding - sending what is there first if needed
+     *
+     * @return where to write them
+     */
+    char *reserve(Encoding recordEncoding, size_t len);
+
+    char event[MAX_EVENT_SIZE + 1];                             // JSON: {"records":[ then the records - the closing ]} is added when sent
+    size_t length = 0;                                          // Bytes used in event
+    Encoding encoding = Encoding::JSON;                         // Of the records in event
+    uint8_t recordCount = 0;
+    system_tick_t firstRecordAt = 0;                            // millis() when the first record of this batch was added
+    uint16_t maxAgeSeconds = 300;
+
+    /**
+     * @brief Singleton instance of this class
+     *
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static Webhook_Batch *_instance;
+
+};
+#endif  /* __WEBHOOK_BATCH_H */